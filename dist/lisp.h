@@ -43,6 +43,12 @@
 #ifndef LISP_H
 #define LISP_H
 
+// mmap flags and the profiler's signals are POSIX, which -std=c99 hides.
+// This only helps if lisp.h comes before any other include.
+#if defined(LISP_IMPLEMENTATION) && !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -69,6 +75,12 @@ typedef enum
     LISP_PORT_IN,
     LISP_PORT_OUT,
     LISP_PTR,     // pointer to arbitary C object.
+    LISP_F64VECTOR, // unboxed arrays of a single numeric type
+    LISP_S64VECTOR,
+    LISP_BYTEVECTOR,
+    LISP_ESCAPE,  // escape-only continuation
+    LISP_RECORD,  // fixed fields of a record type
+    LISP_TYPE_COUNT // not a type
 } LispType;
 
 typedef double LispReal;
@@ -103,6 +115,8 @@ typedef enum
     LISP_ERROR_TOO_MANY_ARGS,
     LISP_ERROR_TOO_FEW_ARGS,
     LISP_ERROR_RUNTIME,
+    LISP_ERROR_HEAP_LIMIT,
+    LISP_ERROR_OUT_OF_FUEL,
 } LispError;
 
 typedef struct
@@ -123,6 +137,82 @@ void lisp_shutdown(LispContext ctx);
 // this will free all objects which are not reachable from root_to_save or the global env
 Lisp lisp_collect(Lisp root_to_save, LispContext ctx);
 void lisp_print_collect_stats(LispContext ctx);
+
+// Checkpoints. lisp_checkpoint collects, and keeps the heap and global state as they are,
+// so that lisp_restore can go back to them any number of times
+// (to start each request from the same prepared state, for example).
+// Restoring discards everything done since, including a suspended evaluation,
+// and invalidates Lisp values held in C like lisp_collect.
+// Neither may be called during evaluation.
+// The pages are mapped copy-on-write from a temporary file,
+// so a restore costs the pages written since. With LISP_NO_MMAP they are copied back.
+// Returns NULL if the pages can't be saved.
+typedef struct LispCheckpoint LispCheckpoint;
+LispCheckpoint* lisp_checkpoint(LispContext ctx);
+void lisp_restore(const LispCheckpoint* checkpoint, LispContext ctx);
+// lisp_shutdown frees any which are left.
+void lisp_checkpoint_free(LispCheckpoint* checkpoint, LispContext ctx);
+
+// Arenas. Objects allocated after lisp_arena_begin go in pages of their own,
+// which lisp_arena_end frees all at once, without a collection.
+// lisp_arena_end returns keep, copied out of the arena along with what it refers to.
+// Values stored from the arena into older objects (lisp_set_car, lisp_vector_set,
+// lisp_table_set, define, ...), and the global environment, are copied out too.
+// Any other Lisp values held in C from inside the arena are invalid after it ends.
+// Arenas may nest. lisp_collect closes those which are open, and what they hold joins the heap.
+// No evaluation may be suspended across one.
+void lisp_arena_begin(LispContext ctx);
+Lisp lisp_arena_end(Lisp keep, LispContext ctx);
+
+typedef struct
+{
+    // since lisp_init
+    size_t allocated_count[LISP_TYPE_COUNT];
+    size_t allocated_bytes[LISP_TYPE_COUNT];
+    // census of what survived the last collection
+    size_t live_bytes[LISP_TYPE_COUNT];
+    size_t collections;
+
+    size_t heap_size;
+    // by the last collection
+    size_t freed;
+    size_t time; // microseconds
+} LispHeapStats;
+
+// Allocation and survival by type.
+// While the profiler runs, allocations are also counted for the procedure making them.
+void lisp_heap_stats(LispHeapStats* out, LispContext ctx);
+// Number of threads used to copy objects during collection. Default is 1.
+// More than one requires pthreads. Define LISP_NO_THREADS to build without them.
+void lisp_set_gc_threads(int n, LispContext ctx);
+// Incremental collection. When the pause is positive, lisp_collect only moves the roots,
+// and the rest is copied in slices of about that many microseconds as the program allocates.
+// Values held in C are invalidated by lisp_collect just the same. 0 (the default) turns it off.
+// Requires LISP_GC_INCREMENTAL, which adds a read barrier to every object access.
+// Without it the setting is ignored.
+void lisp_set_gc_pause(int microseconds, LispContext ctx);
+// Heap sizing. Collection is still explicit, but lisp_should_collect says when the heap has grown
+// to growth times what survived the last collection (at least LISP_HEAP_MIN bytes),
+// or to soft_max bytes, if it is not 0. Defaults are 2 and 0.
+// If the live data is near or over soft_max, the heap may still grow by soft_max / 2.
+// Freed pages are kept for reuse up to the same size. The rest are given back to the system.
+void lisp_set_heap_growth(double growth, size_t soft_max, LispContext ctx);
+int lisp_should_collect(LispContext ctx);
+// Limits on evaluation. 0 means no limit (the default).
+// Allocating past the heap limit fails with LISP_ERROR_HEAP_LIMIT.
+// Garbage counts until it is collected.
+void lisp_set_heap_limit(size_t bytes, LispContext ctx);
+// Fuel is used up one evaluation step at a time.
+// When it runs out, evaluation fails with LISP_ERROR_OUT_OF_FUEL,
+// or is suspended if it was started with lisp_eval_resumable.
+void lisp_set_fuel(size_t steps, LispContext ctx);
+size_t lisp_fuel(LispContext ctx);
+// Workers are threads with contexts of their own, for futures and parallel maps.
+// They start on first use. n <= 0 (the default) means one for each processor.
+// Each context is set up by init (usually lisp_lib_load), if it is not NULL.
+// Without threads the work is done right away, in this context.
+void lisp_set_workers(int n, LispContext ctx);
+void lisp_set_worker_init(void (*init)(LispContext), LispContext ctx);
 const char *lisp_error_string(LispError error);
 
 void lisp_set_env(Lisp env, LispContext ctx);
@@ -149,13 +239,26 @@ Lisp lisp_read(const char *text, LispError* out_error, LispContext ctx);
 Lisp lisp_read_range(const char* start, const char* end, LispError* out_error, LispContext ctx);
 // Read from contents of file path.
 Lisp lisp_read_path(const char* path, LispError* out_error, LispContext ctx);
+// Find the elements of the list or vector in the range, without reading them.
+// Returns an s64vector of start and end offsets, two per element, for lisp_read_range.
+Lisp lisp_index_range(const char* start, const char* end, LispError* out_error, LispContext ctx);
+// Like lisp_read_range, but the elements of a big list or vector are read by several threads.
+// The result is the same. threads <= 0 uses one per processor.
+Lisp lisp_read_range_parallel(const char* start, const char* end, int threads, LispError* out_error, LispContext ctx);
 // This is intended for unseekable files (like stdin) and may be less efficient.
 Lisp lisp_read_file(FILE *file, LispError* out_error, LispContext ctx);
+// The contents of a file as a read-only LISP_STRING or LISP_BYTEVECTOR.
+// The file is mapped instead of copied onto the heap, and unmapped when the object is collected.
+// With LISP_NO_MMAP it is read into an ordinary object.
+Lisp lisp_map_path(const char* path, LispType type, LispError* out_error, LispContext ctx);
+int lisp_is_read_only(Lisp x);
 
 // Evaluate a lisp expression.
 Lisp lisp_eval(Lisp expr, LispError* out_error, LispContext ctx);
 // Provide an environment parameter.
 Lisp lisp_eval2(Lisp expr, Lisp env, LispError* out_error, LispContext ctx);
+// Evaluate an expression which has already been through lisp_macroexpand.
+Lisp lisp_eval_expanded(Lisp expr, Lisp env, LispError* out_error, LispContext ctx);
 Lisp lisp_apply(Lisp operator, Lisp args, LispError* out_error, LispContext ctx);
 // Expands special Lisp forms and checks syntax (called by eval).
 Lisp lisp_macroexpand(Lisp lisp, LispError* out_error, LispContext ctx);
@@ -165,8 +268,80 @@ void lisp_printf(FILE *file, Lisp l);
 
 void lisp_displayf(FILE *file, Lisp l);
 
+// Binary serialization (FASL). Much faster to read than text.
+// Supports null, booleans, numbers, characters, strings, symbols, pairs, vectors and records.
+// Shared structure (including cycles) is preserved.
+// Record types read are new types, so write them with the records and procedures which use them.
+// Fails with LISP_ERROR_ARG_TYPE if any other type is encountered.
+LispError lisp_write_binary(FILE* file, Lisp x, LispContext ctx);
+// Reads one object from the current position. Returns lisp_eof() at the end of the file.
+Lisp lisp_read_binary(FILE* file, LispError* out_error, LispContext ctx);
+// Range restricted. If out_end is not NULL, it receives the end of the object read.
+Lisp lisp_read_binary_range(const char* start, const char* end, const char** out_end, LispError* out_error, LispContext ctx);
+
+// Procedures, arguments and results are copied between contexts in the binary format,
+// along with the global definitions the procedures refer to
+// (those in the first table of the global environment).
+// Ports, promises and continuations can't be copied.
+// A record type copied to a worker and back is the same type again.
+// Changes a procedure makes to globals are not seen by the caller
+// (unless LISP_NO_THREADS runs it inline).
+// Calls thunk on a worker. Returns a promise for the result.
+Lisp lisp_future(Lisp thunk, LispError* out_error, LispContext ctx);
+// Calls proc on each item of a vector, spread over the workers. Returns a vector of the results.
+Lisp lisp_parallel_map(Lisp proc, Lisp items, LispError* out_error, LispContext ctx);
+
 // Calls proc with an argument containing the current continuation.
 Lisp lisp_call_cc(Lisp proc, LispError* out_error, LispContext ctx);
+// Calls proc with an escape procedure, which returns its argument from lisp_call_ec.
+// Nothing is allocated for it, but calling it once lisp_call_ec has returned is an error.
+Lisp lisp_call_ec(Lisp proc, LispError* out_error, LispContext ctx);
+
+// Callbacks for tracing and metrics. Any of them may be NULL.
+// They must not use the context they are called from.
+// Define LISP_NO_HOOKS to leave them out.
+typedef struct
+{
+    void* user;
+    // A procedure is about to be applied. name is the symbol it was called through, or null.
+    void (*enter)(void* user, Lisp procedure, Lisp name);
+    // The procedure entered last has returned. A tail call returns before the next procedure enters.
+    // Procedures left by errors and continuations don't.
+    void (*exit)(void* user);
+    // A collection, or a slice of an incremental one.
+    void (*gc_start)(void* user);
+    void (*gc_end)(void* user, size_t microseconds);
+    // The heap took another page. Collector threads call this too.
+    void (*page)(void* user, size_t bytes);
+    // Evaluating, reading or expanding failed, and the error is being returned to the host.
+    void (*error)(void* user, LispError error);
+} LispHooks;
+
+// Copies the hooks. NULL removes them.
+void lisp_set_hooks(const LispHooks* hooks, LispContext ctx);
+
+// Profiler. While it runs, procedure calls are counted, and every interval microseconds
+// of CPU time the procedures being applied are sampled (with SIGPROF).
+// Procedures are named by the symbol they were called through.
+// Only one context is sampled at a time. Define LISP_NO_SAMPLING to only count calls.
+void lisp_profile_start(int interval, LispContext ctx);
+void lisp_profile_stop(LispContext ctx);
+// Calls, and time spent in (self) and under (total) each procedure, of the last profile.
+void lisp_profile_print(FILE* file, LispContext ctx);
+// The samples of the last profile, one "A;B;C count" line per stack,
+// which flame graph tools can read.
+void lisp_profile_write_folded(FILE* file, LispContext ctx);
+
+// Like lisp_eval_expanded, but runs on a stack of its own (LISP_TASK_STACK_SIZE),
+// so that when fuel runs out, evaluation is suspended instead of failing.
+// Then the error is LISP_ERROR_OUT_OF_FUEL, and lisp_resume continues from
+// where it left off, after more fuel is given.
+// While suspended the context may be collected, but not used to evaluate anything else.
+// Requires ucontext. Define LISP_NO_RESUME to leave it out.
+Lisp lisp_eval_resumable(Lisp expanded, Lisp env, LispError* out_error, LispContext ctx);
+Lisp lisp_resume(LispError* out_error, LispContext ctx);
+// Abandons a suspended evaluation.
+void lisp_cancel(LispContext ctx);
 
 // -----------------------------------------
 // PRIMITIVES
@@ -277,6 +452,25 @@ void lisp_vector_fill(Lisp v, Lisp x); // inplace.
 Lisp lisp_vector_grow(Lisp v, int n, LispContext ctx);
 Lisp lisp_subvector(Lisp old, int start, int end, LispContext ctx);
 
+// Homogeneous numeric arrays. Entries are stored unboxed, 8 or 1 bytes each.
+Lisp lisp_make_f64vector(int n, LispContext ctx); // Contents are uninitialized.
+Lisp lisp_make_s64vector(int n, LispContext ctx);
+Lisp lisp_make_bytevector(int n, LispContext ctx);
+int lisp_is_typed_vector(Lisp v);
+int lisp_typed_vector_length(Lisp v);
+LispReal* lisp_f64vector(Lisp v);
+LispInt* lisp_s64vector(Lisp v);
+uint8_t* lisp_bytevector(Lisp v);
+
+// Records
+// A record type has a name and a list of field names.
+Lisp lisp_make_record_type(Lisp name, Lisp field_names, LispContext ctx);
+Lisp lisp_make_record(Lisp type, LispContext ctx); // Fields are #f.
+int lisp_is_record(Lisp r); // Records of a type, and not types themselves.
+Lisp lisp_record_type(Lisp r);
+Lisp lisp_record_ref(Lisp r, int i); // O(1)
+void lisp_record_set(Lisp r, int i, Lisp x); // O(1)
+
 // association vector like "alist"
 Lisp lisp_avector_ref(Lisp l, Lisp key); // O(n)
 
@@ -319,13 +513,23 @@ int lisp_is_env(Lisp l);
 Lisp lisp_make_promise(Lisp proc, LispContext ctx);
 int lisp_promise_forced(Lisp p);
 Lisp lisp_promise_val(Lisp p);
+// The procedure of a promise from lisp_make_promise which isn't forced.
 Lisp lisp_promise_proc(Lisp p);
 void lisp_promise_store(Lisp p, Lisp x);
+// Computes the value of a promise the first time, and returns it.
+// Anything else is returned as it is.
+Lisp lisp_force(Lisp p, LispError* out_error, LispContext ctx);
 
+// Must be a power of two.
+// Define LISP_HUGE_PAGES to ask for transparent huge pages (needs at least 2MB).
 #ifndef LISP_PAGE_SIZE
 #define LISP_PAGE_SIZE 512 * 1024
 #endif
 
+#ifndef LISP_HEAP_MIN
+#define LISP_HEAP_MIN (8 * (LISP_PAGE_SIZE))
+#endif
+
 #ifndef LISP_STACK_DEPTH
 #define LISP_STACK_DEPTH 1024
 #endif
@@ -354,6 +558,24 @@ void lisp_promise_store(Lisp p, Lisp x);
 
 #ifdef _WIN32
 #define LISP_NO_MMAP
+#define LISP_NO_THREADS
+#define LISP_NO_RESUME
+#define LISP_NO_SAMPLING
+#endif
+
+#ifndef LISP_NO_RESUME
+#include <ucontext.h>
+#endif
+
+// the parallel collector uses the GCC/Clang atomic builtins.
+#if !defined(__GNUC__) && !defined(LISP_NO_THREADS)
+#define LISP_NO_THREADS
+#endif
+
+#ifndef LISP_NO_THREADS
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
 #endif
 
 #ifndef LISP_NO_MMAP
@@ -362,6 +584,24 @@ void lisp_promise_store(Lisp p, Lisp x);
 #include <unistd.h>
 #endif
 
+#if !defined(LISP_NO_MMAP) && !defined(MAP_ANONYMOUS)
+#ifdef MAP_ANON
+#define MAP_ANONYMOUS MAP_ANON
+#else
+#define LISP_NO_MMAP
+#endif
+#endif
+
+#ifndef LISP_NO_SAMPLING
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
+// sigaction and interval timers are POSIX. Without them the profiler only counts calls.
+#if !defined(LISP_NO_SAMPLING) && (!defined(SA_RESTART) || !defined(ITIMER_PROF))
+#define LISP_NO_SAMPLING
+#endif
+
 #define IS_POW2(x) (((x) != 0) && ((x) & ((x)-1)) == 0)
 
 enum
@@ -369,33 +609,238 @@ enum
     GC_CLEAR = 0,
     GC_GONE = 1,
     GC_NEED_VISIT = 2,
+    GC_BUSY = 3, // being copied by another collector thread.
 };
 
+/* Pages are aligned to LISP_PAGE_SIZE so the page holding a block can be found from its address
+   (by the incremental collector and arenas). Large pages hold a single block at the start. */
 typedef struct Page
 {
     struct Page* next;
+    // large pages are in a doubly linked list
+    struct Page* prev;
     size_t size;
     size_t capacity;
+    struct LispImpl* owner;
+    // set while the collector copies out of this page.
+    // (a size_t to keep the buffer aligned)
+    size_t from_space;
+    // memory given back to the system while in the pool.
+    size_t released;
+    // depth of the arena it was taken in, or 0 (see lisp_arena_begin).
+    size_t arena;
+    // bytes mapped for a file (see heap_map_file_), or 0.
+    size_t mapped;
     char buffer[];
 } Page;
 
-static Page* page_create(size_t capacity)
+// Pages are mapped directly, unless LISP_NO_MMAP is defined.
+static size_t page_mapped_size_(size_t capacity)
 {
-    Page* page = malloc(sizeof(Page) + capacity);
+    size_t total = sizeof(Page) + capacity;
+#ifndef LISP_NO_MMAP
+    // whole system pages, so the alignment can be trimmed off
+    size_t system_page = (size_t)sysconf(_SC_PAGESIZE);
+    total = ((total + system_page - 1) / system_page) * system_page;
+#endif
+    return total;
+}
+
+static Page* page_create(size_t capacity, struct LispImpl* owner)
+{
+    size_t total = page_mapped_size_(capacity);
+#if !defined(LISP_NO_MMAP)
+    // map extra, and trim it off to align
+    const size_t align = LISP_PAGE_SIZE;
+    char* memory = mmap(NULL, total + align, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(memory != MAP_FAILED);
+    size_t head = (align - (uintptr_t)memory % align) % align;
+    if (head > 0) munmap(memory, head);
+    munmap(memory + head + total, align - head);
+    memory += head;
+#if defined(LISP_HUGE_PAGES) && defined(MADV_HUGEPAGE)
+    madvise(memory, total, MADV_HUGEPAGE);
+#endif
+    Page* page = (Page*)memory;
+#elif defined(_WIN32)
+    Page* page = _aligned_malloc(total, LISP_PAGE_SIZE);
+#else
+    void* memory = NULL;
+    if (posix_memalign(&memory, LISP_PAGE_SIZE, total) != 0) memory = NULL;
+    Page* page = memory;
+#endif
+    assert(page);
     page->capacity = capacity;
     page->size = 0;
     page->next = NULL;
+    page->prev = NULL;
+    page->owner = owner;
+    page->from_space = 0;
+    page->released = 0;
+    page->arena = 0;
+    page->mapped = 0;
+    return page;
+}
+
+void page_destroy(Page* page)
+{
+#if !defined(LISP_NO_MMAP)
+    if (page->mapped)
+    {
+        // the mapping starts at the system page holding the header.
+        size_t system_page = (size_t)sysconf(_SC_PAGESIZE);
+        munmap((char*)page - (uintptr_t)page % system_page, page->mapped);
+        return;
+    }
+    munmap(page, page_mapped_size_(page->capacity));
+#elif defined(_WIN32)
+    _aligned_free(page);
+#else
+    free(page);
+#endif
+}
+
+/* Free pages are kept for the next heap, instead of going back and forth with the system.
+   Only pages of the standard size are pooled. */
+typedef struct
+{
+    Page* pages;
+    size_t count;
+    // pages beyond this are given back to the system (see page_pool_trim_).
+    size_t limit;
+#ifndef LISP_NO_THREADS
+    // the parallel collector allocates from several threads.
+    pthread_mutex_t lock;
+#endif
+} PagePool;
+
+static void page_pool_init_(PagePool* pool)
+{
+    pool->pages = NULL;
+    pool->count = 0;
+    pool->limit = SIZE_MAX;
+#ifndef LISP_NO_THREADS
+    pthread_mutex_init(&pool->lock, NULL);
+#endif
+}
+
+static void page_pool_shutdown_(PagePool* pool)
+{
+    while (pool->pages)
+    {
+        Page* next = pool->pages->next;
+        page_destroy(pool->pages);
+        pool->pages = next;
+    }
+    pool->count = 0;
+#ifndef LISP_NO_THREADS
+    pthread_mutex_destroy(&pool->lock);
+#endif
+}
+
+static Page* page_pool_take_(PagePool* pool, struct LispImpl* owner)
+{
+#ifndef LISP_NO_THREADS
+    pthread_mutex_lock(&pool->lock);
+#endif
+    Page* page = pool->pages;
+    if (page)
+    {
+        pool->pages = page->next;
+        --pool->count;
+    }
+#ifndef LISP_NO_THREADS
+    pthread_mutex_unlock(&pool->lock);
+#endif
+
+    if (!page) return page_create((LISP_PAGE_SIZE) - sizeof(Page), owner);
+
+    page->size = 0;
+    page->next = NULL;
+    page->prev = NULL;
+    page->owner = owner;
+    page->from_space = 0;
+    page->released = 0;
+    page->arena = 0;
+    page->mapped = 0;
     return page;
 }
 
-void page_destroy(Page* page) { free(page); }
+static void page_pool_give_(PagePool* pool, Page* page)
+{
+#ifndef LISP_NO_THREADS
+    pthread_mutex_lock(&pool->lock);
+#endif
+    page->next = pool->pages;
+    pool->pages = page;
+    ++pool->count;
+#ifndef LISP_NO_THREADS
+    pthread_mutex_unlock(&pool->lock);
+#endif
+}
+
+// A list of pages linked from first to last.
+static void page_pool_give_list_(PagePool* pool, Page* first, Page* last, size_t count)
+{
+#ifndef LISP_NO_THREADS
+    pthread_mutex_lock(&pool->lock);
+#endif
+    last->next = pool->pages;
+    pool->pages = first;
+    pool->count += count;
+#ifndef LISP_NO_THREADS
+    pthread_mutex_unlock(&pool->lock);
+#endif
+}
+
+// Keep up to the limit in memory.
+// Past that, mapped pages are released with MADV_DONTNEED (keeping their header),
+// and others are freed.
+static void page_pool_trim_(PagePool* pool)
+{
+    size_t kept = 0;
+    Page** link = &pool->pages;
+    while (*link)
+    {
+        Page* page = *link;
+        if (kept < pool->limit)
+        {
+            ++kept;
+            link = &page->next;
+            continue;
+        }
+#if !defined(LISP_NO_MMAP) && defined(MADV_DONTNEED)
+        if (!page->released)
+        {
+            // the header is in the first system page, which stays.
+            size_t system_page = (size_t)sysconf(_SC_PAGESIZE);
+            size_t total = page_mapped_size_(page->capacity);
+            if (total > system_page)
+                madvise((char*)page + system_page, total - system_page, MADV_DONTNEED);
+            page->released = 1;
+        }
+        link = &page->next;
+#else
+        *link = page->next;
+        --pool->count;
+        page_destroy(page);
+#endif
+    }
+}
 
 typedef struct
 {
+    PagePool* pool;
     Page* bottom;
     Page* top;
+    // blocks too big for a page. The collector keeps these in place instead of copying them.
+    Page* large;
+    size_t large_count;
     size_t size;
     size_t page_count;
+    struct LispImpl* owner;
+    // depth of the innermost open arena, given to new pages.
+    size_t arena;
 } Heap;
 
 typedef struct Block
@@ -430,6 +875,8 @@ typedef struct Block
         struct
         {
             uint8_t cached;
+            // an expression to evaluate in env, instead of a procedure.
+            uint8_t delayed;
             uint8_t type;
         } promise;
 
@@ -448,28 +895,84 @@ typedef struct Block
     // 32
     uint8_t gc_state;
     uint8_t type;
+    // scratch space for traversals outside of GC. Must be cleared after.
+    uint8_t mark;
+    // alone on a large page, see heap_alloc.
+    uint8_t large : 1;
+    // in the remembered set of the open arenas (see arena_remember_).
+    uint8_t remembered : 1;
 } Block;
 
-static void heap_init(Heap* heap)
+static Page* page_of_(const void* block)
 {
-    heap->bottom = page_create(LISP_PAGE_SIZE);
+    return (Page*)((uintptr_t)block & ~((uintptr_t)(LISP_PAGE_SIZE) - 1));
+}
+
+static void heap_init(Heap* heap, PagePool* pool, struct LispImpl* owner)
+{
+    heap->owner = owner;
+    heap->pool = pool;
+    heap->bottom = page_pool_take_(pool, owner);
     heap->top = heap->bottom;
+    heap->large = NULL;
+    heap->large_count = 0;
 
     heap->size = 0;
     heap->page_count = 1;
+    heap->arena = 0;
 }
 
+// pages kept by a checkpoint are never freed or reused.
+static int page_pinned_(const Page* page, const struct LispImpl* p);
+
 static void heap_shutdown(Heap* heap)
 {
     Page* page = heap->bottom;
     while (page)
     {
         Page* next = page->next;
-        page_destroy(page);
+        if (!page_pinned_(page, heap->owner)) page_pool_give_(heap->pool, page);
+        page = next;
+    }
+    page = heap->large;
+    while (page)
+    {
+        Page* next = page->next;
+        if (!page_pinned_(page, heap->owner)) page_destroy(page);
         page = next;
     }
     heap->bottom = NULL;
     heap->top = NULL;
+    heap->large = NULL;
+}
+
+static void heap_push_large_(Heap* heap, Page* page)
+{
+    page->prev = NULL;
+    page->next = heap->large;
+    if (heap->large) heap->large->prev = page;
+    heap->large = page;
+    ++heap->large_count;
+}
+
+static void heap_remove_large_(Heap* heap, Page* page)
+{
+    if (page->prev)
+        page->prev->next = page->next;
+    else
+        heap->large = page->next;
+    if (page->next) page->next->prev = page->prev;
+    --heap->large_count;
+}
+
+static Page* large_page_of_(const Block* block)
+{
+    return (Page*)((const char*)block - offsetof(Page, buffer));
+}
+
+static Page* block_page_(const Block* block)
+{
+    return block->large ? large_page_of_(block) : page_of_(block);
 }
 
 static size_t align_to_bytes(size_t n, size_t k)
@@ -478,6 +981,10 @@ static size_t align_to_bytes(size_t n, size_t k)
     return ((n + k - 1) / k) * k;
 }
 
+#ifndef LISP_NO_HOOKS
+static void hook_page_(size_t bytes, struct LispImpl* p);
+#endif
+
 static void* heap_alloc(size_t alloc_size, LispType type, Heap* heap)
 {
     assert(alloc_size > 0);
@@ -488,25 +995,31 @@ static void* heap_alloc(size_t alloc_size, LispType type, Heap* heap)
     assert(alloc_size % sizeof(LispVal) == 0);
 
     Page* to_use;
-    if (alloc_size >= LISP_PAGE_SIZE)
-    {
-        /* add to bottom of stack.
-         As soon as this page is made it it is full and can't be used.
-         However, our current page may still have room.
-         */
-        to_use = page_create(alloc_size);
-        to_use->next = heap->bottom;
-        heap->bottom = to_use;
-        ++heap->page_count;
+    int large = alloc_size + sizeof(Page) > (LISP_PAGE_SIZE);
+    if (large)
+    {
+        /* gets a page of its own, outside of the page stack.
+         The collector never copies these. Live ones are moved
+         from list to list, and the rest are freed. */
+        to_use = page_create(alloc_size, heap->owner);
+        to_use->arena = heap->arena;
+        heap_push_large_(heap, to_use);
+#ifndef LISP_NO_HOOKS
+        hook_page_(to_use->capacity, heap->owner);
+#endif
     }
     else if (alloc_size + heap->top->size > heap->top->capacity)
     {
         /* add to top of the stack.
          need a new page because ours is full */
-        to_use = page_create(LISP_PAGE_SIZE);
+        to_use = page_pool_take_(heap->pool, heap->owner);
+        to_use->arena = heap->arena;
         heap->top->next = to_use;
         heap->top = to_use;
         ++heap->page_count;
+#ifndef LISP_NO_HOOKS
+        hook_page_(to_use->capacity, heap->owner);
+#endif
     }
     else
     {
@@ -520,11 +1033,60 @@ static void* heap_alloc(size_t alloc_size, LispType type, Heap* heap)
 
     Block* block = address;
     block->gc_state = GC_CLEAR;
+    block->mark = 0;
+    block->large = (uint8_t)large;
+    block->remembered = 0;
     block->info.size = alloc_size;
     block->type = type;
     return address;
 }
 
+#ifndef LISP_NO_MMAP
+/* A block whose contents are a read-only file mapping.
+ It is alone on a large page, but the page and block headers go at the end
+ of a system page, so the contents start on the next one where the file is mapped.
+ The mapping is followed by at least one zero byte.
+ Only the system page of the header counts towards the heap size,
+ so that collections still come often enough to unmap files. */
+static Block* heap_map_file_(int fd, size_t length, LispType type, Heap* heap)
+{
+    size_t system_page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t header = sizeof(Page) + sizeof(Block);
+    size_t total = system_page + align_to_bytes(length + 1, system_page);
+
+    char* memory = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return NULL;
+    if (length > 0 && mmap(memory + system_page, length, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        munmap(memory, total);
+        return NULL;
+    }
+
+    Page* page = (Page*)(memory + system_page - header);
+    page->capacity = sizeof(Block);
+    page->size = sizeof(Block);
+    page->owner = heap->owner;
+    page->from_space = 0;
+    page->released = 0;
+    page->arena = heap->arena;
+    page->mapped = total;
+    heap_push_large_(heap, page);
+    heap->size += system_page;
+
+    Block* block = (Block*)page->buffer;
+    block->gc_state = GC_CLEAR;
+    block->mark = 0;
+    block->large = 1;
+    block->remembered = 0;
+    block->info.size = system_page;
+    block->type = type;
+    return block;
+}
+#endif
+
+// pauses are counted in power of two buckets of microseconds.
+#define LISP_GC_PAUSE_BUCKETS 24
+
 enum {
     SYM_IF = 0,
     SYM_BEGIN,
@@ -537,12 +1099,19 @@ enum {
     SYM_SET,
     SYM_LAMBDA,
     SYM_CONS,
+    SYM_DELAY,
+    SYM_CONS_STREAM,
     SYM_COUNT
 };
 
 struct LispImpl
 {
     Heap heap;
+    PagePool pool;
+    // size the heap may grow to before lisp_should_collect
+    size_t heap_target;
+    double heap_growth;
+    size_t heap_soft_max;
 
     Lisp* stack;
     size_t stack_ptr;
@@ -553,6 +1122,8 @@ struct LispImpl
     Lisp symbols;
     Lisp env;
     Lisp macros;
+    // record type id -> type, for those copied to or from other contexts (see fasl).
+    Lisp record_types;
 
     int symbol_counter;
 
@@ -560,15 +1131,141 @@ struct LispImpl
 
     size_t gc_stat_freed;
     size_t gc_stat_time;
+    LispHeapStats stats;
+    int gc_threads;
+
+    // incremental collection
+    int gc_pause;
+    struct GcCycle* gc_cycle;
+    // heap size which triggers the next slice. SIZE_MAX when there is nothing to do.
+    size_t gc_next_slice;
+    size_t gc_pauses[LISP_GC_PAUSE_BUCKETS];
+    size_t gc_pause_max;
+
+    // where errors in the current evaluation go. NULL outside of evaluation.
+    jmp_buf* error_jmp;
+    // escape points of call/ec which can still be returned to.
+    struct Escape* escapes;
+    LispInt escape_counter;
+    size_t heap_limit;
+    // steps left. Evaluation stops when it goes below 0.
+    int64_t fuel;
+    // suspended evaluation
+    struct LispTask* task;
+
+    // the last profile, and whether it is still running.
+    struct Profile* profile;
+    int profiling;
+    // number of procedures being applied, while profiling or hooked.
+    volatile size_t call_depth;
+    int tracing;
+#ifndef LISP_NO_HOOKS
+    LispHooks hooks;
+#endif
+
+    struct WorkerPool* workers;
+    int worker_count;
+    void (*worker_init)(LispContext);
+    // workers run futures and maps themselves.
+    int in_worker;
+
+    struct LispCheckpoint* checkpoints;
+
+    // open arenas, innermost last.
+    struct ArenaMark* arenas;
+    size_t arena_count;
+    size_t arena_capacity;
+    // older objects which have been given values from an arena.
+    Block** remembered;
+    size_t remembered_count;
+    size_t remembered_capacity;
+    // whether symbols have been made in an arena.
+    int arena_symbols;
 };
 
 static Lisp get_sym(int sym, LispContext ctx) { return ctx.p->symbol_cache[sym]; }
 
+#ifndef LISP_NO_HOOKS
+static void hook_page_(size_t bytes, struct LispImpl* p)
+{
+    if (p->hooks.page) p->hooks.page(p->hooks.user, bytes);
+}
+
+static void hook_gc_start_(LispContext ctx)
+{
+    if (ctx.p->hooks.gc_start) ctx.p->hooks.gc_start(ctx.p->hooks.user);
+}
+
+static void hook_error_(LispError error, LispContext ctx)
+{
+    // only once the error leaves the outermost call.
+    if (!ctx.p->error_jmp && ctx.p->hooks.error) ctx.p->hooks.error(ctx.p->hooks.user, error);
+}
+#else
+#define hook_gc_start_(ctx)
+#define hook_error_(error, ctx)
+#endif
+
+// whether the evaluator needs to keep track of procedures.
+static void trace_update_(LispContext ctx)
+{
+    ctx.p->tracing = ctx.p->profiling;
+#ifndef LISP_NO_HOOKS
+    if (ctx.p->hooks.enter || ctx.p->hooks.exit) ctx.p->tracing = 1;
+#endif
+}
+
+#ifdef LISP_GC_INCREMENTAL
+static void gc_slice_(LispContext ctx);
+static void gc_blacken_(Block* block);
+#endif
+static Lisp gc_forward_symbol_(Lisp symbol, LispContext ctx);
+static void profile_alloc_(size_t bytes, LispContext ctx);
+
 static void* gc_alloc(size_t size, LispType type, LispContext ctx)
 {
+#ifdef LISP_GC_INCREMENTAL
+    if (ctx.p->heap.size >= ctx.p->gc_next_slice) gc_slice_(ctx);
+#endif
+    // only enforced during evaluation, and never while collecting.
+    if (ctx.p->heap.size + size > ctx.p->heap_limit && ctx.p->error_jmp)
+        longjmp(*ctx.p->error_jmp, LISP_ERROR_HEAP_LIMIT);
+
+    // as heap_alloc rounds it
+    size_t block_size = align_to_bytes(size, sizeof(LispVal));
+    ++ctx.p->stats.allocated_count[type];
+    ctx.p->stats.allocated_bytes[type] += block_size;
+    if (ctx.p->profiling) profile_alloc_(block_size, ctx);
+
     return heap_alloc(size, type, &ctx.p->heap);
 }
 
+// During an incremental collection, objects which have been copied but not scanned
+// still point into the old heap. Scan them before anything reads them.
+static void gc_read_barrier_(Block* block)
+{
+#ifdef LISP_GC_INCREMENTAL
+    if (block->gc_state == GC_NEED_VISIT) gc_blacken_(block);
+#else
+    (void)block;
+#endif
+}
+
+/* Arenas (see lisp_arena_begin) need to know when a value allocated in one
+ is stored into an object outside of it.
+ The count of arenas open in the process keeps the check to a load and a branch when there are none. */
+static int arenas_open_ = 0;
+static void arena_remember_(Block* target, Lisp x);
+
+static void arena_write_barrier_(Block* target, Lisp x)
+{
+#ifndef LISP_NO_THREADS
+    if (__atomic_load_n(&arenas_open_, __ATOMIC_RELAXED)) arena_remember_(target, x);
+#else
+    if (arenas_open_) arena_remember_(target, x);
+#endif
+}
+
 typedef struct
 {
     Block block;
@@ -588,6 +1285,13 @@ typedef struct
     LispVal entries[];
 } Vector;
 
+typedef struct
+{
+    Block block;
+    // reinterpreted by element type. LispVal keeps it aligned.
+    LispVal data[];
+} TypedVector;
+
 static Lisp val_to_list_(LispVal x)
 {
     return (Lisp) { x, x.ptr_val == NULL ? LISP_NULL : LISP_PAIR };
@@ -650,6 +1354,33 @@ int lisp_equal_r(Lisp a, Lisp b)
         {
             return a.type == b.type && strcmp(lisp_string(a), lisp_string(b)) == 0;
         }
+        case LISP_F64VECTOR:
+        {
+            if (a.type != b.type) return 0;
+            int n = lisp_typed_vector_length(a);
+            if (n != lisp_typed_vector_length(b)) return 0;
+            const LispReal* x = lisp_f64vector(a);
+            const LispReal* y = lisp_f64vector(b);
+            for (int i = 0; i < n; ++i)
+            {
+                if (x[i] != y[i]) return 0;
+            }
+            return 1;
+        }
+        case LISP_S64VECTOR:
+        {
+            if (a.type != b.type) return 0;
+            int n = lisp_typed_vector_length(a);
+            if (n != lisp_typed_vector_length(b)) return 0;
+            return memcmp(lisp_s64vector(a), lisp_s64vector(b), sizeof(LispInt) * n) == 0;
+        }
+        case LISP_BYTEVECTOR:
+        {
+            if (a.type != b.type) return 0;
+            int n = lisp_typed_vector_length(a);
+            if (n != lisp_typed_vector_length(b)) return 0;
+            return memcmp(lisp_bytevector(a), lisp_bytevector(b), n) == 0;
+        }
         default:
             return lisp_equal(a, b);
     }
@@ -710,7 +1441,9 @@ LispInt lisp_number_to_int(Lisp x)
 static Pair* pair_get_(Lisp p)
 {
     assert(p.type == LISP_PAIR);
-    return p.val.ptr_val;
+    Pair* pair = p.val.ptr_val;
+    gc_read_barrier_(&pair->block);
+    return pair;
 }
 
 Lisp lisp_car(Lisp p)
@@ -728,6 +1461,7 @@ Lisp lisp_cdr(Lisp p)
 void lisp_set_car(Lisp p, Lisp x)
 {
     Pair* pair = pair_get_(p);
+    arena_write_barrier_(&pair->block, x);
     pair->car = x.val;
     pair->block.d.pair.car_type = x.type;
 }
@@ -735,6 +1469,7 @@ void lisp_set_car(Lisp p, Lisp x)
 void lisp_set_cdr(Lisp p, Lisp x)
 {
     Pair* pair = pair_get_(p);
+    arena_write_barrier_(&pair->block, x);
     pair->cdr = x.val;
     pair->block.d.pair.cdr_type = x.type;
 }
@@ -869,7 +1604,9 @@ static char* vector_types_(Vector* v)
 static Vector* vector_get_(Lisp v)
 {
     assert(lisp_type(v) == LISP_VECTOR);
-    return v.val.ptr_val;
+    Vector* vector = v.val.ptr_val;
+    gc_read_barrier_(&vector->block);
+    return vector;
 }
 
 Lisp lisp_make_vector(int n, LispContext ctx)
@@ -901,7 +1638,7 @@ Lisp lisp_vector_ref(Lisp v, int i)
     return x;
 }
 
-void lisp_vector_set(Lisp v, int i, Lisp x)
+static void vector_set_(Lisp v, int i, Lisp x)
 {
     Vector* vector = vector_get_(v);
     assert(i < vector_len_(vector));
@@ -909,6 +1646,12 @@ void lisp_vector_set(Lisp v, int i, Lisp x)
     vector_types_(vector)[i] = (char)x.type;
 }
 
+void lisp_vector_set(Lisp v, int i, Lisp x)
+{
+    arena_write_barrier_(&vector_get_(v)->block, x);
+    vector_set_(v, i, x);
+}
+
 Lisp lisp_vector_swap(Lisp v, int i, int j)
 {
     Lisp tmp = lisp_vector_ref(v, i);
@@ -922,6 +1665,7 @@ void lisp_vector_fill(Lisp v, Lisp x)
     int n = lisp_vector_length(v);
     Vector* vector = vector_get_(v);
     char* entry_types = vector_types_(vector);
+    arena_write_barrier_(&vector->block, x);
 
     for (int i = 0; i < n; ++i)
     {
@@ -966,77 +1710,319 @@ Lisp lisp_vector_grow(Lisp v, int n, LispContext ctx)
     }
 }
 
-Lisp lisp_avector_ref(Lisp v, Lisp key)
+static Lisp make_typed_vector_(int n, size_t element_size, LispType type, LispContext ctx)
 {
-    int n = lisp_vector_length(v);
-    for (int i = 0; i < n; ++i)
+    assert(n >= 0);
+    TypedVector* vector = gc_alloc(sizeof(TypedVector) + element_size * n, type, ctx);
+    vector->block.d.vector.length = n;
+
+    LispVal val;
+    val.ptr_val = vector;
+    return (Lisp) { val, type };
+}
+
+Lisp lisp_make_f64vector(int n, LispContext ctx) { return make_typed_vector_(n, sizeof(LispReal), LISP_F64VECTOR, ctx); }
+Lisp lisp_make_s64vector(int n, LispContext ctx) { return make_typed_vector_(n, sizeof(LispInt), LISP_S64VECTOR, ctx); }
+Lisp lisp_make_bytevector(int n, LispContext ctx) { return make_typed_vector_(n, sizeof(uint8_t), LISP_BYTEVECTOR, ctx); }
+
+int lisp_is_typed_vector(Lisp v)
+{
+    switch (lisp_type(v))
     {
-        Lisp pair = lisp_vector_ref(v, i);
-        if (lisp_is_pair(pair) && lisp_eq(lisp_car(pair), key)) return pair;
+        case LISP_F64VECTOR:
+        case LISP_S64VECTOR:
+        case LISP_BYTEVECTOR:
+            return 1;
+        default:
+            return 0;
     }
-    return lisp_false();
 }
 
-static uint64_t hash_uint64(uint64_t x)
+static TypedVector* typed_vector_get_(Lisp v)
 {
-    x *= 0xff51afd7ed558ccd;
-    x ^= x >> 32;
-    return x;
+    assert(lisp_is_typed_vector(v));
+    return v.val.ptr_val;
 }
 
-static uint64_t hash_val(LispVal x) { return hash_uint64((uint64_t)x.int_val); }
+int lisp_typed_vector_length(Lisp v) { return typed_vector_get_(v)->block.d.vector.length; }
 
-// hash table
-// linked list chaining
-typedef struct
+LispReal* lisp_f64vector(Lisp v)
 {
-    Block block;
-    int size;
-    int capacity;
+    assert(lisp_type(v) == LISP_F64VECTOR);
+    return (LispReal*)typed_vector_get_(v)->data;
+}
 
-    // vectors. uninitialized if capacity == 0.
-    // entries of vals may be unitialized if the correspding key entry is.
-    LispVal keys;
-    LispVal vals;
-} Table;
+LispInt* lisp_s64vector(Lisp v)
+{
+    assert(lisp_type(v) == LISP_S64VECTOR);
+    return (LispInt*)typed_vector_get_(v)->data;
+}
 
-static Table *table_get_(Lisp t)
+uint8_t* lisp_bytevector(Lisp v)
 {
-    assert(lisp_type(t) == LISP_TABLE);
-    return t.val.ptr_val;
+    assert(lisp_type(v) == LISP_BYTEVECTOR);
+    return (uint8_t*)typed_vector_get_(v)->data;
 }
 
-Lisp lisp_make_table(LispContext ctx)
+/* Records share the layout of vectors. Entry 0 is the record type and the rest are the fields.
+ A record type is also a record, whose entry 0 is RECORD_TYPE instead of a type,
+ and so are the procedures made for a type, which apply does by their kind. */
+enum
 {
-    Table *table = gc_alloc(sizeof(Table), LISP_TABLE, ctx);
-    table->size = 0;
-    table->capacity = 0;
+    RECORD_TYPE = 0,
+    RECORD_CONSTRUCTOR,
+    RECORD_PREDICATE,
+    RECORD_ACCESSOR,
+    RECORD_MODIFIER,
+};
 
-    LispVal x;
-    x.ptr_val = table;
-    return (Lisp) { x, LISP_TABLE };
+static Vector* record_get_(Lisp r)
+{
+    assert(lisp_type(r) == LISP_RECORD);
+    Vector* record = r.val.ptr_val;
+    gc_read_barrier_(&record->block);
+    return record;
 }
 
-static void table_grow_(Lisp t, size_t new_capacity, LispContext ctx)
+static Lisp record_entry_(Vector* record, int i)
 {
-    Table *table = table_get_(t);
-    if (new_capacity < 16) new_capacity = 16;
-    assert(IS_POW2(new_capacity));
+    return (Lisp) { record->entries[i], (LispType)(vector_types_(record)[i]) };
+}
 
-    int old_capacity = table->capacity;
-    Lisp old_keys = { table->keys, LISP_VECTOR };
-    Lisp old_vals = { table->vals, LISP_VECTOR };
+static void record_set_entry_(Vector* record, int i, Lisp x)
+{
+    arena_write_barrier_(&record->block, x);
+    record->entries[i] = x.val;
+    vector_types_(record)[i] = (char)x.type;
+}
 
-    table->capacity = new_capacity;
-    int n = table->size;
-    table->size = 0;
+// Entries are uninitialized.
+static Lisp make_record_(int n, LispContext ctx)
+{
+    size_t size = sizeof(Vector) + sizeof(LispVal) * n + sizeof(char) * n;
+    Vector* record = gc_alloc(size, LISP_RECORD, ctx);
+    record->block.d.vector.length = n;
 
-    // table vals are uninitialized.
-    Lisp new_vals = lisp_make_vector(new_capacity, ctx);
-    Lisp new_keys = lisp_make_vector(new_capacity, ctx);
-    lisp_vector_fill(new_keys, lisp_null());
-    table->vals = new_vals.val;
-    table->keys = new_keys.val;
+    LispVal val;
+    val.ptr_val = record;
+    return (Lisp) { val, LISP_RECORD };
+}
+
+static int record_kind_(Lisp r)
+{
+    Lisp kind = record_entry_(record_get_(r), 0);
+    return kind.type == LISP_INT ? (int)lisp_int(kind) : -1;
+}
+
+// Record types are numbered across contexts, so copies between them can find each other (see fasl).
+static LispInt record_type_ids_ = 0;
+
+static LispInt record_type_next_id_(void)
+{
+#ifndef LISP_NO_THREADS
+    return __atomic_add_fetch(&record_type_ids_, 1, __ATOMIC_RELAXED);
+#else
+    return ++record_type_ids_;
+#endif
+}
+
+// (RECORD_TYPE name field-names field-count id)
+Lisp lisp_make_record_type(Lisp name, Lisp field_names, LispContext ctx)
+{
+    Lisp t = make_record_(5, ctx);
+    Vector* type = record_get_(t);
+    record_set_entry_(type, 0, lisp_make_int(RECORD_TYPE));
+    record_set_entry_(type, 1, name);
+    record_set_entry_(type, 2, field_names);
+    record_set_entry_(type, 3, lisp_make_int(lisp_list_length(field_names)));
+    record_set_entry_(type, 4, lisp_make_int(record_type_next_id_()));
+    return t;
+}
+
+static int record_type_fields_(Lisp type)
+{
+    assert(record_kind_(type) == RECORD_TYPE);
+    return (int)lisp_int(record_entry_(record_get_(type), 3));
+}
+
+Lisp lisp_make_record(Lisp type, LispContext ctx)
+{
+    int n = record_type_fields_(type) + 1;
+    Lisp r = make_record_(n, ctx);
+    Vector* record = record_get_(r);
+    record_set_entry_(record, 0, type);
+    for (int i = 1; i < n; ++i) record_set_entry_(record, i, lisp_false());
+    return r;
+}
+
+int lisp_is_record(Lisp r)
+{
+    return lisp_type(r) == LISP_RECORD && record_kind_(r) == -1;
+}
+
+Lisp lisp_record_type(Lisp r)
+{
+    assert(lisp_is_record(r));
+    return record_entry_(record_get_(r), 0);
+}
+
+Lisp lisp_record_ref(Lisp r, int i)
+{
+    Vector* record = record_get_(r);
+    assert(i + 1 < vector_len_(record));
+    return record_entry_(record, i + 1);
+}
+
+void lisp_record_set(Lisp r, int i, Lisp x)
+{
+    Vector* record = record_get_(r);
+    assert(i + 1 < vector_len_(record));
+    record_set_entry_(record, i + 1, x);
+}
+
+static Lisp record_apply_(Lisp operator, Lisp args, LispError* e, LispContext ctx)
+{
+    Vector* procedure = record_get_(operator);
+    Lisp kind = record_entry_(procedure, 0);
+    Lisp type = record_entry_(procedure, 1);
+    Lisp arg = record_entry_(procedure, 2);
+
+    if (kind.type != LISP_INT || lisp_int(kind) == RECORD_TYPE)
+    {
+        lisp_printf(ctx.p->err_port, operator);
+        fprintf(ctx.p->err_port, " is not an operator.\n");
+        *e = LISP_ERROR_BAD_OP;
+        return lisp_null();
+    }
+
+    if (lisp_int(kind) == RECORD_CONSTRUCTOR)
+    {
+        int n = lisp_vector_length(arg);
+        if (lisp_list_length(args) != n)
+        {
+            *e = lisp_list_length(args) < n ? LISP_ERROR_TOO_FEW_ARGS : LISP_ERROR_TOO_MANY_ARGS;
+            return lisp_null();
+        }
+
+        Lisp r = lisp_make_record(type, ctx);
+        Vector* record = record_get_(r);
+        for (int i = 0; i < n; ++i)
+        {
+            record_set_entry_(record, (int)lisp_int(lisp_vector_ref(arg, i)) + 1, lisp_car(args));
+            args = lisp_cdr(args);
+        }
+        return r;
+    }
+
+    if (!lisp_is_pair(args))
+    {
+        *e = LISP_ERROR_TOO_FEW_ARGS;
+        return lisp_null();
+    }
+
+    Lisp r = lisp_car(args);
+    int is_type = lisp_type(r) == LISP_RECORD && lisp_eq(record_entry_(record_get_(r), 0), type);
+    if (lisp_int(kind) == RECORD_PREDICATE) return lisp_make_bool(is_type);
+
+    if (!is_type)
+    {
+        lisp_printf(ctx.p->err_port, r);
+        fprintf(ctx.p->err_port, " is not a record of type ");
+        lisp_printf(ctx.p->err_port, record_entry_(record_get_(type), 1));
+        fprintf(ctx.p->err_port, ".\n");
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
+    }
+
+    Vector* record = record_get_(r);
+    int i = (int)lisp_int(arg) + 1;
+    if (lisp_int(kind) == RECORD_ACCESSOR) return record_entry_(record, i);
+
+    args = lisp_cdr(args);
+    if (!lisp_is_pair(args))
+    {
+        *e = LISP_ERROR_TOO_FEW_ARGS;
+        return lisp_null();
+    }
+    record_set_entry_(record, i, lisp_car(args));
+    return lisp_null();
+}
+
+Lisp lisp_avector_ref(Lisp v, Lisp key)
+{
+    int n = lisp_vector_length(v);
+    for (int i = 0; i < n; ++i)
+    {
+        Lisp pair = lisp_vector_ref(v, i);
+        if (lisp_is_pair(pair) && lisp_eq(lisp_car(pair), key)) return pair;
+    }
+    return lisp_false();
+}
+
+static uint64_t hash_uint64(uint64_t x)
+{
+    x *= 0xff51afd7ed558ccd;
+    x ^= x >> 32;
+    return x;
+}
+
+static uint64_t hash_val(LispVal x) { return hash_uint64((uint64_t)x.int_val); }
+
+// hash table
+// linked list chaining
+typedef struct
+{
+    Block block;
+    int size;
+    int capacity;
+
+    // vectors. uninitialized if capacity == 0.
+    // entries of vals may be unitialized if the correspding key entry is.
+    LispVal keys;
+    LispVal vals;
+} Table;
+
+static Table *table_get_(Lisp t)
+{
+    assert(lisp_type(t) == LISP_TABLE);
+    Table* table = t.val.ptr_val;
+    gc_read_barrier_(&table->block);
+    return table;
+}
+
+Lisp lisp_make_table(LispContext ctx)
+{
+    Table *table = gc_alloc(sizeof(Table), LISP_TABLE, ctx);
+    table->size = 0;
+    table->capacity = 0;
+
+    LispVal x;
+    x.ptr_val = table;
+    return (Lisp) { x, LISP_TABLE };
+}
+
+static void table_grow_(Lisp t, size_t new_capacity, LispContext ctx)
+{
+    Table *table = table_get_(t);
+    if (new_capacity < 16) new_capacity = 16;
+    assert(IS_POW2(new_capacity));
+
+    int old_capacity = table->capacity;
+    Lisp old_keys = { table->keys, LISP_VECTOR };
+    Lisp old_vals = { table->vals, LISP_VECTOR };
+
+    table->capacity = new_capacity;
+    int n = table->size;
+    table->size = 0;
+
+    // table vals are uninitialized.
+    Lisp new_vals = lisp_make_vector(new_capacity, ctx);
+    Lisp new_keys = lisp_make_vector(new_capacity, ctx);
+    lisp_vector_fill(new_keys, lisp_null());
+    arena_write_barrier_(&table->block, new_vals);
+    arena_write_barrier_(&table->block, new_keys);
+    table->vals = new_vals.val;
+    table->keys = new_keys.val;
 
     for (int i = 0; i < old_capacity; ++i)
     {
@@ -1064,17 +2050,21 @@ void lisp_table_set(Lisp t, Lisp key, Lisp x, LispContext ctx)
     {
         i &= (table->capacity - 1);
 
+        // the table is remembered for arenas, never its vectors.
         Lisp saved_key = lisp_vector_ref(keys, i);
         if (lisp_is_null(saved_key))
         {
             ++table->size;
-            lisp_vector_set(keys, i, key);
-            lisp_vector_set(vals, i, x);
+            arena_write_barrier_(&table->block, key);
+            arena_write_barrier_(&table->block, x);
+            vector_set_(keys, i, key);
+            vector_set_(vals, i, x);
             return;
         }
         else if (lisp_eq(saved_key, key))
         {
-            lisp_vector_set(vals, i, x);
+            arena_write_barrier_(&table->block, x);
+            vector_set_(vals, i, x);
             return;
         }
         ++i;
@@ -1212,6 +2202,7 @@ int lisp_string_ref(Lisp s, int i) {
 void lisp_string_set(Lisp s, int i, int c)
 {
     assert(c >= 0 && c <= 127);
+    assert(!lisp_is_read_only(s));
     assert(i >= 0 && i < lisp_buffer_capacity(s));
     string_get_(s)->string[i] = (char)c;
 }
@@ -1300,6 +2291,11 @@ static Lisp symbol_intern_(Lisp table, const char* string, size_t length, LispCo
     key.type = LISP_INT;
     key.val.int_val = (LispInt)hash;
 
+    // finishing an incremental collection rebuilds the table,
+    // so don't run a slice while we hold onto the chain.
+    size_t next_slice = ctx.p->gc_next_slice;
+    ctx.p->gc_next_slice = SIZE_MAX;
+
     // linked list chaining in the resulting value.
     int present;
     Lisp first_symbol = lisp_table_get(table, key, &present);
@@ -1312,7 +2308,8 @@ static Lisp symbol_intern_(Lisp table, const char* string, size_t length, LispCo
         {
             if (lisp_symbol_length(it) == length &&
                 strncmp(lisp_symbol_string(it), string, length) == 0) {
-                return it;
+                ctx.p->gc_next_slice = next_slice;
+                return gc_forward_symbol_(it, ctx);
             }
             it.val = symbol_get_(it)->next;
         }
@@ -1320,12 +2317,35 @@ static Lisp symbol_intern_(Lisp table, const char* string, size_t length, LispCo
 
     // new symbol
     Lisp symbol = symbol_make_(string, length, ctx);
+    if (ctx.p->heap.arena) ctx.p->arena_symbols = 1;
 
     symbol_get_(symbol)->next = first_symbol.val;
     lisp_table_set(table, key, symbol, ctx);
+    ctx.p->gc_next_slice = next_slice;
     return symbol;
 }
 
+static int symbol_is_interned_(Lisp table, Lisp symbol)
+{
+    Lisp key;
+    key.type = LISP_INT;
+    key.val.int_val = (LispInt)hash_bytes(lisp_symbol_string(symbol), lisp_symbol_length(symbol));
+
+    int present;
+    Lisp it = lisp_table_get(table, key, &present);
+    if (!present) return 0;
+
+    while (it.val.ptr_val != NULL)
+    {
+        // the chain may still hold the old copy during an incremental collection.
+        const Block* block = it.val.ptr_val;
+        if (block->gc_state == GC_GONE) block = block->info.forward;
+        if (block == symbol.val.ptr_val) return 1;
+        it.val = symbol_get_(it)->next;
+    }
+    return 0;
+}
+
 Lisp lisp_make_symbol(const char* string, LispContext ctx)
 {
     assert(string);
@@ -1407,7 +2427,9 @@ Lisp lisp_make_lambda(Lisp args, Lisp body, Lisp env, LispContext ctx)
 static Lambda* lambda_get_(Lisp l)
 {
     assert(l.type == LISP_LAMBDA);
-    return l.val.ptr_val;
+    Lambda* lambda = l.val.ptr_val;
+    gc_read_barrier_(&lambda->block);
+    return lambda;
 }
 
 Lisp lisp_lambda_body(Lisp l)
@@ -1428,38 +2450,76 @@ Lisp lisp_lambda_env(Lisp l)
     return val_to_list_(lambda->env);
 }
 
+static void lambda_set_(Lisp l, Lisp args, Lisp body, Lisp env)
+{
+    Lambda* lambda = lambda_get_(l);
+    arena_write_barrier_(&lambda->block, args);
+    arena_write_barrier_(&lambda->block, body);
+    arena_write_barrier_(&lambda->block, env);
+    lambda->block.d.lambda.body_type = (uint8_t)lisp_type(body);
+    lambda->block.d.lambda.args_type = (uint8_t)lisp_type(args);
+    lambda->args = args.val;
+    lambda->body = body.val;
+    lambda->env = env.val;
+}
+
 typedef struct
 {
     Block block;
     LispVal val_or_proc;
+    LispVal env;
 } Promise;
 
-Lisp lisp_make_promise(Lisp proc, LispContext ctx)
+static Lisp promise_alloc_(Lisp x, LispContext ctx)
 {
-    assert(lisp_type(proc) == LISP_LAMBDA || lisp_type(proc) == LISP_FUNC);
     Promise* promise = gc_alloc(sizeof(Promise), LISP_PROMISE, ctx);
     promise->block.d.promise.cached = 0;
-    promise->block.d.promise.type = lisp_type(proc);
-    promise->val_or_proc = proc.val;
+    promise->block.d.promise.delayed = 0;
+    promise->block.d.promise.type = lisp_type(x);
+    promise->val_or_proc = x.val;
+    promise->env.ptr_val = NULL;
 
     LispVal val;
     val.ptr_val = promise;
     return (Lisp) { val, LISP_PROMISE };
 }
 
+Lisp lisp_make_promise(Lisp proc, LispContext ctx)
+{
+    assert(lisp_type(proc) == LISP_LAMBDA || lisp_type(proc) == LISP_FUNC);
+    return promise_alloc_(proc, ctx);
+}
+
+// (delay expr) only keeps the expression and environment until it is forced,
+// rather than making a procedure which would need its own environment.
+static Lisp promise_delay_(Lisp expr, Lisp env, LispContext ctx)
+{
+    Lisp p = promise_alloc_(expr, ctx);
+    Promise* promise = p.val.ptr_val;
+    promise->block.d.promise.delayed = 1;
+    promise->env = env.val;
+    return p;
+}
+
 static Promise* promise_get_(Lisp p)
 {
     assert(p.type == LISP_PROMISE);
-    return p.val.ptr_val;
+    Promise* promise = p.val.ptr_val;
+    gc_read_barrier_(&promise->block);
+    return promise;
 }
 
 void lisp_promise_store(Lisp p, Lisp x)
 {
     Promise* promise = promise_get_(p);
     assert(!promise->block.d.promise.cached);
+    arena_write_barrier_(&promise->block, x);
     promise->block.d.promise.cached = 1;
+    promise->block.d.promise.delayed = 0;
     promise->block.d.promise.type = lisp_type(x);
     promise->val_or_proc = x.val;
+    // the computation is no longer needed.
+    promise->env.ptr_val = NULL;
 }
 
 int lisp_promise_forced(Lisp p)
@@ -1478,7 +2538,7 @@ static Lisp promise_body_or_val_(Lisp p)
 Lisp lisp_promise_proc(Lisp p)
 {
     const Promise* promise = promise_get_(p);
-    assert(!promise->block.d.promise.cached);
+    assert(!promise->block.d.promise.cached && !promise->block.d.promise.delayed);
     return promise_body_or_val_(p);
 }
 
@@ -1494,7 +2554,10 @@ typedef struct
     Block block;
     Lisp result;
     jmp_buf jmp;
+    jmp_buf* error_jmp;
+    struct Escape* escapes;
     int stack_ptr;
+    size_t call_depth;
 } Jump;
 
 static Jump* jump_get_(Lisp x) {
@@ -1527,6 +2590,9 @@ typedef enum
     TOKEN_CHAR,
     TOKEN_BOOL,
     TOKEN_HASH_L_PAREN,
+    TOKEN_HASH_F64_L_PAREN,
+    TOKEN_HASH_S64_L_PAREN,
+    TOKEN_HASH_U8_L_PAREN,
 } TokenType;
 
 /* for debug
@@ -1680,6 +2746,8 @@ static void lexer_next_token(Lexer* lex) {
     lex->token_end = f;
     lex->token_start = f;
     lex->token = TOKEN_NONE;
+    // a range need not end with a null.
+    if (f == l) return;
 
     int has_decimal;
 
@@ -1734,12 +2802,37 @@ static void lexer_next_token(Lexer* lex) {
                         lex->token_end = f;
                     }
                     break;
-                case 't':
                 case 'f':
-                    // #t or #f
+                    if (l - f >= 4 && strncmp(f, "f64(", 4) == 0)
+                    {
+                        // #f64(
+                        lex->token = TOKEN_HASH_F64_L_PAREN;
+                        lex->token_end = f + 4;
+                        break;
+                    }
+                    // #f
+                    lex->token = TOKEN_BOOL;
+                    lex->token_end = f + 1;
+                    break;
+                case 't':
+                    // #t
                     lex->token = TOKEN_BOOL;
                     lex->token_end = f + 1;
                     break;
+                case 's':
+                    if (l - f >= 4 && strncmp(f, "s64(", 4) == 0)
+                    {
+                        lex->token = TOKEN_HASH_S64_L_PAREN;
+                        lex->token_end = f + 4;
+                    }
+                    break;
+                case 'u':
+                    if (l - f >= 3 && strncmp(f, "u8(", 3) == 0)
+                    {
+                        lex->token = TOKEN_HASH_U8_L_PAREN;
+                        lex->token_end = f + 3;
+                    }
+                    break;
                 default:
                     break;
             }
@@ -1995,6 +3088,64 @@ static Lisp parse_list_r(Lexer* lex, jmp_buf error_jmp, LispContext ctx)
             if (buffer) free(buffer);
             return v;
         }
+        case TOKEN_HASH_F64_L_PAREN:
+        case TOKEN_HASH_S64_L_PAREN:
+        case TOKEN_HASH_U8_L_PAREN:
+        {
+            // #f64( #s64( #u8(
+            TokenType kind = lex->token;
+            lexer_next_token(lex);
+
+            Lisp* buffer = NULL;
+            size_t buffer_cap = 0;
+
+            int n = 0;
+            while (lex->token != TOKEN_R_PAREN)
+            {
+                if (lex->token != TOKEN_INT && (lex->token != TOKEN_FLOAT || kind != TOKEN_HASH_F64_L_PAREN))
+                {
+                    if (buffer) free(buffer);
+                    fprintf(ctx.p->err_port, "%lu. expected number in typed vector\n", lexer_position_(lex));
+                    longjmp(error_jmp, LISP_ERROR_READ_SYNTAX);
+                }
+
+                if (buffer_cap <= n + 1)
+                {
+                    buffer_cap *= 2;
+                    if (buffer_cap < 16) buffer_cap = 16;
+                    buffer = realloc(buffer, buffer_cap * sizeof(Lisp));
+                }
+                buffer[n] = parse_number_(lex, ctx);
+                if (kind == TOKEN_HASH_U8_L_PAREN && (lisp_int(buffer[n]) < 0 || lisp_int(buffer[n]) > 255))
+                {
+                    free(buffer);
+                    fprintf(ctx.p->err_port, "%lu. byte out of range\n", lexer_position_(lex));
+                    longjmp(error_jmp, LISP_ERROR_READ_SYNTAX);
+                }
+                ++n;
+                lexer_next_token(lex);
+            }
+            // )
+
+            Lisp v;
+            switch (kind)
+            {
+                case TOKEN_HASH_F64_L_PAREN:
+                    v = lisp_make_f64vector(n, ctx);
+                    for (int i = 0; i < n; ++i) lisp_f64vector(v)[i] = lisp_number_to_real(buffer[i]);
+                    break;
+                case TOKEN_HASH_S64_L_PAREN:
+                    v = lisp_make_s64vector(n, ctx);
+                    for (int i = 0; i < n; ++i) lisp_s64vector(v)[i] = lisp_int(buffer[i]);
+                    break;
+                default:
+                    v = lisp_make_bytevector(n, ctx);
+                    for (int i = 0; i < n; ++i) lisp_bytevector(v)[i] = (uint8_t)lisp_int(buffer[i]);
+                    break;
+            }
+            if (buffer) free(buffer);
+            return v;
+        }
         case TOKEN_FLOAT:
         case TOKEN_INT:
             return parse_number_(lex, ctx);
@@ -2051,6 +3202,7 @@ static Lisp parse(Lexer* lex, LispError* out_error, LispContext ctx)
 
     if (error != LISP_ERROR_NONE)
     {
+        hook_error_(error, ctx);
         if (out_error) *out_error = error;
         return lisp_null();
     }
@@ -2094,24 +3246,450 @@ Lisp lisp_read_range(const char* start, const char* end, LispError* out_error, L
     return l;
 }
 
-static
-void* fread_all_(FILE* file, size_t* out_size) {
-    const size_t BLOCK_SIZE = 32 * 1024;
-    const size_t MEDIUM_SIZE = 10 * 1024 * 1024;
+// Move to the last token of the expression starting at the current one,
+// as parse_list_r does, but only lexing.
+static int lex_skip_expr_(Lexer* lex)
+{
+    int depth = 0;
+    while (1)
+    {
+        switch (lex->token)
+        {
+            case TOKEN_NONE:
+                return 0;
+            case TOKEN_L_PAREN:
+            case TOKEN_HASH_L_PAREN:
+            case TOKEN_HASH_F64_L_PAREN:
+            case TOKEN_HASH_S64_L_PAREN:
+            case TOKEN_HASH_U8_L_PAREN:
+                ++depth;
+                break;
+            case TOKEN_R_PAREN:
+                if (depth == 0) return 0;
+                --depth;
+                break;
+            case TOKEN_QUOTE:
+            case TOKEN_BQUOTE:
+            case TOKEN_COMMA:
+            case TOKEN_AT:
+                // the quoted expression follows
+                lexer_next_token(lex);
+                continue;
+            default:
+                break;
+        }
+        if (depth == 0) return 1;
+        lexer_next_token(lex);
+    }
+}
 
-    *out_size = 0;
+Lisp lisp_index_range(const char* start, const char* end, LispError* out_error, LispContext ctx)
+{
+    Lexer lex;
+    lexer_init(&lex, start, end);
+    lexer_next_token(&lex);
+    if (lex.token != TOKEN_L_PAREN && lex.token != TOKEN_HASH_L_PAREN)
+    {
+        fprintf(ctx.p->err_port, "%lu. expected a list or vector to index\n", lexer_position_(&lex));
+        *out_error = LISP_ERROR_READ_SYNTAX;
+        return lisp_null();
+    }
 
-    size_t cap = 0;
-    char* data = NULL;
+    size_t count = 0;
+    size_t capacity = 256;
+    LispInt* offsets = malloc(sizeof(LispInt) * capacity);
 
-    while (1) {
-        if (*out_size + BLOCK_SIZE > cap) {
-            if (cap > MEDIUM_SIZE) {
-                cap = (cap * 3) / 2;
-            } else if (cap < BLOCK_SIZE) {
-                cap = BLOCK_SIZE;
-            } else {
-                cap *= 2;
+    lexer_next_token(&lex);
+    while (lex.token != TOKEN_R_PAREN)
+    {
+        LispInt element_start = (LispInt)(lex.token_start - start);
+        if (lex.token == TOKEN_DOT || !lex_skip_expr_(&lex))
+        {
+            fprintf(ctx.p->err_port, "%lu. unfinished list or vector\n", lexer_position_(&lex));
+            free(offsets);
+            *out_error = LISP_ERROR_READ_SYNTAX;
+            return lisp_null();
+        }
+
+        if (count + 2 > capacity)
+        {
+            capacity *= 2;
+            offsets = realloc(offsets, sizeof(LispInt) * capacity);
+        }
+        offsets[count++] = element_start;
+        offsets[count++] = (LispInt)(lex.token_end - start);
+        lexer_next_token(&lex);
+    }
+
+    Lisp v = lisp_make_s64vector((int)count, ctx);
+    memcpy(lisp_s64vector(v), offsets, sizeof(LispInt) * count);
+    free(offsets);
+    *out_error = LISP_ERROR_NONE;
+    return v;
+}
+
+/* Parallel reading.
+ The elements of a big list or vector are split into chunks by a scan
+ which only follows brackets, strings, characters and comments.
+ Each chunk is read by a thread with a copy of the context,
+ into pages and a symbol table of its own.
+ The pages then join the heap, as those of the parallel collector do,
+ and the symbols are interned in the context. */
+#ifndef LISP_NO_THREADS
+
+// smallest chunk worth a thread
+#define READ_CHUNK_MIN (64 * 1024)
+
+typedef struct
+{
+    struct LispImpl impl;
+    const char* start;
+    const char* end;
+    const char* chunk_start;
+    const char* chunk_end;
+
+    Lisp* elements;
+    size_t count;
+    int failed;
+} ReadChunk;
+
+#ifdef LISP_GC_INCREMENTAL
+static void gc_cycle_end_(LispContext ctx);
+#endif
+
+// characters the split stops at.
+enum { SPLIT_OTHER, SPLIT_STRING, SPLIT_COMMENT, SPLIT_HASH, SPLIT_OPEN, SPLIT_CLOSE, SPLIT_END };
+static const unsigned char split_class_[256] = {
+    ['"'] = SPLIT_STRING, [';'] = SPLIT_COMMENT, ['#'] = SPLIT_HASH,
+    ['('] = SPLIT_OPEN, [')'] = SPLIT_CLOSE, ['\0'] = SPLIT_END,
+};
+// and inside strings, as match_string_
+static const unsigned char split_string_class_[256] = {
+    ['"'] = 1, ['\\'] = 1, ['\n'] = 1, ['\0'] = 1,
+};
+
+// Finds where the chunks start in the elements from f,
+// after an element which ends near each nth of the range.
+// Returns the closing bracket, or NULL if the text can't be split safely.
+static const char* read_split_(const char* f, const char* l, int count, const char** splits, int* out_n)
+{
+    const char* body = f;
+    size_t step = (size_t)(l - f) / count;
+    int depth = 0;
+    int n = 1;
+    // a string may follow a string or character directly.
+    const char* literal_end = NULL;
+    splits[0] = f;
+
+    while (f != l)
+    {
+        const char* c = f++;
+        switch (split_class_[(unsigned char)*c])
+        {
+            case SPLIT_OTHER:
+                break;
+            case SPLIT_STRING:
+                // a quote inside a symbol is part of it. Not worth following.
+                if (c != body && c != literal_end && is_symbol_(c[-1])) return NULL;
+                while (1)
+                {
+                    while (f != l && !split_string_class_[(unsigned char)*f]) ++f;
+                    if (f == l || *f == '\n' || *f == '\0') return NULL;
+                    if (*f == '"') break;
+                    // escape
+                    f += 2;
+                    if (f > l) return NULL;
+                }
+                literal_end = ++f;
+                break;
+            case SPLIT_COMMENT:
+                while (f != l && *f != '\n') ++f;
+                break;
+            case SPLIT_HASH:
+                if (f != l && *f == '\\')
+                {
+                    f = match_char_(f + 1, l);
+                    if (!f) return NULL;
+                    literal_end = f;
+                }
+                break;
+            case SPLIT_OPEN:
+                ++depth;
+                break;
+            case SPLIT_CLOSE:
+                if (depth == 0)
+                {
+                    *out_n = n;
+                    return c;
+                }
+                --depth;
+                if (depth == 0 && n < count && (size_t)(f - body) >= step * n)
+                    splits[n++] = f;
+                break;
+            case SPLIT_END:
+                return NULL;
+        }
+    }
+    return NULL;
+}
+
+static void* read_chunk_(void* arg)
+{
+    ReadChunk* c = arg;
+    LispContext ctx = { &c->impl };
+    size_t capacity = 0;
+
+    jmp_buf error_jmp;
+    if (setjmp(error_jmp) != LISP_ERROR_NONE)
+    {
+        c->failed = 1;
+        return NULL;
+    }
+
+    c->impl.symbols = lisp_make_table(ctx);
+
+    // offsets in errors are from the start, as they are for the serial reader.
+    Lexer lex;
+    lexer_init(&lex, c->start, c->end);
+    lex.token_end = c->chunk_start;
+
+    while (1)
+    {
+        lexer_next_token(&lex);
+        if (lex.token_start >= c->chunk_end) break;
+        // dotted lists and anything the split got wrong are left to the serial reader.
+        if (lex.token == TOKEN_NONE || lex.token == TOKEN_DOT || lex.token == TOKEN_R_PAREN)
+        {
+            c->failed = 1;
+            break;
+        }
+
+        Lisp x = parse_list_r(&lex, error_jmp, ctx);
+        if (lex.token_end > c->chunk_end)
+        {
+            c->failed = 1;
+            break;
+        }
+
+        if (c->count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 256;
+            c->elements = realloc(c->elements, sizeof(Lisp) * capacity);
+        }
+        c->elements[c->count++] = x;
+    }
+    return NULL;
+}
+
+// Replaces the symbols of a chunk with those of the context.
+// A chunk symbol is marked once interned and refers to the interned one after.
+// Nothing refers to the chunk symbols afterwards, so the marks are never seen.
+static Lisp read_intern_r_(Lisp x, LispContext ctx)
+{
+    switch (lisp_type(x))
+    {
+        case LISP_SYMBOL:
+        {
+            Symbol* symbol = symbol_get_(x);
+            if (symbol->block.mark)
+            {
+                x.val = symbol->next;
+                return x;
+            }
+
+            Lisp interned = symbol_intern_(ctx.p->symbols, symbol->text, lisp_symbol_length(x), ctx);
+            // the quote symbols already come from the context
+            if (interned.val.ptr_val != symbol)
+            {
+                symbol->block.mark = 1;
+                symbol->next = interned.val;
+            }
+            return interned;
+        }
+        case LISP_PAIR:
+        {
+            Lisp it = x;
+            while (1)
+            {
+                lisp_set_car(it, read_intern_r_(lisp_car(it), ctx));
+                Lisp next = lisp_cdr(it);
+                if (lisp_type(next) != LISP_PAIR)
+                {
+                    lisp_set_cdr(it, read_intern_r_(next, ctx));
+                    return x;
+                }
+                it = next;
+            }
+        }
+        case LISP_VECTOR:
+        {
+            int n = lisp_vector_length(x);
+            for (int i = 0; i < n; ++i)
+                lisp_vector_set(x, i, read_intern_r_(lisp_vector_ref(x, i), ctx));
+            return x;
+        }
+        default:
+            return x;
+    }
+}
+
+// Returns 0 if the range must be read serially instead.
+static int read_parallel_(const char* start, const char* end, int threads, Lisp* out, LispContext ctx)
+{
+    Lexer lex;
+    lexer_init(&lex, start, end);
+    lexer_next_token(&lex);
+    if (lex.token != TOKEN_L_PAREN && lex.token != TOKEN_HASH_L_PAREN) return 0;
+    int is_vector = lex.token == TOKEN_HASH_L_PAREN;
+
+    int n = 0;
+    const char** splits = malloc(sizeof(const char*) * threads);
+    const char* close = read_split_(lex.token_end, end, threads, splits, &n);
+
+    // anything after the list and the serial reader reads a BEGIN.
+    const char* rest = close ? lex_skip_empty_(close + 1, end) : NULL;
+    if (!close || n < 2 || (rest != end && *rest != '\0'))
+    {
+        free(splits);
+        return 0;
+    }
+
+#ifdef LISP_GC_INCREMENTAL
+    // the heap must not be in the middle of a collection when the chunks join it.
+    if (ctx.p->gc_cycle) gc_cycle_end_(ctx);
+#endif
+
+    FILE* quiet = fopen("/dev/null", "w");
+    ReadChunk* chunks = calloc(n, sizeof(ReadChunk));
+    pthread_t* ids = malloc(sizeof(pthread_t) * n);
+    for (int i = 0; i < n; ++i)
+    {
+        ReadChunk* c = chunks + i;
+        c->start = start;
+        c->end = end;
+        c->chunk_start = splits[i];
+        c->chunk_end = i + 1 < n ? splits[i + 1] : close;
+
+        c->impl = *ctx.p;
+        // the pages are handed to the context after the join, with the page events.
+        heap_init(&c->impl.heap, &ctx.p->pool, &c->impl);
+#ifndef LISP_NO_HOOKS
+        memset(&c->impl.hooks, 0, sizeof(LispHooks));
+#endif
+        memset(&c->impl.stats, 0, sizeof(LispHeapStats));
+        c->impl.error_jmp = NULL;
+        c->impl.gc_next_slice = SIZE_MAX;
+        c->impl.profiling = 0;
+        // errors are reported by the serial reader.
+        if (quiet) c->impl.err_port = quiet;
+    }
+    free(splits);
+
+    for (int i = 1; i < n; ++i)
+        pthread_create(ids + i, NULL, read_chunk_, chunks + i);
+    read_chunk_(chunks);
+    for (int i = 1; i < n; ++i)
+        pthread_join(ids[i], NULL);
+    free(ids);
+    if (quiet) fclose(quiet);
+
+    int failed = 0;
+    size_t count = 0;
+    Heap* heap = &ctx.p->heap;
+    for (int i = 0; i < n; ++i)
+    {
+        ReadChunk* c = chunks + i;
+        failed |= c->failed;
+        count += c->count;
+
+        // join the pages of each chunk to the heap
+        Heap* chunk_heap = &c->impl.heap;
+        for (Page* page = chunk_heap->bottom; page; page = page->next)
+        {
+            page->owner = ctx.p;
+#ifndef LISP_NO_HOOKS
+            if (page != chunk_heap->bottom) hook_page_(page->capacity, ctx.p);
+#endif
+        }
+        heap->top->next = chunk_heap->bottom;
+        heap->top = chunk_heap->top;
+        heap->size += chunk_heap->size;
+        heap->page_count += chunk_heap->page_count;
+        while (chunk_heap->large)
+        {
+            Page* page = chunk_heap->large;
+            page->owner = ctx.p;
+#ifndef LISP_NO_HOOKS
+            hook_page_(page->capacity, ctx.p);
+#endif
+            heap_remove_large_(chunk_heap, page);
+            heap_push_large_(heap, page);
+        }
+
+        for (int t = 0; t < LISP_TYPE_COUNT; ++t)
+        {
+            ctx.p->stats.allocated_count[t] += c->impl.stats.allocated_count[t];
+            ctx.p->stats.allocated_bytes[t] += c->impl.stats.allocated_bytes[t];
+        }
+    }
+
+    Lisp* elements = failed ? NULL : malloc(sizeof(Lisp) * (count + 1));
+    size_t k = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        ReadChunk* c = chunks + i;
+        for (size_t j = 0; elements && j < c->count; ++j)
+            elements[k++] = read_intern_r_(c->elements[j], ctx);
+        free(c->elements);
+    }
+    free(chunks);
+    if (failed) return 0;
+
+    *out = is_vector ? lisp_make_vector2(elements, (int)count, ctx) : lisp_make_list2(elements, (int)count, ctx);
+    free(elements);
+    return 1;
+}
+
+#endif
+
+Lisp lisp_read_range_parallel(const char* start, const char* end, int threads, LispError* out_error, LispContext ctx)
+{
+#ifndef LISP_NO_THREADS
+#ifdef _SC_NPROCESSORS_ONLN
+    if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if ((size_t)(end - start) / threads < READ_CHUNK_MIN)
+        threads = (int)((size_t)(end - start) / READ_CHUNK_MIN);
+
+    // values in an arena must stay in its pages.
+    Lisp result;
+    if (threads > 1 && ctx.p->arena_count == 0 && read_parallel_(start, end, threads, &result, ctx))
+    {
+        if (out_error) *out_error = LISP_ERROR_NONE;
+        return result;
+    }
+#endif
+    return lisp_read_range(start, end, out_error, ctx);
+}
+
+static
+void* fread_all_(FILE* file, size_t* out_size) {
+    const size_t BLOCK_SIZE = 32 * 1024;
+    const size_t MEDIUM_SIZE = 10 * 1024 * 1024;
+
+    *out_size = 0;
+
+    size_t cap = 0;
+    char* data = NULL;
+
+    while (1) {
+        if (*out_size + BLOCK_SIZE > cap) {
+            if (cap > MEDIUM_SIZE) {
+                cap = (cap * 3) / 2;
+            } else if (cap < BLOCK_SIZE) {
+                cap = BLOCK_SIZE;
+            } else {
+                cap *= 2;
 
             }
 
@@ -2183,6 +3761,99 @@ Lisp lisp_read_path(const char *path, LispError* out_error, LispContext ctx)
     return lisp_eof();
 }
 
+Lisp lisp_map_path(const char* path, LispType type, LispError* out_error, LispContext ctx)
+{
+    assert(type == LISP_STRING || type == LISP_BYTEVECTOR);
+#ifndef LISP_NO_MMAP
+    // the contents follow the block header, as in heap objects.
+    assert(offsetof(String, string) == sizeof(Block));
+    assert(offsetof(TypedVector, data) == sizeof(Block));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        *out_error = LISP_ERROR_FILE_OPEN;
+        return lisp_null();
+    }
+    off_t size = lseek(fd, 0, SEEK_END);
+    // lengths are ints.
+    if (size < 0 || size >= INT32_MAX)
+    {
+        close(fd);
+        *out_error = LISP_ERROR_OUT_OF_BOUNDS;
+        return lisp_null();
+    }
+
+    Block* block = heap_map_file_(fd, (size_t)size, type, &ctx.p->heap);
+    close(fd);
+    if (!block)
+    {
+        *out_error = LISP_ERROR_MMAP;
+        return lisp_null();
+    }
+    ++ctx.p->stats.allocated_count[type];
+    ctx.p->stats.allocated_bytes[type] += block->info.size;
+
+    if (type == LISP_STRING)
+        block->d.string.capacity = (int)size + 1;
+    else
+        block->d.vector.length = (int)size;
+
+    *out_error = LISP_ERROR_NONE;
+    LispVal val;
+    val.ptr_val = block;
+    return (Lisp) { val, type };
+#else
+    FILE* file = fopen(path, "rb");
+    if (!file)
+    {
+        *out_error = LISP_ERROR_FILE_OPEN;
+        return lisp_null();
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (size < 0 || size >= INT32_MAX)
+    {
+        fclose(file);
+        *out_error = LISP_ERROR_OUT_OF_BOUNDS;
+        return lisp_null();
+    }
+
+    Lisp x;
+    char* data;
+    if (type == LISP_STRING)
+    {
+        x = lisp_make_string((int)size, ctx);
+        data = lisp_buffer(x);
+    }
+    else
+    {
+        x = lisp_make_bytevector((int)size, ctx);
+        data = (char*)lisp_bytevector(x);
+    }
+    size_t read = fread(data, 1, (size_t)size, file);
+    fclose(file);
+    *out_error = read == (size_t)size ? LISP_ERROR_NONE : LISP_ERROR_FILE_OPEN;
+    return x;
+#endif
+}
+
+int lisp_is_read_only(Lisp x)
+{
+    switch (lisp_type(x))
+    {
+        case LISP_STRING:
+        case LISP_BYTEVECTOR:
+        {
+            const Block* block = x.val.ptr_val;
+            return block->large && large_page_of_(block)->mapped != 0;
+        }
+        default:
+            return 0;
+    }
+}
+
 Lisp lisp_env_extend(Lisp l, Lisp table, LispContext ctx) { return lisp_cons(table, l, ctx); }
 
 Lisp lisp_env_lookup(Lisp l, Lisp key, int *present)
@@ -2270,6 +3941,7 @@ static void lisp_print_r(FILE* file, Lisp l, int human_readable, int is_cdr)
             break;
         }
         case LISP_JUMP: fputs("<jump>", file); break;
+        case LISP_ESCAPE: fputs("<escape>", file); break;
         case LISP_LAMBDA: fputs("<lambda>", file); break;
         case LISP_PROMISE: fputs("<promise>", file); break;
         case LISP_PTR: fprintf(file, "<ptr-%p>", l.val.ptr_val); break;
@@ -2299,6 +3971,62 @@ static void lisp_print_r(FILE* file, Lisp l, int human_readable, int is_cdr)
             fprintf(file, "}");
             break;
         }
+        case LISP_F64VECTOR:
+        case LISP_S64VECTOR:
+        case LISP_BYTEVECTOR:
+        {
+            int N = lisp_typed_vector_length(l);
+            switch (lisp_type(l))
+            {
+                case LISP_F64VECTOR: fprintf(file, "#f64("); break;
+                case LISP_S64VECTOR: fprintf(file, "#s64("); break;
+                default: fprintf(file, "#u8("); break;
+            }
+            for (int i = 0; i < N; ++i)
+            {
+                switch (lisp_type(l))
+                {
+                    case LISP_F64VECTOR: lisp_print_r(file, lisp_make_real(lisp_f64vector(l)[i]), human_readable, 0); break;
+                    case LISP_S64VECTOR: fprintf(file, "%lli", lisp_s64vector(l)[i]); break;
+                    default: fprintf(file, "%i", (int)lisp_bytevector(l)[i]); break;
+                }
+                if (i + 1 < N)
+                {
+                    fprintf(file, " ");
+                }
+            }
+            fprintf(file, ")");
+            break;
+        }
+        case LISP_RECORD:
+        {
+            Vector* record = record_get_(l);
+            int kind = record_kind_(l);
+            if (kind == -1)
+            {
+                // #[name field ...]
+                Vector* type = record_get_(record_entry_(record, 0));
+                fprintf(file, "#[");
+                lisp_print_r(file, record_entry_(type, 1), human_readable, 0);
+                for (int i = 1; i < vector_len_(record); ++i)
+                {
+                    fprintf(file, " ");
+                    lisp_print_r(file, record_entry_(record, i), human_readable, 0);
+                }
+                fprintf(file, "]");
+            }
+            else if (kind == RECORD_TYPE)
+            {
+                fprintf(file, "#[record-type ");
+                lisp_print_r(file, record_entry_(record, 1), human_readable, 0);
+                fprintf(file, "]");
+            }
+            else
+            {
+                fputs("<record-procedure>", file);
+            }
+            break;
+        }
         case LISP_VECTOR:
         {
             fprintf(file, "#(");
@@ -2346,304 +4074,2113 @@ static void lisp_print_r(FILE* file, Lisp l, int human_readable, int is_cdr)
 void lisp_printf(FILE* file, Lisp l) { lisp_print_r(file, l, 0, 0);  }
 void lisp_displayf(FILE* file, Lisp l) { lisp_print_r(file, l, 1, 0); }
 
-void lisp_set_stderr(FILE* file, LispContext ctx) { ctx.p->err_port = file; }
-FILE *lisp_stderr(LispContext ctx) { return ctx.p->err_port; }
+// FASL format. Fixed size integers are little-endian.
+// Counts, lengths and indices are unsigned LEB128 (uint).
+//   header: "LSPB" u32 version, u64 payload length
+//   payload: uint symbol count, symbols (u8 interned, uint length, bytes), object
+// Objects are a tag byte followed by data.
+// Objects referenced more than once are prefixed by FASL_LABEL
+// and numbered in the order they are read. FASL_REF refers to them by number.
+// Copies between contexts of one process (see workers) may also contain
+// C functions, pointers, lambdas and tables. Their environments end
+// in the global environment of the context reading them.
+// A record type read from a file is a new type. Copied between contexts it is found
+// by its id in the reader's record_types, so records keep their type both ways.
+
+#define FASL_MAGIC "LSPB"
+#define FASL_VERSION 1
+#define FASL_HEADER_SIZE 16
 
-static void lisp_stack_push(Lisp x, LispContext ctx)
+enum
 {
-#ifdef LISP_DEBUG
-    if (ctx.p->stack_ptr + 1 >= ctx.p->stack_depth)
-    {
-        fprintf(ctx.p->err_port, "stack overflow\n");
-    }
-#endif
+    FASL_NULL = 0,
+    FASL_TRUE,
+    FASL_FALSE,
+    FASL_INT8,
+    FASL_INT,     // u64
+    FASL_REAL,    // u64 bits
+    FASL_CHAR,    // uint (char + 1)
+    FASL_STRING,  // uint length, bytes
+    FASL_SYMBOL,  // uint index
+    FASL_LIST,    // uint count (n >= 1), n cars, tail
+    FASL_VECTOR,  // uint length, entries
+    FASL_LABEL,   // next object is shared
+    FASL_REF,     // uint label
+    FASL_F64VECTOR, // uint length, u64 bits
+    FASL_S64VECTOR, // uint length, u64
+    FASL_BYTEVECTOR, // uint length, bytes
+    FASL_RECORD,  // uint length, entries (see make_record_)
+    // in process only
+    FASL_FUNC,    // u64 address
+    FASL_PTR,     // u64 address
+    FASL_LAMBDA,  // args, body, env
+    FASL_TABLE,   // uint count, keys and values
+    FASL_ENV,     // uint index of a tail of the global environment
+};
 
-    ctx.p->stack[ctx.p->stack_ptr] = x;
-    ++ctx.p->stack_ptr;
-}
+enum
+{
+    FASL_UNMARKED = 0,
+    FASL_SEEN,
+    FASL_SHARED,
+};
 
-static Lisp lisp_stack_pop(LispContext ctx)
+// Identity map for shared objects. Does not allocate on the lisp heap.
+typedef struct
 {
-    ctx.p->stack_ptr--;
+    const void** keys;
+    int* vals;
+    size_t count;
+    size_t capacity;
+} FaslMap;
 
-#ifdef LISP_DEBUG
-    if (ctx.p->stack_ptr < 0)
+static size_t fasl_map_hash_(const void* key, size_t capacity)
+{
+    uint64_t x = (uint64_t)(uintptr_t)key >> 3;
+    x *= 0x9E3779B97F4A7C15ULL;
+    return (size_t)(x >> 32) & (capacity - 1);
+}
+
+static int* fasl_map_find_(FaslMap* map, const void* key)
+{
+    if (map->capacity == 0) return NULL;
+    size_t i = fasl_map_hash_(key, map->capacity);
+    while (map->keys[i])
     {
-        fprintf(ctx.p->err_port, "stack underflow\n");
+        if (map->keys[i] == key) return map->vals + i;
+        i = (i + 1) & (map->capacity - 1);
     }
-#endif
-    return ctx.p->stack[ctx.p->stack_ptr];
+    return NULL;
 }
 
-static Lisp* lisp_stack_peek(size_t i, LispContext ctx)
+static void fasl_map_insert_(FaslMap* map, const void* key, int val)
 {
-    return ctx.p->stack + (ctx.p->stack_ptr - i);
+    if ((map->count + 1) * 2 > map->capacity)
+    {
+        FaslMap old = *map;
+        map->capacity = old.capacity ? old.capacity * 2 : 64;
+        map->keys = calloc(map->capacity, sizeof(void*));
+        map->vals = malloc(map->capacity * sizeof(int));
+        map->count = 0;
+        for (size_t i = 0; i < old.capacity; ++i)
+            if (old.keys[i]) fasl_map_insert_(map, old.keys[i], old.vals[i]);
+        free(old.keys);
+        free(old.vals);
+    }
+
+    size_t i = fasl_map_hash_(key, map->capacity);
+    while (map->keys[i]) i = (i + 1) & (map->capacity - 1);
+    map->keys[i] = key;
+    map->vals[i] = val;
+    ++map->count;
 }
 
-Lisp lisp_call_cc(Lisp proc, LispError* out_error, LispContext ctx)
+typedef struct
 {
-    Lisp j = make_jump_(ctx);
-    Jump* jump = jump_get_(j);
-    jump->stack_ptr = ctx.p->stack_ptr;
+    // shared object -> label (-1 until written)
+    FaslMap shared;
+    int label_count;
 
-    int has_result = setjmp(jump->jmp);
-    if (has_result)
+    // symbol -> index
+    FaslMap symbols;
+    Lisp* symbol_list;
+    int symbol_count;
+    int symbol_capacity;
+
+    // record types to add to record_types, in process.
+    Lisp* types;
+    int type_count;
+    int type_capacity;
+
+    char* buffer;
+    size_t size;
+    size_t capacity;
+
+    int in_process;
+    Lisp env;
+} FaslWriter;
+
+static void fasl_reserve_(FaslWriter* w, size_t n)
+{
+    if (w->size + n > w->capacity)
     {
-        // restore jump from the stack
-        jump = jump_get_(lisp_stack_pop(ctx));
-        ctx.p->stack_ptr = jump->stack_ptr;
-        return jump->result;
+        w->capacity = (w->size + n) * 2;
+        w->buffer = realloc(w->buffer, w->capacity);
     }
-    else
+}
+
+static void fasl_put_u8_(FaslWriter* w, uint8_t x)
+{
+    fasl_reserve_(w, 1);
+    w->buffer[w->size++] = (char)x;
+}
+
+static void fasl_put_uint_(FaslWriter* w, uint64_t x)
+{
+    // LEB128
+    fasl_reserve_(w, 10);
+    while (x >= 0x80)
     {
-        return lisp_apply(proc, lisp_cons(j, lisp_null(), ctx), out_error, ctx);
+        w->buffer[w->size++] = (char)(x | 0x80);
+        x >>= 7;
     }
+    w->buffer[w->size++] = (char)x;
 }
 
-// returns whether the result is final, or needs to be eval'd.
-static int apply(Lisp operator, Lisp args, Lisp* out_result, Lisp* out_env, LispError* error, LispContext ctx)
+static void fasl_put_u64_(FaslWriter* w, uint64_t x)
 {
-    switch (lisp_type(operator))
+    fasl_reserve_(w, 8);
+    for (int i = 0; i < 8; ++i) w->buffer[w->size++] = (char)(x >> (8 * i));
+}
+
+static void fasl_put_bytes_(FaslWriter* w, const char* bytes, size_t n)
+{
+    fasl_put_uint_(w, n);
+    fasl_reserve_(w, n);
+    memcpy(w->buffer + w->size, bytes, n);
+    w->size += n;
+}
+
+static Block* fasl_block_(Lisp x)
+{
+    switch (lisp_type(x))
     {
-        case LISP_LAMBDA: // lambda call (compound procedure)
-        {
-            Lisp slot_names = lambda_args_(operator);
-            *out_env = lisp_lambda_env(operator);
+        case LISP_PAIR:
+        case LISP_VECTOR:
+        case LISP_STRING:
+        case LISP_F64VECTOR:
+        case LISP_S64VECTOR:
+        case LISP_BYTEVECTOR:
+        case LISP_RECORD:
+        case LISP_LAMBDA:
+        case LISP_TABLE:
+            return x.val.ptr_val;
+        default:
+            return NULL;
+    }
+}
 
-            // make a new environment
-            Lisp new_table = lisp_make_table(ctx);
+// Returns which tail of the environment x is, or -1.
+static int env_tail_index_(Lisp env, Lisp x)
+{
+    if (!lisp_is_pair(x)) return -1;
 
-            // bind parameters to arguments
-            // to pass into function call
-            while (lisp_is_pair(slot_names) && lisp_is_pair(args))
+    int i = 0;
+    for (; lisp_is_pair(env); env = lisp_cdr(env))
+    {
+        if (env.val.ptr_val == x.val.ptr_val) return i;
+        ++i;
+    }
+    return -1;
+}
+
+// The global environment isn't copied.
+static int fasl_env_index_(const FaslWriter* w, Lisp x)
+{
+    return w->in_process ? env_tail_index_(w->env, x) : -1;
+}
+
+// First pass: find shared objects, collect symbols, and check types.
+static LispError fasl_scan_r_(FaslWriter* w, Lisp x)
+{
+    while (1)
+    {
+        if (fasl_env_index_(w, x) != -1) return LISP_ERROR_NONE;
+
+        Block* block = fasl_block_(x);
+        if (block)
+        {
+            if (block->mark != FASL_UNMARKED)
             {
-                lisp_table_set(new_table, lisp_car(slot_names), lisp_car(args), ctx);
-                slot_names = lisp_cdr(slot_names);
-                args = lisp_cdr(args);
+                if (block->mark == FASL_SEEN)
+                {
+                    block->mark = FASL_SHARED;
+                    fasl_map_insert_(&w->shared, block, -1);
+                }
+                return LISP_ERROR_NONE;
             }
+            block->mark = FASL_SEEN;
+        }
 
-            if (lisp_type(slot_names) == LISP_SYMBOL)
+        switch (lisp_type(x))
+        {
+            case LISP_NULL:
+            case LISP_BOOL:
+            case LISP_INT:
+            case LISP_REAL:
+            case LISP_CHAR:
+            case LISP_STRING:
+            case LISP_F64VECTOR:
+            case LISP_S64VECTOR:
+            case LISP_BYTEVECTOR:
+                return LISP_ERROR_NONE;
+            case LISP_SYMBOL:
+                if (!fasl_map_find_(&w->symbols, x.val.ptr_val))
+                {
+                    if (w->symbol_count == w->symbol_capacity)
+                    {
+                        w->symbol_capacity = w->symbol_capacity ? w->symbol_capacity * 2 : 64;
+                        w->symbol_list = realloc(w->symbol_list, sizeof(Lisp) * w->symbol_capacity);
+                    }
+                    fasl_map_insert_(&w->symbols, x.val.ptr_val, w->symbol_count);
+                    w->symbol_list[w->symbol_count++] = x;
+                }
+                return LISP_ERROR_NONE;
+            case LISP_VECTOR:
             {
-                // variable length arguments
-                lisp_table_set(new_table, slot_names, args, ctx);
+                int n = lisp_vector_length(x);
+                for (int i = 0; i < n; ++i)
+                {
+                    LispError e = fasl_scan_r_(w, lisp_vector_ref(x, i));
+                    if (e != LISP_ERROR_NONE) return e;
+                }
+                return LISP_ERROR_NONE;
             }
-            else if (!lisp_is_null(slot_names))
+            case LISP_RECORD:
             {
-                *error = LISP_ERROR_TOO_FEW_ARGS;
-                return 0;
+                if (w->in_process && record_kind_(x) == RECORD_TYPE)
+                {
+                    if (w->type_count == w->type_capacity)
+                    {
+                        w->type_capacity = w->type_capacity ? w->type_capacity * 2 : 16;
+                        w->types = realloc(w->types, sizeof(Lisp) * w->type_capacity);
+                    }
+                    w->types[w->type_count++] = x;
+                }
+
+                Vector* record = record_get_(x);
+                int n = vector_len_(record);
+                for (int i = 0; i < n; ++i)
+                {
+                    LispError e = fasl_scan_r_(w, record_entry_(record, i));
+                    if (e != LISP_ERROR_NONE) return e;
+                }
+                return LISP_ERROR_NONE;
             }
-            else if (!lisp_is_null(args))
+            case LISP_PAIR:
             {
-                *error = LISP_ERROR_TOO_MANY_ARGS;
-                return 0;
+                LispError e = fasl_scan_r_(w, lisp_car(x));
+                if (e != LISP_ERROR_NONE) return e;
+                x = lisp_cdr(x);
+                break;
             }
+            case LISP_FUNC:
+            case LISP_PTR:
+                return w->in_process ? LISP_ERROR_NONE : LISP_ERROR_ARG_TYPE;
+            case LISP_LAMBDA:
+            {
+                if (!w->in_process) return LISP_ERROR_ARG_TYPE;
+                LispError e = fasl_scan_r_(w, lambda_args_(x));
+                if (e == LISP_ERROR_NONE) e = fasl_scan_r_(w, lisp_lambda_body(x));
+                if (e != LISP_ERROR_NONE) return e;
+                x = lisp_lambda_env(x);
+                break;
+            }
+            case LISP_TABLE:
+            {
+                if (!w->in_process) return LISP_ERROR_ARG_TYPE;
+                const Table* table = table_get_(x);
+                Lisp keys = { table->keys, LISP_VECTOR };
+                Lisp vals = { table->vals, LISP_VECTOR };
+                for (int i = 0; i < table->capacity; ++i)
+                {
+                    Lisp key = lisp_vector_ref(keys, i);
+                    if (lisp_is_null(key)) continue;
+                    LispError e = fasl_scan_r_(w, key);
+                    if (e == LISP_ERROR_NONE) e = fasl_scan_r_(w, lisp_vector_ref(vals, i));
+                    if (e != LISP_ERROR_NONE) return e;
+                }
+                return LISP_ERROR_NONE;
+            }
+            default:
+                return LISP_ERROR_ARG_TYPE;
+        }
+    }
+}
 
-            // extend the environment
-            *out_env = lisp_env_extend(*out_env, new_table, ctx);
+static void fasl_unmark_r_(Lisp x)
+{
+    while (1)
+    {
+        Block* block = fasl_block_(x);
+        if (!block || block->mark == FASL_UNMARKED) return;
+        block->mark = FASL_UNMARKED;
 
-            // normally we would eval the body here
-            // but while will eval
-            *out_result = lisp_lambda_body(operator);
-            return 1;
+        if (lisp_type(x) == LISP_VECTOR)
+        {
+            int n = lisp_vector_length(x);
+            for (int i = 0; i < n; ++i) fasl_unmark_r_(lisp_vector_ref(x, i));
+            return;
         }
-        case LISP_FUNC: // call into C functions
+        else if (lisp_type(x) == LISP_RECORD)
         {
-            // no environment required
-            LispCFunc f = lisp_func(operator);
-            *out_result = f(args, error, ctx);
-            return 0;
+            Vector* record = record_get_(x);
+            int n = vector_len_(record);
+            for (int i = 0; i < n; ++i) fasl_unmark_r_(record_entry_(record, i));
+            return;
         }
-        case LISP_JUMP:
+        else if (lisp_type(x) == LISP_PAIR)
         {
-            Jump* jump = jump_get_(operator);
-            jump->result = lisp_car(args);
-            // put jump on the stack
-            lisp_stack_push(operator, ctx);
-            longjmp(jump->jmp, 1);
+            fasl_unmark_r_(lisp_car(x));
+            x = lisp_cdr(x);
         }
-        default:
+        else if (lisp_type(x) == LISP_LAMBDA)
         {
-            lisp_printf(ctx.p->err_port, operator);
-            fprintf(ctx.p->err_port, " is not an operator.\n");
-
-            *error = LISP_ERROR_BAD_OP;
-            return 0;
+            fasl_unmark_r_(lambda_args_(x));
+            fasl_unmark_r_(lisp_lambda_body(x));
+            x = lisp_lambda_env(x);
+        }
+        else if (lisp_type(x) == LISP_TABLE)
+        {
+            const Table* table = table_get_(x);
+            Lisp keys = { table->keys, LISP_VECTOR };
+            Lisp vals = { table->vals, LISP_VECTOR };
+            for (int i = 0; i < table->capacity; ++i)
+            {
+                if (lisp_is_null(lisp_vector_ref(keys, i))) continue;
+                fasl_unmark_r_(lisp_vector_ref(keys, i));
+                fasl_unmark_r_(lisp_vector_ref(vals, i));
+            }
+            return;
+        }
+        else
+        {
+            return;
         }
     }
 }
 
-static Lisp eval_r(jmp_buf error_jmp, LispContext ctx)
+// returns whether the object was written as a reference.
+static int fasl_put_label_(FaslWriter* w, Lisp x)
 {
-    Lisp* env = lisp_stack_peek(2, ctx);
-    Lisp* x = lisp_stack_peek(1, ctx);
+    Block* block = fasl_block_(x);
+    if (!block || block->mark != FASL_SHARED) return 0;
 
-    while (1)
+    int* label = fasl_map_find_(&w->shared, block);
+    if (*label >= 0)
     {
-        switch (lisp_type(*x))
+        fasl_put_u8_(w, FASL_REF);
+        fasl_put_uint_(w, (uint64_t)*label);
+        return 1;
+    }
+    else
+    {
+        fasl_put_u8_(w, FASL_LABEL);
+        *label = w->label_count++;
+        return 0;
+    }
+}
+
+static void fasl_write_r_(FaslWriter* w, Lisp x)
+{
+    int env = fasl_env_index_(w, x);
+    if (env != -1)
+    {
+        fasl_put_u8_(w, FASL_ENV);
+        fasl_put_uint_(w, (uint64_t)env);
+        return;
+    }
+
+    if (fasl_put_label_(w, x)) return;
+
+    switch (lisp_type(x))
+    {
+        case LISP_NULL:
+            fasl_put_u8_(w, FASL_NULL);
+            break;
+        case LISP_BOOL:
+            fasl_put_u8_(w, lisp_bool(x) ? FASL_TRUE : FASL_FALSE);
+            break;
+        case LISP_INT:
         {
-            case LISP_SYMBOL: // variable reference
+            LispInt n = lisp_int(x);
+            if (n >= -128 && n <= 127)
             {
-                int present = 0;
-                Lisp val = lisp_env_lookup(*env, *x, &present);
-                if (!present)
-                {
-                    fprintf(ctx.p->err_port, "%s is not defined.\n", lisp_symbol_string(*x));
-                    longjmp(error_jmp, LISP_ERROR_UNDEFINED_VAR);
-                    return lisp_null();
-                }
-                return val;
+                fasl_put_u8_(w, FASL_INT8);
+                fasl_put_u8_(w, (uint8_t)(int8_t)n);
             }
-            case LISP_PAIR:
+            else
             {
-                Lisp op_sym = lisp_car(*x);
-                int op_valid = lisp_type(op_sym) == LISP_SYMBOL;
-
-                if (lisp_eq(op_sym, get_sym(SYM_IF, ctx)) && op_valid)
-                {
-                    // if conditional statemetns
-                    Lisp predicate = lisp_list_ref(*x, 1);
-
-                    lisp_stack_push(*env, ctx);
-                    lisp_stack_push(predicate, ctx);
+                fasl_put_u8_(w, FASL_INT);
+                fasl_put_u64_(w, (uint64_t)n);
+            }
+            break;
+        }
+        case LISP_REAL:
+        {
+            LispReal r = lisp_real(x);
+            uint64_t bits;
+            memcpy(&bits, &r, sizeof(bits));
+            fasl_put_u8_(w, FASL_REAL);
+            fasl_put_u64_(w, bits);
+            break;
+        }
+        case LISP_CHAR:
+            fasl_put_u8_(w, FASL_CHAR);
+            fasl_put_uint_(w, (uint64_t)(lisp_char(x) + 1));
+            break;
+        case LISP_STRING:
+            fasl_put_u8_(w, FASL_STRING);
+            fasl_put_bytes_(w, lisp_string(x), strlen(lisp_string(x)));
+            break;
+        case LISP_SYMBOL:
+            fasl_put_u8_(w, FASL_SYMBOL);
+            fasl_put_uint_(w, (uint64_t)*fasl_map_find_(&w->symbols, x.val.ptr_val));
+            break;
+        case LISP_F64VECTOR:
+        {
+            int n = lisp_typed_vector_length(x);
+            const LispReal* data = lisp_f64vector(x);
+            fasl_put_u8_(w, FASL_F64VECTOR);
+            fasl_put_uint_(w, (uint64_t)n);
+            for (int i = 0; i < n; ++i)
+            {
+                uint64_t bits;
+                memcpy(&bits, data + i, sizeof(bits));
+                fasl_put_u64_(w, bits);
+            }
+            break;
+        }
+        case LISP_S64VECTOR:
+        {
+            int n = lisp_typed_vector_length(x);
+            const LispInt* data = lisp_s64vector(x);
+            fasl_put_u8_(w, FASL_S64VECTOR);
+            fasl_put_uint_(w, (uint64_t)n);
+            for (int i = 0; i < n; ++i) fasl_put_u64_(w, (uint64_t)data[i]);
+            break;
+        }
+        case LISP_BYTEVECTOR:
+            fasl_put_u8_(w, FASL_BYTEVECTOR);
+            fasl_put_bytes_(w, (const char*)lisp_bytevector(x), (size_t)lisp_typed_vector_length(x));
+            break;
+        case LISP_VECTOR:
+        {
+            int n = lisp_vector_length(x);
+            fasl_put_u8_(w, FASL_VECTOR);
+            fasl_put_uint_(w, (uint64_t)n);
+            for (int i = 0; i < n; ++i) fasl_write_r_(w, lisp_vector_ref(x, i));
+            break;
+        }
+        case LISP_RECORD:
+        {
+            Vector* record = record_get_(x);
+            int n = vector_len_(record);
+            fasl_put_u8_(w, FASL_RECORD);
+            fasl_put_uint_(w, (uint64_t)n);
+            for (int i = 0; i < n; ++i) fasl_write_r_(w, record_entry_(record, i));
+            break;
+        }
+        case LISP_PAIR:
+        {
+            // The list run stops before any shared pair, which is written as the tail.
+            uint64_t n = 1;
+            Lisp it = lisp_cdr(x);
+            while (lisp_is_pair(it) && fasl_block_(it)->mark != FASL_SHARED && fasl_env_index_(w, it) == -1)
+            {
+                ++n;
+                it = lisp_cdr(it);
+            }
 
-                    if (lisp_is_true(eval_r(error_jmp, ctx)))
-                    {
-                        // consequence
-                        *x = lisp_list_ref(*x, 2);
-                        // while will eval
-                    }
-                    else
-                    {
-                        // alternative
-                        *x = lisp_list_ref(*x, 3);
-                        // while will eval
-                    }
+            fasl_put_u8_(w, FASL_LIST);
+            fasl_put_uint_(w, n);
+            for (uint64_t i = 0; i < n; ++i)
+            {
+                fasl_write_r_(w, lisp_car(x));
+                x = lisp_cdr(x);
+            }
+            fasl_write_r_(w, x);
+            break;
+        }
+        case LISP_FUNC:
+            fasl_put_u8_(w, FASL_FUNC);
+            fasl_put_u64_(w, (uint64_t)(uintptr_t)x.val.func_val);
+            break;
+        case LISP_PTR:
+            fasl_put_u8_(w, FASL_PTR);
+            fasl_put_u64_(w, (uint64_t)(uintptr_t)x.val.ptr_val);
+            break;
+        case LISP_LAMBDA:
+            fasl_put_u8_(w, FASL_LAMBDA);
+            fasl_write_r_(w, lambda_args_(x));
+            fasl_write_r_(w, lisp_lambda_body(x));
+            fasl_write_r_(w, lisp_lambda_env(x));
+            break;
+        case LISP_TABLE:
+        {
+            const Table* table = table_get_(x);
+            Lisp keys = { table->keys, LISP_VECTOR };
+            Lisp vals = { table->vals, LISP_VECTOR };
+            fasl_put_u8_(w, FASL_TABLE);
+            fasl_put_uint_(w, (uint64_t)table->size);
+            for (int i = 0; i < table->capacity; ++i)
+            {
+                Lisp key = lisp_vector_ref(keys, i);
+                if (lisp_is_null(key)) continue;
+                fasl_write_r_(w, key);
+                fasl_write_r_(w, lisp_vector_ref(vals, i));
+            }
+            break;
+        }
+        default:
+            assert(0);
+            break;
+    }
+}
 
-                    lisp_stack_pop(ctx);
-                    lisp_stack_pop(ctx);
-                }
-                else if (lisp_eq(op_sym, get_sym(SYM_BEGIN, ctx)) && op_valid)
-                {
-                    Lisp it = lisp_cdr(*x);
-                    if (lisp_is_null(it)) return it;
+// The result starts with a header, like a file.
+static LispError fasl_encode_(Lisp x, int in_process, char** out_buffer, size_t* out_size, LispContext ctx)
+{
+    FaslWriter w;
+    memset(&w, 0, sizeof(w));
+    w.in_process = in_process;
+    w.env = lisp_env(ctx);
+    fasl_reserve_(&w, FASL_HEADER_SIZE);
+    w.size = FASL_HEADER_SIZE;
 
-                    // eval all but last
-                    while (lisp_is_pair(lisp_cdr(it)))
-                    {
-                        // save next thing
-                        lisp_stack_push(lisp_cdr(it), ctx);
+    LispError error = fasl_scan_r_(&w, x);
+    if (error == LISP_ERROR_NONE)
+    {
+        fasl_put_uint_(&w, (uint64_t)w.symbol_count);
+        for (int i = 0; i < w.symbol_count; ++i)
+        {
+            Lisp symbol = w.symbol_list[i];
+            fasl_put_u8_(&w, (uint8_t)symbol_is_interned_(ctx.p->symbols, symbol));
+            fasl_put_bytes_(&w, lisp_symbol_string(symbol), (size_t)lisp_symbol_length(symbol));
+        }
 
-                        lisp_stack_push(*env, ctx);
-                        lisp_stack_push(lisp_car(it), ctx);
+        fasl_write_r_(&w, x);
 
-                        eval_r(error_jmp, ctx);
+        uint64_t size = (uint64_t)(w.size - FASL_HEADER_SIZE);
+        char* header = w.buffer;
+        memcpy(header, FASL_MAGIC, 4);
+        for (int i = 0; i < 4; ++i) header[4 + i] = (char)(FASL_VERSION >> (8 * i));
+        for (int i = 0; i < 8; ++i) header[8 + i] = (char)(size >> (8 * i));
+    }
+    fasl_unmark_r_(x);
 
-                        lisp_stack_pop(ctx);
-                        lisp_stack_pop(ctx);
+    // so copies sent back are the same types.
+    for (int i = 0; i < w.type_count && error == LISP_ERROR_NONE; ++i)
+        lisp_table_set(ctx.p->record_types, record_entry_(record_get_(w.types[i]), 4), w.types[i], ctx);
 
-                        it = lisp_stack_pop(ctx);
-                        //it = lisp_cdr(it);
-                    }
+    free(w.shared.keys);
+    free(w.shared.vals);
+    free(w.symbols.keys);
+    free(w.symbols.vals);
+    free(w.symbol_list);
+    free(w.types);
 
-                    *x = lisp_car(it);
-                    // while will eval last
-                }
-                else if (lisp_eq(op_sym, get_sym(SYM_QUOTE, ctx)) && op_valid)
-                {
-                    return lisp_list_ref(*x, 1);
-                }
-                else if (lisp_eq(op_sym, get_sym(SYM_DEFINE, ctx)))
-                {
-                    // variable definitions
-                    lisp_stack_push(*env, ctx);
-                    lisp_stack_push(lisp_list_ref(*x, 2), ctx);
+    if (error == LISP_ERROR_NONE)
+    {
+        *out_buffer = w.buffer;
+        *out_size = w.size;
+    }
+    else
+    {
+        free(w.buffer);
+    }
+    return error;
+}
 
-                    Lisp value = eval_r(error_jmp, ctx);
+LispError lisp_write_binary(FILE* file, Lisp x, LispContext ctx)
+{
+    char* buffer;
+    size_t size;
+    LispError error = fasl_encode_(x, 0, &buffer, &size, ctx);
+    if (error != LISP_ERROR_NONE) return error;
 
-                    lisp_stack_pop(ctx);
-                    lisp_stack_pop(ctx);
+    if (fwrite(buffer, 1, size, file) != size) error = LISP_ERROR_FILE_OPEN;
+    free(buffer);
+    return error;
+}
 
-                    Lisp symbol = lisp_list_ref(*x, 1);
-                    lisp_env_define(*env, symbol, value, ctx);
-                    return lisp_null();
-                }
-                else if (lisp_eq(op_sym, get_sym(SYM_SET, ctx)) && op_valid)
-                {
-                    assert(!lisp_is_null(*env));
-                    // mutablity
-                    // like def, but requires existence
-                    // and will search up the environment chain
+typedef struct
+{
+    const unsigned char* c;
+    const unsigned char* end;
 
-                    lisp_stack_push(*env, ctx);
-                    lisp_stack_push(lisp_list_ref(*x, 2), ctx);
+    Lisp* symbols;
+    uint32_t symbol_count;
 
-                    Lisp value = eval_r(error_jmp, ctx);
+    Lisp* labels;
+    uint32_t label_count;
+    uint32_t label_capacity;
 
-                    lisp_stack_pop(ctx);
-                    lisp_stack_pop(ctx);
+    int in_process;
+    jmp_buf error_jmp;
+    LispContext ctx;
+} FaslReader;
 
-                    Lisp symbol = lisp_list_ref(*x, 1);
-                    if (!lisp_env_set(*env, symbol, value, ctx))
-                    {
-                        fprintf(ctx.p->err_port, "error: unknown variable: %s\n", lisp_symbol_string(symbol));
-                    }
-                    return lisp_null();
-                }
-                else if (lisp_eq(op_sym, get_sym(SYM_LAMBDA, ctx)) && op_valid)
+static void fasl_need_(FaslReader* r, size_t n)
+{
+    if ((size_t)(r->end - r->c) < n) longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
+}
+
+static uint8_t fasl_get_u8_(FaslReader* r)
+{
+    fasl_need_(r, 1);
+    return *r->c++;
+}
+
+static uint32_t fasl_get_u32_(FaslReader* r)
+{
+    fasl_need_(r, 4);
+    uint32_t x = 0;
+    for (int i = 0; i < 4; ++i) x |= (uint32_t)r->c[i] << (8 * i);
+    r->c += 4;
+    return x;
+}
+
+static uint32_t fasl_get_uint_(FaslReader* r)
+{
+    uint64_t x = 0;
+    int shift = 0;
+    while (1)
+    {
+        uint8_t byte = fasl_get_u8_(r);
+        x |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) break;
+        shift += 7;
+        if (shift > 35) longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
+    }
+    if (x > INT32_MAX) longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
+    return (uint32_t)x;
+}
+
+static uint64_t fasl_get_u64_(FaslReader* r)
+{
+    fasl_need_(r, 8);
+    uint64_t x = 0;
+    for (int i = 0; i < 8; ++i) x |= (uint64_t)r->c[i] << (8 * i);
+    r->c += 8;
+    return x;
+}
+
+static uint32_t fasl_add_label_(FaslReader* r)
+{
+    if (r->label_count == r->label_capacity)
+    {
+        r->label_capacity = r->label_capacity ? r->label_capacity * 2 : 64;
+        r->labels = realloc(r->labels, sizeof(Lisp) * r->label_capacity);
+    }
+    r->labels[r->label_count] = lisp_null();
+    return r->label_count++;
+}
+
+static int fasl_is_record_type_(Lisp t)
+{
+    if (lisp_type(t) != LISP_RECORD || record_kind_(t) != RECORD_TYPE) return 0;
+    Vector* type = record_get_(t);
+    return vector_len_(type) == 5 &&
+        record_entry_(type, 3).type == LISP_INT && lisp_int(record_entry_(type, 3)) >= 0 &&
+        record_entry_(type, 4).type == LISP_INT;
+}
+
+static int fasl_is_field_(Lisp type, Lisp i)
+{
+    return i.type == LISP_INT && lisp_int(i) >= 0 && lisp_int(i) < record_type_fields_(type);
+}
+
+// whether a record read is one apply and the printer can use (see record_apply_).
+static int fasl_record_valid_(Lisp r)
+{
+    Vector* record = record_get_(r);
+    int n = vector_len_(record);
+    Lisp kind = record_entry_(record, 0);
+    if (kind.type == LISP_RECORD)
+        return fasl_is_record_type_(kind) && record_type_fields_(kind) == n - 1;
+    if (kind.type != LISP_INT) return 0;
+    if (lisp_int(kind) == RECORD_TYPE) return fasl_is_record_type_(r);
+
+    Lisp type = record_entry_(record, 1);
+    Lisp arg = record_entry_(record, 2);
+    if (n != 3 || !fasl_is_record_type_(type)) return 0;
+
+    switch (lisp_int(kind))
+    {
+        case RECORD_CONSTRUCTOR:
+        {
+            if (lisp_type(arg) != LISP_VECTOR) return 0;
+            for (int i = 0; i < lisp_vector_length(arg); ++i)
+                if (!fasl_is_field_(type, lisp_vector_ref(arg, i))) return 0;
+            return 1;
+        }
+        case RECORD_PREDICATE:
+            return 1;
+        case RECORD_ACCESSOR:
+        case RECORD_MODIFIER:
+            return fasl_is_field_(type, arg);
+        default:
+            return 0;
+    }
+}
+
+static Lisp fasl_read_r_(FaslReader* r)
+{
+    int label = -1;
+    uint8_t tag = fasl_get_u8_(r);
+    if (tag == FASL_LABEL)
+    {
+        label = (int)fasl_add_label_(r);
+        tag = fasl_get_u8_(r);
+    }
+
+    switch (tag)
+    {
+        case FASL_NULL: return lisp_null();
+        case FASL_TRUE: return lisp_true();
+        case FASL_FALSE: return lisp_false();
+        case FASL_INT8: return lisp_make_int((int8_t)fasl_get_u8_(r));
+        case FASL_INT: return lisp_make_int((LispInt)fasl_get_u64_(r));
+        case FASL_REAL:
+        {
+            uint64_t bits = fasl_get_u64_(r);
+            LispReal x;
+            memcpy(&x, &bits, sizeof(x));
+            return lisp_make_real(x);
+        }
+        case FASL_CHAR: return lisp_make_char((int)fasl_get_uint_(r) - 1);
+        case FASL_STRING:
+        {
+            uint32_t n = fasl_get_uint_(r);
+            fasl_need_(r, n);
+            Lisp s = lisp_make_string((int)n, r->ctx);
+            memcpy(lisp_buffer(s), r->c, n);
+            r->c += n;
+            if (label >= 0) r->labels[label] = s;
+            return s;
+        }
+        case FASL_F64VECTOR:
+        case FASL_S64VECTOR:
+        {
+            uint32_t n = fasl_get_uint_(r);
+            fasl_need_(r, (size_t)n * 8);
+            Lisp v;
+            if (tag == FASL_F64VECTOR)
+            {
+                v = lisp_make_f64vector((int)n, r->ctx);
+                LispReal* data = lisp_f64vector(v);
+                for (uint32_t i = 0; i < n; ++i)
                 {
-                    // lambda defintions (compound procedures)
-                    Lisp args = lisp_list_ref(*x, 1);
-                    Lisp body = lisp_list_ref(*x, 2);
-                    return lisp_make_lambda(args, body, *env, ctx);
+                    uint64_t bits = fasl_get_u64_(r);
+                    memcpy(data + i, &bits, sizeof(bits));
                 }
-                else
-                {
-                    // operator application
-                    lisp_stack_push(*env, ctx);
-                    lisp_stack_push(lisp_car(*x), ctx);
+            }
+            else
+            {
+                v = lisp_make_s64vector((int)n, r->ctx);
+                LispInt* data = lisp_s64vector(v);
+                for (uint32_t i = 0; i < n; ++i) data[i] = (LispInt)fasl_get_u64_(r);
+            }
+            if (label >= 0) r->labels[label] = v;
+            return v;
+        }
+        case FASL_BYTEVECTOR:
+        {
+            uint32_t n = fasl_get_uint_(r);
+            fasl_need_(r, n);
+            Lisp v = lisp_make_bytevector((int)n, r->ctx);
+            memcpy(lisp_bytevector(v), r->c, n);
+            r->c += n;
+            if (label >= 0) r->labels[label] = v;
+            return v;
+        }
+        case FASL_SYMBOL:
+        {
+            uint32_t i = fasl_get_uint_(r);
+            if (i >= r->symbol_count) longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
+            return r->symbols[i];
+        }
+        case FASL_REF:
+        {
+            uint32_t i = fasl_get_uint_(r);
+            if (i >= r->label_count) longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
+            return r->labels[i];
+        }
+        case FASL_VECTOR:
+        {
+            uint32_t n = fasl_get_uint_(r);
+            // every entry is at least one byte.
+            fasl_need_(r, n);
+            Lisp v = lisp_make_vector((int)n, r->ctx);
+            lisp_vector_fill(v, lisp_null());
+            if (label >= 0) r->labels[label] = v;
+
+            for (uint32_t i = 0; i < n; ++i)
+                lisp_vector_set(v, (int)i, fasl_read_r_(r));
+            return v;
+        }
+        case FASL_RECORD:
+        {
+            uint32_t n = fasl_get_uint_(r);
+            if (n == 0) longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
+            fasl_need_(r, n);
+            Lisp record = make_record_((int)n, r->ctx);
+            for (uint32_t i = 0; i < n; ++i) record_set_entry_(record_get_(record), (int)i, lisp_false());
+            if (label >= 0) r->labels[label] = record;
+
+            for (uint32_t i = 0; i < n; ++i)
+            {
+                Lisp x = fasl_read_r_(r);
+                record_set_entry_(record_get_(record), (int)i, x);
+            }
+            if (!fasl_record_valid_(record)) longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
 
-                    Lisp operator = eval_r(error_jmp, ctx);
+            if (record_kind_(record) != RECORD_TYPE) return record;
 
-                    Lisp operator_expr = lisp_stack_pop(ctx);
-                    lisp_stack_pop(ctx);
+            if (!r->in_process)
+            {
+                record_set_entry_(record_get_(record), 4, lisp_make_int(record_type_next_id_()));
+                return record;
+            }
 
-                    lisp_stack_push(operator, ctx);
-                    lisp_stack_push(operator_expr, ctx);
+            // a type this context has seen before is that type.
+            Lisp id = record_entry_(record_get_(record), 4);
+            int present;
+            Lisp known = lisp_table_get(r->ctx.p->record_types, id, &present);
+            if (!present)
+            {
+                lisp_table_set(r->ctx.p->record_types, id, record, r->ctx);
+                return record;
+            }
+            if (label >= 0) r->labels[label] = known;
+            return known;
+        }
+        case FASL_LIST:
+        {
+            uint32_t n = fasl_get_uint_(r);
+            if (n == 0) longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
+            fasl_need_(r, n);
 
-                    Lisp arg_expr = lisp_cdr(*x);
+            // allocate the spine first so references to the head resolve.
+            Lisp head = lisp_cons(lisp_null(), lisp_null(), r->ctx);
+            if (label >= 0) r->labels[label] = head;
 
-                    Lisp args = lisp_null();
+            Lisp it = head;
+            for (uint32_t i = 0; i < n; ++i)
+            {
+                lisp_set_car(it, fasl_read_r_(r));
+                if (i + 1 < n)
+                {
+                    Lisp next = lisp_cons(lisp_null(), lisp_null(), r->ctx);
+                    lisp_set_cdr(it, next);
+                    it = next;
+                }
+            }
+            lisp_set_cdr(it, fasl_read_r_(r));
+            return head;
+        }
+        case FASL_FUNC:
+        case FASL_PTR:
+        {
+            if (!r->in_process) longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
+            uint64_t address = fasl_get_u64_(r);
+            if (tag == FASL_PTR) return lisp_make_ptr((void*)(uintptr_t)address);
 
-                    while (lisp_is_pair(arg_expr))
-                    {
-                        // save next
-                        lisp_stack_push(lisp_cdr(arg_expr), ctx);
-                        lisp_stack_push(args, ctx);
+            Lisp f;
+            f.type = LISP_FUNC;
+            f.val.func_val = (void(*)(void))(uintptr_t)address;
+            return f;
+        }
+        case FASL_LAMBDA:
+        {
+            if (!r->in_process) longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
+            Lisp lambda = lisp_make_lambda(lisp_null(), lisp_null(), lisp_null(), r->ctx);
+            if (label >= 0) r->labels[label] = lambda;
+
+            Lisp args = fasl_read_r_(r);
+            Lisp body = fasl_read_r_(r);
+            Lisp env = fasl_read_r_(r);
+            if (!lisp_is_env(env)) longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
+            lambda_set_(lambda, args, body, env);
+            return lambda;
+        }
+        case FASL_TABLE:
+        {
+            if (!r->in_process) longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
+            uint32_t n = fasl_get_uint_(r);
+            fasl_need_(r, n);
+            Lisp table = lisp_make_table(r->ctx);
+            if (label >= 0) r->labels[label] = table;
 
-                        lisp_stack_push(*env, ctx);
-                        lisp_stack_push(lisp_car(arg_expr), ctx);
-                        Lisp new_arg = eval_r(error_jmp, ctx);
-                        lisp_stack_pop(ctx);
-                        lisp_stack_pop(ctx);
+            for (uint32_t i = 0; i < n; ++i)
+            {
+                Lisp key = fasl_read_r_(r);
+                lisp_table_set(table, key, fasl_read_r_(r), r->ctx);
+            }
+            return table;
+        }
+        case FASL_ENV:
+        {
+            if (!r->in_process) longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
+            uint32_t i = fasl_get_uint_(r);
+            Lisp env = lisp_env(r->ctx);
+            while (i-- > 0)
+            {
+                if (!lisp_is_pair(env)) longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
+                env = lisp_cdr(env);
+            }
+            return env;
+        }
+        default:
+            longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
+    }
+}
 
-                        args = lisp_cons(new_arg, lisp_stack_pop(ctx), ctx);
-                        arg_expr = lisp_stack_pop(ctx);
-                    }
+static Lisp fasl_decode_(const char* start, const char* end, const char** out_end, int in_process, LispError* out_error, LispContext ctx)
+{
+    FaslReader r;
+    r.in_process = in_process;
+    r.c = (const unsigned char*)start;
+    r.end = (const unsigned char*)end;
+    r.symbols = NULL;
+    r.symbol_count = 0;
+    r.labels = NULL;
+    r.label_count = 0;
+    r.label_capacity = 0;
+    r.ctx = ctx;
 
-                    operator_expr = lisp_stack_pop(ctx);
-                    operator = lisp_stack_pop(ctx);
+    Lisp result = lisp_eof();
 
-                    LispError error = LISP_ERROR_NONE;
-                    int needs_to_eval = apply(operator, lisp_list_reverse(args), x, env, &error, ctx);
-                    if (error != LISP_ERROR_NONE)
-                    {
-                        if (lisp_type(operator_expr) == LISP_SYMBOL)
-                        {
-                            fprintf(ctx.p->err_port, "operator: %s\n", lisp_symbol_string(operator_expr));
-                        }
+    LispError error = setjmp(r.error_jmp);
+    if (error == LISP_ERROR_NONE)
+    {
+        fasl_need_(&r, FASL_HEADER_SIZE);
+        if (memcmp(r.c, FASL_MAGIC, 4) != 0) longjmp(r.error_jmp, LISP_ERROR_READ_SYNTAX);
+        r.c += 4;
+        if (fasl_get_u32_(&r) != FASL_VERSION) longjmp(r.error_jmp, LISP_ERROR_READ_SYNTAX);
 
-                        longjmp(error_jmp, error);
-                    }
+        uint64_t size = fasl_get_u64_(&r);
+        fasl_need_(&r, size);
+        r.end = r.c + size;
+
+        uint32_t symbol_count = fasl_get_uint_(&r);
+        fasl_need_(&r, symbol_count);
+        r.symbols = malloc(sizeof(Lisp) * (symbol_count + 1));
+
+        for (uint32_t i = 0; i < symbol_count; ++i)
+        {
+            uint8_t interned = fasl_get_u8_(&r);
+            uint32_t n = fasl_get_uint_(&r);
+            fasl_need_(&r, n);
+
+            if (interned)
+                r.symbols[i] = symbol_intern_(ctx.p->symbols, (const char*)r.c, n, ctx);
+            else
+                r.symbols[i] = lisp_gen_symbol(ctx);
+
+            r.c += n;
+            ++r.symbol_count;
+        }
+
+        result = fasl_read_r_(&r);
+        if (r.c != r.end) longjmp(r.error_jmp, LISP_ERROR_READ_SYNTAX);
+        if (out_end) *out_end = (const char*)r.c;
+    }
+    else
+    {
+        hook_error_(error, ctx);
+        result = lisp_null();
+    }
+
+    free(r.symbols);
+    free(r.labels);
+    *out_error = error;
+    return result;
+}
+
+Lisp lisp_read_binary_range(const char* start, const char* end, const char** out_end, LispError* out_error, LispContext ctx)
+{
+    return fasl_decode_(start, end, out_end, 0, out_error, ctx);
+}
+
+Lisp lisp_read_binary(FILE* file, LispError* out_error, LispContext ctx)
+{
+    char header[FASL_HEADER_SIZE];
+    size_t read = fread(header, 1, FASL_HEADER_SIZE, file);
+    if (read == 0 && feof(file))
+    {
+        *out_error = LISP_ERROR_NONE;
+        return lisp_eof();
+    }
+    else if (read != FASL_HEADER_SIZE)
+    {
+        *out_error = LISP_ERROR_READ_SYNTAX;
+        return lisp_null();
+    }
+
+    uint64_t size = 0;
+    for (int i = 0; i < 8; ++i) size |= (uint64_t)(unsigned char)header[8 + i] << (8 * i);
+
+    char* data = malloc(FASL_HEADER_SIZE + size);
+    if (!data)
+    {
+        *out_error = LISP_ERROR_READ_SYNTAX;
+        return lisp_null();
+    }
+    memcpy(data, header, FASL_HEADER_SIZE);
+
+    Lisp result;
+    if (fread(data + FASL_HEADER_SIZE, 1, size, file) != size)
+    {
+        *out_error = LISP_ERROR_READ_SYNTAX;
+        result = lisp_null();
+    }
+    else
+    {
+        result = lisp_read_binary_range(data, data + FASL_HEADER_SIZE + size, NULL, out_error, ctx);
+    }
+    free(data);
+    return result;
+}
+
+/* Workers
+ Each worker thread has a context, and a queue of tasks.
+ A worker takes the newest of its own tasks,
+ and when it has none, steals the oldest of another's.
+ Tasks come in batches, which share a procedure. */
+
+typedef struct
+{
+    struct WorkerBatch* batch;
+    // binary copy of the items to map over, or NULL to call the procedure.
+    char* items;
+    size_t items_size;
+    char* result;
+    size_t result_size;
+    LispError error;
+} WorkerTask;
+
+typedef struct WorkerBatch
+{
+    // binary copy of #(definitions procedure)
+    char* program;
+    size_t program_size;
+    uint64_t id;
+
+    WorkerTask* tasks;
+    int task_count;
+    // guarded by the pool's lock
+    int remaining;
+
+    // futures which haven't been touched
+    struct WorkerBatch* prev;
+    struct WorkerBatch* next;
+} WorkerBatch;
+
+static Lisp worker_call_(Lisp proc, Lisp x, LispError* out_error, LispContext ctx)
+{
+    return lisp_apply(proc, lisp_cons(x, lisp_null(), ctx), out_error, ctx);
+}
+
+#ifndef LISP_NO_THREADS
+
+// Definitions from the first table of the global environment which a procedure needs.
+typedef struct
+{
+    // objects and symbols visited
+    FaslMap seen;
+    Lisp env;
+    Lisp table;
+    Lisp definitions;
+    LispContext ctx;
+} WorkerDefs;
+
+static void worker_defs_value_r_(WorkerDefs* d, Lisp x);
+
+static void worker_defs_code_r_(WorkerDefs* d, Lisp x)
+{
+    LispContext ctx = d->ctx;
+    if (lisp_type(x) == LISP_SYMBOL)
+    {
+        if (fasl_map_find_(&d->seen, x.val.ptr_val)) return;
+        fasl_map_insert_(&d->seen, x.val.ptr_val, 0);
+
+        int present = 0;
+        Lisp value = lisp_table_get(d->table, x, &present);
+        if (!present) return;
+
+        switch (lisp_type(value))
+        {
+            case LISP_PROMISE:
+            case LISP_JUMP:
+            case LISP_ESCAPE:
+            case LISP_PORT_IN:
+            case LISP_PORT_OUT:
+                // the worker keeps its own.
+                return;
+            default:
+                d->definitions = lisp_cons(lisp_cons(x, value, ctx), d->definitions, ctx);
+                worker_defs_value_r_(d, value);
+                return;
+        }
+    }
+
+    if (!lisp_is_pair(x)) return;
+
+    Lisp op = lisp_car(x);
+    if (lisp_eq(op, get_sym(SYM_QUOTE, ctx))) return;
+    // skip names being bound.
+    if (lisp_eq(op, get_sym(SYM_LAMBDA, ctx)) || lisp_eq(op, get_sym(SYM_DEFINE, ctx)))
+        x = lisp_cdr(x);
+
+    while (lisp_is_pair(x))
+    {
+        worker_defs_code_r_(d, lisp_car(x));
+        x = lisp_cdr(x);
+    }
+}
+
+static void worker_defs_value_r_(WorkerDefs* d, Lisp x)
+{
+    while (1)
+    {
+        switch (lisp_type(x))
+        {
+            case LISP_PAIR:
+            case LISP_VECTOR:
+            case LISP_RECORD:
+            case LISP_TABLE:
+            case LISP_LAMBDA:
+                if (env_tail_index_(d->env, x) != -1) return;
+                if (fasl_map_find_(&d->seen, x.val.ptr_val)) return;
+                fasl_map_insert_(&d->seen, x.val.ptr_val, 0);
+                break;
+            default:
+                return;
+        }
+
+        switch (lisp_type(x))
+        {
+            case LISP_PAIR:
+                worker_defs_value_r_(d, lisp_car(x));
+                x = lisp_cdr(x);
+                break;
+            case LISP_VECTOR:
+            {
+                int n = lisp_vector_length(x);
+                for (int i = 0; i < n; ++i) worker_defs_value_r_(d, lisp_vector_ref(x, i));
+                return;
+            }
+            case LISP_RECORD:
+            {
+                // fields may hold procedures.
+                Vector* record = record_get_(x);
+                int n = vector_len_(record);
+                for (int i = 0; i < n; ++i) worker_defs_value_r_(d, record_entry_(record, i));
+                return;
+            }
+            case LISP_TABLE:
+            {
+                const Table* table = table_get_(x);
+                Lisp keys = { table->keys, LISP_VECTOR };
+                Lisp vals = { table->vals, LISP_VECTOR };
+                for (int i = 0; i < table->capacity; ++i)
+                {
+                    if (lisp_is_null(lisp_vector_ref(keys, i))) continue;
+                    worker_defs_value_r_(d, lisp_vector_ref(vals, i));
+                }
+                return;
+            }
+            default:
+                // lambda. Its local environment is data.
+                worker_defs_code_r_(d, lisp_lambda_body(x));
+                x = lisp_lambda_env(x);
+                break;
+        }
+    }
+}
+
+static LispError worker_encode_program_(Lisp proc, char** out_buffer, size_t* out_size, LispContext ctx)
+{
+    WorkerDefs d;
+    memset(&d, 0, sizeof(WorkerDefs));
+    d.env = lisp_env(ctx);
+    d.table = lisp_is_pair(d.env) ? lisp_car(d.env) : lisp_make_table(ctx);
+    d.definitions = lisp_null();
+    d.ctx = ctx;
+
+    worker_defs_value_r_(&d, proc);
+    free(d.seen.keys);
+    free(d.seen.vals);
+
+    Lisp program = lisp_make_vector(2, ctx);
+    lisp_vector_set(program, 0, d.definitions);
+    lisp_vector_set(program, 1, proc);
+    return fasl_encode_(program, 1, out_buffer, out_size, ctx);
+}
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    // ring buffer
+    WorkerTask** tasks;
+    size_t head;
+    size_t count;
+    size_t capacity;
+} WorkerQueue;
+
+typedef struct
+{
+    struct WorkerPool* pool;
+    int index;
+    pthread_t thread;
+    WorkerQueue queue;
+
+    LispContext ctx;
+    // the procedure of the last batch, which is kept for the next task.
+    uint64_t program_id;
+    Lisp proc;
+} Worker;
+
+typedef struct WorkerPool
+{
+    Worker* workers;
+    int count;
+    void (*init)(LispContext);
+
+    pthread_mutex_t lock;
+    // tasks were queued, or stop was set
+    pthread_cond_t work;
+    // a batch finished
+    pthread_cond_t done;
+    // queued, and not taken yet
+    int pending;
+    int stop;
+
+    // round robin
+    int next;
+    uint64_t last_id;
+    WorkerBatch* futures;
+} WorkerPool;
+
+static void worker_queue_push_(WorkerQueue* q, WorkerTask* task)
+{
+    pthread_mutex_lock(&q->lock);
+    if (q->count == q->capacity)
+    {
+        size_t capacity = q->capacity ? q->capacity * 2 : 64;
+        WorkerTask** tasks = malloc(sizeof(WorkerTask*) * capacity);
+        for (size_t i = 0; i < q->count; ++i) tasks[i] = q->tasks[(q->head + i) % q->capacity];
+        free(q->tasks);
+        q->tasks = tasks;
+        q->head = 0;
+        q->capacity = capacity;
+    }
+    q->tasks[(q->head + q->count) % q->capacity] = task;
+    ++q->count;
+    pthread_mutex_unlock(&q->lock);
+}
+
+static WorkerTask* worker_queue_pop_(WorkerQueue* q, int newest)
+{
+    WorkerTask* task = NULL;
+    pthread_mutex_lock(&q->lock);
+    if (q->count > 0)
+    {
+        --q->count;
+        if (newest)
+        {
+            task = q->tasks[(q->head + q->count) % q->capacity];
+        }
+        else
+        {
+            task = q->tasks[q->head];
+            q->head = (q->head + 1) % q->capacity;
+        }
+    }
+    pthread_mutex_unlock(&q->lock);
+    return task;
+}
+
+static WorkerTask* worker_take_(Worker* w)
+{
+    WorkerPool* pool = w->pool;
+    while (1)
+    {
+        WorkerTask* task = worker_queue_pop_(&w->queue, 1);
+        for (int i = 1; !task && i < pool->count; ++i)
+            task = worker_queue_pop_(&pool->workers[(w->index + i) % pool->count].queue, 0);
+
+        pthread_mutex_lock(&pool->lock);
+        if (task)
+        {
+            --pool->pending;
+            pthread_mutex_unlock(&pool->lock);
+            return task;
+        }
+
+        while (pool->pending <= 0 && !pool->stop)
+            pthread_cond_wait(&pool->work, &pool->lock);
+
+        int stop = pool->stop;
+        pthread_mutex_unlock(&pool->lock);
+        if (stop) return NULL;
+    }
+}
+
+static void worker_run_(Worker* w, WorkerTask* task)
+{
+    LispContext ctx = w->ctx;
+    WorkerBatch* batch = task->batch;
+    LispError error = LISP_ERROR_NONE;
+
+    if (w->program_id != batch->id)
+    {
+        Lisp program = fasl_decode_(batch->program, batch->program + batch->program_size, NULL, 1, &error, ctx);
+        if (error != LISP_ERROR_NONE)
+        {
+            task->error = error;
+            return;
+        }
+
+        for (Lisp it = lisp_vector_ref(program, 0); lisp_is_pair(it); it = lisp_cdr(it))
+            lisp_env_define(lisp_env(ctx), lisp_car(lisp_car(it)), lisp_cdr(lisp_car(it)), ctx);
+
+        w->proc = lisp_vector_ref(program, 1);
+        w->program_id = batch->id;
+    }
+
+    Lisp result;
+    if (!task->items)
+    {
+        result = lisp_apply(w->proc, lisp_null(), &error, ctx);
+    }
+    else
+    {
+        Lisp items = fasl_decode_(task->items, task->items + task->items_size, NULL, 1, &error, ctx);
+        int n = error == LISP_ERROR_NONE ? lisp_vector_length(items) : 0;
+        result = lisp_make_vector(n, ctx);
+        lisp_vector_fill(result, lisp_null());
+
+        for (int i = 0; i < n && error == LISP_ERROR_NONE; ++i)
+        {
+            lisp_vector_set(result, i, worker_call_(w->proc, lisp_vector_ref(items, i), &error, ctx));
+
+            if (lisp_should_collect(ctx))
+            {
+                Lisp roots[] = { w->proc, items, result };
+                Lisp moved = lisp_collect(lisp_make_vector2(roots, 3, ctx), ctx);
+                w->proc = lisp_vector_ref(moved, 0);
+                items = lisp_vector_ref(moved, 1);
+                result = lisp_vector_ref(moved, 2);
+            }
+        }
+    }
+
+    if (error == LISP_ERROR_NONE)
+        error = fasl_encode_(result, 1, &task->result, &task->result_size, ctx);
+    task->error = error;
+}
+
+static void* worker_main_(void* arg)
+{
+    Worker* w = arg;
+    WorkerPool* pool = w->pool;
+
+    w->ctx = lisp_init();
+    w->ctx.p->in_worker = 1;
+    if (pool->init) pool->init(w->ctx);
+    w->proc = lisp_null();
+    w->program_id = 0;
+
+    WorkerTask* task;
+    while ((task = worker_take_(w)))
+    {
+        worker_run_(w, task);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--task->batch->remaining == 0) pthread_cond_broadcast(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+
+        if (lisp_should_collect(w->ctx)) w->proc = lisp_collect(w->proc, w->ctx);
+    }
+
+    lisp_shutdown(w->ctx);
+    return NULL;
+}
+
+static WorkerPool* worker_pool_(LispContext ctx)
+{
+    if (ctx.p->in_worker) return NULL;
+    if (ctx.p->workers) return ctx.p->workers;
+
+    int count = ctx.p->worker_count;
+#ifdef _SC_NPROCESSORS_ONLN
+    if (count <= 0) count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (count <= 0) count = 1;
+
+    WorkerPool* pool = calloc(1, sizeof(WorkerPool));
+    pool->count = count;
+    pool->init = ctx.p->worker_init;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    pool->workers = calloc(count, sizeof(Worker));
+    for (int i = 0; i < count; ++i)
+    {
+        Worker* w = pool->workers + i;
+        w->pool = pool;
+        w->index = i;
+        pthread_mutex_init(&w->queue.lock, NULL);
+    }
+    for (int i = 0; i < count; ++i)
+        pthread_create(&pool->workers[i].thread, NULL, worker_main_, pool->workers + i);
+
+    ctx.p->workers = pool;
+    return pool;
+}
+
+static void worker_batch_free_(WorkerBatch* batch)
+{
+    for (int i = 0; i < batch->task_count; ++i)
+    {
+        free(batch->tasks[i].items);
+        free(batch->tasks[i].result);
+    }
+    free(batch->tasks);
+    free(batch->program);
+    free(batch);
+}
+
+static void worker_pool_shutdown_(WorkerPool* pool)
+{
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->count; ++i)
+    {
+        Worker* w = pool->workers + i;
+        pthread_join(w->thread, NULL);
+        pthread_mutex_destroy(&w->queue.lock);
+        free(w->queue.tasks);
+    }
+
+    while (pool->futures)
+    {
+        WorkerBatch* next = pool->futures->next;
+        worker_batch_free_(pool->futures);
+        pool->futures = next;
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->done);
+    free(pool->workers);
+    free(pool);
+}
+
+static WorkerBatch* worker_batch_create_(WorkerPool* pool, Lisp proc, int task_count, LispError* out_error, LispContext ctx)
+{
+    char* program;
+    size_t program_size;
+    *out_error = worker_encode_program_(proc, &program, &program_size, ctx);
+    if (*out_error != LISP_ERROR_NONE) return NULL;
+
+    WorkerBatch* batch = calloc(1, sizeof(WorkerBatch));
+    batch->program = program;
+    batch->program_size = program_size;
+    batch->id = ++pool->last_id;
+    batch->tasks = calloc(task_count, sizeof(WorkerTask));
+    batch->task_count = task_count;
+    batch->remaining = task_count;
+    for (int i = 0; i < task_count; ++i) batch->tasks[i].batch = batch;
+    return batch;
+}
+
+static void worker_batch_start_(WorkerPool* pool, WorkerBatch* batch)
+{
+    for (int i = 0; i < batch->task_count; ++i)
+    {
+        worker_queue_push_(&pool->workers[pool->next].queue, batch->tasks + i);
+        pool->next = (pool->next + 1) % pool->count;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->pending += batch->task_count;
+    if (batch->task_count == 1)
+        pthread_cond_signal(&pool->work);
+    else
+        pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void worker_batch_wait_(WorkerPool* pool, WorkerBatch* batch)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (batch->remaining > 0) pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// The procedure of a future's promise.
+// Its result is released once it has been read.
+static Lisp worker_touch_(Lisp args, LispError* e, LispContext ctx)
+{
+    WorkerPool* pool = ctx.p->workers;
+    WorkerBatch* batch = lisp_ptr(lisp_car(args));
+    worker_batch_wait_(pool, batch);
+
+    const WorkerTask* task = batch->tasks;
+    if (task->error != LISP_ERROR_NONE)
+    {
+        *e = task->error;
+        return lisp_null();
+    }
+
+    Lisp result = fasl_decode_(task->result, task->result + task->result_size, NULL, 1, e, ctx);
+    if (*e != LISP_ERROR_NONE) return lisp_null();
+
+    if (batch->prev) batch->prev->next = batch->next;
+    else pool->futures = batch->next;
+    if (batch->next) batch->next->prev = batch->prev;
+    worker_batch_free_(batch);
+    return result;
+}
+
+#endif
+
+void lisp_set_workers(int n, LispContext ctx) { ctx.p->worker_count = n; }
+void lisp_set_worker_init(void (*init)(LispContext), LispContext ctx) { ctx.p->worker_init = init; }
+
+Lisp lisp_future(Lisp thunk, LispError* out_error, LispContext ctx)
+{
+#ifndef LISP_NO_THREADS
+    WorkerPool* pool = worker_pool_(ctx);
+    if (pool)
+    {
+        WorkerBatch* batch = worker_batch_create_(pool, thunk, 1, out_error, ctx);
+        if (!batch) return lisp_null();
+
+        batch->next = pool->futures;
+        if (pool->futures) pool->futures->prev = batch;
+        pool->futures = batch;
+        worker_batch_start_(pool, batch);
+
+        // (lambda () (touch batch))
+        Lisp call[] = { lisp_make_func(worker_touch_), lisp_make_ptr(batch) };
+        Lisp body = lisp_make_list2(call, 2, ctx);
+        return lisp_make_promise(lisp_make_lambda(lisp_null(), body, lisp_env(ctx), ctx), ctx);
+    }
+#endif
+    Lisp result = lisp_apply(thunk, lisp_null(), out_error, ctx);
+    if (*out_error != LISP_ERROR_NONE) return lisp_null();
+
+    Lisp promise = lisp_make_promise(thunk, ctx);
+    lisp_promise_store(promise, result);
+    return promise;
+}
+
+// tasks per worker, so that uneven items can be balanced.
+#define LISP_WORKER_SPLIT 8
+
+Lisp lisp_parallel_map(Lisp proc, Lisp items, LispError* out_error, LispContext ctx)
+{
+    int n = lisp_vector_length(items);
+    Lisp results = lisp_make_vector(n, ctx);
+    lisp_vector_fill(results, lisp_null());
+    *out_error = LISP_ERROR_NONE;
+
+#ifndef LISP_NO_THREADS
+    WorkerPool* pool = worker_pool_(ctx);
+    if (pool && n > 0)
+    {
+        int task_count = pool->count * LISP_WORKER_SPLIT;
+        if (task_count > n) task_count = n;
+
+        WorkerBatch* batch = worker_batch_create_(pool, proc, task_count, out_error, ctx);
+        if (!batch) return lisp_null();
+
+        for (int i = 0; i < task_count && *out_error == LISP_ERROR_NONE; ++i)
+        {
+            WorkerTask* task = batch->tasks + i;
+            Lisp part = lisp_subvector(items, (int)((int64_t)n * i / task_count), (int)((int64_t)n * (i + 1) / task_count), ctx);
+            *out_error = fasl_encode_(part, 1, &task->items, &task->items_size, ctx);
+        }
+
+        if (*out_error == LISP_ERROR_NONE)
+        {
+            worker_batch_start_(pool, batch);
+            worker_batch_wait_(pool, batch);
+
+            int offset = 0;
+            for (int i = 0; i < task_count && *out_error == LISP_ERROR_NONE; ++i)
+            {
+                const WorkerTask* task = batch->tasks + i;
+                *out_error = task->error;
+                if (*out_error != LISP_ERROR_NONE) break;
+
+                Lisp part = fasl_decode_(task->result, task->result + task->result_size, NULL, 1, out_error, ctx);
+                if (*out_error != LISP_ERROR_NONE) break;
+
+                int m = lisp_vector_length(part);
+                for (int j = 0; j < m; ++j) lisp_vector_set(results, offset + j, lisp_vector_ref(part, j));
+                offset += m;
+            }
+        }
+
+        worker_batch_free_(batch);
+        return *out_error == LISP_ERROR_NONE ? results : lisp_null();
+    }
+#endif
+    for (int i = 0; i < n; ++i)
+    {
+        Lisp x = worker_call_(proc, lisp_vector_ref(items, i), out_error, ctx);
+        if (*out_error != LISP_ERROR_NONE) return lisp_null();
+        lisp_vector_set(results, i, x);
+    }
+    return results;
+}
+
+void lisp_set_stderr(FILE* file, LispContext ctx) { ctx.p->err_port = file; }
+FILE *lisp_stderr(LispContext ctx) { return ctx.p->err_port; }
+
+static void lisp_stack_push(Lisp x, LispContext ctx)
+{
+#ifdef LISP_DEBUG
+    if (ctx.p->stack_ptr + 1 >= ctx.p->stack_depth)
+    {
+        fprintf(ctx.p->err_port, "stack overflow\n");
+    }
+#endif
+
+    ctx.p->stack[ctx.p->stack_ptr] = x;
+    ++ctx.p->stack_ptr;
+}
+
+static Lisp lisp_stack_pop(LispContext ctx)
+{
+    ctx.p->stack_ptr--;
+
+#ifdef LISP_DEBUG
+    if (ctx.p->stack_ptr < 0)
+    {
+        fprintf(ctx.p->err_port, "stack underflow\n");
+    }
+#endif
+    return ctx.p->stack[ctx.p->stack_ptr];
+}
+
+static Lisp* lisp_stack_peek(size_t i, LispContext ctx)
+{
+    return ctx.p->stack + (ctx.p->stack_ptr - i);
+}
+
+Lisp lisp_call_cc(Lisp proc, LispError* out_error, LispContext ctx)
+{
+    Lisp j = make_jump_(ctx);
+    Jump* jump = jump_get_(j);
+    jump->stack_ptr = ctx.p->stack_ptr;
+    jump->error_jmp = ctx.p->error_jmp;
+    jump->escapes = ctx.p->escapes;
+    jump->call_depth = ctx.p->call_depth;
+
+    int has_result = setjmp(jump->jmp);
+    if (has_result)
+    {
+        // restore jump from the stack
+        jump = jump_get_(lisp_stack_pop(ctx));
+        ctx.p->stack_ptr = jump->stack_ptr;
+        ctx.p->error_jmp = jump->error_jmp;
+        ctx.p->escapes = jump->escapes;
+        ctx.p->call_depth = jump->call_depth;
+        return jump->result;
+    }
+    else
+    {
+        return lisp_apply(proc, lisp_cons(j, lisp_null(), ctx), out_error, ctx);
+    }
+}
+
+// The escape procedure is only an id, which is looked up in the escapes
+// still on the C stack, so it can't jump to one which has returned.
+typedef struct Escape
+{
+    struct Escape* prev;
+    LispInt id;
+    jmp_buf jmp;
+    jmp_buf* error_jmp;
+    size_t stack_ptr;
+    size_t call_depth;
+    Lisp result;
+} Escape;
+
+Lisp lisp_call_ec(Lisp proc, LispError* out_error, LispContext ctx)
+{
+    Escape escape;
+    escape.prev = ctx.p->escapes;
+    escape.id = ++ctx.p->escape_counter;
+    escape.error_jmp = ctx.p->error_jmp;
+    escape.stack_ptr = ctx.p->stack_ptr;
+    escape.call_depth = ctx.p->call_depth;
+
+    if (setjmp(escape.jmp))
+    {
+        ctx.p->escapes = escape.prev;
+        ctx.p->stack_ptr = escape.stack_ptr;
+        ctx.p->error_jmp = escape.error_jmp;
+        ctx.p->call_depth = escape.call_depth;
+        *out_error = LISP_ERROR_NONE;
+        return escape.result;
+    }
+
+    ctx.p->escapes = &escape;
+    Lisp k = { .val = { .int_val = escape.id }, .type = LISP_ESCAPE };
+    Lisp result = lisp_apply(proc, lisp_cons(k, lisp_null(), ctx), out_error, ctx);
+    ctx.p->escapes = escape.prev;
+    return result;
+}
+
+// returns whether the result is final, or needs to be eval'd.
+static int apply(Lisp operator, Lisp args, Lisp* out_result, Lisp* out_env, LispError* error, LispContext ctx)
+{
+    switch (lisp_type(operator))
+    {
+        case LISP_LAMBDA: // lambda call (compound procedure)
+        {
+            Lisp slot_names = lambda_args_(operator);
+            *out_env = lisp_lambda_env(operator);
+
+            // make a new environment
+            Lisp new_table = lisp_make_table(ctx);
+
+            // bind parameters to arguments
+            // to pass into function call
+            while (lisp_is_pair(slot_names) && lisp_is_pair(args))
+            {
+                lisp_table_set(new_table, lisp_car(slot_names), lisp_car(args), ctx);
+                slot_names = lisp_cdr(slot_names);
+                args = lisp_cdr(args);
+            }
+
+            if (lisp_type(slot_names) == LISP_SYMBOL)
+            {
+                // variable length arguments
+                lisp_table_set(new_table, slot_names, args, ctx);
+            }
+            else if (!lisp_is_null(slot_names))
+            {
+                *error = LISP_ERROR_TOO_FEW_ARGS;
+                return 0;
+            }
+            else if (!lisp_is_null(args))
+            {
+                *error = LISP_ERROR_TOO_MANY_ARGS;
+                return 0;
+            }
+
+            // extend the environment
+            *out_env = lisp_env_extend(*out_env, new_table, ctx);
+
+            // normally we would eval the body here
+            // but while will eval
+            *out_result = lisp_lambda_body(operator);
+            return 1;
+        }
+        case LISP_FUNC: // call into C functions
+        {
+            // no environment required
+            LispCFunc f = lisp_func(operator);
+            *out_result = f(args, error, ctx);
+            return 0;
+        }
+        case LISP_JUMP:
+        {
+            Jump* jump = jump_get_(operator);
+            jump->result = lisp_car(args);
+            // put jump on the stack
+            lisp_stack_push(operator, ctx);
+            longjmp(jump->jmp, 1);
+        }
+        case LISP_RECORD: // constructors, predicates, accessors and modifiers of records
+        {
+            *out_result = record_apply_(operator, args, error, ctx);
+            return 0;
+        }
+        case LISP_ESCAPE:
+        {
+            Escape* escape = ctx.p->escapes;
+            while (escape && escape->id != operator.val.int_val) escape = escape->prev;
+            if (!escape)
+            {
+                fprintf(ctx.p->err_port, "escape procedure called after call/ec returned.\n");
+                *error = LISP_ERROR_RUNTIME;
+                return 0;
+            }
+            escape->result = lisp_is_pair(args) ? lisp_car(args) : lisp_null();
+            longjmp(escape->jmp, 1);
+        }
+        default:
+        {
+            lisp_printf(ctx.p->err_port, operator);
+            fprintf(ctx.p->err_port, " is not an operator.\n");
+
+            *error = LISP_ERROR_BAD_OP;
+            return 0;
+        }
+    }
+}
+
+#ifndef LISP_NO_RESUME
+static void task_yield_(LispContext ctx);
+#endif
+
+static void eval_out_of_fuel_(jmp_buf error_jmp, LispContext ctx)
+{
+#ifndef LISP_NO_RESUME
+    // continues from here when resumed.
+    if (ctx.p->task)
+    {
+        task_yield_(ctx);
+        return;
+    }
+#endif
+    longjmp(error_jmp, LISP_ERROR_OUT_OF_FUEL);
+}
+
+/* Closure capture.
+ A lambda only keeps the frames of its environment which can bind
+ one of its free variables. The frames are shared, not copied,
+ so define and set! in them are still seen by the closure.
+ Expansion gives each (/\_ args body) a fourth element (n . mask):
+ the lambda is made inside n frames of the expanded form,
+ innermost first, and bit i of mask keeps frame i.
+ Frames outside the form are always kept. */
+#define CAPTURE_DEPTH_MAX 32
+
+static Lisp capture_env_(Lisp env, Lisp capture, LispContext ctx)
+{
+    int n = (int)lisp_int(lisp_car(capture));
+    LispInt mask = lisp_int(lisp_cdr(capture));
+
+    Lisp frames[CAPTURE_DEPTH_MAX];
+    Lisp tail = env;
+    int dropped = -1;
+    for (int i = 0; i < n && lisp_is_pair(tail); ++i)
+    {
+        frames[i] = lisp_car(tail);
+        tail = lisp_cdr(tail);
+        if (!((mask >> i) & 1))
+        {
+            dropped = i;
+            env = tail;
+        }
+    }
+
+    // frames after the last one dropped are shared with the enclosing environment.
+    for (int i = dropped - 1; i >= 0; --i)
+    {
+        if ((mask >> i) & 1) env = lisp_env_extend(env, frames[i], ctx);
+    }
+    return env;
+}
+
+static void trace_enter_(Lisp operator, Lisp operator_expr, size_t base, LispContext ctx);
+
+static Lisp eval_r(jmp_buf error_jmp, LispContext ctx);
+
+// call_base is the call depth when eval_r was entered.
+static Lisp eval_loop_(size_t call_base, jmp_buf error_jmp, LispContext ctx)
+{
+    Lisp* env = lisp_stack_peek(2, ctx);
+    Lisp* x = lisp_stack_peek(1, ctx);
+
+    while (1)
+    {
+        if (--ctx.p->fuel < 0) eval_out_of_fuel_(error_jmp, ctx);
+
+        switch (lisp_type(*x))
+        {
+            case LISP_SYMBOL: // variable reference
+            {
+                int present = 0;
+                Lisp val = lisp_env_lookup(*env, *x, &present);
+                if (!present)
+                {
+                    fprintf(ctx.p->err_port, "%s is not defined.\n", lisp_symbol_string(*x));
+                    longjmp(error_jmp, LISP_ERROR_UNDEFINED_VAR);
+                    return lisp_null();
+                }
+                return val;
+            }
+            case LISP_PAIR:
+            {
+                Lisp op_sym = lisp_car(*x);
+                int op_valid = lisp_type(op_sym) == LISP_SYMBOL;
+
+                if (lisp_eq(op_sym, get_sym(SYM_IF, ctx)) && op_valid)
+                {
+                    // if conditional statemetns
+                    Lisp predicate = lisp_list_ref(*x, 1);
+
+                    lisp_stack_push(*env, ctx);
+                    lisp_stack_push(predicate, ctx);
+
+                    if (lisp_is_true(eval_r(error_jmp, ctx)))
+                    {
+                        // consequence
+                        *x = lisp_list_ref(*x, 2);
+                        // while will eval
+                    }
+                    else
+                    {
+                        // alternative
+                        *x = lisp_list_ref(*x, 3);
+                        // while will eval
+                    }
+
+                    lisp_stack_pop(ctx);
+                    lisp_stack_pop(ctx);
+                }
+                else if (lisp_eq(op_sym, get_sym(SYM_BEGIN, ctx)) && op_valid)
+                {
+                    Lisp it = lisp_cdr(*x);
+                    if (lisp_is_null(it)) return it;
+
+                    // eval all but last
+                    while (lisp_is_pair(lisp_cdr(it)))
+                    {
+                        // save next thing
+                        lisp_stack_push(lisp_cdr(it), ctx);
+
+                        lisp_stack_push(*env, ctx);
+                        lisp_stack_push(lisp_car(it), ctx);
+
+                        eval_r(error_jmp, ctx);
+
+                        lisp_stack_pop(ctx);
+                        lisp_stack_pop(ctx);
+
+                        it = lisp_stack_pop(ctx);
+                        //it = lisp_cdr(it);
+                    }
+
+                    *x = lisp_car(it);
+                    // while will eval last
+                }
+                else if (lisp_eq(op_sym, get_sym(SYM_QUOTE, ctx)) && op_valid)
+                {
+                    return lisp_list_ref(*x, 1);
+                }
+                else if (lisp_eq(op_sym, get_sym(SYM_DEFINE, ctx)))
+                {
+                    // variable definitions
+                    lisp_stack_push(*env, ctx);
+                    lisp_stack_push(lisp_list_ref(*x, 2), ctx);
+
+                    Lisp value = eval_r(error_jmp, ctx);
+
+                    lisp_stack_pop(ctx);
+                    lisp_stack_pop(ctx);
+
+                    Lisp symbol = lisp_list_ref(*x, 1);
+                    lisp_env_define(*env, symbol, value, ctx);
+                    return lisp_null();
+                }
+                else if (lisp_eq(op_sym, get_sym(SYM_SET, ctx)) && op_valid)
+                {
+                    assert(!lisp_is_null(*env));
+                    // mutablity
+                    // like def, but requires existence
+                    // and will search up the environment chain
+
+                    lisp_stack_push(*env, ctx);
+                    lisp_stack_push(lisp_list_ref(*x, 2), ctx);
+
+                    Lisp value = eval_r(error_jmp, ctx);
+
+                    lisp_stack_pop(ctx);
+                    lisp_stack_pop(ctx);
+
+                    Lisp symbol = lisp_list_ref(*x, 1);
+                    if (!lisp_env_set(*env, symbol, value, ctx))
+                    {
+                        fprintf(ctx.p->err_port, "error: unknown variable: %s\n", lisp_symbol_string(symbol));
+                    }
+                    return lisp_null();
+                }
+                else if (lisp_eq(op_sym, get_sym(SYM_LAMBDA, ctx)) && op_valid)
+                {
+                    // lambda defintions (compound procedures)
+                    Lisp args = lisp_list_ref(*x, 1);
+                    Lisp body = lisp_list_ref(*x, 2);
+                    Lisp capture = lisp_list_ref(*x, 3);
+                    Lisp lambda_env = lisp_is_pair(capture) ? capture_env_(*env, capture, ctx) : *env;
+                    return lisp_make_lambda(args, body, lambda_env, ctx);
+                }
+                else if (lisp_eq(op_sym, get_sym(SYM_DELAY, ctx)) && op_valid)
+                {
+                    return promise_delay_(lisp_list_ref(*x, 1), *env, ctx);
+                }
+                else if (lisp_eq(op_sym, get_sym(SYM_CONS_STREAM, ctx)) && op_valid)
+                {
+                    // (cons a (delay b))
+                    lisp_stack_push(*env, ctx);
+                    lisp_stack_push(lisp_list_ref(*x, 1), ctx);
+
+                    Lisp head = eval_r(error_jmp, ctx);
+
+                    lisp_stack_pop(ctx);
+                    lisp_stack_pop(ctx);
+
+                    Lisp tail = promise_delay_(lisp_list_ref(*x, 2), *env, ctx);
+                    return lisp_cons(head, tail, ctx);
+                }
+                else
+                {
+                    // operator application
+                    lisp_stack_push(*env, ctx);
+                    lisp_stack_push(lisp_car(*x), ctx);
+
+                    Lisp operator = eval_r(error_jmp, ctx);
+
+                    Lisp operator_expr = lisp_stack_pop(ctx);
+                    lisp_stack_pop(ctx);
+
+                    lisp_stack_push(operator, ctx);
+                    lisp_stack_push(operator_expr, ctx);
+
+                    Lisp arg_expr = lisp_cdr(*x);
+
+                    Lisp args = lisp_null();
+
+                    while (lisp_is_pair(arg_expr))
+                    {
+                        // save next
+                        lisp_stack_push(lisp_cdr(arg_expr), ctx);
+                        lisp_stack_push(args, ctx);
+
+                        lisp_stack_push(*env, ctx);
+                        lisp_stack_push(lisp_car(arg_expr), ctx);
+                        Lisp new_arg = eval_r(error_jmp, ctx);
+                        lisp_stack_pop(ctx);
+                        lisp_stack_pop(ctx);
+
+                        args = lisp_cons(new_arg, lisp_stack_pop(ctx), ctx);
+                        arg_expr = lisp_stack_pop(ctx);
+                    }
+
+                    operator_expr = lisp_stack_pop(ctx);
+                    operator = lisp_stack_pop(ctx);
+
+                    if (ctx.p->tracing) trace_enter_(operator, operator_expr, call_base, ctx);
+
+                    LispError error = LISP_ERROR_NONE;
+                    int needs_to_eval = apply(operator, lisp_list_reverse(args), x, env, &error, ctx);
+                    if (error != LISP_ERROR_NONE)
+                    {
+                        if (lisp_type(operator_expr) == LISP_SYMBOL)
+                        {
+                            fprintf(ctx.p->err_port, "operator: %s\n", lisp_symbol_string(operator_expr));
+                        }
+
+                        longjmp(error_jmp, error);
+                    }
 
                     if (!needs_to_eval)
                     {
@@ -2651,418 +6188,2293 @@ static Lisp eval_r(jmp_buf error_jmp, LispContext ctx)
                     }
                     // Otherwise while will eval
                 }
-                break;
+                break;
+            }
+            default:
+               return *x; // atom
+        }
+    }
+}
+
+static Lisp eval_r(jmp_buf error_jmp, LispContext ctx)
+{
+    // procedures applied in this frame are done when it returns.
+    size_t call_base = ctx.p->call_depth;
+    Lisp result = eval_loop_(call_base, error_jmp, ctx);
+#ifndef LISP_NO_HOOKS
+    if (ctx.p->call_depth > call_base && ctx.p->hooks.exit) ctx.p->hooks.exit(ctx.p->hooks.user);
+#endif
+    ctx.p->call_depth = call_base;
+    return result;
+}
+
+static Lisp expand_quasi_r(Lisp l, jmp_buf error_jmp, LispContext ctx)
+{
+    if (lisp_type(l) != LISP_PAIR)
+    {
+        Lisp terms[] = { get_sym(SYM_QUOTE, ctx), l };
+        return lisp_make_list2(terms, 2, ctx);
+    }
+
+    Lisp op = lisp_car(l);
+    int op_valid = lisp_type(op) == LISP_SYMBOL;
+
+    if (lisp_eq(op, get_sym(SYM_UNQUOTE, ctx)) && op_valid)
+    {
+        return lisp_car(lisp_cdr(l));
+    }
+    else if (lisp_eq(op, get_sym(SYM_UNQUOTE_SPLICE, ctx)) && op_valid)
+    {
+        fprintf(ctx.p->err_port, "slicing ,@ must be in a backquoted list.\n");
+        longjmp(error_jmp, LISP_ERROR_FORM_SYNTAX);
+    }
+    else
+    {
+        Lisp terms[] = {
+            get_sym(SYM_CONS, ctx),
+            expand_quasi_r(lisp_car(l), error_jmp, ctx),
+            expand_quasi_r(lisp_cdr(l), error_jmp, ctx),
+        };
+        return lisp_make_list2(terms, 3, ctx);
+    }
+}
+
+static Lisp expand_r(Lisp l, jmp_buf error_jmp, LispContext ctx)
+{
+    if (lisp_type(l) != LISP_PAIR) return l;
+
+    // 1. expand extended syntax into primitive syntax
+    // 2. perform optimizations
+    // 3. check syntax
+
+    Lisp op = lisp_car(l);
+    if (lisp_type(op) == LISP_SYMBOL)
+    {
+        if (lisp_eq(op, get_sym(SYM_QUOTE, ctx)))
+        {
+            // don't expand quotes
+            if (lisp_list_length(l) != 2)
+            {
+                fprintf(ctx.p->err_port, "(quote x)\n");
+                longjmp(error_jmp, LISP_ERROR_FORM_SYNTAX);
+            }
+            return l;
+        }
+        else if (lisp_eq(op, get_sym(SYM_QUASI_QUOTE, ctx)))
+        {
+            return expand_quasi_r(lisp_car(lisp_cdr(l)), error_jmp, ctx);
+        }
+        else if (lisp_eq(op, get_sym(SYM_DELAY, ctx)) && lisp_list_length(l) != 2)
+        {
+            fprintf(ctx.p->err_port, "(delay expr)\n");
+            longjmp(error_jmp, LISP_ERROR_FORM_SYNTAX);
+        }
+        else if (lisp_eq(op, get_sym(SYM_CONS_STREAM, ctx)) && lisp_list_length(l) != 3)
+        {
+            fprintf(ctx.p->err_port, "(cons-stream a b)\n");
+            longjmp(error_jmp, LISP_ERROR_FORM_SYNTAX);
+        }
+        else if (lisp_eq(op, get_sym(SYM_DEFINE_MACRO, ctx)))
+        {
+            if (lisp_list_length(l) != 3)
+            {
+                fprintf(ctx.p->err_port, "(define-macro name proc)\n");
+                longjmp(error_jmp, LISP_ERROR_FORM_SYNTAX);
+            }
+
+            Lisp symbol = lisp_list_ref(l, 1);
+            Lisp body = lisp_list_ref(l, 2);
+
+            LispError e;
+            Lisp lambda = lisp_eval(body, &e, ctx);
+
+            if (e != LISP_ERROR_NONE)
+            {
+                longjmp(error_jmp, e);
+            }
+            if (lisp_type(lambda) != LISP_LAMBDA)
+            {
+                fprintf(ctx.p->err_port, "(define-macro name proc) not a procedure\n");
+                longjmp(error_jmp, LISP_ERROR_FORM_SYNTAX);
+            }
+
+            lisp_table_set(ctx.p->macros, symbol, lambda, ctx);
+            return lisp_null();
+        }
+        else
+        {
+            int present;
+            Lisp proc = lisp_table_get(ctx.p->macros, op, &present);
+
+            if (present)
+            {
+                // EXPAND MACRO
+
+                // TODO: need to make sure collection is not triggered
+                // while evaling a macro.
+                Lisp result;
+                Lisp calling_env;
+                LispError error = LISP_ERROR_NONE;
+                if (apply(proc, lisp_cdr(l), &result, &calling_env, &error, ctx) == 1)
+                {
+                    result = lisp_eval2(result, calling_env, &error, ctx);
+                }
+
+                if (error != LISP_ERROR_NONE)
+                {
+                    fprintf(ctx.p->err_port, "macroexpand failed: %s\n", lisp_symbol_string(op));
+                    longjmp(error_jmp, error);
+                }
+                return expand_r(result, error_jmp, ctx);
+            }
+        }
+    }
+
+    // list
+    Lisp it = l;
+    while (lisp_is_pair(it))
+    {
+        lisp_set_car(it, expand_r(lisp_car(it), error_jmp, ctx));
+        it = lisp_cdr(it);
+    }
+    return l;
+
+}
+
+static int capture_member_(Lisp symbol, Lisp set)
+{
+    for (; lisp_is_pair(set); set = lisp_cdr(set))
+    {
+        if (lisp_eq(lisp_car(set), symbol)) return 1;
+    }
+    return 0;
+}
+
+static Lisp capture_add_(Lisp symbol, Lisp set, LispContext ctx)
+{
+    return capture_member_(symbol, set) ? set : lisp_cons(symbol, set, ctx);
+}
+
+static int capture_intersects_(Lisp a, Lisp b)
+{
+    for (; lisp_is_pair(a); a = lisp_cdr(a))
+    {
+        if (capture_member_(lisp_car(a), b)) return 1;
+    }
+    return 0;
+}
+
+static int capture_is_lambda_(Lisp x, LispContext ctx)
+{
+    // (/\_ args body . capture)
+    return lisp_is_pair(x) &&
+        lisp_eq(lisp_car(x), get_sym(SYM_LAMBDA, ctx)) &&
+        lisp_is_pair(lisp_cdr(x)) &&
+        lisp_is_pair(lisp_cdr(lisp_cdr(x)));
+}
+
+static Lisp capture_info_(Lisp lambda, LispContext ctx);
+
+// variables referenced by x, and names defined in its frame.
+static void capture_scan_(Lisp x, Lisp* refs, Lisp* defs, LispContext ctx)
+{
+    if (lisp_type(x) == LISP_SYMBOL)
+    {
+        *refs = capture_add_(x, *refs, ctx);
+        return;
+    }
+    if (!lisp_is_pair(x)) return;
+
+    Lisp op = lisp_car(x);
+    if (lisp_eq(op, get_sym(SYM_QUOTE, ctx))) return;
+
+    if (capture_is_lambda_(x, ctx))
+    {
+        Lisp free_vars = lisp_car(capture_info_(x, ctx));
+        for (; lisp_is_pair(free_vars); free_vars = lisp_cdr(free_vars))
+            *refs = capture_add_(lisp_car(free_vars), *refs, ctx);
+        return;
+    }
+
+    if (lisp_eq(op, get_sym(SYM_DEFINE, ctx)) && lisp_is_pair(lisp_cdr(x)))
+    {
+        *defs = capture_add_(lisp_car(lisp_cdr(x)), *defs, ctx);
+        x = lisp_cdr(lisp_cdr(x));
+    }
+    else if (lisp_eq(op, get_sym(SYM_IF, ctx)) ||
+             lisp_eq(op, get_sym(SYM_BEGIN, ctx)) ||
+             lisp_eq(op, get_sym(SYM_SET, ctx)) ||
+             lisp_eq(op, get_sym(SYM_DELAY, ctx)) ||
+             lisp_eq(op, get_sym(SYM_CONS_STREAM, ctx)))
+    {
+        x = lisp_cdr(x);
+    }
+
+    for (; lisp_is_pair(x); x = lisp_cdr(x))
+        capture_scan_(lisp_car(x), refs, defs, ctx);
+}
+
+// (free . binds) of a lambda, cached in its capture slot until annotated.
+static Lisp capture_info_(Lisp lambda, LispContext ctx)
+{
+    Lisp slot = lisp_cdr(lisp_cdr(lambda));
+    Lisp info = lisp_cdr(slot);
+    if (lisp_is_pair(info) && lisp_is_pair(lisp_car(info)) &&
+        lisp_type(lisp_car(lisp_car(info))) != LISP_INT)
+    {
+        return lisp_car(info);
+    }
+
+    Lisp binds = lisp_null();
+    Lisp args = lisp_car(lisp_cdr(lambda));
+    for (; lisp_is_pair(args); args = lisp_cdr(args))
+        binds = capture_add_(lisp_car(args), binds, ctx);
+    if (lisp_type(args) == LISP_SYMBOL)
+        binds = capture_add_(args, binds, ctx);
+
+    Lisp refs = lisp_null();
+    capture_scan_(lisp_car(slot), &refs, &binds, ctx);
+
+    Lisp free_vars = lisp_null();
+    for (; lisp_is_pair(refs); refs = lisp_cdr(refs))
+    {
+        if (!capture_member_(lisp_car(refs), binds))
+            free_vars = lisp_cons(lisp_car(refs), free_vars, ctx);
+    }
+
+    info = lisp_cons(free_vars, binds, ctx);
+    if (lisp_is_pair(lisp_cdr(slot)))
+        lisp_set_car(lisp_cdr(slot), info);
+    else
+        lisp_set_cdr(slot, lisp_cons(info, lisp_null(), ctx));
+    return info;
+}
+
+static Lisp capture_copy_(Lisp x, LispContext ctx)
+{
+    if (!lisp_is_pair(x)) return x;
+    return lisp_cons(capture_copy_(lisp_car(x), ctx), capture_copy_(lisp_cdr(x), ctx), ctx);
+}
+
+// frames holds the names each enclosing frame can bind, innermost first.
+static void capture_annotate_r_(Lisp x, const Lisp* frames, int n, LispContext ctx)
+{
+    if (!lisp_is_pair(x)) return;
+    if (lisp_eq(lisp_car(x), get_sym(SYM_QUOTE, ctx))) return;
+
+    if (capture_is_lambda_(x, ctx))
+    {
+        Lisp info = capture_info_(x, ctx);
+
+        Lisp inner[CAPTURE_DEPTH_MAX];
+        inner[0] = lisp_cdr(info);
+        int m = 1;
+
+        LispInt mask = 0;
+        for (int i = 0; i < n; ++i)
+        {
+            if (!capture_intersects_(frames[i], lisp_car(info))) continue;
+            mask |= (LispInt)1 << i;
+            if (m < CAPTURE_DEPTH_MAX) inner[m++] = frames[i];
+        }
+
+        Lisp slot = lisp_cdr(lisp_cdr(lisp_cdr(x)));
+        lisp_set_car(slot, lisp_cons(lisp_make_int(n), lisp_make_int(mask), ctx));
+        capture_annotate_r_(lisp_car(lisp_cdr(lisp_cdr(x))), inner, m, ctx);
+        return;
+    }
+
+    for (Lisp it = x; lisp_is_pair(it); it = lisp_cdr(it))
+    {
+        Lisp child = lisp_car(it);
+        // code shared between two places is annotated for the first.
+        if (capture_is_lambda_(child, ctx) &&
+            lisp_is_pair(lisp_cdr(lisp_cdr(lisp_cdr(child)))) &&
+            lisp_type(lisp_car(lisp_car(lisp_cdr(lisp_cdr(lisp_cdr(child)))))) == LISP_INT)
+        {
+            child = capture_copy_(child, ctx);
+            lisp_set_car(it, child);
+        }
+        capture_annotate_r_(child, frames, n, ctx);
+    }
+}
+
+static void capture_annotate_(Lisp x, LispContext ctx)
+{
+    // fill the caches first, so annotations left from an earlier expansion
+    // aren't taken for shared code.
+    Lisp refs = lisp_null();
+    Lisp defs = lisp_null();
+    capture_scan_(x, &refs, &defs, ctx);
+    capture_annotate_r_(x, NULL, 0, ctx);
+}
+
+Lisp lisp_macroexpand(Lisp lisp, LispError* out_error, LispContext ctx)
+{
+    jmp_buf error_jmp;
+    LispError error = setjmp(error_jmp);
+
+    if (error == LISP_ERROR_NONE)
+    {
+        Lisp result = expand_r(lisp, error_jmp, ctx);
+        capture_annotate_(result, ctx);
+        *out_error = error;
+        return result;
+    }
+    else
+    {
+        hook_error_(error, ctx);
+        *out_error = error;
+        return lisp_null();
+    }
+}
+
+Lisp lisp_eval2(Lisp l, Lisp env, LispError* out_error, LispContext ctx)
+{
+    LispError error;
+    Lisp expanded = lisp_macroexpand(l, &error, ctx);
+
+    if (error != LISP_ERROR_NONE)
+    {
+        if (out_error) *out_error = error;
+        return lisp_null();
+    }
+
+    return lisp_eval_expanded(expanded, env, out_error, ctx);
+}
+
+Lisp lisp_eval_expanded(Lisp expanded, Lisp env, LispError* out_error, LispContext ctx)
+{
+    size_t save_stack = ctx.p->stack_ptr;
+    size_t save_call_depth = ctx.p->call_depth;
+    jmp_buf* save_error_jmp = ctx.p->error_jmp;
+    Escape* save_escapes = ctx.p->escapes;
+
+    jmp_buf error_jmp;
+    LispError error = setjmp(error_jmp);
+
+    if (error == LISP_ERROR_NONE)
+    {
+        ctx.p->error_jmp = &error_jmp;
+        lisp_stack_push(env, ctx);
+        lisp_stack_push(expanded, ctx);
+
+        Lisp result = eval_r(error_jmp, ctx);
+
+        lisp_stack_pop(ctx);
+        lisp_stack_pop(ctx);
+        ctx.p->error_jmp = save_error_jmp;
+
+        if (out_error)
+        {
+            *out_error = error;
+        }
+
+        return result;
+    }
+    else
+    {
+        ctx.p->error_jmp = save_error_jmp;
+        ctx.p->escapes = save_escapes;
+        ctx.p->call_depth = save_call_depth;
+        hook_error_(error, ctx);
+        if (out_error)
+        {
+            ctx.p->stack_ptr = save_stack;
+            *out_error = error;
+        }
+
+        return lisp_null();
+    }
+}
+
+Lisp lisp_eval(Lisp expr, LispError* out_error, LispContext ctx)
+{
+    return lisp_eval2(expr, lisp_env(ctx), out_error, ctx);
+}
+
+Lisp lisp_apply(Lisp operator, Lisp args, LispError* out_error, LispContext ctx)
+{
+    // TODO: argument passing is a little more sophisitaed
+    // No environment required. procedures always bring their own enviornment
+    // to the call.
+    Lisp x;
+    Lisp env;
+    size_t call_depth = ctx.p->call_depth;
+    if (ctx.p->tracing) trace_enter_(operator, lisp_null(), call_depth, ctx);
+
+    int needs_to_eval = apply(operator, args, &x, &env, out_error, ctx);
+    // lambda bodies are expanded when the lambda is evaluated.
+    if (*out_error != LISP_ERROR_NONE)
+        x = lisp_false();
+    else if (needs_to_eval)
+        x = lisp_eval_expanded(x, env, out_error, ctx);
+
+#ifndef LISP_NO_HOOKS
+    if (ctx.p->call_depth > call_depth && *out_error == LISP_ERROR_NONE && ctx.p->hooks.exit)
+        ctx.p->hooks.exit(ctx.p->hooks.user);
+#endif
+    ctx.p->call_depth = call_depth;
+    return x;
+}
+
+Lisp lisp_force(Lisp p, LispError* out_error, LispContext ctx)
+{
+    *out_error = LISP_ERROR_NONE;
+    if (lisp_type(p) != LISP_PROMISE) return p;
+
+    const Promise* promise = promise_get_(p);
+    if (promise->block.d.promise.cached) return promise_body_or_val_(p);
+
+    // kept on the stack in case the computation collects.
+    lisp_stack_push(p, ctx);
+
+    Lisp x;
+    if (promise->block.d.promise.delayed)
+    {
+        Lisp env = { promise->env, promise->env.ptr_val == NULL ? LISP_NULL : LISP_PAIR };
+        x = lisp_eval_expanded(promise_body_or_val_(p), env, out_error, ctx);
+    }
+    else
+    {
+        x = lisp_apply(promise_body_or_val_(p), lisp_null(), out_error, ctx);
+    }
+
+    p = lisp_stack_pop(ctx);
+    if (*out_error != LISP_ERROR_NONE) return lisp_null();
+
+    // the computation may have forced it already.
+    if (!lisp_promise_forced(p)) lisp_promise_store(p, x);
+    return lisp_promise_val(p);
+}
+
+void lisp_set_heap_limit(size_t bytes, LispContext ctx)
+{
+    ctx.p->heap_limit = bytes == 0 ? SIZE_MAX : bytes;
+}
+
+void lisp_set_fuel(size_t steps, LispContext ctx)
+{
+    ctx.p->fuel = (steps == 0 || steps > INT64_MAX) ? INT64_MAX : (int64_t)steps;
+}
+
+size_t lisp_fuel(LispContext ctx)
+{
+    return ctx.p->fuel < 0 ? 0 : (size_t)ctx.p->fuel;
+}
+
+#ifndef LISP_NO_RESUME
+
+#ifndef LISP_TASK_STACK_SIZE
+#define LISP_TASK_STACK_SIZE (8 * 1024 * 1024)
+#endif
+
+typedef struct LispTask
+{
+    ucontext_t host;
+    ucontext_t eval;
+    char* stack;
+
+    // the error handlers and escapes of each side are swapped with the stacks.
+    jmp_buf* host_error_jmp;
+    jmp_buf* eval_error_jmp;
+    Escape* host_escapes;
+    Escape* eval_escapes;
+    size_t host_stack_ptr;
+
+    Lisp expanded;
+    Lisp env;
+    Lisp result;
+    LispError error;
+    int done;
+} LispTask;
+
+static void task_entry_(unsigned int high, unsigned int low)
+{
+    // makecontext only passes ints
+    LispContext ctx;
+    ctx.p = (struct LispImpl*)(uintptr_t)(((uint64_t)high << 32) | low);
+
+    LispTask* task = ctx.p->task;
+    task->result = lisp_eval_expanded(task->expanded, task->env, &task->error, ctx);
+    task->done = 1;
+    // returns to the host through uc_link
+}
+
+static void task_yield_(LispContext ctx)
+{
+    LispTask* task = ctx.p->task;
+    task->eval_error_jmp = ctx.p->error_jmp;
+    ctx.p->error_jmp = task->host_error_jmp;
+    task->eval_escapes = ctx.p->escapes;
+    ctx.p->escapes = task->host_escapes;
+    swapcontext(&task->eval, &task->host);
+}
+
+static void task_destroy_(LispTask* task)
+{
+    free(task->stack);
+    free(task);
+}
+
+Lisp lisp_resume(LispError* out_error, LispContext ctx)
+{
+    LispTask* task = ctx.p->task;
+    LispError error = LISP_ERROR_RUNTIME;
+    Lisp result = lisp_null();
+
+    if (task)
+    {
+        task->host_error_jmp = ctx.p->error_jmp;
+        ctx.p->error_jmp = task->eval_error_jmp;
+        task->host_escapes = ctx.p->escapes;
+        ctx.p->escapes = task->eval_escapes;
+        swapcontext(&task->host, &task->eval);
+
+        if (task->done)
+        {
+            ctx.p->error_jmp = task->host_error_jmp;
+            ctx.p->escapes = task->host_escapes;
+            result = task->result;
+            error = task->error;
+            task_destroy_(task);
+            ctx.p->task = NULL;
+        }
+        else
+        {
+            error = LISP_ERROR_OUT_OF_FUEL;
+        }
+    }
+
+    if (out_error) *out_error = error;
+    return result;
+}
+
+Lisp lisp_eval_resumable(Lisp expanded, Lisp env, LispError* out_error, LispContext ctx)
+{
+    if (ctx.p->task)
+    {
+        // one at a time
+        if (out_error) *out_error = LISP_ERROR_RUNTIME;
+        return lisp_null();
+    }
+
+    LispTask* task = calloc(1, sizeof(LispTask));
+    task->stack = malloc(LISP_TASK_STACK_SIZE);
+    task->expanded = expanded;
+    task->env = env;
+    task->host_stack_ptr = ctx.p->stack_ptr;
+
+    getcontext(&task->eval);
+    task->eval.uc_stack.ss_sp = task->stack;
+    task->eval.uc_stack.ss_size = LISP_TASK_STACK_SIZE;
+    task->eval.uc_link = &task->host;
+
+    uint64_t address = (uint64_t)(uintptr_t)ctx.p;
+    makecontext(&task->eval, (void (*)(void))task_entry_, 2, (unsigned int)(address >> 32), (unsigned int)address);
+
+    ctx.p->task = task;
+    return lisp_resume(out_error, ctx);
+}
+
+void lisp_cancel(LispContext ctx)
+{
+    LispTask* task = ctx.p->task;
+    if (!task) return;
+
+    ctx.p->stack_ptr = task->host_stack_ptr;
+    task_destroy_(task);
+    ctx.p->task = NULL;
+}
+
+#else
+
+Lisp lisp_eval_resumable(Lisp expanded, Lisp env, LispError* out_error, LispContext ctx)
+{
+    return lisp_eval_expanded(expanded, env, out_error, ctx);
+}
+
+Lisp lisp_resume(LispError* out_error, LispContext ctx)
+{
+    if (out_error) *out_error = LISP_ERROR_RUNTIME;
+    return lisp_null();
+}
+
+void lisp_cancel(LispContext ctx) {}
+
+#endif
+
+/* Profiler.
+ eval_r keeps a stack of the procedures it is applying.
+ A frame's entry is replaced when it makes a tail call, and dropped when it returns.
+ SIGPROF copies the stack into a buffer of samples, which are summarized afterwards,
+ so the handler never allocates or reads the heap. */
+
+#ifndef LISP_PROFILE_BUFFER
+// ints of samples. Each sample takes its depth + 1.
+#define LISP_PROFILE_BUFFER (4 * 1024 * 1024)
+#endif
+
+typedef struct
+{
+    char* name;
+    size_t calls;
+    size_t allocated;
+} ProfileProc;
+
+typedef struct
+{
+    const void* key;
+    int proc;
+} ProfileKey;
+
+typedef struct Profile
+{
+    int interval;
+
+    ProfileProc* procs;
+    int proc_count;
+    int proc_capacity;
+    // procedures by name (open addressing, -1 is empty).
+    int* names;
+    int names_capacity;
+    // procedures by the address of their symbol or lambda body.
+    // Addresses change when collected, so it is emptied then.
+    ProfileKey* keys;
+    int keys_count;
+    int keys_capacity;
+
+    // procedures being applied, by call depth (-1 is unnamed).
+    // Those below base_depth were entered before the profile started.
+    volatile int* stack;
+    size_t stack_capacity;
+    size_t base_depth;
+
+    int* samples;
+    volatile size_t samples_size;
+    volatile size_t sample_count;
+    volatile size_t dropped;
+
+    LispContext ctx;
+#ifndef LISP_NO_THREADS
+    pthread_t thread;
+#endif
+} Profile;
+
+static void profile_destroy_(Profile* profile)
+{
+    if (!profile) return;
+    for (int i = 0; i < profile->proc_count; ++i) free(profile->procs[i].name);
+    free(profile->procs);
+    free(profile->names);
+    free(profile->keys);
+    free((void*)profile->stack);
+    free(profile->samples);
+    free(profile);
+}
+
+static void profile_forget_(Profile* profile)
+{
+    profile->keys_count = 0;
+    for (int i = 0; i < profile->keys_capacity; ++i) profile->keys[i].key = NULL;
+}
+
+static int profile_proc_named_(Profile* profile, const char* name)
+{
+    if (2 * profile->proc_count >= profile->names_capacity)
+    {
+        int capacity = profile->names_capacity * 2;
+        int* names = malloc(sizeof(int) * capacity);
+        for (int i = 0; i < capacity; ++i) names[i] = -1;
+
+        for (int i = 0; i < profile->proc_count; ++i)
+        {
+            const char* s = profile->procs[i].name;
+            uint32_t j = hash_bytes(s, strlen(s));
+            while (names[j & (capacity - 1)] != -1) ++j;
+            names[j & (capacity - 1)] = i;
+        }
+        free(profile->names);
+        profile->names = names;
+        profile->names_capacity = capacity;
+    }
+
+    uint32_t i = hash_bytes(name, strlen(name));
+    while (1)
+    {
+        i &= (profile->names_capacity - 1);
+        int proc = profile->names[i];
+        if (proc == -1) break;
+        if (strcmp(profile->procs[proc].name, name) == 0) return proc;
+        ++i;
+    }
+
+    if (profile->proc_count == profile->proc_capacity)
+    {
+        profile->proc_capacity *= 2;
+        profile->procs = realloc(profile->procs, sizeof(ProfileProc) * profile->proc_capacity);
+    }
+    int proc = profile->proc_count++;
+    profile->procs[proc].name = malloc(strlen(name) + 1);
+    strcpy(profile->procs[proc].name, name);
+    profile->procs[proc].calls = 0;
+    profile->procs[proc].allocated = 0;
+    profile->names[i] = proc;
+    return proc;
+}
+
+// Lambdas passed as values (to map, apply, ...) are usually defined globally.
+static Lisp profile_global_name_(Lisp lambda, LispContext ctx)
+{
+    for (Lisp env = lisp_env(ctx); lisp_is_pair(env); env = lisp_cdr(env))
+    {
+        const Table* table = table_get_(lisp_car(env));
+        Lisp keys = { table->keys, LISP_VECTOR };
+        Lisp vals = { table->vals, LISP_VECTOR };
+        for (int i = 0; i < table->capacity; ++i)
+        {
+            Lisp key = lisp_vector_ref(keys, i);
+            if (!lisp_is_null(key) && lisp_eq(lisp_vector_ref(vals, i), lambda)) return key;
+        }
+    }
+    return lisp_null();
+}
+
+// the others are named by their arguments.
+static void profile_lambda_name_(Lisp lambda, char* buffer, size_t n)
+{
+    size_t used = snprintf(buffer, n, "(lambda ");
+    Lisp args = lambda_args_(lambda);
+    if (lisp_type(args) == LISP_SYMBOL)
+    {
+        used += snprintf(buffer + used, n - used, "%s)", lisp_symbol_string(args));
+    }
+    else
+    {
+        const char* separator = "(";
+        while (lisp_is_pair(args) && used < n)
+        {
+            used += snprintf(buffer + used, n - used, "%s%s", separator, lisp_symbol_string(lisp_car(args)));
+            separator = " ";
+            args = lisp_cdr(args);
+        }
+        if (used < n && lisp_type(args) == LISP_SYMBOL)
+            used += snprintf(buffer + used, n - used, " . %s", lisp_symbol_string(args));
+        if (used < n)
+            snprintf(buffer + used, n - used, "%s))", lisp_is_null(lambda_args_(lambda)) ? "(" : "");
+    }
+}
+
+static int profile_proc_(Profile* profile, Lisp operator, Lisp operator_expr)
+{
+    Lisp key_val = operator_expr;
+    if (lisp_type(key_val) != LISP_SYMBOL)
+    {
+        if (lisp_type(operator) != LISP_LAMBDA) return -1;
+        key_val = lisp_lambda_body(operator);
+        if (lisp_type(key_val) != LISP_PAIR) key_val = operator;
+    }
+
+    const void* key = key_val.val.ptr_val;
+    uint32_t i = hash_uint64((uint64_t)(uintptr_t)key);
+    while (1)
+    {
+        i &= (profile->keys_capacity - 1);
+        if (profile->keys[i].key == key) return profile->keys[i].proc;
+        if (!profile->keys[i].key) break;
+        ++i;
+    }
+
+    Lisp symbol = key_val;
+    if (lisp_type(symbol) != LISP_SYMBOL) symbol = profile_global_name_(operator, profile->ctx);
+
+    int proc;
+    if (lisp_type(symbol) == LISP_SYMBOL)
+    {
+        proc = profile_proc_named_(profile, lisp_symbol_string(symbol));
+    }
+    else
+    {
+        char name[LISP_IDENTIFIER_MAX];
+        profile_lambda_name_(operator, name, sizeof(name));
+        proc = profile_proc_named_(profile, name);
+    }
+
+    // it's only a cache, so start over instead of growing.
+    if (2 * (profile->keys_count + 1) >= profile->keys_capacity)
+    {
+        profile_forget_(profile);
+        i = hash_uint64((uint64_t)(uintptr_t)key) & (profile->keys_capacity - 1);
+    }
+    profile->keys[i].key = key;
+    profile->keys[i].proc = proc;
+    ++profile->keys_count;
+    return proc;
+}
+
+static void profile_enter_(Lisp operator, Lisp operator_expr, size_t depth, LispContext ctx)
+{
+    Profile* profile = ctx.p->profile;
+    if (depth >= profile->stack_capacity) return;
+
+    int proc = profile_proc_(profile, operator, operator_expr);
+    if (proc != -1) ++profile->procs[proc].calls;
+    profile->stack[depth] = proc;
+}
+
+static void trace_enter_(Lisp operator, Lisp operator_expr, size_t base, LispContext ctx)
+{
+#ifndef LISP_NO_HOOKS
+    // a tail call returns from the caller first.
+    if (ctx.p->call_depth > base && ctx.p->hooks.exit) ctx.p->hooks.exit(ctx.p->hooks.user);
+    if (ctx.p->hooks.enter)
+    {
+        Lisp name = lisp_type(operator_expr) == LISP_SYMBOL ? operator_expr : lisp_null();
+        ctx.p->hooks.enter(ctx.p->hooks.user, operator, name);
+    }
+#endif
+    // the stack below is published before the depth, for the sampler.
+    if (ctx.p->profiling) profile_enter_(operator, operator_expr, base, ctx);
+    ctx.p->call_depth = base + 1;
+}
+
+// the innermost named procedure being applied, or -1.
+static int profile_top_(const Profile* profile, size_t depth)
+{
+    if (depth > profile->stack_capacity) depth = profile->stack_capacity;
+    while (depth > profile->base_depth)
+    {
+        int proc = profile->stack[--depth];
+        if (proc != -1) return proc;
+    }
+    return -1;
+}
+
+static void profile_alloc_(size_t bytes, LispContext ctx)
+{
+    Profile* profile = ctx.p->profile;
+    int proc = profile_top_(profile, ctx.p->call_depth);
+    if (proc != -1) profile->procs[proc].allocated += bytes;
+}
+
+#ifndef LISP_NO_SAMPLING
+
+static Profile* volatile profile_sampled_ = NULL;
+static struct sigaction profile_old_action_;
+static struct itimerval profile_old_timer_;
+
+static void profile_signal_(int sig)
+{
+    Profile* profile = profile_sampled_;
+    if (!profile) return;
+#ifndef LISP_NO_THREADS
+    // the collector's threads
+    if (!pthread_equal(pthread_self(), profile->thread)) return;
+#endif
+
+    size_t depth = profile->ctx.p->call_depth;
+    if (depth > profile->stack_capacity) depth = profile->stack_capacity;
+    if (depth < profile->base_depth) depth = profile->base_depth;
+
+    size_t size = profile->samples_size;
+    if (size + depth - profile->base_depth + 1 > LISP_PROFILE_BUFFER)
+    {
+        ++profile->dropped;
+        return;
+    }
+
+    int* sample = profile->samples + size;
+    int n = 0;
+    for (size_t i = profile->base_depth; i < depth; ++i)
+    {
+        int proc = profile->stack[i];
+        if (proc != -1) sample[++n] = proc;
+    }
+    sample[0] = n;
+    profile->samples_size = size + n + 1;
+    ++profile->sample_count;
+}
+
+#endif
+
+void lisp_profile_start(int interval, LispContext ctx)
+{
+    lisp_profile_stop(ctx);
+    profile_destroy_(ctx.p->profile);
+
+    Profile* profile = calloc(1, sizeof(Profile));
+    profile->interval = interval < 1 ? 1 : interval;
+    profile->ctx = ctx;
+    profile->proc_capacity = 64;
+    profile->procs = malloc(sizeof(ProfileProc) * profile->proc_capacity);
+    profile->names_capacity = 128;
+    profile->names = malloc(sizeof(int) * profile->names_capacity);
+    for (int i = 0; i < profile->names_capacity; ++i) profile->names[i] = -1;
+    profile->keys_capacity = 4096;
+    profile->keys = calloc(profile->keys_capacity, sizeof(ProfileKey));
+    // each frame of eval_r adds at most one, and lisp_apply another.
+    profile->base_depth = ctx.p->call_depth;
+    profile->stack_capacity = profile->base_depth + ctx.p->stack_depth;
+    profile->stack = malloc(sizeof(int) * profile->stack_capacity);
+
+    ctx.p->profile = profile;
+    ctx.p->profiling = 1;
+    trace_update_(ctx);
+
+#ifndef LISP_NO_SAMPLING
+    if (profile_sampled_) return;
+
+    profile->samples = malloc(sizeof(int) * LISP_PROFILE_BUFFER);
+#ifndef LISP_NO_THREADS
+    profile->thread = pthread_self();
+#endif
+    profile_sampled_ = profile;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = profile_signal_;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, &profile_old_action_);
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = profile->interval / 1000000;
+    timer.it_interval.tv_usec = profile->interval % 1000000;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, &profile_old_timer_);
+#endif
+}
+
+void lisp_profile_stop(LispContext ctx)
+{
+    if (!ctx.p->profiling) return;
+
+    ctx.p->profiling = 0;
+    trace_update_(ctx);
+
+#ifndef LISP_NO_SAMPLING
+    if (profile_sampled_ == ctx.p->profile)
+    {
+        setitimer(ITIMER_PROF, &profile_old_timer_, NULL);
+        sigaction(SIGPROF, &profile_old_action_, NULL);
+        profile_sampled_ = NULL;
+    }
+#endif
+}
+
+typedef struct
+{
+    int proc;
+    size_t calls;
+    size_t self;
+    size_t total;
+} ProfileRow;
+
+static int profile_row_compare_(const void* a, const void* b)
+{
+    const ProfileRow* x = a;
+    const ProfileRow* y = b;
+    if (x->self != y->self) return x->self < y->self ? 1 : -1;
+    if (x->total != y->total) return x->total < y->total ? 1 : -1;
+    return x->calls < y->calls ? 1 : (x->calls > y->calls ? -1 : 0);
+}
+
+void lisp_profile_print(FILE* file, LispContext ctx)
+{
+    const Profile* profile = ctx.p->profile;
+    if (!profile) return;
+
+    int n = profile->proc_count;
+    ProfileRow* rows = calloc(n + 1, sizeof(ProfileRow));
+    // the last sample each procedure was counted in, so recursion counts once.
+    size_t* seen = calloc(n + 1, sizeof(size_t));
+    for (int i = 0; i < n; ++i)
+    {
+        rows[i].proc = i;
+        rows[i].calls = profile->procs[i].calls;
+    }
+
+    size_t offset = 0;
+    for (size_t s = 1; offset < profile->samples_size; ++s)
+    {
+        const int* sample = profile->samples + offset;
+        int depth = sample[0];
+        if (depth > 0) ++rows[sample[depth]].self;
+        for (int i = 1; i <= depth; ++i)
+        {
+            int proc = sample[i];
+            if (seen[proc] != s)
+            {
+                seen[proc] = s;
+                ++rows[proc].total;
+            }
+        }
+        offset += depth + 1;
+    }
+    qsort(rows, n, sizeof(ProfileRow), profile_row_compare_);
+
+    double ms = profile->interval / 1000.0;
+    fprintf(file, "profile: %lu samples every %d us", (size_t)profile->sample_count, profile->interval);
+    if (profile->dropped > 0) fprintf(file, " (%lu dropped)", (size_t)profile->dropped);
+    fprintf(file, "\n%10s %10s %10s %10s  %s\n", "calls", "self ms", "total ms", "alloc KB", "procedure");
+    for (int i = 0; i < n; ++i)
+    {
+        const ProfileRow* row = rows + i;
+        fprintf(file, "%10lu %10.1f %10.1f %10lu  %s\n",
+                row->calls,
+                row->self * ms,
+                row->total * ms,
+                profile->procs[row->proc].allocated / 1024,
+                profile->procs[row->proc].name);
+    }
+
+    free(seen);
+    free(rows);
+}
+
+static int profile_sample_compare_(const void* a, const void* b)
+{
+    const int* x = *(const int**)a;
+    const int* y = *(const int**)b;
+    int n = x[0] < y[0] ? x[0] : y[0];
+    for (int i = 1; i <= n; ++i)
+    {
+        if (x[i] != y[i]) return x[i] - y[i];
+    }
+    return x[0] - y[0];
+}
+
+void lisp_profile_write_folded(FILE* file, LispContext ctx)
+{
+    const Profile* profile = ctx.p->profile;
+    if (!profile || profile->sample_count == 0) return;
+
+    // sort so that equal stacks are next to each other.
+    const int** samples = malloc(sizeof(int*) * profile->sample_count);
+    size_t count = 0;
+    size_t offset = 0;
+    while (offset < profile->samples_size)
+    {
+        const int* sample = profile->samples + offset;
+        // the top level isn't in a procedure.
+        if (sample[0] > 0) samples[count++] = sample;
+        offset += sample[0] + 1;
+    }
+    qsort(samples, count, sizeof(int*), profile_sample_compare_);
+
+    size_t i = 0;
+    while (i < count)
+    {
+        size_t j = i + 1;
+        while (j < count && profile_sample_compare_(samples + i, samples + j) == 0) ++j;
+
+        const int* sample = samples[i];
+        for (int k = 1; k <= sample[0]; ++k)
+        {
+            if (k > 1) fputc(';', file);
+            fputs(profile->procs[sample[k]].name, file);
+        }
+        fprintf(file, " %lu\n", j - i);
+        i = j;
+    }
+    free(samples);
+}
+
+// A collector thread's state.
+// The serial collector uses a single worker with no group.
+typedef struct GcWorker
+{
+    Heap* to;
+    Heap* from;
+    LispContext ctx;
+    struct GcGroup* group;
+    // when ending an arena, its depth. Only blocks in it are moved.
+    size_t arena;
+    // bytes copied (or kept in place), by type.
+    size_t live_bytes[LISP_TYPE_COUNT];
+
+#ifndef LISP_NO_THREADS
+    Heap heap;
+
+    // copied blocks which still need to be scanned.
+    // The local stack is private. The shared stack can be stolen from by other workers.
+    Block** local;
+    size_t local_size;
+    size_t local_capacity;
+
+    pthread_mutex_t lock;
+    Block** shared;
+    size_t shared_size;
+    size_t shared_capacity;
+#endif
+} GcWorker;
+
+static void gc_scan_(Block* block, GcWorker* w);
+
+static void gc_count_live_(const Block* block, GcWorker* w)
+{
+    w->live_bytes[block->type] += block->info.size;
+}
+
+// The collector makes new tables as it moves them.
+// Those are counted as surviving, not as allocated.
+static void gc_count_remade_(LispType type, size_t count, size_t bytes, GcWorker* w)
+{
+    LispHeapStats* stats = &w->ctx.p->stats;
+    w->live_bytes[type] += stats->allocated_bytes[type] - bytes;
+    stats->allocated_count[type] = count;
+    stats->allocated_bytes[type] = bytes;
+}
+
+static void gc_census_add_(const GcWorker* w, LispContext ctx)
+{
+    for (int i = 0; i < LISP_TYPE_COUNT; ++i)
+        ctx.p->stats.live_bytes[i] += w->live_bytes[i];
+}
+
+#ifndef LISP_NO_THREADS
+
+typedef struct GcGroup
+{
+    GcWorker* workers;
+    int count;
+    int idle;
+
+    // the large pages of the old heap are shared.
+    pthread_mutex_t large_lock;
+
+    // tables need to allocate while they are scanned,
+    // so they are deferred to the main thread.
+    pthread_mutex_t tables_lock;
+    Block** tables;
+    size_t tables_size;
+    size_t tables_capacity;
+} GcGroup;
+
+// Blocks are shared with other workers in batches.
+#define GC_BATCH 64
+
+static void gc_reserve_(Block*** items, size_t* capacity, size_t n)
+{
+    if (n <= *capacity) return;
+    while (*capacity < n) *capacity = *capacity ? *capacity * 2 : 256;
+    *items = realloc(*items, sizeof(Block*) * *capacity);
+}
+
+static void gc_push_(GcWorker* w, Block* block)
+{
+    gc_reserve_(&w->local, &w->local_capacity, w->local_size + 1);
+    w->local[w->local_size++] = block;
+
+    // give the oldest work away if others might need it.
+    if (w->local_size >= 2 * GC_BATCH && __atomic_load_n(&w->shared_size, __ATOMIC_RELAXED) == 0)
+    {
+        pthread_mutex_lock(&w->lock);
+        gc_reserve_(&w->shared, &w->shared_capacity, w->shared_size + GC_BATCH);
+        memcpy(w->shared + w->shared_size, w->local, sizeof(Block*) * GC_BATCH);
+        __atomic_store_n(&w->shared_size, w->shared_size + GC_BATCH, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&w->lock);
+
+        w->local_size -= GC_BATCH;
+        memmove(w->local, w->local + GC_BATCH, sizeof(Block*) * w->local_size);
+    }
+}
+
+// Move up to half of the victim's shared work to w's local stack.
+static int gc_take_(GcWorker* w, GcWorker* victim)
+{
+    if (__atomic_load_n(&victim->shared_size, __ATOMIC_RELAXED) == 0) return 0;
+
+    pthread_mutex_lock(&victim->lock);
+    size_t n = victim->shared_size;
+    if (victim != w) n = (n + 1) / 2;
+    if (n == 0)
+    {
+        pthread_mutex_unlock(&victim->lock);
+        return 0;
+    }
+
+    gc_reserve_(&w->local, &w->local_capacity, w->local_size + n);
+    size_t rest = victim->shared_size - n;
+    memcpy(w->local + w->local_size, victim->shared + rest, sizeof(Block*) * n);
+    w->local_size += n;
+    __atomic_store_n(&victim->shared_size, rest, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&victim->lock);
+    return n > 0;
+}
+
+static Block* gc_pop_(GcWorker* w)
+{
+    GcGroup* g = w->group;
+    if (w->local_size == 0 && !gc_take_(w, w))
+    {
+        int self = (int)(w - g->workers);
+        int i;
+        for (i = 1; i < g->count; ++i)
+        {
+            if (gc_take_(w, g->workers + (self + i) % g->count)) break;
+        }
+        if (i == g->count) return NULL;
+    }
+    return w->local[--w->local_size];
+}
+
+static int gc_has_shared_work_(GcGroup* g)
+{
+    for (int i = 0; i < g->count; ++i)
+    {
+        if (__atomic_load_n(&g->workers[i].shared_size, __ATOMIC_RELAXED) > 0) return 1;
+    }
+    return 0;
+}
+
+static void* gc_drain_(void* arg)
+{
+    GcWorker* w = arg;
+    GcGroup* g = w->group;
+    while (1)
+    {
+        Block* block = gc_pop_(w);
+        if (block)
+        {
+            gc_scan_(block, w);
+            continue;
+        }
+
+        // A worker only becomes idle once its own work is gone, and only workers
+        // which aren't idle add work. So when every worker is idle, the scan is finished.
+        __atomic_add_fetch(&g->idle, 1, __ATOMIC_SEQ_CST);
+        while (1)
+        {
+            if (__atomic_load_n(&g->idle, __ATOMIC_SEQ_CST) == g->count) return NULL;
+            if (gc_has_shared_work_(g))
+            {
+                __atomic_sub_fetch(&g->idle, 1, __ATOMIC_SEQ_CST);
+                break;
+            }
+            sched_yield();
+        }
+    }
+}
+
+// Queue a block in the new heap to be scanned.
+static void gc_enqueue_parallel_(Block* block, GcWorker* w)
+{
+    switch (block->type)
+    {
+        case LISP_TABLE:
+            pthread_mutex_lock(&w->group->tables_lock);
+            gc_reserve_(&w->group->tables, &w->group->tables_capacity, w->group->tables_size + 1);
+            w->group->tables[w->group->tables_size++] = block;
+            pthread_mutex_unlock(&w->group->tables_lock);
+            break;
+        case LISP_PAIR:
+        case LISP_VECTOR:
+        case LISP_RECORD:
+        case LISP_LAMBDA:
+        case LISP_PROMISE:
+            gc_push_(w, block);
+            break;
+        default:
+            // no references
+            break;
+    }
+}
+
+static Block* gc_move_parallel_(Block* block, GcWorker* w)
+{
+    // The first worker to claim the block copies it.
+    // Others wait for the forwarding address.
+    uint8_t expected = GC_CLEAR;
+    if (__atomic_compare_exchange_n(&block->gc_state, &expected, GC_BUSY, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+    {
+        size_t size = block->info.size;
+        Block* dest = heap_alloc(size, block->type, w->to);
+        gc_count_live_(block, w);
+
+        // other workers may be reading gc_state, so copy around it.
+        const size_t state = offsetof(Block, gc_state);
+        const size_t after = state + sizeof(block->gc_state);
+        memcpy(dest, block, state);
+        memcpy((char*)dest + after, (char*)block + after, size - after);
+        dest->gc_state = GC_CLEAR;
+
+        block->info.forward = dest;
+        __atomic_store_n(&block->gc_state, GC_GONE, __ATOMIC_RELEASE);
+
+        gc_enqueue_parallel_(dest, w);
+        return dest;
+    }
+
+    while (__atomic_load_n(&block->gc_state, __ATOMIC_ACQUIRE) != GC_GONE) {}
+    return block->info.forward;
+}
+
+#endif
+
+static void gc_keep_large_(Block* block, GcWorker* w)
+{
+    // The page is moved to the new heap by whoever reaches it first.
+    Page* page = large_page_of_(block);
+#ifndef LISP_NO_THREADS
+    if (w->group)
+    {
+        size_t expected = 1;
+        if (!__atomic_compare_exchange_n(&page->from_space, &expected, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return;
+
+        pthread_mutex_lock(&w->group->large_lock);
+        heap_remove_large_(w->from, page);
+        pthread_mutex_unlock(&w->group->large_lock);
+
+        heap_push_large_(w->to, page);
+        w->to->size += block->info.size;
+        gc_count_live_(block, w);
+        gc_enqueue_parallel_(block, w);
+        return;
+    }
+#endif
+    if (!page->from_space) return;
+    page->from_space = 0;
+
+    heap_remove_large_(w->from, page);
+    heap_push_large_(w->to, page);
+    w->to->size += block->info.size;
+    gc_count_live_(block, w);
+    block->gc_state = GC_NEED_VISIT;
+}
+
+static Lisp gc_move(Lisp x, GcWorker* w)
+{
+    switch (x.type)
+    {
+        case LISP_PAIR:
+        case LISP_STRING:
+        case LISP_LAMBDA:
+        case LISP_VECTOR:
+        case LISP_PROMISE:
+        case LISP_TABLE:
+        case LISP_SYMBOL:
+        case LISP_F64VECTOR:
+        case LISP_S64VECTOR:
+        case LISP_BYTEVECTOR:
+        case LISP_JUMP:
+        case LISP_RECORD:
+        {
+            Block* block = x.val.ptr_val;
+            if (w->arena && block_page_(block)->arena < w->arena) return x;
+            if (block->large)
+            {
+                gc_keep_large_(block, w);
+                return x;
+            }
+#ifndef LISP_NO_THREADS
+            if (w->group)
+            {
+                x.val.ptr_val = gc_move_parallel_(block, w);
+                return x;
+            }
+#endif
+            if (block->gc_state == GC_CLEAR)
+            {
+                // copy the data to new block
+                Block* dest = heap_alloc(block->info.size, block->type, w->to);
+                memcpy(dest, block, block->info.size);
+                dest->gc_state = GC_NEED_VISIT;
+                gc_count_live_(block, w);
+
+                // save forwarding address (offset in to)
+                block->info.forward = dest;
+                block->gc_state = GC_GONE;
+            }
+
+            assert(block->gc_state == GC_GONE);
+
+            // return the moved block address
+            x.val.ptr_val = block->info.forward;
+            return x;
+        }
+        default:
+            return x;
+    }
+}
+
+static LispVal gc_move_val(LispVal val, LispType type, GcWorker* w)
+{
+    return gc_move( (Lisp) { val, type}, w).val;
+}
+
+static void gc_move_v(Lisp* start, int n, GcWorker* w)
+{
+    for (int i = 0; i < n; ++i) start[i] = gc_move(start[i], w);
+}
+
+static void gc_scan_table_(Block* block, GcWorker* w)
+{
+    // During garbage collection all pointers change INCLUDING symbols,
+    // so that means if a symbol pointer is being used as a key, it is no
+    // longer in the correct place in the hash table.
+    // So we have to move it to a new place during garbage collection.
+    Lisp table;
+    table.val.ptr_val = block;
+    table.type = LISP_TABLE;
+
+    Table* t = (Table*)block;
+    int n = t->capacity;
+
+    Lisp keys = { t->keys, LISP_VECTOR };
+    Lisp vals = { t->vals, LISP_VECTOR };
+
+    for (int i = 0; i < n; ++i)
+    {
+        // move all the values, but borrow the old table for now.
+        Lisp key = lisp_vector_ref(keys, i);
+        if (!lisp_is_null(key))
+        {
+            vector_set_(keys, i, gc_move(key, w));
+            vector_set_(vals, i, gc_move(lisp_vector_ref(vals, i), w));
+        }
+    }
+    // create new table and move the values in place.
+    size_t count = w->ctx.p->stats.allocated_count[LISP_VECTOR];
+    size_t bytes = w->ctx.p->stats.allocated_bytes[LISP_VECTOR];
+    table_grow_(table, n, w->ctx);
+    gc_count_remade_(LISP_VECTOR, count, bytes, w);
+}
+
+static void gc_scan_entries_(Vector* v, int start, int end, GcWorker* w)
+{
+    const char* types = vector_types_(v);
+    for (int i = start; i < end; ++i)
+        v->entries[i] = gc_move_val(v->entries[i], (LispType)types[i], w);
+}
+
+// Move the references held by a copied block.
+static void gc_scan_(Block* block, GcWorker* w)
+{
+    switch (block->type)
+    {
+        // these add &to the buffer!
+        // so lists are handled in a single pass
+        case LISP_PAIR:
+        {
+            // move the CAR and CDR
+            Pair* p = (Pair*)block;
+            p->car = gc_move_val(p->car, p->block.d.pair.car_type, w);
+            p->cdr = gc_move_val(p->cdr, p->block.d.pair.cdr_type, w);
+            break;
+        }
+        case LISP_VECTOR:
+        case LISP_RECORD:
+        {
+            Vector* v = (Vector*)block;
+            gc_scan_entries_(v, 0, vector_len_(v), w);
+            break;
+        }
+        case LISP_LAMBDA:
+        {
+            // move the body and args
+            Lambda* l = (Lambda*)block;
+            l->args = gc_move_val(l->args, (LispType)l->block.d.lambda.args_type, w);
+            l->body = gc_move_val(l->body, (LispType)l->block.d.lambda.body_type, w);
+            l->env = gc_move_val(l->env, l->env.ptr_val == NULL ? LISP_NULL : LISP_PAIR, w);
+            break;
+        }
+        case LISP_PROMISE:
+        {
+            Promise* p = (Promise*)block;
+            p->val_or_proc = gc_move_val(p->val_or_proc, (LispType)p->block.d.promise.type, w);
+            p->env = gc_move_val(p->env, p->env.ptr_val == NULL ? LISP_NULL : LISP_PAIR, w);
+            break;
+        }
+        case LISP_TABLE:
+            gc_scan_table_(block, w);
+            break;
+        default: break;
+    }
+}
+
+static int gc_in_from_space_(const Block* block)
+{
+    if (block->large) return (int)large_page_of_(block)->from_space;
+#ifdef LISP_GC_INCREMENTAL
+    return (int)page_of_(block)->from_space;
+#else
+    (void)block;
+    return 1;
+#endif
+}
+
+static Lisp gc_move_weak_symbols(Lisp old_table, GcWorker* w)
+{
+    LispContext ctx = w->ctx;
+
+    // move symbol table (weak references)
+    Table* from = table_get_(old_table);
+    size_t table_count = ctx.p->stats.allocated_count[LISP_TABLE];
+    size_t table_bytes = ctx.p->stats.allocated_bytes[LISP_TABLE];
+    size_t vector_count = ctx.p->stats.allocated_count[LISP_VECTOR];
+    size_t vector_bytes = ctx.p->stats.allocated_bytes[LISP_VECTOR];
+    Lisp to_table = lisp_make_table(ctx);
+    // preallocate
+    int cap = from->capacity;
+    table_grow_(to_table, cap, ctx);
+
+    Lisp hashes = { from->keys, LISP_VECTOR };
+    Lisp symbols = { from->vals, LISP_VECTOR };
+
+    for (int i = 0; i < cap; ++i)
+    {
+        Lisp hash = lisp_vector_ref(hashes, i);
+        if (!lisp_is_null(hash))
+        {
+            Lisp old_symbol = lisp_vector_ref(symbols, i);
+            while (old_symbol.val.ptr_val != NULL)
+            {
+                const Block* block = old_symbol.val.ptr_val;
+                // symbols made during an incremental collection are already in the new heap.
+                if (block->gc_state == GC_GONE || !gc_in_from_space_(block))
+                {
+                    Lisp to_insert = block->gc_state == GC_GONE ? gc_move(old_symbol, w) : old_symbol;
+                    int present;
+                    Lisp existing = lisp_table_get(to_table, hash, &present);
+                    symbol_get_(to_insert)->next = existing.val;
+                    lisp_table_set(to_table, hash, to_insert, ctx);
+                }
+                else
+                {
+#ifdef LISP_DEBUG
+                    //printf("losing symbol: %s\n", lisp_symbol_string(old_symbol));
+#endif
+                }
+                old_symbol.val = symbol_get_(old_symbol)->next;
             }
-            default:
-               return *x; // atom
         }
     }
+    gc_count_remade_(LISP_TABLE, table_count, table_bytes, w);
+    gc_count_remade_(LISP_VECTOR, vector_count, vector_bytes, w);
+    return to_table;
 }
 
-static Lisp expand_quasi_r(Lisp l, jmp_buf error_jmp, LispContext ctx)
+static void gc_visit_(Block* block, GcWorker* w)
 {
-    if (lisp_type(l) != LISP_PAIR)
+    if (block->gc_state == GC_NEED_VISIT)
     {
-        Lisp terms[] = { get_sym(SYM_QUOTE, ctx), l };
-        return lisp_make_list2(terms, 2, ctx);
+        // clear first, so the block doesn't trip the read barrier while it's scanned.
+        block->gc_state = GC_CLEAR;
+        gc_scan_(block, w);
     }
+}
 
-    Lisp op = lisp_car(l);
-    int op_valid = lisp_type(op) == LISP_SYMBOL;
-
-    if (lisp_eq(op, get_sym(SYM_UNQUOTE, ctx)) && op_valid)
-    {
-        return lisp_car(lisp_cdr(l));
-    }
-    else if (lisp_eq(op, get_sym(SYM_UNQUOTE_SPLICE, ctx)) && op_valid)
+// Scans the blocks copied from page and offset on,
+// and the large pages in front of large_scanned.
+static void gc_scan_from_(GcWorker* w, const Page* page, size_t offset, Page* large_scanned)
+{
+    // large pages are added to the front of the list,
+    // so everything from large_scanned on has been scanned.
+    while (1)
     {
-        fprintf(ctx.p->err_port, "slicing ,@ must be in a backquoted list.\n");
-        longjmp(error_jmp, LISP_ERROR_FORM_SYNTAX);
+        while (offset < page->size)
+        {
+            Block* block = (Block*)(page->buffer + offset);
+            gc_visit_(block, w);
+            offset += block->info.size;
+        }
+        if (page->next)
+        {
+            page = page->next;
+            offset = 0;
+            continue;
+        }
+
+        Page* large = w->to->large;
+        if (large == large_scanned) break;
+        for (Page* it = large; it != large_scanned; it = it->next)
+            gc_visit_((Block*)it->buffer, w);
+        large_scanned = large;
     }
-    else
+}
+
+#ifndef LISP_NO_THREADS
+
+static void gc_scan_parallel_(GcGroup* g)
+{
+    pthread_t* threads = malloc(sizeof(pthread_t) * g->count);
+    GcWorker* main_worker = g->workers;
+
+    while (1)
     {
-        Lisp terms[] = {
-            get_sym(SYM_CONS, ctx),
-            expand_quasi_r(lisp_car(l), error_jmp, ctx),
-            expand_quasi_r(lisp_cdr(l), error_jmp, ctx),
-        };
-        return lisp_make_list2(terms, 3, ctx);
+        g->idle = 0;
+        for (int i = 1; i < g->count; ++i)
+            pthread_create(threads + i, NULL, gc_drain_, g->workers + i);
+        gc_drain_(main_worker);
+        for (int i = 1; i < g->count; ++i)
+            pthread_join(threads[i], NULL);
+
+        if (g->tables_size == 0) break;
+
+        // may produce more work for the next round.
+        while (g->tables_size > 0)
+            gc_scan_table_(g->tables[--g->tables_size], main_worker);
     }
+    free(threads);
 }
 
-static Lisp expand_r(Lisp l, jmp_buf error_jmp, LispContext ctx)
+static void gc_group_init_(GcGroup* g, int count, Heap* from, LispContext ctx)
 {
-    if (lisp_type(l) != LISP_PAIR) return l;
-
-    // 1. expand extended syntax into primitive syntax
-    // 2. perform optimizations
-    // 3. check syntax
+    memset(g, 0, sizeof(GcGroup));
+    g->count = count;
+    g->workers = calloc(count, sizeof(GcWorker));
+    pthread_mutex_init(&g->large_lock, NULL);
+    pthread_mutex_init(&g->tables_lock, NULL);
 
-    Lisp op = lisp_car(l);
-    if (lisp_type(op) == LISP_SYMBOL)
+    for (int i = 0; i < count; ++i)
     {
-        if (lisp_eq(op, get_sym(SYM_QUOTE, ctx)))
+        GcWorker* w = g->workers + i;
+        w->ctx = ctx;
+        w->from = from;
+        w->group = g;
+        pthread_mutex_init(&w->lock, NULL);
+
+        if (i == 0)
         {
-            // don't expand quotes
-            if (lisp_list_length(l) != 2)
-            {
-                fprintf(ctx.p->err_port, "(quote x)\n");
-                longjmp(error_jmp, LISP_ERROR_FORM_SYNTAX);
-            }
-            return l;
+            // the main thread copies into the context heap
+            w->to = &ctx.p->heap;
         }
-        else if (lisp_eq(op, get_sym(SYM_QUASI_QUOTE, ctx)))
+        else
         {
-            return expand_quasi_r(lisp_car(lisp_cdr(l)), error_jmp, ctx);
+            heap_init(&w->heap, &ctx.p->pool, ctx.p);
+            w->to = &w->heap;
         }
-        else if (lisp_eq(op, get_sym(SYM_DEFINE_MACRO, ctx)))
-        {
-            if (lisp_list_length(l) != 3)
-            {
-                fprintf(ctx.p->err_port, "(define-macro name proc)\n");
-                longjmp(error_jmp, LISP_ERROR_FORM_SYNTAX);
-            }
-
-            Lisp symbol = lisp_list_ref(l, 1);
-            Lisp body = lisp_list_ref(l, 2);
-
-            LispError e;
-            Lisp lambda = lisp_eval(body, &e, ctx);
-
-            if (e != LISP_ERROR_NONE)
-            {
-                longjmp(error_jmp, e);
-            }
-            if (lisp_type(lambda) != LISP_LAMBDA)
-            {
-                fprintf(ctx.p->err_port, "(define-macro name proc) not a procedure\n");
-                longjmp(error_jmp, LISP_ERROR_FORM_SYNTAX);
-            }
+    }
+}
 
-            lisp_table_set(ctx.p->macros, symbol, lambda, ctx);
-            return lisp_null();
-        }
-        else
+static void gc_group_shutdown_(GcGroup* g, LispContext ctx)
+{
+    Heap* heap = &ctx.p->heap;
+    for (int i = 0; i < g->count; ++i)
+    {
+        GcWorker* w = g->workers + i;
+        if (i > 0)
         {
-            int present;
-            Lisp proc = lisp_table_get(ctx.p->macros, op, &present);
+            // join the pages of each worker to the heap
+            heap->top->next = w->heap.bottom;
+            heap->top = w->heap.top;
+            heap->size += w->heap.size;
+            heap->page_count += w->heap.page_count;
 
-            if (present)
+            while (w->heap.large)
             {
-                // EXPAND MACRO
-
-                // TODO: need to make sure collection is not triggered
-                // while evaling a macro.
-                Lisp result;
-                Lisp calling_env;
-                LispError error = LISP_ERROR_NONE;
-                if (apply(proc, lisp_cdr(l), &result, &calling_env, &error, ctx) == 1)
-                {
-                    result = lisp_eval2(result, calling_env, &error, ctx);
-                }
-
-                if (error != LISP_ERROR_NONE)
-                {
-                    fprintf(ctx.p->err_port, "macroexpand failed: %s\n", lisp_symbol_string(op));
-                    longjmp(error_jmp, error);
-                }
-                return expand_r(result, error_jmp, ctx);
+                Page* page = w->heap.large;
+                heap_remove_large_(&w->heap, page);
+                heap_push_large_(heap, page);
             }
         }
+        gc_census_add_(w, ctx);
+        pthread_mutex_destroy(&w->lock);
+        free(w->local);
+        free(w->shared);
     }
+    pthread_mutex_destroy(&g->large_lock);
+    pthread_mutex_destroy(&g->tables_lock);
+    free(g->tables);
+    free(g->workers);
+}
 
-    // list
-    Lisp it = l;
-    while (lisp_is_pair(it))
-    {
-        lisp_set_car(it, expand_r(lisp_car(it), error_jmp, ctx));
-        it = lisp_cdr(it);
-    }
-    return l;
+#endif
 
+void lisp_set_gc_threads(int n, LispContext ctx)
+{
+    ctx.p->gc_threads = n < 1 ? 1 : n;
 }
 
-Lisp lisp_macroexpand(Lisp lisp, LispError* out_error, LispContext ctx)
+void lisp_set_gc_pause(int microseconds, LispContext ctx)
 {
-    jmp_buf error_jmp;
-    LispError error = setjmp(error_jmp);
+    ctx.p->gc_pause = microseconds < 0 ? 0 : microseconds;
+}
 
-    if (error == LISP_ERROR_NONE)
-    {
-        Lisp result = expand_r(lisp, error_jmp, ctx);
-        *out_error = error;
-        return result;
-    }
-    else
-    {
-        *out_error = error;
-        return lisp_null();
-    }
+void lisp_set_heap_growth(double growth, size_t soft_max, LispContext ctx)
+{
+    ctx.p->heap_growth = growth < 1.0 ? 1.0 : growth;
+    ctx.p->heap_soft_max = soft_max;
 }
 
-Lisp lisp_eval2(Lisp l, Lisp env, LispError* out_error, LispContext ctx)
+int lisp_should_collect(LispContext ctx)
 {
-    LispError error;
-    Lisp expanded = lisp_macroexpand(l, &error, ctx);
+    return ctx.p->heap.size >= ctx.p->heap_target;
+}
 
-    if (error != LISP_ERROR_NONE)
+// After a collection, set the next target from what survived.
+// The high-water mark for free pages is the larger of the target,
+// and what the heap grew to before this collection (used).
+static void gc_resize_heap_(size_t used, LispContext ctx)
+{
+    double target = (double)ctx.p->heap.size * ctx.p->heap_growth;
+    size_t t = target >= (double)SIZE_MAX ? SIZE_MAX : (size_t)target;
+    if (t < (LISP_HEAP_MIN)) t = LISP_HEAP_MIN;
+    if (ctx.p->heap_soft_max > 0 && t > ctx.p->heap_soft_max)
     {
-        if (out_error) *out_error = error;
-        return lisp_null();
+        // more may have survived than the cap allows. Leave room to allocate half of it,
+        // rather than asking for another collection right away.
+        size_t room = ctx.p->heap.size + ctx.p->heap_soft_max / 2;
+        if (room < ctx.p->heap_soft_max) room = ctx.p->heap_soft_max;
+        if (room < t) t = room;
     }
+    ctx.p->heap_target = t;
 
-    size_t save_stack = ctx.p->stack_ptr;
-
-    jmp_buf error_jmp;
-    error = setjmp(error_jmp);
+    size_t keep = used > t ? used : t;
+    size_t keep_max = ctx.p->heap_soft_max > t ? ctx.p->heap_soft_max : t;
+    if (ctx.p->heap_soft_max > 0 && keep > keep_max) keep = keep_max;
+    ctx.p->pool.limit = keep / (LISP_PAGE_SIZE);
+    page_pool_trim_(&ctx.p->pool);
+}
 
-    if (error == LISP_ERROR_NONE)
-    {
-        lisp_stack_push(env, ctx);
-        lisp_stack_push(expanded, ctx);
+static uint64_t gc_clock_us_(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000 + (uint64_t)t.tv_nsec / 1000;
+#else
+    return (uint64_t)clock() * 1000000 / CLOCKS_PER_SEC;
+#endif
+}
 
-        Lisp result = eval_r(error_jmp, ctx);
+static void gc_record_pause_(uint64_t start_time, LispContext ctx)
+{
+    uint64_t us = gc_clock_us_() - start_time;
+    int bucket = 0;
+    while (bucket < LISP_GC_PAUSE_BUCKETS - 1 && (us >> (bucket + 1)) != 0) ++bucket;
+    ++ctx.p->gc_pauses[bucket];
+    if (us > ctx.p->gc_pause_max) ctx.p->gc_pause_max = (size_t)us;
+#ifndef LISP_NO_HOOKS
+    if (ctx.p->hooks.gc_end) ctx.p->hooks.gc_end(ctx.p->hooks.user, (size_t)us);
+#endif
+}
 
-        lisp_stack_pop(ctx);
-        lisp_stack_pop(ctx);
+static Lisp gc_move_roots_(Lisp root_to_save, GcWorker* w)
+{
+    LispContext ctx = w->ctx;
+    ctx.p->env = gc_move(ctx.p->env, w);
+    ctx.p->macros = gc_move(ctx.p->macros, w);
+    ctx.p->record_types = gc_move(ctx.p->record_types, w);
+
+    gc_move_v(ctx.p->symbol_cache, SYM_COUNT, w);
+    gc_move_v(ctx.p->stack, ctx.p->stack_ptr, w);
+
+    return gc_move(root_to_save, w);
+}
+
+#ifdef LISP_GC_INCREMENTAL
+/* Incremental collection (Baker).
+ The flip only moves the roots, and the rest of the Cheney scan
+ is done in slices as the program allocates.
+ Nothing outside the collector may see the old heap, so the accessors of objects
+ with references (pair_get_, vector_get_, ...) go through gc_read_barrier_,
+ which scans a copied block before it is used.
+ Anything allocated during the collection is already in the new heap
+ and can only refer to it. */
+typedef struct GcCycle
+{
+    GcWorker w;
+    Heap from;
+    // scan position in the new heap
+    Page* page;
+    size_t offset;
+    // large pages are added to the front of the new heap's list.
+    // The current pass goes from large to large_end,
+    // and anything in front of large_start is new.
+    Page* large;
+    Page* large_end;
+    Page* large_start;
+    // a large vector is scanned across several slices.
+    Vector* partial;
+    int partial_index;
+    // bytes scanned in the current slice
+    size_t walked;
+} GcCycle;
+
+// Returns 1 when the vector is finished.
+static int gc_cycle_scan_vector_(Vector* v, GcCycle* c, uint64_t deadline)
+{
+    int i = 0;
+    if (c->partial == v)
+        i = c->partial_index;
+    else if (c->partial)
+        // only one vector is left part way at a time, so this one must finish.
+        deadline = UINT64_MAX;
+
+    int n = vector_len_(v);
+    while (i < n)
+    {
+        int end = n - i > 1024 ? i + 1024 : n;
+        gc_scan_entries_(v, i, end, &c->w);
+        c->walked += (end - i) * sizeof(LispVal);
+        i = end;
 
-        if (out_error)
+        if (i < n && gc_clock_us_() >= deadline)
         {
-            *out_error = error;
+            c->partial = v;
+            c->partial_index = i;
+            return 0;
         }
+    }
+    if (c->partial == v) c->partial = NULL;
+    v->block.gc_state = GC_CLEAR;
+    return 1;
+}
 
-        return result;
+// Returns 0 if the deadline passed before the block was finished.
+static int gc_cycle_visit_(Block* block, GcCycle* c, uint64_t deadline)
+{
+    if (block->gc_state == GC_NEED_VISIT)
+    {
+        if (block->type == LISP_VECTOR)
+            return gc_cycle_scan_vector_((Vector*)block, c, deadline);
+
+        block->gc_state = GC_CLEAR;
+        gc_scan_(block, &c->w);
     }
-    else
+    return 1;
+}
+
+// Returns 1 once everything copied has been scanned.
+static int gc_cycle_scan_(GcCycle* c, uint64_t deadline)
+{
+    int counter = 0;
+    while (1)
     {
-        if (out_error)
+        Page* page = c->page;
+        if (c->offset < page->size)
         {
-            ctx.p->stack_ptr = save_stack;
-            *out_error = error;
+            Block* block = (Block*)(page->buffer + c->offset);
+            if (!gc_cycle_visit_(block, c, deadline)) return 0;
+            c->offset += block->info.size;
+            c->walked += block->info.size;
+        }
+        else if (page->next)
+        {
+            c->page = page->next;
+            c->offset = 0;
+            continue;
+        }
+        else if (c->large != c->large_end)
+        {
+            if (!gc_cycle_visit_((Block*)c->large->buffer, c, deadline)) return 0;
+            c->large = c->large->next;
+        }
+        else
+        {
+            Page* front = c->w.to->large;
+            if (front == c->large_start) return 1;
+            c->large_end = c->large_start;
+            c->large_start = front;
+            c->large = front;
+            continue;
         }
 
-        return lisp_null();
+        if ((++counter & 63) == 0 && gc_clock_us_() >= deadline) return 0;
     }
 }
 
-Lisp lisp_eval(Lisp expr, LispError* out_error, LispContext ctx)
+static void gc_cycle_end_(LispContext ctx)
 {
-    return lisp_eval2(expr, lisp_env(ctx), out_error, ctx);
+    GcCycle* c = ctx.p->gc_cycle;
+    ctx.p->gc_next_slice = SIZE_MAX;
+    gc_cycle_scan_(c, UINT64_MAX);
+
+    ctx.p->symbols = gc_move_weak_symbols(ctx.p->symbols, &c->w);
+    if (ctx.p->profile) profile_forget_(ctx.p->profile);
+
+    memset(ctx.p->stats.live_bytes, 0, sizeof(ctx.p->stats.live_bytes));
+    gc_census_add_(&c->w, ctx);
+
+    size_t live = 0;
+    for (int i = 0; i < LISP_TYPE_COUNT; ++i) live += c->w.live_bytes[i];
+    ctx.p->gc_stat_freed = c->from.size - live;
+    size_t used = c->from.size;
+    heap_shutdown(&c->from);
+    free(c);
+    ctx.p->gc_cycle = NULL;
+    gc_resize_heap_(used, ctx);
 }
 
-Lisp lisp_apply(Lisp operator, Lisp args, LispError* out_error, LispContext ctx)
+static void gc_slice_(LispContext ctx)
 {
-    // TODO: argument passing is a little more sophisitaed
-    // No environment required. procedures always bring their own enviornment
-    // to the call.
-    Lisp x;
-    Lisp env;
-    int needs_to_eval = apply(operator, args, &x, &env, out_error, ctx);
-    if (*out_error != LISP_ERROR_NONE) return lisp_false();
-    return needs_to_eval ? lisp_eval2(x, env, out_error, ctx) : x;
+    GcCycle* c = ctx.p->gc_cycle;
+    // scanning allocates, which must not start another slice,
+    // or run into the heap limit.
+    ctx.p->gc_next_slice = SIZE_MAX;
+    jmp_buf* save_error_jmp = ctx.p->error_jmp;
+    ctx.p->error_jmp = NULL;
+
+    hook_gc_start_(ctx);
+    uint64_t start_time = gc_clock_us_();
+    c->walked = 0;
+    if (gc_cycle_scan_(c, start_time + ctx.p->gc_pause))
+    {
+        gc_cycle_end_(ctx);
+    }
+    else
+    {
+        // Allow half as much to be allocated as was scanned,
+        // so the scan catches up with the end of the heap.
+        ctx.p->gc_next_slice = ctx.p->heap.size + c->walked / 2;
+    }
+
+    ctx.p->error_jmp = save_error_jmp;
+    gc_record_pause_(start_time, ctx);
 }
 
-static Lisp gc_move(Lisp x, LispContext ctx)
+static void gc_blacken_(Block* block)
 {
-    switch (x.type)
+    struct LispImpl* p = page_of_(block)->owner;
+    GcCycle* c = p->gc_cycle;
+    assert(c);
+
+    size_t next_slice = p->gc_next_slice;
+    jmp_buf* save_error_jmp = p->error_jmp;
+    p->gc_next_slice = SIZE_MAX;
+    p->error_jmp = NULL;
+    if ((Vector*)block == c->partial)
     {
-        case LISP_PAIR:
-        case LISP_STRING:
-        case LISP_LAMBDA:
-        case LISP_VECTOR:
-        case LISP_PROMISE:
-        case LISP_TABLE:
-        case LISP_SYMBOL:
-        {
-            Block* block = x.val.ptr_val;
-            if (block->gc_state == GC_CLEAR)
-            {
-                // copy the data to new block
-                Block* dest = heap_alloc(block->info.size, block->type, &ctx.p->heap);
-                memcpy(dest, block, block->info.size);
-                dest->gc_state = GC_NEED_VISIT;
+        // continue from where the slices left it
+        gc_cycle_scan_vector_(c->partial, c, UINT64_MAX);
+    }
+    else
+    {
+        block->gc_state = GC_CLEAR;
+        gc_scan_(block, &c->w);
+    }
+    p->gc_next_slice = next_slice;
+    p->error_jmp = save_error_jmp;
+}
 
-                // save forwarding address (offset in to)
-                block->info.forward = dest;
-                block->gc_state = GC_GONE;
-            }
+#endif
 
-            assert(block->gc_state == GC_GONE);
+static void heap_mark_from_space_(Heap* heap)
+{
+#ifdef LISP_GC_INCREMENTAL
+    for (Page* page = heap->bottom; page; page = page->next)
+        page->from_space = 1;
+#endif
+    for (Page* page = heap->large; page; page = page->next)
+        page->from_space = 1;
+}
+
+static Lisp gc_forward_symbol_(Lisp symbol, LispContext ctx)
+{
+#ifdef LISP_GC_INCREMENTAL
+    // the symbol table is weak, so it isn't moved until the end of the collection.
+    GcCycle* c = ctx.p->gc_cycle;
+    if (c && page_of_(symbol.val.ptr_val)->from_space) return gc_move(symbol, &c->w);
+#else
+    (void)ctx;
+#endif
+    return symbol;
+}
+
+/* Arenas.
+ An arena starts a new page at the top of the heap, and everything allocated until it ends
+ goes in pages marked with its depth. At the end those pages are cut off the heap,
+ and a collection which only moves blocks in them (GcWorker.arena) copies out what is still
+ reachable, from the roots and from the older objects which were given arena values
+ (the remembered set, filled by arena_write_barrier_). The pages then go back to the pool. */
+typedef struct ArenaMark
+{
+    Page* top;
+    size_t top_size;
+    size_t size;
+    size_t page_count;
+    Page* large;
+    size_t large_count;
+} ArenaMark;
 
-            // return the moved block address
-            x.val.ptr_val = block->info.forward;
-            return x;
-        }
+static int is_block_type_(LispType type)
+{
+    switch (type)
+    {
+        case LISP_PAIR:
+        case LISP_STRING:
+        case LISP_LAMBDA:
+        case LISP_VECTOR:
+        case LISP_PROMISE:
+        case LISP_TABLE:
+        case LISP_SYMBOL:
+        case LISP_F64VECTOR:
+        case LISP_S64VECTOR:
+        case LISP_BYTEVECTOR:
+        case LISP_JUMP:
+        case LISP_RECORD:
+            return 1;
         default:
-            return x;
+            return 0;
     }
 }
 
-static LispVal gc_move_val(LispVal val, LispType type, LispContext ctx)
+static void arena_remember_(Block* target, Lisp x)
 {
-    return gc_move( (Lisp) { val, type}, ctx).val;
+    if (!is_block_type_(x.type) || x.val.ptr_val == NULL) return;
+
+    size_t depth = block_page_(x.val.ptr_val)->arena;
+    if (depth == 0) return;
+    Page* page = block_page_(target);
+    if (page->arena >= depth) return;
+
+    if (target->remembered) return;
+    target->remembered = 1;
+
+    struct LispImpl* p = page->owner;
+    if (p->remembered_count == p->remembered_capacity)
+    {
+        p->remembered_capacity = p->remembered_capacity ? p->remembered_capacity * 2 : 64;
+        p->remembered = realloc(p->remembered, sizeof(Block*) * p->remembered_capacity);
+    }
+    p->remembered[p->remembered_count++] = target;
 }
 
-static void gc_move_v(Lisp* start, int n, LispContext ctx)
+static void arenas_open_add_(int n)
 {
-    for (int i = 0; i < n; ++i) start[i] = gc_move(start[i], ctx);
+#ifndef LISP_NO_THREADS
+    __atomic_add_fetch(&arenas_open_, n, __ATOMIC_RELAXED);
+#else
+    arenas_open_ += n;
+#endif
 }
 
-static Lisp gc_move_weak_symbols(Lisp old_table, LispContext ctx)
+// What the arenas hold becomes part of the heap.
+static void arena_close_all_(LispContext ctx)
 {
-    // move symbol table (weak references)
-    Table* from = table_get_(old_table);
-    Lisp to_table = lisp_make_table(ctx);
-    // preallocate
-    int cap = from->capacity;
-    table_grow_(to_table, cap, ctx);
+    for (size_t i = 0; i < ctx.p->remembered_count; ++i) ctx.p->remembered[i]->remembered = 0;
+    arenas_open_add_(-(int)ctx.p->arena_count);
+    ctx.p->arena_count = 0;
+    ctx.p->remembered_count = 0;
+    ctx.p->arena_symbols = 0;
+    ctx.p->heap.arena = 0;
+}
 
-    Lisp hashes = { from->keys, LISP_VECTOR };
-    Lisp symbols = { from->vals, LISP_VECTOR };
+void lisp_arena_begin(LispContext ctx)
+{
+#ifdef LISP_GC_INCREMENTAL
+    // the collector must not be scanning pages which will be cut off.
+    if (ctx.p->gc_cycle) gc_cycle_end_(ctx);
+#endif
+    if (ctx.p->arena_count == ctx.p->arena_capacity)
+    {
+        ctx.p->arena_capacity = ctx.p->arena_capacity ? ctx.p->arena_capacity * 2 : 4;
+        ctx.p->arenas = realloc(ctx.p->arenas, sizeof(ArenaMark) * ctx.p->arena_capacity);
+    }
 
-    for (int i = 0; i < cap; ++i)
+    Heap* heap = &ctx.p->heap;
+    ArenaMark* mark = ctx.p->arenas + ctx.p->arena_count++;
+    mark->top = heap->top;
+    mark->top_size = heap->top->size;
+    mark->size = heap->size;
+    mark->page_count = heap->page_count;
+    mark->large = heap->large;
+    mark->large_count = heap->large_count;
+
+    heap->arena = ctx.p->arena_count;
+    Page* page = page_pool_take_(heap->pool, heap->owner);
+    page->arena = heap->arena;
+    heap->top->next = page;
+    heap->top = page;
+    ++heap->page_count;
+
+    arenas_open_add_(1);
+}
+
+// Symbols are weak, so the symbol table isn't scanned.
+// Instead the symbols made in the arena are moved out, and the chains relinked.
+static void arena_move_symbols_(GcWorker* w)
+{
+    Table* t = table_get_(w->ctx.p->symbols);
+    // the table may have grown in the arena too.
+    t->keys = gc_move((Lisp) { t->keys, LISP_VECTOR }, w).val;
+    t->vals = gc_move((Lisp) { t->vals, LISP_VECTOR }, w).val;
+
+    Vector* symbols = t->vals.ptr_val;
+    const char* hash_types = vector_types_(t->keys.ptr_val);
+    for (int i = 0; i < t->capacity; ++i)
     {
-        Lisp hash = lisp_vector_ref(hashes, i);
-        if (!lisp_is_null(hash))
+        if (hash_types[i] == LISP_NULL) continue;
+
+        LispVal* link = symbols->entries + i;
+        while (link->ptr_val != NULL)
         {
-            Lisp old_symbol = lisp_vector_ref(symbols, i);
-            while (old_symbol.val.ptr_val != NULL)
-            {
-                if (symbol_get_(old_symbol)->block.gc_state == GC_GONE)
-                {
-                    Lisp to_insert = gc_move(old_symbol, ctx);
-                    int present;
-                    Lisp existing = lisp_table_get(to_table, hash, &present);
-                    symbol_get_(to_insert)->next = existing.val;
-                    lisp_table_set(to_table, hash, to_insert, ctx);
-                }
-                else
-                {
-#ifdef LISP_DEBUG
-                    //printf("losing symbol: %s\n", lisp_symbol_string(old_symbol));
-#endif
-                }
-                old_symbol.val = symbol_get_(old_symbol)->next;
-            }
+            *link = gc_move((Lisp) { *link, LISP_SYMBOL }, w).val;
+            link = &((Symbol*)link->ptr_val)->next;
         }
     }
-    return to_table;
+}
+
+Lisp lisp_arena_end(Lisp keep, LispContext ctx)
+{
+    // closed by a collection
+    if (ctx.p->arena_count == 0) return keep;
+
+    size_t depth = ctx.p->arena_count--;
+    ArenaMark mark = ctx.p->arenas[ctx.p->arena_count];
+    Heap* heap = &ctx.p->heap;
+
+    // cut the arena's pages off the heap.
+    Heap arena = *heap;
+    arena.bottom = mark.top->next;
+    arena.large = NULL;
+    arena.large_count = 0;
+    Page* large = heap->large;
+    while (large != mark.large)
+    {
+        Page* next = large->next;
+        large->from_space = 1;
+        heap_remove_large_(heap, large);
+        heap_push_large_(&arena, large);
+        large = next;
+    }
+
+    mark.top->next = NULL;
+    heap->top = mark.top;
+    heap->size = mark.size;
+    heap->page_count = mark.page_count;
+    heap->arena = depth - 1;
+
+    GcWorker w;
+    memset(&w, 0, sizeof(GcWorker));
+    w.to = heap;
+    w.from = &arena;
+    w.ctx = ctx;
+    w.arena = depth;
+
+    Lisp result = gc_move_roots_(keep, &w);
+
+    // older objects which may point into the arena.
+    // Those still older than the enclosing arena are kept for it.
+    size_t n = ctx.p->remembered_count;
+    size_t kept = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        Block* block = ctx.p->remembered[i];
+        gc_scan_(block, &w);
+        if (block_page_(block)->arena + 1 < depth) ctx.p->remembered[kept++] = block;
+        else block->remembered = 0;
+    }
+    // rebuilding tables may remember them again.
+    for (size_t i = n; i < ctx.p->remembered_count; ++i)
+        ctx.p->remembered[kept++] = ctx.p->remembered[i];
+    ctx.p->remembered_count = kept;
+
+    if (ctx.p->arena_symbols)
+    {
+        arena_move_symbols_(&w);
+        ctx.p->arena_symbols = depth > 1;
+    }
+
+    gc_scan_from_(&w, mark.top, mark.top_size, mark.large);
+    if (ctx.p->profile) profile_forget_(ctx.p->profile);
+
+    // large pages which were reached are kept where they are.
+    for (Page* it = heap->large; it != mark.large; it = it->next)
+        it->arena = depth - 1;
+
+    // the rest is garbage.
+    page_pool_give_list_(heap->pool, arena.bottom, arena.top, arena.page_count - mark.page_count);
+    Page* page = arena.large;
+    while (page)
+    {
+        Page* next = page->next;
+        page_destroy(page);
+        page = next;
+    }
+
+    arenas_open_add_(-1);
+    return result;
 }
 
 Lisp lisp_collect(Lisp root_to_save, LispContext ctx)
 {
-#ifdef LISP_DEBUG
-    time_t start_time = clock();
+    hook_gc_start_(ctx);
+    uint64_t start_time = gc_clock_us_();
+    // the heap limit doesn't apply to the collector.
+    jmp_buf* save_error_jmp = ctx.p->error_jmp;
+    ctx.p->error_jmp = NULL;
+
+#ifdef LISP_GC_INCREMENTAL
+    // the previous incremental collection must finish before flipping again.
+    if (ctx.p->gc_cycle) gc_cycle_end_(ctx);
 #endif
+    arena_close_all_(ctx);
+    if (ctx.p->profile) profile_forget_(ctx.p->profile);
+    ++ctx.p->stats.collections;
 
     // copy of old heap
     Heap from = ctx.p->heap;
 
     // make new heap to allocate and copy to
-    heap_init(&ctx.p->heap);
+    heap_init(&ctx.p->heap, &ctx.p->pool, ctx.p);
+    heap_mark_from_space_(&from);
 
-    // move root object
-    ctx.p->env = gc_move(ctx.p->env, ctx);
-    ctx.p->macros = gc_move(ctx.p->macros, ctx);
+#ifdef LISP_GC_INCREMENTAL
+    if (ctx.p->gc_pause > 0)
+    {
+        GcCycle* c = calloc(1, sizeof(GcCycle));
+        c->from = from;
+        c->w.to = &ctx.p->heap;
+        c->w.from = &c->from;
+        c->w.ctx = ctx;
+
+        Lisp result = gc_move_roots_(root_to_save, &c->w);
+
+        c->page = ctx.p->heap.bottom;
+        c->offset = 0;
+        ctx.p->gc_cycle = c;
+        ctx.p->gc_next_slice = ctx.p->heap.size;
+
+        ctx.p->gc_stat_time = (size_t)(gc_clock_us_() - start_time);
+        gc_record_pause_(start_time, ctx);
+        ctx.p->error_jmp = save_error_jmp;
+        return result;
+    }
+#endif
 
-    gc_move_v(ctx.p->symbol_cache, SYM_COUNT, ctx);
-    gc_move_v(ctx.p->stack, ctx.p->stack_ptr, ctx);
+    memset(ctx.p->stats.live_bytes, 0, sizeof(ctx.p->stats.live_bytes));
 
-    Lisp result = gc_move(root_to_save, ctx);
+    GcWorker serial;
+    memset(&serial, 0, sizeof(GcWorker));
+    serial.to = &ctx.p->heap;
+    serial.from = &from;
+    serial.ctx = ctx;
+    GcWorker* w = &serial;
 
-    // move references
-    const Page* page = ctx.p->heap.bottom;
-    int page_counter = 0;
-    while (page)
+#ifndef LISP_NO_THREADS
+    GcGroup group;
+    if (ctx.p->gc_threads > 1)
     {
-        size_t offset = 0;
-        while (offset < page->size)
-        {
-            Block* block = (Block*)(page->buffer + offset);
-            if (block->gc_state == GC_NEED_VISIT)
-            {
-                switch (block->type)
-                {
-                    // these add &to the buffer!
-                    // so lists are handled in a single pass
-                    case LISP_PAIR:
-                    {
-                        // move the CAR and CDR
-                        Pair* p = (Pair*)block;
-                        p->car = gc_move_val(p->car, p->block.d.pair.car_type, ctx);
-                        p->cdr = gc_move_val(p->cdr, p->block.d.pair.cdr_type, ctx);
-                        break;
-                    }
-                    case LISP_VECTOR:
-                    {
-                        Lisp vector;
-                        vector.val.ptr_val = block;
-                        vector.type = LISP_VECTOR;
-
-                        Vector* v = (Vector*)block;
-                        int n = vector_len_(v);
-                        for (int i = 0; i < n; ++i)
-                            v->entries[i] = gc_move(lisp_vector_ref(vector, i), ctx).val;
-                        break;
-                    }
-                    case LISP_LAMBDA:
-                    {
-                        // move the body and args
-                        Lambda* l = (Lambda*)block;
-                        l->args = gc_move_val(l->args, (LispType)l->block.d.lambda.args_type, ctx);
-                        l->body = gc_move_val(l->body, (LispType)l->block.d.lambda.body_type, ctx);
-                        l->env = gc_move_val(l->env, l->env.ptr_val == NULL ? LISP_NULL : LISP_PAIR, ctx);
-                        break;
-                    }
-                    case LISP_PROMISE:
-                    {
-                        Promise* p = (Promise*)block;
-                        p->val_or_proc = gc_move_val(p->val_or_proc, (LispType)p->block.d.promise.type, ctx);
-                        break;
-                    }
-                    case LISP_TABLE:
-                    {
-
-                        // During garbage collection all pointers change INCLUDING symbols,
-                        // so that means if a symbol pointer is being used as a key, it is no
-                        // longer in the correct place in the hash table.
-                        // So we have to move it to a new place during garbage collection.
-                        Lisp table;
-                        table.val.ptr_val = block;
-                        table.type = LISP_TABLE;
-
-                        Table* t = (Table*)block;
-                        int n = t->capacity;
+        gc_group_init_(&group, ctx.p->gc_threads, &from, ctx);
+        w = group.workers;
+    }
+#endif
 
-                        Lisp keys = { t->keys, LISP_VECTOR };
-                        Lisp vals = { t->vals, LISP_VECTOR };
+    // move root object
+    Lisp result = gc_move_roots_(root_to_save, w);
 
-                        for (int i = 0; i < n; ++i)
-                        {
-                            // move all the values, but borrow the old table for now.
-                            Lisp key = lisp_vector_ref(keys, i);
-                            if (!lisp_is_null(key))
-                            {
-                                lisp_vector_set(keys, i, gc_move(key, ctx));
-                                lisp_vector_set(vals, i, gc_move(lisp_vector_ref(vals, i), ctx));
-                            }
-                        }
-                        // create new table and move the values in place.
-                        table_grow_(table, n, ctx);
-                        break;
-                     }
-                    default: break;
-                }
-                block->gc_state = GC_CLEAR;
-            }
-            offset += block->info.size;
-        }
-        page = page->next;
-        ++page_counter;
+    // move references
+#ifndef LISP_NO_THREADS
+    if (w->group)
+    {
+        gc_scan_parallel_(&group);
+        gc_group_shutdown_(&group, ctx);
+        // symbols are only read from here on.
+        serial.group = NULL;
+        w = &serial;
+    }
+    else
+#endif
+    {
+        gc_scan_from_(w, w->to->bottom, 0, NULL);
     }
-    // check that we visited all the pages
-    assert(page_counter == ctx.p->heap.page_count);
-    ctx.p->symbols = gc_move_weak_symbols(ctx.p->symbols, ctx);
+
+    ctx.p->symbols = gc_move_weak_symbols(ctx.p->symbols, w);
+    gc_census_add_(w, ctx);
 
 #ifdef LISP_DEBUG
      {
@@ -3091,13 +8503,255 @@ Lisp lisp_collect(Lisp root_to_save, LispContext ctx)
     heap_shutdown(&from);
 
     ctx.p->gc_stat_freed = diff;
-#ifdef LISP_DEBUG
-    time_t end_time = clock();
-    ctx.p->gc_stat_time = 1000000 * (end_time - start_time) / CLOCKS_PER_SEC;
+    gc_resize_heap_(from.size, ctx);
+    ctx.p->gc_stat_time = (size_t)(gc_clock_us_() - start_time);
+    gc_record_pause_(start_time, ctx);
+    ctx.p->error_jmp = save_error_jmp;
+    return result;
+}
+
+void lisp_heap_stats(LispHeapStats* out, LispContext ctx)
+{
+    *out = ctx.p->stats;
+    out->heap_size = ctx.p->heap.size;
+    out->freed = ctx.p->gc_stat_freed;
+    out->time = ctx.p->gc_stat_time;
+}
+
+/* Checkpoints.
+ After a collection the heap is just its pages, and everything else refers into them
+ through env, macros, record types, symbols and the symbol cache.
+ A checkpoint keeps those pages where they are, so their pointers stay valid,
+ and saves their contents. heap_shutdown skips them, so a later collection
+ can copy out of them without freeing them.
+ With mmap the contents are written to a temporary file and each page is mapped back
+ copy-on-write, so restoring is mapping it again, which drops the pages that were written. */
+struct LispCheckpoint
+{
+    struct LispCheckpoint* next;
+    Page** pages;
+    size_t page_count;
+#ifndef LISP_NO_MMAP
+    FILE* file;
+    size_t* offsets;
 #else
-    ctx.p->gc_stat_time = 0;
+    char** copies;
 #endif
-    return result;
+
+    Heap heap;
+    size_t heap_target;
+    Lisp env;
+    Lisp macros;
+    Lisp record_types;
+    Lisp symbols;
+    Lisp symbol_cache[SYM_COUNT];
+    int symbol_counter;
+};
+
+// The part of a page a checkpoint saves. For a mapped file (see heap_map_file_)
+// that is the system page with the headers, since the contents are read-only.
+static char* checkpoint_region_(Page* page, size_t* size)
+{
+#ifndef LISP_NO_MMAP
+    if (page->mapped)
+    {
+        *size = (size_t)sysconf(_SC_PAGESIZE);
+        return (char*)page - (uintptr_t)page % *size;
+    }
+#endif
+    *size = page_mapped_size_(page->capacity);
+    return (char*)page;
+}
+
+static int page_pinned_(const Page* page, const struct LispImpl* p)
+{
+    for (const LispCheckpoint* c = p->checkpoints; c; c = c->next)
+    {
+        for (size_t i = 0; i < c->page_count; ++i)
+            if (c->pages[i] == page) return 1;
+    }
+    return 0;
+}
+
+static int heap_has_page_(const Heap* heap, const Page* page)
+{
+    for (const Page* it = heap->bottom; it; it = it->next)
+        if (it == page) return 1;
+    for (const Page* it = heap->large; it; it = it->next)
+        if (it == page) return 1;
+    return 0;
+}
+
+static void checkpoint_destroy_(LispCheckpoint* c)
+{
+#ifndef LISP_NO_MMAP
+    if (c->file) fclose(c->file);
+    free(c->offsets);
+#else
+    if (c->copies)
+    {
+        for (size_t i = 0; i < c->page_count; ++i) free(c->copies[i]);
+        free(c->copies);
+    }
+#endif
+    free(c->pages);
+    free(c);
+}
+
+LispCheckpoint* lisp_checkpoint(LispContext ctx)
+{
+    lisp_collect(lisp_null(), ctx);
+#ifdef LISP_GC_INCREMENTAL
+    if (ctx.p->gc_cycle) gc_cycle_end_(ctx);
+#endif
+
+    LispCheckpoint* c = calloc(1, sizeof(LispCheckpoint));
+    if (!c) return NULL;
+
+    const Heap* heap = &ctx.p->heap;
+    c->pages = malloc(sizeof(Page*) * (heap->page_count + heap->large_count));
+    if (!c->pages)
+    {
+        checkpoint_destroy_(c);
+        return NULL;
+    }
+    for (Page* page = heap->bottom; page; page = page->next) c->pages[c->page_count++] = page;
+    for (Page* page = heap->large; page; page = page->next) c->pages[c->page_count++] = page;
+
+#ifndef LISP_NO_MMAP
+    c->file = tmpfile();
+    c->offsets = malloc(sizeof(size_t) * c->page_count);
+    if (!c->file || !c->offsets)
+    {
+        checkpoint_destroy_(c);
+        return NULL;
+    }
+
+    size_t offset = 0;
+    for (size_t i = 0; i < c->page_count; ++i)
+    {
+        size_t size;
+        char* memory = checkpoint_region_(c->pages[i], &size);
+        if (fwrite(memory, 1, size, c->file) != size)
+        {
+            checkpoint_destroy_(c);
+            return NULL;
+        }
+        c->offsets[i] = offset;
+        offset += size;
+    }
+    if (fflush(c->file) != 0)
+    {
+        checkpoint_destroy_(c);
+        return NULL;
+    }
+
+    // the same contents, now backed by the file.
+    int fd = fileno(c->file);
+    for (size_t i = 0; i < c->page_count; ++i)
+    {
+        size_t size;
+        char* memory = checkpoint_region_(c->pages[i], &size);
+        void* result = mmap(memory, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, (off_t)c->offsets[i]);
+        assert(result == memory);
+        (void)result;
+    }
+#else
+    c->copies = calloc(c->page_count, sizeof(char*));
+    if (!c->copies)
+    {
+        checkpoint_destroy_(c);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < c->page_count; ++i)
+    {
+        size_t size;
+        char* memory = checkpoint_region_(c->pages[i], &size);
+        c->copies[i] = malloc(size);
+        if (!c->copies[i])
+        {
+            checkpoint_destroy_(c);
+            return NULL;
+        }
+        memcpy(c->copies[i], memory, size);
+    }
+#endif
+
+    c->heap = ctx.p->heap;
+    c->heap_target = ctx.p->heap_target;
+    c->env = ctx.p->env;
+    c->macros = ctx.p->macros;
+    c->record_types = ctx.p->record_types;
+    c->symbols = ctx.p->symbols;
+    memcpy(c->symbol_cache, ctx.p->symbol_cache, sizeof(c->symbol_cache));
+    c->symbol_counter = ctx.p->symbol_counter;
+
+    c->next = ctx.p->checkpoints;
+    ctx.p->checkpoints = c;
+    return c;
+}
+
+void lisp_restore(const LispCheckpoint* c, LispContext ctx)
+{
+    assert(!ctx.p->error_jmp);
+    lisp_cancel(ctx);
+    if (ctx.p->profile) profile_forget_(ctx.p->profile);
+
+    // free what has been allocated since, except pages kept by checkpoints.
+#ifdef LISP_GC_INCREMENTAL
+    if (ctx.p->gc_cycle)
+    {
+        heap_shutdown(&ctx.p->gc_cycle->from);
+        free(ctx.p->gc_cycle);
+        ctx.p->gc_cycle = NULL;
+    }
+#endif
+    ctx.p->gc_next_slice = SIZE_MAX;
+    arena_close_all_(ctx);
+    heap_shutdown(&ctx.p->heap);
+
+    for (size_t i = 0; i < c->page_count; ++i)
+    {
+        size_t size;
+        char* memory = checkpoint_region_(c->pages[i], &size);
+#ifndef LISP_NO_MMAP
+        void* result = mmap(memory, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fileno(c->file), (off_t)c->offsets[i]);
+        assert(result == memory);
+        (void)result;
+#else
+        memcpy(memory, c->copies[i], size);
+#endif
+    }
+
+    ctx.p->heap = c->heap;
+    ctx.p->heap_target = c->heap_target;
+    ctx.p->env = c->env;
+    ctx.p->macros = c->macros;
+    ctx.p->record_types = c->record_types;
+    ctx.p->symbols = c->symbols;
+    memcpy(ctx.p->symbol_cache, c->symbol_cache, sizeof(c->symbol_cache));
+    ctx.p->symbol_counter = c->symbol_counter;
+    ctx.p->stack_ptr = 0;
+}
+
+void lisp_checkpoint_free(LispCheckpoint* c, LispContext ctx)
+{
+    LispCheckpoint** link = &ctx.p->checkpoints;
+    while (*link != c) link = &(*link)->next;
+    *link = c->next;
+
+    // pages in use are freed with the heap instead.
+    for (size_t i = 0; i < c->page_count; ++i)
+    {
+        Page* page = c->pages[i];
+        if (page_pinned_(page, ctx.p) || heap_has_page_(&ctx.p->heap, page)) continue;
+#ifdef LISP_GC_INCREMENTAL
+        if (ctx.p->gc_cycle && heap_has_page_(&ctx.p->gc_cycle->from, page)) continue;
+#endif
+        page_destroy(page);
+    }
+    checkpoint_destroy_(c);
 }
 
 void lisp_print_collect_stats(LispContext ctx)
@@ -3109,8 +8763,19 @@ void lisp_print_collect_stats(LispContext ctx)
         page = page->next;
     }
     fprintf(ctx.p->err_port, "\ngc collected: %lu\t time: %lu us\n", ctx.p->gc_stat_freed, ctx.p->gc_stat_time);
-    fprintf(ctx.p->err_port, "heap size: %lu\t pages: %lu\n", ctx.p->heap.size, ctx.p->heap.page_count);
+    fprintf(ctx.p->err_port, "heap size: %lu\t pages: %lu\t large: %lu\n", ctx.p->heap.size, ctx.p->heap.page_count, ctx.p->heap.large_count);
     fprintf(ctx.p->err_port, "symbols: %lu \n", (size_t)lisp_table_size(ctx.p->symbols));
+    fprintf(ctx.p->err_port, "free pages: %lu\t next collection at: %lu\n", ctx.p->pool.count, ctx.p->heap_target);
+
+    // pauses of full collections, flips and incremental slices
+    size_t count = 0;
+    for (int i = 0; i < LISP_GC_PAUSE_BUCKETS; ++i) count += ctx.p->gc_pauses[i];
+    fprintf(ctx.p->err_port, "gc pauses: %lu\t longest: %lu us\n", count, ctx.p->gc_pause_max);
+    for (int i = 0; i < LISP_GC_PAUSE_BUCKETS; ++i)
+    {
+        if (ctx.p->gc_pauses[i] > 0)
+            fprintf(ctx.p->err_port, "  < %lu us: %lu\n", (size_t)2 << i, ctx.p->gc_pauses[i]);
+    }
 }
 
 Lisp lisp_env(LispContext ctx) { return ctx.p->env; }
@@ -3157,6 +8822,10 @@ const char* lisp_error_string(LispError error)
             return "eval error: index out of bounds";
         case LISP_ERROR_RUNTIME:
             return "evaluation called (error) and it was not handled";
+        case LISP_ERROR_HEAP_LIMIT:
+            return "eval error: heap limit exceeded";
+        case LISP_ERROR_OUT_OF_FUEL:
+            return "eval error: out of fuel";
         default:
             return "unknown error code";
     }
@@ -3176,12 +8845,47 @@ LispContext lisp_init(void)
     ctx.p->stack = malloc(sizeof(Lisp) * LISP_STACK_DEPTH);
     ctx.p->gc_stat_freed = 0;
     ctx.p->gc_stat_time = 0;
-
-    heap_init(&ctx.p->heap);
+    memset(&ctx.p->stats, 0, sizeof(LispHeapStats));
+    ctx.p->gc_threads = 1;
+    ctx.p->gc_pause = 0;
+    ctx.p->gc_cycle = NULL;
+    ctx.p->gc_next_slice = SIZE_MAX;
+    memset(ctx.p->gc_pauses, 0, sizeof(ctx.p->gc_pauses));
+    ctx.p->gc_pause_max = 0;
+    ctx.p->error_jmp = NULL;
+    ctx.p->heap_limit = SIZE_MAX;
+    ctx.p->fuel = INT64_MAX;
+    ctx.p->task = NULL;
+    ctx.p->profile = NULL;
+    ctx.p->profiling = 0;
+    ctx.p->call_depth = 0;
+    ctx.p->tracing = 0;
+#ifndef LISP_NO_HOOKS
+    memset(&ctx.p->hooks, 0, sizeof(LispHooks));
+#endif
+    ctx.p->workers = NULL;
+    ctx.p->worker_count = 0;
+    ctx.p->worker_init = NULL;
+    ctx.p->in_worker = 0;
+    ctx.p->checkpoints = NULL;
+    ctx.p->arenas = NULL;
+    ctx.p->arena_count = 0;
+    ctx.p->arena_capacity = 0;
+    ctx.p->remembered = NULL;
+    ctx.p->remembered_count = 0;
+    ctx.p->remembered_capacity = 0;
+    ctx.p->arena_symbols = 0;
+
+    page_pool_init_(&ctx.p->pool);
+    ctx.p->heap_target = LISP_HEAP_MIN;
+    ctx.p->heap_growth = 2.0;
+    ctx.p->heap_soft_max = 0;
+    heap_init(&ctx.p->heap, &ctx.p->pool, ctx.p);
 
     ctx.p->symbols = lisp_make_table(ctx);
     ctx.p->env = lisp_null();
     ctx.p->macros = lisp_make_table(ctx);
+    ctx.p->record_types = lisp_make_table(ctx);
 
     Lisp* c = ctx.p->symbol_cache;
     c[SYM_IF] = lisp_make_symbol("IF", ctx);
@@ -3195,12 +8899,45 @@ LispContext lisp_init(void)
     c[SYM_SET] = lisp_make_symbol("_SET!", ctx);
     c[SYM_LAMBDA] = lisp_make_symbol("/\\_", ctx);
     c[SYM_CONS] = lisp_make_symbol("CONS", ctx);
+    c[SYM_DELAY] = lisp_make_symbol("DELAY", ctx);
+    c[SYM_CONS_STREAM] = lisp_make_symbol("CONS-STREAM", ctx);
     return ctx;
 }
 
+void lisp_set_hooks(const LispHooks* hooks, LispContext ctx)
+{
+#ifndef LISP_NO_HOOKS
+    if (hooks)
+        ctx.p->hooks = *hooks;
+    else
+        memset(&ctx.p->hooks, 0, sizeof(LispHooks));
+    trace_update_(ctx);
+#endif
+}
+
 void lisp_shutdown(LispContext ctx)
 {
+#ifndef LISP_NO_THREADS
+    worker_pool_shutdown_(ctx.p->workers);
+#endif
+    lisp_cancel(ctx);
+    lisp_profile_stop(ctx);
+    profile_destroy_(ctx.p->profile);
+#ifdef LISP_GC_INCREMENTAL
+    if (ctx.p->gc_cycle)
+    {
+        heap_shutdown(&ctx.p->gc_cycle->from);
+        free(ctx.p->gc_cycle);
+        ctx.p->gc_cycle = NULL;
+    }
+#endif
+    arena_close_all_(ctx);
     heap_shutdown(&ctx.p->heap);
+    while (ctx.p->checkpoints)
+        lisp_checkpoint_free(ctx.p->checkpoints, ctx);
+    page_pool_shutdown_(&ctx.p->pool);
+    free(ctx.p->arenas);
+    free(ctx.p->remembered);
     free(ctx.p->stack);
     free(ctx.p);
 }
@@ -11,20 +11,857 @@
 #include "lisp.h"
 #include "lisp_lib.h"
 
+#ifdef _WIN32
+#define LISP_NO_LOAD_CACHE
+#define LISP_NO_SERVER
+#endif
+
+#ifndef LISP_NO_LOAD_CACHE
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifndef LISP_NO_SERVER
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#endif
+
 #define LINE_MAX 4096
 
+// -----------------------------------------
+// LOAD CACHE
+// -----------------------------------------
+
+// With --cache, loaded files are cached on disk after macro expansion.
+// Each cache file is keyed by the absolute path of the source (its name),
+// and stores the interpreter build ID and a hash of the source and of the macros
+// defined when it was loaded, along with the globals they use (see cache_hash_macros).
+// A mismatch on either is treated as a miss and the entry is rewritten.
+// Nothing is cached while a macro uses a value which can't be hashed.
+// The forms follow the header in the binary format of lisp_write_binary.
+//
+// Top-level DEFINE-MACRO and INCLUDE forms have side effects
+// at expansion time, so they are stored unexpanded and expanded again when loaded.
+// Files which use them anywhere else are not cached.
+
+#define CACHE_MAGIC "LSPC"
+#define CACHE_VERSION 2
+#define CACHE_BUILD_ID __DATE__ " " __TIME__
+
+static struct
+{
+    int enabled;
+    char dir[4096];
+    unsigned long hits;
+    unsigned long misses;
+} load_cache;
+
+static uint64_t cache_hash(const char* buffer, size_t n, uint64_t x)
+{
+    // FNV-1a
+    for (size_t i = 0; i < n; i++)
+    {
+        x ^= (unsigned char)buffer[i];
+        x *= 0x100000001b3;
+    }
+    return x;
+}
+
+#define CACHE_HASH_SEED 0xcbf29ce484222325
+
+// Expansion depends on the macros, and on anything they use when they run:
+// their parameters and bodies, the frames they closed over,
+// and the values of the globals they name, such as procedures they call.
+// Each global reached is hashed once, by its name and value.
+// Tables change order between runs, so their entries are summed,
+// and so are the globals. Cycles stop at containers already being hashed.
+#define CACHE_HASH_DEPTH 256
+
+typedef struct
+{
+    const void* path[CACHE_HASH_DEPTH];
+    int depth;
+    // globals found -> #t, and those whose values are still to be hashed.
+    Lisp globals;
+    Lisp pending;
+    // a value which can't be hashed by its contents (a file, promise, record, ...).
+    int unknown;
+    LispContext ctx;
+} CacheHasher;
+
+static void cache_note_global(CacheHasher* c, Lisp symbol)
+{
+    int present;
+    lisp_table_get(c->globals, symbol, &present);
+    if (present) return;
+
+    lisp_env_lookup(lisp_env(c->ctx), symbol, &present);
+    if (!present) return;
+
+    lisp_table_set(c->globals, symbol, lisp_true(), c->ctx);
+    c->pending = lisp_cons(symbol, c->pending, c->ctx);
+}
+
+// returns 0 if x is already being hashed.
+static int cache_enter(CacheHasher* c, Lisp x)
+{
+    for (int i = 0; i < c->depth; ++i)
+        if (c->path[i] == x.val.ptr_val) return 0;
+
+    if (c->depth == CACHE_HASH_DEPTH)
+    {
+        c->unknown = 1;
+        return 0;
+    }
+    c->path[c->depth++] = x.val.ptr_val;
+    return 1;
+}
+
+static uint64_t cache_hash_value(CacheHasher* c, Lisp x, uint64_t h)
+{
+    char type = (char)lisp_type(x);
+    h = cache_hash(&type, 1, h);
+    switch (lisp_type(x))
+    {
+        case LISP_NULL:
+            return h;
+        case LISP_SYMBOL:
+            cache_note_global(c, x);
+            return cache_hash(lisp_symbol_string(x), strlen(lisp_symbol_string(x)), h);
+        case LISP_STRING:
+            return cache_hash(lisp_string(x), strlen(lisp_string(x)), h);
+        case LISP_INT:
+        {
+            LispInt i = lisp_int(x);
+            return cache_hash((const char*)&i, sizeof(i), h);
+        }
+        case LISP_REAL:
+        {
+            LispReal r = lisp_real(x);
+            return cache_hash((const char*)&r, sizeof(r), h);
+        }
+        case LISP_CHAR:
+        case LISP_BOOL:
+        {
+            int c = lisp_type(x) == LISP_CHAR ? lisp_char(x) : lisp_bool(x);
+            return cache_hash((const char*)&c, sizeof(c), h);
+        }
+        case LISP_FUNC:
+        {
+            // the build is the same (see CACHE_BUILD_ID), but it may be loaded at another address.
+            uint64_t offset = (uint64_t)((uintptr_t)x.val.func_val - (uintptr_t)cache_hash);
+            return cache_hash((const char*)&offset, sizeof(offset), h);
+        }
+        case LISP_PORT_IN:
+        case LISP_PORT_OUT:
+        {
+            // the standard streams are the same every run. Other files aren't.
+            FILE* file = lisp_port(x);
+            int stream = file == stdin ? 0 : file == stdout ? 1 : file == stderr ? 2 : -1;
+            if (stream == -1) c->unknown = 1;
+            return cache_hash((const char*)&stream, sizeof(stream), h);
+        }
+        case LISP_F64VECTOR:
+            return cache_hash((const char*)lisp_f64vector(x), sizeof(LispReal) * lisp_typed_vector_length(x), h);
+        case LISP_S64VECTOR:
+            return cache_hash((const char*)lisp_s64vector(x), sizeof(LispInt) * lisp_typed_vector_length(x), h);
+        case LISP_BYTEVECTOR:
+            return cache_hash((const char*)lisp_bytevector(x), lisp_typed_vector_length(x), h);
+        case LISP_PAIR:
+        {
+            if (!cache_enter(c, x)) return h;
+            // a cycle of cdrs is found by one which moves half as fast.
+            Lisp slow = x;
+            int step = 0;
+            while (lisp_is_pair(x))
+            {
+                h = cache_hash_value(c, lisp_car(x), h);
+                x = lisp_cdr(x);
+                if (step++ & 1) slow = lisp_cdr(slow);
+                if (lisp_is_pair(x) && x.val.ptr_val == slow.val.ptr_val) break;
+            }
+            if (!lisp_is_pair(x)) h = cache_hash_value(c, x, h);
+            --c->depth;
+            return h;
+        }
+        case LISP_VECTOR:
+        {
+            if (!cache_enter(c, x)) return h;
+            int n = lisp_vector_length(x);
+            for (int i = 0; i < n; ++i)
+                h = cache_hash_value(c, lisp_vector_ref(x, i), h);
+            --c->depth;
+            return h;
+        }
+        case LISP_LAMBDA:
+        {
+            if (!cache_enter(c, x)) return h;
+            h = cache_hash_value(c, lambda_args_(x), h);
+            h = cache_hash_value(c, lisp_lambda_body(x), h);
+            // globals are hashed as they are named.
+            Lisp env = lisp_lambda_env(x);
+            for (; lisp_is_pair(env) && env_tail_index_(lisp_env(c->ctx), env) == -1; env = lisp_cdr(env))
+                h = cache_hash_value(c, lisp_car(env), h);
+            --c->depth;
+            return h;
+        }
+        case LISP_TABLE:
+        {
+            if (!cache_enter(c, x)) return h;
+            uint64_t sum = 0;
+            for (Lisp it = lisp_table_to_alist(x, c->ctx); lisp_is_pair(it); it = lisp_cdr(it))
+            {
+                Lisp entry = lisp_car(it);
+                sum += cache_hash_value(c, lisp_cdr(entry), cache_hash_value(c, lisp_car(entry), CACHE_HASH_SEED));
+            }
+            --c->depth;
+            return cache_hash((const char*)&sum, sizeof(sum), h);
+        }
+        default:
+            c->unknown = 1;
+            return h;
+    }
+}
+
+// Sets *out_unknown if the expansion depends on something the hash can't see.
+static uint64_t cache_hash_macros(int* out_unknown, LispContext ctx)
+{
+    CacheHasher c;
+    c.depth = 0;
+    c.globals = lisp_make_table(ctx);
+    c.pending = lisp_null();
+    c.unknown = 0;
+    c.ctx = ctx;
+
+    uint64_t h = cache_hash_value(&c, lisp_macro_table(ctx), CACHE_HASH_SEED);
+    while (lisp_is_pair(c.pending))
+    {
+        Lisp symbol = lisp_car(c.pending);
+        c.pending = lisp_cdr(c.pending);
+
+        int present;
+        Lisp value = lisp_env_lookup(lisp_env(ctx), symbol, &present);
+        h += cache_hash_value(&c, value, cache_hash_value(&c, symbol, CACHE_HASH_SEED));
+    }
+
+    *out_unknown = c.unknown;
+    return h;
+}
+
+#define CACHE_HEADER_MAX (4 + 4 + sizeof(CACHE_BUILD_ID) + 8)
+
+// magic, version, build ID, and content hash.
+// An entry is valid only if its header matches exactly.
+static size_t cache_header(uint64_t hash, char* out)
+{
+    char* it = out;
+    memcpy(it, CACHE_MAGIC, 4);
+    it += 4;
+    for (int i = 0; i < 4; ++i) *it++ = (char)(CACHE_VERSION >> (8 * i));
+    memcpy(it, CACHE_BUILD_ID, sizeof(CACHE_BUILD_ID));
+    it += sizeof(CACHE_BUILD_ID);
+    for (int i = 0; i < 8; ++i) *it++ = (char)(hash >> (8 * i));
+    return it - out;
+}
+
+static char* read_whole_file(const char* path, size_t* out_size)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file) return NULL;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char* data = size >= 0 ? malloc((size_t)size + 1) : NULL;
+    if (data && fread(data, 1, (size_t)size, file) != (size_t)size)
+    {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+
+    if (!data) return NULL;
+    data[size] = '\0';
+    *out_size = (size_t)size;
+    return data;
+}
+
+#ifndef LISP_NO_LOAD_CACHE
+static int cache_entry_path(const char* path, char* out, size_t out_size)
+{
+    char* absolute = realpath(path, NULL);
+    if (!absolute) return 0;
+
+    uint64_t key = cache_hash(absolute, strlen(absolute), CACHE_HASH_SEED);
+    free(absolute);
+    int n = snprintf(out, out_size, "%s/%016llx.lfc", load_cache.dir, (unsigned long long)key);
+    return n > 0 && (size_t)n < out_size;
+}
+
+static void make_dirs(const char* path)
+{
+    char scratch[4096];
+    snprintf(scratch, sizeof(scratch), "%s", path);
+    for (char* c = scratch + 1; *c; ++c)
+    {
+        if (*c == '/')
+        {
+            *c = '\0';
+            mkdir(scratch, 0755);
+            *c = '/';
+        }
+    }
+    mkdir(scratch, 0755);
+}
+#endif
+
+// Returns whether the forms can be cached.
+// Only top-level DEFINE-MACRO and INCLUDE are allowed.
+static int cache_check_r(Lisp x, LispContext ctx)
+{
+    if (lisp_type(x) == LISP_SYMBOL)
+    {
+        return !lisp_eq(x, lisp_make_symbol("DEFINE-MACRO", ctx)) &&
+            !lisp_eq(x, lisp_make_symbol("INCLUDE", ctx));
+    }
+    else if (lisp_type(x) == LISP_VECTOR)
+    {
+        int n = lisp_vector_length(x);
+        for (int i = 0; i < n; ++i)
+            if (!cache_check_r(lisp_vector_ref(x, i), ctx)) return 0;
+    }
+    else
+    {
+        while (lisp_is_pair(x))
+        {
+            if (!cache_check_r(lisp_car(x), ctx)) return 0;
+            x = lisp_cdr(x);
+        }
+    }
+    return 1;
+}
+
+static int is_expand_time_form(Lisp form, LispContext ctx)
+{
+    if (!lisp_is_pair(form)) return 0;
+    Lisp op = lisp_car(form);
+    return lisp_eq(op, lisp_make_symbol("DEFINE-MACRO", ctx)) ||
+        lisp_eq(op, lisp_make_symbol("INCLUDE", ctx));
+}
+
+static void cache_store(const char* entry, uint64_t hash, Lisp forms, LispContext ctx)
+{
+#ifndef LISP_NO_LOAD_CACHE
+    Lisp it = forms;
+    while (lisp_is_pair(it))
+    {
+        Lisp form = lisp_car(it);
+        Lisp to_check = is_expand_time_form(form, ctx) ? lisp_cdr(form) : form;
+        if (!cache_check_r(to_check, ctx)) return;
+        it = lisp_cdr(it);
+    }
+
+    make_dirs(load_cache.dir);
+
+    // write to a temporary and rename so readers never see a partial entry.
+    char temp[4096 + 32];
+    snprintf(temp, sizeof(temp), "%s.%ld.tmp", entry, (long)getpid());
+
+    FILE* file = fopen(temp, "wb");
+    if (!file) return;
+
+    char header[CACHE_HEADER_MAX];
+    fwrite(header, 1, cache_header(hash, header), file);
+
+    // fails if the forms contain objects without a binary representation.
+    int ok = lisp_write_binary(file, forms, ctx) == LISP_ERROR_NONE;
+
+    if (fclose(file) == 0 && ok)
+        rename(temp, entry);
+    else
+        remove(temp);
+#endif
+}
+
+static int cache_fetch(const char* entry, uint64_t hash, Lisp* out_forms, LispContext ctx)
+{
+    size_t size;
+    char* data = read_whole_file(entry, &size);
+    if (!data) return 0;
+
+    char header[CACHE_HEADER_MAX];
+    size_t header_size = cache_header(hash, header);
+
+    int ok = 0;
+    if (size >= header_size && memcmp(data, header, header_size) == 0)
+    {
+        LispError error;
+        const char* end = data + size;
+        const char* forms_end;
+        *out_forms = lisp_read_binary_range(data + header_size, end, &forms_end, &error, ctx);
+        ok = error == LISP_ERROR_NONE && forms_end == end;
+    }
+
+    free(data);
+    return ok;
+}
+
+static Lisp sch_eval_unexpanded(Lisp args, LispError* e, LispContext ctx)
+{
+    return lisp_eval(lisp_car(args), e, ctx);
+}
+
+// Reads and expands the file at path.
+// Returns a program ready for lisp_eval_expanded.
+static Lisp load_program(const char* path, LispError* e, LispContext ctx)
+{
+    *e = LISP_ERROR_NONE;
+
+    size_t size;
+    char* text = read_whole_file(path, &size);
+    if (!text)
+    {
+        *e = LISP_ERROR_FILE_OPEN;
+        return lisp_null();
+    }
+
+    uint64_t hash = cache_hash(text, size, CACHE_HASH_SEED);
+    Lisp begin = lisp_make_symbol("BEGIN", ctx);
+
+    char entry[4096];
+    int use_cache = 0;
+#ifndef LISP_NO_LOAD_CACHE
+    use_cache = load_cache.enabled && cache_entry_path(path, entry, sizeof(entry));
+    if (use_cache)
+    {
+        int unknown;
+        hash ^= cache_hash_macros(&unknown, ctx);
+        if (unknown) use_cache = 0;
+    }
+#endif
+
+    Lisp forms;
+    if (use_cache && cache_fetch(entry, hash, &forms, ctx))
+    {
+        ++load_cache.hits;
+        free(text);
+
+        // forms stored unexpanded are expanded and evaluated in order with the rest.
+        Lisp it = forms;
+        while (lisp_is_pair(it))
+        {
+            Lisp form = lisp_car(it);
+            if (is_expand_time_form(form, ctx))
+            {
+                Lisp quoted[] = { lisp_make_symbol("QUOTE", ctx), form };
+                Lisp call[] = { lisp_make_func(sch_eval_unexpanded), lisp_make_list2(quoted, 2, ctx) };
+                lisp_set_car(it, lisp_make_list2(call, 2, ctx));
+            }
+            it = lisp_cdr(it);
+        }
+        return lisp_cons(begin, forms, ctx);
+    }
+
+    Lisp program = lisp_read_range(text, text + size, e, ctx);
+    free(text);
+    if (*e != LISP_ERROR_NONE) return lisp_null();
+
+    if (lisp_type(program) == LISP_CHAR)
+    {
+        // empty file
+        return lisp_null();
+    }
+    else if (lisp_is_pair(program) && lisp_eq(lisp_car(program), begin))
+    {
+        forms = lisp_cdr(program);
+    }
+    else
+    {
+        forms = lisp_cons(program, lisp_null(), ctx);
+        program = lisp_cons(begin, forms, ctx);
+    }
+
+    // remember the forms which must be expanded again at load.
+    Lisp raw = use_cache ? lisp_list_copy(forms, ctx) : lisp_null();
+
+    Lisp expanded = lisp_macroexpand(program, e, ctx);
+    if (*e != LISP_ERROR_NONE) return lisp_null();
+
+    if (use_cache)
+    {
+        Lisp it = raw;
+        Lisp expanded_it = lisp_cdr(expanded);
+        while (lisp_is_pair(it))
+        {
+            if (!is_expand_time_form(lisp_car(it), ctx))
+                lisp_set_car(it, lisp_car(expanded_it));
+
+            it = lisp_cdr(it);
+            expanded_it = lisp_cdr(expanded_it);
+        }
+
+        ++load_cache.misses;
+        cache_store(entry, hash, raw, ctx);
+    }
+
+    return expanded;
+}
+
 static Lisp sch_load(Lisp args, LispError* e, LispContext ctx)
 {
     Lisp path = lisp_car(args);
-    Lisp result = lisp_read_path(lisp_string(path), e, ctx);
+    Lisp program = load_program(lisp_string(path), e, ctx);
     if (*e != LISP_ERROR_NONE) return lisp_null();
-    return lisp_eval(result, e, ctx);
+    return lisp_eval_expanded(program, lisp_env(ctx), e, ctx);
 }
 
+static void cache_default_dir(void)
+{
+    const char* base = getenv("XDG_CACHE_HOME");
+    if (base && *base)
+    {
+        snprintf(load_cache.dir, sizeof(load_cache.dir), "%s/lisp", base);
+        return;
+    }
+
+    base = getenv("HOME");
+    if (base && *base)
+    {
+        snprintf(load_cache.dir, sizeof(load_cache.dir), "%s/.cache/lisp", base);
+        return;
+    }
+
+    load_cache.enabled = 0;
+}
+
+// -----------------------------------------
+// SERVER
+// -----------------------------------------
+
+// --serve keeps a context with the library loaded,
+// and runs scripts sent by --client over a Unix domain socket, one at a time.
+// The client passes its stdin, stdout and stderr with the request,
+// so output goes straight to it, and gets back the exit status.
+// The context is checkpointed once it is set up, and restored after each script,
+// so nothing a script defines or changes is seen by the next.
+//
+// request: kind ('F' path or 'T' text), u32 cwd length, u32 payload length, cwd, payload.
+// response: one byte, the exit status.
+
+#ifndef LISP_NO_SERVER
+
+#define SERVER_HEADER_SIZE 9
+
+static int write_all(int fd, const char* buffer, size_t n)
+{
+    while (n > 0)
+    {
+        ssize_t count = write(fd, buffer, n);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return 0;
+        buffer += count;
+        n -= (size_t)count;
+    }
+    return 1;
+}
+
+static int read_all(int fd, char* buffer, size_t n)
+{
+    while (n > 0)
+    {
+        ssize_t count = read(fd, buffer, n);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return 0;
+        buffer += count;
+        n -= (size_t)count;
+    }
+    return 1;
+}
+
+static void put_u32(char* out, uint32_t x)
+{
+    for (int i = 0; i < 4; ++i) out[i] = (char)(x >> (8 * i));
+}
+
+static uint32_t get_u32(const char* in)
+{
+    uint32_t x = 0;
+    for (int i = 0; i < 4; ++i) x |= (uint32_t)(unsigned char)in[i] << (8 * i);
+    return x;
+}
+
+static int socket_address(const char* path, struct sockaddr_un* address)
+{
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path)) return 0;
+    strcpy(address->sun_path, path);
+    return 1;
+}
+
+// Runs a script like --script, and returns the exit status.
+static int serve_script(char kind, const char* payload, size_t size, LispContext ctx)
+{
+    LispError error;
+    Lisp code;
+    if (kind == 'F')
+    {
+        code = load_program(payload, &error, ctx);
+        if (error != LISP_ERROR_NONE)
+        {
+            fprintf(stderr, "%s. %s\n", payload, lisp_error_string(error));
+            return 1;
+        }
+    }
+    else
+    {
+        code = lisp_read_range(payload, payload + size, &error, ctx);
+        if (error == LISP_ERROR_NONE)
+            code = lisp_macroexpand(code, &error, ctx);
+        if (error != LISP_ERROR_NONE)
+        {
+            fprintf(stderr, "%s\n", lisp_error_string(error));
+            return 1;
+        }
+    }
+
+    lisp_eval_expanded(code, lisp_env(ctx), &error, ctx);
+    if (error != LISP_ERROR_NONE)
+    {
+        fprintf(stderr, "%s\n", lisp_error_string(error));
+        return 1;
+    }
+    return 0;
+}
+
+// Reads a request from the connection and runs it with the client's files.
+static int serve_request(int connection, int* out_status, LispContext ctx)
+{
+    char header[SERVER_HEADER_SIZE];
+    int fds[3];
+
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec io = { header, SERVER_HEADER_SIZE };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    if (recvmsg(connection, &message, MSG_WAITALL) != SERVER_HEADER_SIZE) return 0;
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+    if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) return 0;
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    size_t cwd_size = get_u32(header + 1);
+    size_t size = get_u32(header + 5);
+    char* data = malloc(cwd_size + size + 2);
+    int ok = read_all(connection, data, cwd_size + size);
+
+    if (ok)
+    {
+        char* cwd = data;
+        char* payload = data + cwd_size + 1;
+        memmove(payload, data + cwd_size, size);
+        cwd[cwd_size] = '\0';
+        payload[size] = '\0';
+
+        if (chdir(cwd) != 0)
+        {
+            *out_status = 1;
+        }
+        else
+        {
+            for (int i = 0; i < 3; ++i) dup2(fds[i], i);
+            *out_status = serve_script(header[0], payload, size, ctx);
+            fflush(stdout);
+            fflush(stderr);
+            clearerr(stdin);
+        }
+    }
+
+    free(data);
+    for (int i = 0; i < 3; ++i) close(fds[i]);
+    return ok;
+}
+
+static int serve(const char* socket_path, int verbose, LispContext ctx)
+{
+    struct sockaddr_un address;
+    if (!socket_address(socket_path, &address))
+    {
+        fprintf(stderr, "socket path too long: %s\n", socket_path);
+        return 1;
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path);
+    if (listener < 0 ||
+        bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(listener, 64) != 0)
+    {
+        fprintf(stderr, "failed to listen on: %s\n", socket_path);
+        return 1;
+    }
+
+    // a client may leave before reading its status.
+    signal(SIGPIPE, SIG_IGN);
+    // input is read straight from each client.
+    setvbuf(stdin, NULL, _IONBF, 0);
+
+    // keep the server's own files to switch back to.
+    int saved[3];
+    for (int i = 0; i < 3; ++i) saved[i] = dup(i);
+
+    LispCheckpoint* checkpoint = lisp_checkpoint(ctx);
+    if (!checkpoint)
+    {
+        fprintf(stderr, "failed to checkpoint\n");
+        return 1;
+    }
+
+    while (1)
+    {
+        int connection = accept(listener, NULL, NULL);
+        if (connection < 0)
+        {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        clock_t start_time = clock();
+
+        int status = 1;
+        int ok = serve_request(connection, &status, ctx);
+        for (int i = 0; i < 3; ++i) dup2(saved[i], i);
+
+        if (ok)
+        {
+            char byte = (char)status;
+            write_all(connection, &byte, 1);
+        }
+        close(connection);
+
+        lisp_restore(checkpoint, ctx);
+
+        if (verbose)
+            fprintf(stderr, "request (us): %lu\n", 1000000 * (clock() - start_time) / CLOCKS_PER_SEC);
+    }
+
+    close(listener);
+    return 0;
+}
+
+// Sends a script to a server, and returns its exit status.
+// A path of "-" sends the text of stdin instead.
+static int client(const char* socket_path, const char* path)
+{
+    char kind = 'F';
+    char* payload = NULL;
+    size_t size = 0;
+
+    if (strcmp(path, "-") == 0)
+    {
+        kind = 'T';
+        size_t capacity = 4096;
+        payload = malloc(capacity);
+        size_t count;
+        while ((count = fread(payload + size, 1, capacity - size, stdin)) > 0)
+        {
+            size += count;
+            if (size == capacity)
+            {
+                capacity *= 2;
+                payload = realloc(payload, capacity);
+            }
+        }
+    }
+    else
+    {
+        // the server runs in another directory.
+        payload = realpath(path, NULL);
+        if (!payload)
+        {
+            fprintf(stderr, "%s. %s\n", path, lisp_error_string(LISP_ERROR_FILE_OPEN));
+            return 1;
+        }
+        size = strlen(payload);
+    }
+
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof(cwd))) cwd[0] = '\0';
+    size_t cwd_size = strlen(cwd);
+
+    struct sockaddr_un address;
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0 ||
+        !socket_address(socket_path, &address) ||
+        connect(connection, (struct sockaddr*)&address, sizeof(address)) != 0)
+    {
+        fprintf(stderr, "failed to connect to: %s\n", socket_path);
+        free(payload);
+        return 1;
+    }
+
+    char header[SERVER_HEADER_SIZE];
+    header[0] = kind;
+    put_u32(header + 1, (uint32_t)cwd_size);
+    put_u32(header + 5, (uint32_t)size);
+
+    int fds[3] = { 0, 1, 2 };
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct iovec io = { header, SERVER_HEADER_SIZE };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    char status = 1;
+    if (sendmsg(connection, &message, 0) != SERVER_HEADER_SIZE ||
+        !write_all(connection, cwd, cwd_size) ||
+        !write_all(connection, payload, size) ||
+        !read_all(connection, &status, 1))
+    {
+        fprintf(stderr, "lost connection to: %s\n", socket_path);
+        status = 1;
+    }
+
+    close(connection);
+    free(payload);
+    return status;
+}
+
+#endif
+
 int main(int argc, const char* argv[])
 {
     const char* file_path = NULL;
     int run_script = 0;
+    int gc_threads = 1;
+    int gc_pause = 0;
+    double heap_growth = 2.0;
+    size_t heap_max = 0;
+    size_t heap_limit = 0;
+    size_t time_slice = 0;
+    int workers = 0;
+    const char* profile_path = NULL;
+    const char* serve_path = NULL;
+    const char* client_path = NULL;
     int verbose;
 #ifdef LISP_DEBUG
     verbose = 1;
@@ -32,6 +869,10 @@ int main(int argc, const char* argv[])
     verbose = 0;
 #endif
 
+    // off unless asked for
+    load_cache.enabled = 0;
+    int no_cache = 0;
+
     for (int i = 1; i < argc; ++i)
     {
         if (strcmp(argv[i], "--load") == 0)
@@ -43,10 +884,98 @@ int main(int argc, const char* argv[])
             file_path = argv[i + 1];
             run_script = 1;
         }
+        if (strcmp(argv[i], "--verbose") == 0)
+        {
+            verbose = 1;
+        }
+        if (strcmp(argv[i], "--cache") == 0)
+        {
+            load_cache.enabled = 1;
+        }
+        if (strcmp(argv[i], "--no-cache") == 0)
+        {
+            no_cache = 1;
+        }
+        if (strcmp(argv[i], "--cache-dir") == 0 && i + 1 < argc)
+        {
+            load_cache.enabled = 1;
+            snprintf(load_cache.dir, sizeof(load_cache.dir), "%s", argv[i + 1]);
+        }
+        if (strcmp(argv[i], "--gc-threads") == 0 && i + 1 < argc)
+        {
+            gc_threads = atoi(argv[i + 1]);
+        }
+        if (strcmp(argv[i], "--gc-pause") == 0 && i + 1 < argc)
+        {
+            gc_pause = atoi(argv[i + 1]);
+        }
+        if (strcmp(argv[i], "--heap-growth") == 0 && i + 1 < argc)
+        {
+            heap_growth = atof(argv[i + 1]);
+        }
+        if (strcmp(argv[i], "--heap-max") == 0 && i + 1 < argc)
+        {
+            // in megabytes
+            heap_max = (size_t)atol(argv[i + 1]) * 1024 * 1024;
+        }
+        if (strcmp(argv[i], "--heap-limit") == 0 && i + 1 < argc)
+        {
+            // in megabytes
+            heap_limit = (size_t)atol(argv[i + 1]) * 1024 * 1024;
+        }
+        if (strcmp(argv[i], "--time-slice") == 0 && i + 1 < argc)
+        {
+            // evaluation steps
+            time_slice = (size_t)atol(argv[i + 1]);
+        }
+        if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+        {
+            // threads for futures and parallel maps
+            workers = atoi(argv[i + 1]);
+        }
+        if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+        {
+            // where to write folded stacks
+            profile_path = argv[i + 1];
+        }
+        if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+        {
+            // socket to run scripts from clients on
+            serve_path = argv[i + 1];
+        }
+        if (strcmp(argv[i], "--client") == 0 && i + 1 < argc)
+        {
+            // socket of a server to run the script on
+            client_path = argv[i + 1];
+        }
+    }
+
+#ifdef LISP_NO_LOAD_CACHE
+    no_cache = 1;
+#endif
+    if (no_cache) load_cache.enabled = 0;
+    if (load_cache.enabled && !load_cache.dir[0]) cache_default_dir();
+
+#ifndef LISP_NO_SERVER
+    // the client doesn't need a context of its own.
+    if (client_path)
+    {
+        if (!file_path)
+        {
+            fprintf(stderr, "--client needs --script\n");
+            return 1;
+        }
+        return client(client_path, file_path);
     }
+#endif
 
     //LispContext ctx = lisp_init();
     LispContext ctx = lisp_init_with_lib();
+    lisp_set_gc_threads(gc_threads, ctx);
+    lisp_set_gc_pause(gc_pause, ctx);
+    lisp_set_heap_growth(heap_growth, heap_max, ctx);
+    lisp_set_heap_limit(heap_limit, ctx);
+    lisp_set_workers(workers, ctx);
     lisp_env_define(
         lisp_cdr(lisp_env(ctx)),
         lisp_make_symbol("LOAD", ctx),
@@ -62,6 +991,15 @@ int main(int argc, const char* argv[])
             ctx
     );
 
+#ifndef LISP_NO_SERVER
+    if (serve_path)
+    {
+        int status = serve(serve_path, verbose, ctx);
+        lisp_shutdown(ctx);
+        return status;
+    }
+#endif
+
     clock_t start_time, end_time;
 
     if (file_path)
@@ -74,38 +1012,60 @@ int main(int argc, const char* argv[])
         start_time = clock();
 
         LispError error;
-        Lisp l = lisp_read_path(file_path, &error, ctx);
+        Lisp code = load_program(file_path, &error, ctx);
 
         if (error != LISP_ERROR_NONE)
         {
             fprintf(stderr, "%s. %s\n", file_path, lisp_error_string(error));
+            exit(1);
         }
 
         end_time = clock();
 
         if (verbose)
-            printf("read (us): %lu\n", 1000000 * (end_time - start_time) / CLOCKS_PER_SEC);
+            printf("read+expand (us): %lu\n", 1000000 * (end_time - start_time) / CLOCKS_PER_SEC);
 
         start_time = clock();
+        if (profile_path)
+            lisp_profile_start(1000, ctx);
 
-        Lisp code = lisp_macroexpand(l, &error, ctx);
+        if (time_slice > 0)
+        {
+            // suspend every so often, as a host running many scripts would.
+            lisp_set_fuel(time_slice, ctx);
+            lisp_eval_resumable(code, lisp_env(ctx), &error, ctx);
+            while (error == LISP_ERROR_OUT_OF_FUEL)
+            {
+                if (lisp_should_collect(ctx))
+                    lisp_collect(lisp_null(), ctx);
 
-        if (error != LISP_ERROR_NONE)
+                lisp_set_fuel(time_slice, ctx);
+                lisp_resume(&error, ctx);
+            }
+            lisp_set_fuel(0, ctx);
+        }
+        else
         {
-            fprintf(stderr, "%s\n", lisp_error_string(error));
-            exit(1);
+            lisp_eval_expanded(code, lisp_env(ctx), &error, ctx);
         }
-
-
         end_time = clock();
 
-        if (verbose)
-            printf("expand (us): %lu\n", 1000000 * (end_time - start_time) / CLOCKS_PER_SEC);
-
+        if (profile_path)
+        {
+            lisp_profile_stop(ctx);
+            lisp_profile_print(stderr, ctx);
 
-        start_time = clock();
-        lisp_eval(code, &error, ctx);
-        end_time = clock();
+            FILE* file = fopen(profile_path, "w");
+            if (file)
+            {
+                lisp_profile_write_folded(file, ctx);
+                fclose(file);
+            }
+            else
+            {
+                fprintf(stderr, "failed to write profile: %s\n", profile_path);
+            }
+        }
 
         if (error != LISP_ERROR_NONE)
         {
@@ -113,10 +1073,14 @@ int main(int argc, const char* argv[])
             exit(1);
         }
 
-        lisp_collect(lisp_null(), ctx);
+        if (lisp_should_collect(ctx))
+            lisp_collect(lisp_null(), ctx);
 
         if (verbose)
+        {
             printf("eval (us): %lu\n", 1000000 * (end_time - start_time) / CLOCKS_PER_SEC);
+            printf("cache hits: %lu misses: %lu\n", load_cache.hits, load_cache.misses);
+        }
     }
 
     if (!run_script)
@@ -160,4 +1124,3 @@ int main(int argc, const char* argv[])
 
     return 0;
 }
-
@@ -0,0 +1,23 @@
+#!/bin/sh
+
+# Each benchmark is run twice against a fresh load cache.
+# The cold run reads and expands the source, the warm run loads the cached forms.
+
+CACHE_DIR=$(mktemp -d)
+
+cd tests/benchmarks
+
+for FILE in *.scm
+do
+    echo "$FILE"
+
+    printf "cold\n"
+    ../../lisp --script "$FILE" --cache-dir "$CACHE_DIR" --verbose | grep -E "\(us\)|cache"
+
+    printf "warm\n"
+    ../../lisp --script "$FILE" --cache-dir "$CACHE_DIR" --verbose | grep -E "\(us\)|cache"
+
+    printf "\n"
+done
+
+rm -rf "$CACHE_DIR"
@@ -21,6 +21,59 @@ do
     printf "\n"
 done
 
+# again with the parallel collector
+for FILE in *.scm
+do
+    ../../lisp --script "$FILE" --gc-threads 4 > /dev/null
+    if [ $? != "0" ]
+    then
+        echo "*FAILED* $FILE (--gc-threads 4)"
+        PASS=0
+    fi
+done
+
+# again with the incremental collector, slicing as often as possible
+for FILE in *.scm
+do
+    ../../lisp-incremental --script "$FILE" --gc-pause 1 > /dev/null
+    if [ $? != "0" ]
+    then
+        echo "*FAILED* $FILE (--gc-pause 1)"
+        PASS=0
+    fi
+done
+
+# again suspending and resuming evaluation, collecting in between
+for FILE in *.scm
+do
+    ../../lisp --script "$FILE" --time-slice 100 --heap-max 4 > /dev/null
+    if [ $? != "0" ]
+    then
+        echo "*FAILED* $FILE (--time-slice 100)"
+        PASS=0
+    fi
+done
+
+# again through one server, each script after the others
+SOCKET="/tmp/lisp-test-$$.sock"
+../../lisp --serve "$SOCKET" > /dev/null 2>&1 &
+SERVER=$!
+sleep 1
+for FILE in *.scm
+do
+    ../../lisp --client "$SOCKET" --script "$FILE" > /dev/null 2>&1
+    if [ $? != "0" ]
+    then
+        echo "*FAILED* $FILE (--client)"
+        PASS=0
+    fi
+done
+kill $SERVER
+rm -f "$SOCKET"
+
+# files the tests write
+rm -f binary.bin json.tmp indexed.tmp
+
 cd ../
 cd data
 
@@ -49,6 +102,34 @@ else
     PASS=0
 fi
 
+cd ../
+cd cache
+
+( ./test.sh )
+RESULT=$?
+
+if [ $RESULT = "0" ]
+then
+    echo "FINISHED cache test"
+else
+    echo "*FAILED* cache test"
+    PASS=0
+fi
+
+cd ../
+cd api
+
+( ./test.sh )
+RESULT=$?
+
+if [ $RESULT = "0" ]
+then
+    echo "FINISHED api test"
+else
+    echo "*FAILED* api test"
+    PASS=0
+fi
+
 if [ $PASS = "0" ]
 then
   echo "**TESTS FAILED**"
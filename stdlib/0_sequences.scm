@@ -33,19 +33,6 @@
       (if (pred (car l)) #t 
           (some? pred (cdr l))))) 
 
-(define (_map1-helper proc l result) 
-  (if (null? l) 
-      (reverse! result) 
-      (_map1-helper proc 
-                    (cdr l) 
-                    (cons (proc (car l)) result)))) 
-
-(define (map1 proc l) (_map1-helper proc l '())) 
-
-(define (for-each1 proc l) 
-  (if (null? l) '() 
-      (begin (proc (car l)) (for-each1 proc (cdr l ))))) 
-
 (define (reverse! l) (append-reverse! l '()))
 (define (reverse l) (reverse! (list-copy l))) 
 
@@ -57,10 +44,6 @@
  (if (zero? k) x 
   (list-tail (cdr x) (- k 1)))) 
 
-(define (fold-left op acc lst)
-  (if (null? lst) acc 
-      (fold-left op (op acc (car lst)) (cdr lst))))
-
 (define (_expand-shorthand-body path) 
   (if (null? path) (cons 'pair '()) 
       (list (if (char=? (car path) #\A) 
@@ -73,3 +73,8 @@
               (lambda (x)
                 `(SET! ,x (- ,x 1))))
 
+
+; (let/ec k body ...) binds k to an escape procedure for body.
+(define-macro let/ec
+              (lambda (k . body)
+                `(CALL/EC (LAMBDA (,k) ,(cons (quote BEGIN) body)))))
@@ -1,15 +1,10 @@
+; delay and cons-stream are evaluated natively,
+; and force, stream-head, stream-tail and stream->list are builtin.
 
-(define-macro delay (lambda (expr)
-                      `(make-promise ,(cons 'LAMBDA
-                                            (cons '()
-                                                  (cons expr '()))))))
+; futures are promises computed by a worker.
+(define (touch x) (if (promise? x) (force x) x))
 
-(define (force promise)
-  (if (not (promise-forced? promise))
-      (_promise-store! promise ((_promise-procedure promise))))
-  (promise-value promise))
-
-(define-macro cons-stream (lambda (x expr) `(cons ,x (delay ,expr))))
+(define the-empty-stream '())
 
 (define (stream-car stream) (car stream))
 (define (stream-cdr stream) (force (cdr stream)))
@@ -19,16 +14,6 @@
 
 (define (stream-null? stream) (null? stream))
 
-(define (stream->list-helper stream result)
-  (if (stream-null? stream)
-      (reverse! result)
-      (stream->list-helper 
-        (force (cdr stream)) 
-        (cons (car stream) result)))) 
-
-(define (stream->list stream) 
-  (stream->list-helper stream '())) 
-
 (define (list->stream list) 
   (if (null? list) 
       '() 
@@ -36,19 +21,6 @@
 
 (define (stream . args) (list->stream args)) 
 
-(define (stream-head-helper stream k result) 
-  (if (= k 0) 
-      (reverse! result) 
-      (stream-head-helper (force (cdr stream)) (- k 1) (cons (car stream) result)))) 
-
-(define (stream-head stream k) 
-  (stream-head-helper stream k '())) 
-
-(define (stream-tail stream k) 
-  (if (= k 0) 
-      stream 
-      (stream-tail (stream-cdr stream) (- k 1)))) 
-
 (define (stream-filter pred stream) 
   (cond ((stream-null? stream) the-empty-stream) 
         ((pred (stream-car stream)) 
@@ -32,6 +32,28 @@
                 (current-output-port)
                 (car args))))
 
+(define (read-binary . args) 
+  (_read-binary (if (null? args)
+                  (current-input-port)
+                  (car args))))
+
+(define (write-binary obj . args) 
+  (_write-binary obj (if (null? args)
+                       (current-output-port)
+                       (car args))))
+
+; (json-read [port [string-keys?]])
+(define (json-read . args) 
+  (_json-read (if (null? args)
+                (current-input-port)
+                (car args))
+              (and (pair? args) (pair? (cdr args)) (car (cdr args)))))
+
+(define (json-write obj . args) 
+  (_json-write obj (if (null? args)
+                     (current-output-port)
+                     (car args))))
+
 (define (display obj . args) 
   (_display obj (if (null? args)
                   (current-output-port)
@@ -60,4 +82,19 @@
 (define-macro ==>  (lambda (test expected) 
                 `(assert (equal? ,test (quote ,expected))) ))  
 
-
+; SRFI-9
+; (define-record-type point (make-point x y) point? (x point-x set-point-x!) (y point-y))
+(define-macro define-record-type
+              (lambda (type constructor predicate . fields)
+                (define (field-definitions field)
+                  (cons `(DEFINE ,(car (cdr field)) (RECORD-ACCESSOR ,type (QUOTE ,(car field))))
+                        (if (pair? (cdr (cdr field)))
+                            (list `(DEFINE ,(car (cdr (cdr field))) (RECORD-MODIFIER ,type (QUOTE ,(car field)))))
+                            '())))
+                (cons 'BEGIN
+                      (append (list `(DEFINE ,type (MAKE-RECORD-TYPE (QUOTE ,type) (QUOTE ,(map car fields)))))
+                              (if (pair? constructor)
+                                  (list `(DEFINE ,(car constructor) (RECORD-CONSTRUCTOR ,type (QUOTE ,(cdr constructor)))))
+                                  '())
+                              (if predicate (list `(DEFINE ,predicate (RECORD-PREDICATE ,type))) '())
+                              (apply append (map field-definitions fields))))))
@@ -0,0 +1,40 @@
+; Lazy reading of a file holding one big list or vector.
+; The file is mapped and only the offsets of its elements are found up front.
+; indexed-ref reads an element the first time and keeps it,
+; and indexed-for-each reads each in turn without keeping them.
+
+(define-record-type indexed
+  (_make-indexed text offsets cache)
+  indexed?
+  (text _indexed-text)
+  (offsets _indexed-offsets)
+  (cache _indexed-cache))
+
+(define _unread (list 'unread))
+
+(define (read-indexed path)
+  (let* ((text (file->string path))
+         (offsets (_index-text text)))
+    (_make-indexed text offsets (make-vector (quotient (s64vector-length offsets) 2) _unread))))
+
+(define (indexed-length x) (vector-length (_indexed-cache x)))
+
+(define (_indexed-read x i)
+  (let ((offsets (_indexed-offsets x)))
+    (_read-text (_indexed-text x)
+                (s64vector-ref offsets (* 2 i))
+                (s64vector-ref offsets (+ (* 2 i) 1)))))
+
+(define (indexed-ref x i)
+  (let ((cached (vector-ref (_indexed-cache x) i)))
+    (if (eq? cached _unread)
+        (let ((value (_indexed-read x i)))
+          (vector-set! (_indexed-cache x) i value)
+          value)
+        cached)))
+
+(define (indexed-for-each proc x)
+  (let ((n (indexed-length x)))
+    (do ((i 0 (+ i 1))) ((= i n))
+      (let ((cached (vector-ref (_indexed-cache x) i)))
+        (proc (if (eq? cached _unread) (_indexed-read x i) cached))))))
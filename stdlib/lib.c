@@ -6,6 +6,8 @@
 #include <math.h>
 #include <stdint.h>
 #include <assert.h>
+#include <setjmp.h>
+#include <errno.h>
 
 #define ARITY_CHECK(min_, max_) do { \
   int args_length_ = lisp_list_length(args); \
@@ -136,1022 +138,3007 @@ static Lisp sch_read(Lisp args, LispError* e, LispContext ctx)
     return lisp_read_file(lisp_port(a), e, ctx);
 }
 
-static Lisp sch_is_port_in(Lisp args, LispError* e, LispContext ctx)
-{
-    return lisp_make_bool(lisp_type(lisp_car(args)) == LISP_PORT_IN);
-}
-
-static Lisp sch_is_port_out(Lisp args, LispError* e, LispContext ctx)
+// (_index-text text) the offsets of the elements of the list or vector in text.
+static Lisp sch_index_text(Lisp args, LispError* e, LispContext ctx)
 {
-    return lisp_make_bool(lisp_type(lisp_car(args)) == LISP_PORT_OUT);
+    ARITY_CHECK(1, 1);
+    Lisp text = lisp_car(args);
+    if (lisp_type(text) != LISP_STRING)
+    {
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
+    }
+    const char* start = lisp_string(text);
+    return lisp_index_range(start, start + lisp_buffer_capacity(text) - 1, e, ctx);
 }
 
-static Lisp sch_open_input(Lisp args, LispError* e, LispContext ctx)
+// (_read-text text start end)
+static Lisp sch_read_text(Lisp args, LispError* e, LispContext ctx)
 {
-    ARITY_CHECK(1, 1);
-    Lisp a = lisp_car(args);
-    FILE* f = fopen(lisp_string(a), "r");
-    if (!f) {
-        *e = LISP_ERROR_FILE_OPEN;
+    ARITY_CHECK(3, 3);
+    Lisp text = lisp_car(args);
+    args = lisp_cdr(args);
+    Lisp start = lisp_car(args);
+    Lisp end = lisp_car(lisp_cdr(args));
+    if (lisp_type(text) != LISP_STRING || lisp_type(start) != LISP_INT || lisp_type(end) != LISP_INT)
+    {
+        *e = LISP_ERROR_ARG_TYPE;
         return lisp_null();
     }
-
-    return lisp_make_port(f, 1);
+    if (lisp_int(start) < 0 || lisp_int(start) > lisp_int(end) || lisp_int(end) >= lisp_buffer_capacity(text))
+    {
+        *e = LISP_ERROR_OUT_OF_BOUNDS;
+        return lisp_null();
+    }
+    const char* c = lisp_string(text);
+    return lisp_read_range(c + lisp_int(start), c + lisp_int(end), e, ctx);
 }
 
-static Lisp sch_open_output(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_write_binary(Lisp args, LispError* e, LispContext ctx)
 {
-    ARITY_CHECK(1, 1);
+    ARITY_CHECK(2, 2);
     Lisp a = lisp_car(args);
-    FILE* f = fopen(lisp_string(a), "w");
-    return lisp_make_port(f, 0);
+    args = lisp_cdr(args);
+    Lisp b = lisp_car(args);
+    *e = lisp_write_binary(lisp_port(b), a, ctx);
+    return lisp_null();
 }
 
-static Lisp sch_port_close(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_read_binary(Lisp args, LispError* e, LispContext ctx)
 {
     ARITY_CHECK(1, 1);
     Lisp a = lisp_car(args);
-    fclose(lisp_port(a));
-    return lisp_null();
+    return lisp_read_binary(lisp_port(a), e, ctx);
 }
 
-static Lisp sch_is_eof(Lisp args, LispError* e, LispContext ctx)
-{
-    return lisp_make_bool(lisp_equal(lisp_car(args), lisp_eof()));
-}
+// -----------------------------------------
+// JSON
+// -----------------------------------------
 
-static Lisp sch_error(Lisp args, LispError* e, LispContext ctx)
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define JSON_DEPTH_MAX 512
+
+typedef struct
 {
-   if (lisp_is_pair(args))
-   {
-       Lisp l = lisp_car(args);
-       fputs(lisp_string(l), lisp_stderr(ctx));
-       args = lisp_cdr(args);
-   }
-   while (lisp_is_pair(args))
-   {
-       fputs(" ", lisp_stderr(ctx));
-       lisp_printf(lisp_stderr(ctx), lisp_car(args));
-       args = lisp_cdr(args);
-   }
+    const char* c;
+    const char* end;
+    int flags;
+    int depth;
 
-   *e = LISP_ERROR_RUNTIME;
-   return lisp_null();
-}
+    // values of the objects and arrays being read.
+    Lisp* stack;
+    size_t stack_size;
+    size_t stack_capacity;
 
-static Lisp sch_syntax_error(Lisp args, LispError* e, LispContext ctx)
+    // decoded string scratch
+    char* scratch;
+    size_t scratch_capacity;
+
+    jmp_buf error_jmp;
+    LispContext ctx;
+} JsonReader;
+
+static void json_push_(JsonReader* r, Lisp x)
 {
-    fprintf(lisp_stderr(ctx), "expand error: %s ", lisp_string(lisp_car(args)));
-    args = lisp_cdr(args);
-    if (!lisp_is_null(args))
+    if (r->stack_size == r->stack_capacity)
     {
-        lisp_printf(lisp_stderr(ctx), lisp_car(args));
+        r->stack_capacity = r->stack_capacity ? r->stack_capacity * 2 : 256;
+        r->stack = realloc(r->stack, sizeof(Lisp) * r->stack_capacity);
     }
-    fprintf(lisp_stderr(ctx), "\n");
+    r->stack[r->stack_size++] = x;
+}
 
-    *e = LISP_ERROR_FORM_SYNTAX;
-    return lisp_null();
+static void json_skip_space_(JsonReader* r)
+{
+    const char* c = r->c;
+    while (c < r->end && (*c == ' ' || *c == '\n' || *c == '\r' || *c == '\t')) ++c;
+    r->c = c;
 }
 
-static Lisp sch_equals(Lisp args, LispError* e, LispContext ctx)
+static void json_expect_(JsonReader* r, char x)
 {
-    Lisp to_check  = lisp_car(args);
-    if (lisp_is_null(to_check)) return lisp_true();
-    args = lisp_cdr(args);
+    json_skip_space_(r);
+    if (r->c == r->end || *r->c != x) longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
+    ++r->c;
+}
 
-    while (lisp_is_pair(args))
+// Finds the first quote, backslash or control character.
+// Only strings are long enough to be worth scanning 16 bytes at a time.
+// Between tokens there is rarely more than a byte or two of space,
+// so the structural characters are read one at a time.
+static const char* json_scan_string_(const char* c, const char* end)
+{
+#if defined(__SSE2__)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i slash = _mm_set1_epi8('\\');
+    // control characters are < 0x20. Bias to compare signed.
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+    const __m128i control = _mm_set1_epi8((char)(0x20 ^ 0x80));
+
+    while (end - c >= 16)
     {
-        if (lisp_bool(lisp_car(args)) != lisp_bool(to_check)) return lisp_false();
-        args = lisp_cdr(args);
+        __m128i x = _mm_loadu_si128((const __m128i*)c);
+        __m128i hits = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(x, quote), _mm_cmpeq_epi8(x, slash)),
+                _mm_cmplt_epi8(_mm_xor_si128(x, bias), control)
+        );
+        int mask = _mm_movemask_epi8(hits);
+        if (mask)
+        {
+            int i = 0;
+            while (!(mask & 1)) { mask >>= 1; ++i; }
+            return c + i;
+        }
+        c += 16;
     }
-    return lisp_true();
+#endif
+    while (c < end && *c != '"' && *c != '\\' && (unsigned char)*c >= 0x20) ++c;
+    return c;
 }
 
-static Lisp sch_list(Lisp args, LispError* e, LispContext ctx) { return args; }
-
-static Lisp sch_is_list(Lisp args, LispError* e, LispContext ctx)
+static int json_hex_(JsonReader* r)
 {
-    ARITY_CHECK(1, 1);
-    return lisp_make_bool(lisp_is_list(lisp_car(args)));
+    if (r->end - r->c < 4) longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
+    int x = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        char h = *r->c++;
+        x <<= 4;
+        if (h >= '0' && h <= '9') x |= h - '0';
+        else if (h >= 'a' && h <= 'f') x |= h - 'a' + 10;
+        else if (h >= 'A' && h <= 'F') x |= h - 'A' + 10;
+        else longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
+    }
+    return x;
 }
 
-static Lisp sch_make_list(Lisp args, LispError* e, LispContext ctx)
+// Reads a string after the opening quote. Returns its length in r->scratch.
+// Strings without escapes are returned in place in out_text.
+static size_t json_read_chars_(JsonReader* r, const char** out_text)
 {
-    Lisp length = lisp_car(args);
-    if (lisp_type(length) != LISP_INT)
-    {
-        *e = LISP_ERROR_ARG_TYPE;
-        return lisp_null();
-    }
+    const char* start = r->c;
+    const char* c = json_scan_string_(start, r->end);
+    if (c == r->end) longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
 
-    Lisp next = lisp_cdr(args);
-    Lisp x;
-    if (lisp_is_null(next))
+    if (*c == '"')
     {
-        x = lisp_null();
+        r->c = c + 1;
+        *out_text = start;
+        return c - start;
     }
-    else
+
+    // escapes. decoded text is never longer than the source.
+    size_t n = 0;
+    while (1)
     {
-        x = lisp_car(lisp_cdr(args));
+        size_t needed = n + (c - start) + 4;
+        if (needed > r->scratch_capacity)
+        {
+            r->scratch_capacity = needed * 2;
+            r->scratch = realloc(r->scratch, r->scratch_capacity);
+        }
+        memcpy(r->scratch + n, start, c - start);
+        n += c - start;
+        r->c = c;
+
+        if (c == r->end || (unsigned char)*c < 0x20) longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
+        if (*c == '"') break;
+
+        // backslash
+        ++r->c;
+        if (r->c == r->end) longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
+        char e = *r->c++;
+        switch (e)
+        {
+            case '"': r->scratch[n++] = '"'; break;
+            case '\\': r->scratch[n++] = '\\'; break;
+            case '/': r->scratch[n++] = '/'; break;
+            case 'b': r->scratch[n++] = '\b'; break;
+            case 'f': r->scratch[n++] = '\f'; break;
+            case 'n': r->scratch[n++] = '\n'; break;
+            case 'r': r->scratch[n++] = '\r'; break;
+            case 't': r->scratch[n++] = '\t'; break;
+            case 'u':
+            {
+                long code = json_hex_(r);
+                if (code >= 0xD800 && code <= 0xDBFF)
+                {
+                    // surrogate pair
+                    if (r->end - r->c < 6 || r->c[0] != '\\' || r->c[1] != 'u')
+                        longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
+                    r->c += 2;
+                    long low = json_hex_(r);
+                    if (low < 0xDC00 || low > 0xDFFF) longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                }
+
+                // strings are null terminated.
+                if (code == 0) longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
+
+                // UTF-8. At most 4 bytes for 6 or 12 bytes of source.
+                if (code < 0x80)
+                {
+                    r->scratch[n++] = (char)code;
+                }
+                else if (code < 0x800)
+                {
+                    r->scratch[n++] = (char)(0xC0 | (code >> 6));
+                    r->scratch[n++] = (char)(0x80 | (code & 0x3F));
+                }
+                else if (code < 0x10000)
+                {
+                    r->scratch[n++] = (char)(0xE0 | (code >> 12));
+                    r->scratch[n++] = (char)(0x80 | ((code >> 6) & 0x3F));
+                    r->scratch[n++] = (char)(0x80 | (code & 0x3F));
+                }
+                else
+                {
+                    r->scratch[n++] = (char)(0xF0 | (code >> 18));
+                    r->scratch[n++] = (char)(0x80 | ((code >> 12) & 0x3F));
+                    r->scratch[n++] = (char)(0x80 | ((code >> 6) & 0x3F));
+                    r->scratch[n++] = (char)(0x80 | (code & 0x3F));
+                }
+                break;
+            }
+            default:
+                longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
+        }
+
+        start = r->c;
+        c = json_scan_string_(start, r->end);
     }
-    return lisp_make_list(x, lisp_int(length), ctx);
+
+    r->c = c + 1;
+    *out_text = r->scratch;
+    return n;
 }
 
-static Lisp sch_list_copy(Lisp args, LispError* e, LispContext ctx) {
-    return lisp_list_copy(lisp_car(args), ctx);
+static Lisp json_read_string_(JsonReader* r)
+{
+    const char* text;
+    size_t n = json_read_chars_(r, &text);
+    Lisp s = lisp_make_string((int)n, r->ctx);
+    memcpy(lisp_buffer(s), text, n);
+    return s;
 }
 
-static Lisp sch_append(Lisp args, LispError* e, LispContext ctx)
+static Lisp json_read_key_(JsonReader* r)
 {
-    Lisp l = lisp_null();
+    json_expect_(r, '"');
+    if (r->flags & LISP_JSON_STRING_KEYS) return json_read_string_(r);
 
-    while (lisp_is_pair(args))
+    const char* text;
+    size_t n = json_read_chars_(r, &text);
+    if (n > LISP_IDENTIFIER_MAX)
     {
-        l = lisp_list_append(l, lisp_car(args), ctx);
-        args = lisp_cdr(args);
+        // too long for a symbol.
+        Lisp s = lisp_make_string((int)n, r->ctx);
+        memcpy(lisp_buffer(s), text, n);
+        return s;
     }
-    return l;
+
+    // symbols are upper case, like the reader.
+    char name[LISP_IDENTIFIER_MAX + 1];
+    for (size_t i = 0; i < n; ++i) name[i] = (char)toupper((unsigned char)text[i]);
+    name[n] = '\0';
+    return lisp_make_symbol(name, r->ctx);
 }
 
-static Lisp sch_append_reverse(Lisp args, LispError* e, LispContext ctx)
+static Lisp json_read_number_(JsonReader* r)
 {
-    ARITY_CHECK(2, 2);
+    const char* start = r->c;
+    const char* c = start;
+    const char* end = r->end;
 
-    Lisp l = lisp_car(args);
-    args = lisp_cdr(args);
-    Lisp tail = lisp_car(args);
+    int negative = 0;
+    if (c < end && *c == '-')
+    {
+        negative = 1;
+        ++c;
+    }
 
-    return lisp_list_reverse2(l, tail);
-}
+    if (c == end || !isdigit(*c)) longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
 
-static Lisp sch_list_ref(Lisp args, LispError* e, LispContext ctx)
-{
-    ARITY_CHECK(2, 2);
-    Lisp list = lisp_car(args);
-    args = lisp_cdr(args);
-    Lisp index = lisp_car(args);
-    return lisp_list_ref(list, lisp_int(index));
-}
+    uint64_t mantissa = 0;
+    int digits = 0;
+    while (c < end && isdigit(*c))
+    {
+        mantissa = mantissa * 10 + (*c - '0');
+        ++digits;
+        ++c;
+    }
 
-static Lisp sch_length(Lisp args, LispError* e, LispContext ctx)
-{
-    ARITY_CHECK(1, 1);
-    return lisp_make_int(lisp_list_length(lisp_car(args)));
+    int is_real = 0;
+    int exponent = 0;
+    if (c < end && *c == '.')
+    {
+        is_real = 1;
+        ++c;
+        if (c == end || !isdigit(*c)) longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
+        while (c < end && isdigit(*c))
+        {
+            mantissa = mantissa * 10 + (*c - '0');
+            ++digits;
+            --exponent;
+            ++c;
+        }
+    }
+
+    int has_exponent = 0;
+    if (c < end && (*c == 'e' || *c == 'E'))
+    {
+        is_real = 1;
+        has_exponent = 1;
+        ++c;
+        if (c < end && (*c == '+' || *c == '-')) ++c;
+        if (c == end || !isdigit(*c)) longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
+        while (c < end && isdigit(*c)) ++c;
+    }
+    r->c = c;
+
+    if (!is_real && digits <= 18)
+    {
+        LispInt x = (LispInt)mantissa;
+        return lisp_make_int(negative ? -x : x);
+    }
+
+    // Exact when the mantissa and power of ten are both representable.
+    static const double powers[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    if (!has_exponent && digits <= 19 && mantissa <= ((uint64_t)1 << 53) && -exponent <= 22)
+    {
+        double x = (double)mantissa / powers[-exponent];
+        return lisp_make_real(negative ? -x : x);
+    }
+
+    // strtod and strtoll need a terminated copy.
+    char small[64];
+    size_t n = c - start;
+    char* buffer = n < sizeof(small) ? small : malloc(n + 1);
+    memcpy(buffer, start, n);
+    buffer[n] = '\0';
+
+    // integers too big for LispInt are reals, as JSON doesn't tell them apart.
+    Lisp x;
+    errno = 0;
+    LispInt i = is_real ? 0 : strtoll(buffer, NULL, 10);
+    if (is_real || errno == ERANGE)
+        x = lisp_make_real(strtod(buffer, NULL));
+    else
+        x = lisp_make_int(i);
+
+    if (buffer != small) free(buffer);
+    return x;
 }
 
-static Lisp sch_list_advance(Lisp args, LispError* e, LispContext ctx)
+static void json_read_literal_(JsonReader* r, const char* word)
 {
-    ARITY_CHECK(2, 2);
-    Lisp x = lisp_car(args);
-    args = lisp_cdr(args);
-    Lisp count = lisp_car(args);
-    return lisp_list_advance(x, lisp_int(count));
+    size_t n = strlen(word);
+    if ((size_t)(r->end - r->c) < n || memcmp(r->c, word, n) != 0)
+        longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
+    r->c += n;
 }
 
-static Lisp sch_add(Lisp args, LispError* e, LispContext ctx)
+static Lisp json_read_r_(JsonReader* r)
 {
-    LispInt exact = 0;
-    LispReal inexact = 0;
+    json_skip_space_(r);
+    if (r->c == r->end) longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
 
-    while (lisp_is_pair(args))
+    switch (*r->c)
     {
-        Lisp x = lisp_car(args);
-        args = lisp_cdr(args);
-        switch (lisp_type(x))
+        case '{':
+        case '[':
         {
-            case LISP_INT:
-                exact += lisp_int(x);
-                break;
-            case LISP_REAL:
-                inexact += lisp_real(x);
-                break;
-            default:
-                *e = LISP_ERROR_ARG_TYPE;
-                return lisp_null();
+            int is_object = *r->c == '{';
+            char close = is_object ? '}' : ']';
+            ++r->c;
+
+            if (++r->depth > JSON_DEPTH_MAX) longjmp(r->error_jmp, LISP_ERROR_OUT_OF_BOUNDS);
+
+            size_t first = r->stack_size;
+
+            json_skip_space_(r);
+            if (r->c < r->end && *r->c == close)
+            {
+                ++r->c;
+            }
+            else
+            {
+                while (1)
+                {
+                    if (is_object)
+                    {
+                        Lisp key = json_read_key_(r);
+                        json_expect_(r, ':');
+                        json_push_(r, lisp_cons(key, json_read_r_(r), r->ctx));
+                    }
+                    else
+                    {
+                        json_push_(r, json_read_r_(r));
+                    }
+
+                    json_skip_space_(r);
+                    if (r->c == r->end) longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
+                    if (*r->c == close)
+                    {
+                        ++r->c;
+                        break;
+                    }
+                    if (*r->c != ',') longjmp(r->error_jmp, LISP_ERROR_READ_SYNTAX);
+                    ++r->c;
+                }
+            }
+
+            --r->depth;
+            int n = (int)(r->stack_size - first);
+            r->stack_size = first;
+            return lisp_make_vector2(r->stack + first, n, r->ctx);
         }
+        case '"':
+            ++r->c;
+            return json_read_string_(r);
+        case 't':
+            json_read_literal_(r, "true");
+            return lisp_true();
+        case 'f':
+            json_read_literal_(r, "false");
+            return lisp_false();
+        case 'n':
+            json_read_literal_(r, "null");
+            return lisp_null();
+        default:
+            return json_read_number_(r);
     }
-
-    return inexact == 0
-        ? lisp_make_int(exact)
-        : lisp_make_real(inexact + (LispReal)exact);
 }
 
-static Lisp sch_mult(Lisp args, LispError* e, LispContext ctx)
+Lisp lisp_json_read_range(const char* start, const char* end, int flags, LispError* out_error, LispContext ctx)
 {
-    LispInt exact = 1;
-    LispReal inexact = 1;
+    JsonReader r;
+    r.c = start;
+    r.end = end;
+    r.flags = flags;
+    r.depth = 0;
+    r.stack = NULL;
+    r.stack_size = 0;
+    r.stack_capacity = 0;
+    r.scratch = NULL;
+    r.scratch_capacity = 0;
+    r.ctx = ctx;
 
-    while (lisp_is_pair(args))
+    Lisp result = lisp_null();
+    LispError error = setjmp(r.error_jmp);
+    if (error == LISP_ERROR_NONE)
     {
-        Lisp x = lisp_car(args);
-        args = lisp_cdr(args);
-        switch (lisp_type(x))
+        json_skip_space_(&r);
+        if (r.c == r.end)
         {
-            case LISP_INT:
-                exact *= lisp_int(x);
-                break;
-            case LISP_REAL:
-                inexact *= lisp_real(x);
-                break;
-            default:
-                *e = LISP_ERROR_ARG_TYPE;
-                return lisp_null();
+            result = lisp_eof();
+        }
+        else
+        {
+            result = json_read_r_(&r);
+            json_skip_space_(&r);
+            if (r.c != r.end) longjmp(r.error_jmp, LISP_ERROR_READ_SYNTAX);
         }
     }
 
-    return inexact == 1
-        ? lisp_make_int(exact)
-        : lisp_make_real(inexact * (LispReal)exact);
+    free(r.stack);
+    free(r.scratch);
+    *out_error = error;
+    return result;
 }
 
-static Lisp sch_sub(Lisp args, LispError* e, LispContext ctx)
+Lisp lisp_json_read_file(FILE* file, int flags, LispError* out_error, LispContext ctx)
 {
-    ARITY_CHECK(1, 2);
-    Lisp x = lisp_car(args);
-    args = lisp_cdr(args);
+    size_t size = 0;
+    size_t capacity = 64 * 1024;
+    char* data = malloc(capacity);
 
-    Lisp y;
-    if (lisp_is_null(args))
+    while (1)
     {
-        y = x;
-        x = lisp_make_int(0);
+        size += fread(data + size, 1, capacity - size, file);
+        if (size < capacity) break;
+        capacity *= 2;
+        data = realloc(data, capacity);
+    }
+
+    Lisp result;
+    if (ferror(file))
+    {
+        *out_error = LISP_ERROR_FILE_OPEN;
+        result = lisp_null();
     }
     else
     {
-        y = lisp_car(args);
+        result = lisp_json_read_range(data, data + size, flags, out_error, ctx);
     }
-    switch (lisp_type(x))
+    free(data);
+    return result;
+}
+
+static void json_write_string_(FILE* file, const char* s)
+{
+    fputc('"', file);
+    for (const char* c = s; *c; ++c)
     {
-        case LISP_REAL:
-            return lisp_make_real(lisp_real(x) - lisp_number_to_real(y));
-        case LISP_INT:
-            switch (lisp_type(y))
-            {
-                case LISP_REAL:
-                    return lisp_make_real(lisp_number_to_real(x) - lisp_real(y));
-                case LISP_INT:
-                    return lisp_make_int(lisp_int(x) - lisp_int(y));
-                default:
-                    *e = LISP_ERROR_ARG_TYPE;
-                    return lisp_null();
-            }
-            break;
-        default:
-            *e = LISP_ERROR_ARG_TYPE;
-            return lisp_null();
+        switch (*c)
+        {
+            case '"': fputs("\\\"", file); break;
+            case '\\': fputs("\\\\", file); break;
+            case '\n': fputs("\\n", file); break;
+            case '\r': fputs("\\r", file); break;
+            case '\t': fputs("\\t", file); break;
+            case '\b': fputs("\\b", file); break;
+            case '\f': fputs("\\f", file); break;
+            default:
+                if ((unsigned char)*c < 0x20)
+                    fprintf(file, "\\u%04x", *c);
+                else
+                    fputc(*c, file);
+        }
     }
+    fputc('"', file);
 }
 
-static Lisp sch_divide(Lisp args, LispError* e, LispContext ctx)
+static int json_is_object_(Lisp v)
 {
-    ARITY_CHECK(2, 2);
-    Lisp x = lisp_car(args);
-    args = lisp_cdr(args);
-    Lisp y = lisp_car(args);
-
-    switch (lisp_type(x))
+    int n = lisp_vector_length(v);
+    if (n == 0) return 0;
+    for (int i = 0; i < n; ++i)
     {
-        case LISP_REAL:
-            return lisp_make_real(lisp_real(x) / lisp_number_to_real(y));
-        case LISP_INT:
-            switch (lisp_type(y))
-            {
-                case LISP_REAL:
-                    return lisp_make_real(lisp_number_to_real(x) / lisp_real(y));
-                case LISP_INT:
-                    // TODO: divide by zero check?
-                    return lisp_make_int(lisp_int(x) / lisp_int(y));
-                default:
-                    *e = LISP_ERROR_ARG_TYPE;
-                    return lisp_null();
-            }
-            break;
-        default:
-            *e = LISP_ERROR_ARG_TYPE;
-            return lisp_null();
+        Lisp entry = lisp_vector_ref(v, i);
+        if (!lisp_is_pair(entry)) return 0;
+        LispType key_type = lisp_type(lisp_car(entry));
+        if (key_type != LISP_SYMBOL && key_type != LISP_STRING) return 0;
     }
+    return 1;
 }
 
-static Lisp sch_less(Lisp args, LispError* e, LispContext ctx)
+static LispError json_write_r_(FILE* file, Lisp x, int depth)
 {
-    ARITY_CHECK(2, 2);
-    Lisp x = lisp_car(args);
-    args = lisp_cdr(args);
-    Lisp y = lisp_car(args);
+    if (depth > JSON_DEPTH_MAX) return LISP_ERROR_OUT_OF_BOUNDS;
 
     switch (lisp_type(x))
     {
-        case LISP_REAL:
-            return lisp_make_bool(lisp_real(x) < lisp_number_to_real(y));
+        case LISP_NULL:
+            fputs("null", file);
+            break;
+        case LISP_BOOL:
+            fputs(lisp_bool(x) ? "true" : "false", file);
+            break;
         case LISP_INT:
-            switch (lisp_type(y))
+            fprintf(file, "%lld", lisp_int(x));
+            break;
+        case LISP_REAL:
+        {
+            LispReal r = lisp_real(x);
+            // JSON has no infinity or NaN.
+            if (r != r || r - r != 0)
+                fputs("null", file);
+            else
+                fprintf(file, "%.17g", r);
+            break;
+        }
+        case LISP_CHAR:
+        {
+            char s[2] = { (char)lisp_char(x), '\0' };
+            json_write_string_(file, s);
+            break;
+        }
+        case LISP_STRING:
+            json_write_string_(file, lisp_string(x));
+            break;
+        case LISP_SYMBOL:
+            json_write_string_(file, lisp_symbol_string(x));
+            break;
+        case LISP_VECTOR:
+        {
+            int n = lisp_vector_length(x);
+            if (json_is_object_(x))
             {
-                case LISP_REAL:
-                    return lisp_make_bool(lisp_number_to_real(x) < lisp_real(y));
-                case LISP_INT:
-                    return lisp_make_bool(lisp_int(x) < lisp_int(y));
-                default:
-                    *e = LISP_ERROR_ARG_TYPE;
-                    return lisp_null();
+                fputc('{', file);
+                for (int i = 0; i < n; ++i)
+                {
+                    if (i > 0) fputc(',', file);
+                    Lisp entry = lisp_vector_ref(x, i);
+                    Lisp key = lisp_car(entry);
+                    json_write_string_(file, lisp_type(key) == LISP_SYMBOL ? lisp_symbol_string(key) : lisp_string(key));
+                    fputc(':', file);
+                    LispError e = json_write_r_(file, lisp_cdr(entry), depth + 1);
+                    if (e != LISP_ERROR_NONE) return e;
+                }
+                fputc('}', file);
+            }
+            else
+            {
+                fputc('[', file);
+                for (int i = 0; i < n; ++i)
+                {
+                    if (i > 0) fputc(',', file);
+                    LispError e = json_write_r_(file, lisp_vector_ref(x, i), depth + 1);
+                    if (e != LISP_ERROR_NONE) return e;
+                }
+                fputc(']', file);
+            }
+            break;
+        }
+        case LISP_F64VECTOR:
+        case LISP_S64VECTOR:
+        case LISP_BYTEVECTOR:
+        {
+            int n = lisp_typed_vector_length(x);
+            fputc('[', file);
+            for (int i = 0; i < n; ++i)
+            {
+                if (i > 0) fputc(',', file);
+                Lisp entry;
+                switch (lisp_type(x))
+                {
+                    case LISP_F64VECTOR: entry = lisp_make_real(lisp_f64vector(x)[i]); break;
+                    case LISP_S64VECTOR: entry = lisp_make_int(lisp_s64vector(x)[i]); break;
+                    default: entry = lisp_make_int(lisp_bytevector(x)[i]); break;
+                }
+                json_write_r_(file, entry, depth + 1);
+            }
+            fputc(']', file);
+            break;
+        }
+        case LISP_PAIR:
+        {
+            fputc('[', file);
+            int first = 1;
+            while (lisp_is_pair(x))
+            {
+                if (!first) fputc(',', file);
+                first = 0;
+                LispError e = json_write_r_(file, lisp_car(x), depth + 1);
+                if (e != LISP_ERROR_NONE) return e;
+                x = lisp_cdr(x);
             }
+            if (!lisp_is_null(x)) return LISP_ERROR_ARG_TYPE;
+            fputc(']', file);
             break;
+        }
         default:
-            *e = LISP_ERROR_ARG_TYPE;
-            return lisp_null();
+            return LISP_ERROR_ARG_TYPE;
     }
+    return LISP_ERROR_NONE;
 }
 
-static Lisp sch_to_exact(Lisp args, LispError* e, LispContext ctx)
+LispError lisp_json_write(FILE* file, Lisp x)
 {
-    ARITY_CHECK(1, 1);
-    return lisp_make_int(lisp_number_to_int(lisp_car(args)));
+    return json_write_r_(file, x, 0);
 }
 
-static Lisp sch_to_inexact(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_json_read(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 2);
+    Lisp port = lisp_car(args);
+    int flags = lisp_is_true(lisp_car(lisp_cdr(args))) ? LISP_JSON_STRING_KEYS : 0;
+    return lisp_json_read_file(lisp_port(port), flags, e, ctx);
+}
+
+static Lisp sch_json_write(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 2);
+    Lisp a = lisp_car(args);
+    Lisp port = lisp_car(lisp_cdr(args));
+    *e = lisp_json_write(lisp_port(port), a);
+    return lisp_null();
+}
+
+static Lisp sch_is_port_in(Lisp args, LispError* e, LispContext ctx)
+{
+    return lisp_make_bool(lisp_type(lisp_car(args)) == LISP_PORT_IN);
+}
+
+static Lisp sch_is_port_out(Lisp args, LispError* e, LispContext ctx)
+{
+    return lisp_make_bool(lisp_type(lisp_car(args)) == LISP_PORT_OUT);
+}
+
+static Lisp sch_open_input(Lisp args, LispError* e, LispContext ctx)
 {
     ARITY_CHECK(1, 1);
-    return lisp_make_real(lisp_number_to_real(lisp_car(args)));
+    Lisp a = lisp_car(args);
+    FILE* f = fopen(lisp_string(a), "r");
+    if (!f) {
+        *e = LISP_ERROR_FILE_OPEN;
+        return lisp_null();
+    }
+
+    return lisp_make_port(f, 1);
 }
 
-static Lisp sch_symbol_to_string(Lisp args, LispError* e, LispContext ctx)
+// (file->string path) and (file->bytevector path) map the file read-only.
+static Lisp map_file_(LispType type, Lisp args, LispError* e, LispContext ctx)
 {
     ARITY_CHECK(1, 1);
-    Lisp val = lisp_car(args);
-    if (lisp_type(val) != LISP_SYMBOL)
+    Lisp path = lisp_car(args);
+    if (lisp_type(path) != LISP_STRING)
     {
         *e = LISP_ERROR_ARG_TYPE;
         return lisp_null();
     }
-    else
-    {
-        return lisp_make_string2(lisp_symbol_string(val), ctx);
-    }
+    return lisp_map_path(lisp_string(path), type, e, ctx);
 }
 
-static Lisp sch_is_symbol(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_file_to_string(Lisp args, LispError* e, LispContext ctx)
 {
-    ARITY_CHECK(1, 1);
-    return lisp_make_bool(lisp_type(lisp_car(args)) == LISP_SYMBOL);
+    return map_file_(LISP_STRING, args, e, ctx);
 }
 
-static Lisp sch_symbol_less(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_file_to_bytevector(Lisp args, LispError* e, LispContext ctx)
 {
-    ARITY_CHECK(2, 2);
-    Lisp a = lisp_car(args);
-    args = lisp_cdr(args);
-    Lisp b = lisp_car(args);
-    int result = strncmp(lisp_symbol_string(a), lisp_symbol_string(b), LISP_IDENTIFIER_MAX) < 0;
-    return lisp_make_bool(result);
+    return map_file_(LISP_BYTEVECTOR, args, e, ctx);
 }
 
-static Lisp sch_string_to_symbol(Lisp args, LispError* e, LispContext ctx)
+// (read-parallel path [threads])
+static Lisp sch_read_parallel(Lisp args, LispError* e, LispContext ctx)
 {
-    ARITY_CHECK(1, 1);
-    Lisp val = lisp_car(args);
-    if (lisp_type(val) != LISP_STRING)
+    ARITY_CHECK(1, 2);
+    Lisp path = lisp_car(args);
+    args = lisp_cdr(args);
+    int threads = 0;
+    if (!lisp_is_null(args))
     {
-        *e = LISP_ERROR_ARG_TYPE;
-        return lisp_null();
+        if (lisp_type(lisp_car(args)) != LISP_INT)
+        {
+            *e = LISP_ERROR_ARG_TYPE;
+            return lisp_null();
+        }
+        threads = (int)lisp_int(lisp_car(args));
     }
-    else
+    if (lisp_type(path) != LISP_STRING)
     {
-        return lisp_make_symbol(lisp_string(val), ctx);
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
     }
-}
 
-static Lisp sch_gensym(Lisp args, LispError* e, LispContext ctx)
-{
-    ARITY_CHECK(0, 0);
-    return lisp_gen_symbol(ctx);
+    Lisp text = lisp_map_path(lisp_string(path), LISP_STRING, e, ctx);
+    if (*e != LISP_ERROR_NONE) return lisp_null();
+    const char* start = lisp_string(text);
+    return lisp_read_range_parallel(start, start + lisp_buffer_capacity(text) - 1, threads, e, ctx);
 }
 
-static Lisp sch_is_string(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_open_output(Lisp args, LispError* e, LispContext ctx)
 {
     ARITY_CHECK(1, 1);
-    return lisp_make_bool(lisp_type(lisp_car(args)) == LISP_STRING);
+    Lisp a = lisp_car(args);
+    FILE* f = fopen(lisp_string(a), "w");
+    return lisp_make_port(f, 0);
 }
 
-static Lisp sch_string_is_null(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_port_close(Lisp args, LispError* e, LispContext ctx)
 {
     ARITY_CHECK(1, 1);
     Lisp a = lisp_car(args);
-    return lisp_make_bool(lisp_string(a)[0] == '\0');
+    fclose(lisp_port(a));
+    return lisp_null();
 }
 
-static Lisp sch_make_string(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_is_eof(Lisp args, LispError* e, LispContext ctx)
 {
-    Lisp length = lisp_car(args);
-
-    if (lisp_type(length) != LISP_INT)
-    {
-        *e = LISP_ERROR_ARG_TYPE;
-        return lisp_null();
-    }
+    return lisp_make_bool(lisp_equal(lisp_car(args), lisp_eof()));
+}
 
-    Lisp s = lisp_make_string(lisp_int(length), ctx);
-    args = lisp_cdr(args);
+static Lisp sch_error(Lisp args, LispError* e, LispContext ctx)
+{
+   if (lisp_is_pair(args))
+   {
+       Lisp l = lisp_car(args);
+       fputs(lisp_string(l), lisp_stderr(ctx));
+       args = lisp_cdr(args);
+   }
+   while (lisp_is_pair(args))
+   {
+       fputs(" ", lisp_stderr(ctx));
+       lisp_printf(lisp_stderr(ctx), lisp_car(args));
+       args = lisp_cdr(args);
+   }
 
-    if (!lisp_is_null(args))
-        lisp_buffer_fill(s, 0, lisp_int(length), lisp_char(lisp_car(args)));
-    return s;
+   *e = LISP_ERROR_RUNTIME;
+   return lisp_null();
 }
 
-static Lisp sch_string_less(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_syntax_error(Lisp args, LispError* e, LispContext ctx)
 {
-    ARITY_CHECK(2, 2);
-    Lisp a = lisp_car(args);
+    fprintf(lisp_stderr(ctx), "expand error: %s ", lisp_string(lisp_car(args)));
     args = lisp_cdr(args);
-    Lisp b = lisp_car(args);
-    int result = strcmp(lisp_string(a), lisp_string(b)) < 0;
-    return lisp_make_bool(result);
+    if (!lisp_is_null(args))
+    {
+        lisp_printf(lisp_stderr(ctx), lisp_car(args));
+    }
+    fprintf(lisp_stderr(ctx), "\n");
+
+    *e = LISP_ERROR_FORM_SYNTAX;
+    return lisp_null();
 }
 
-static Lisp sch_substring(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_equals(Lisp args, LispError* e, LispContext ctx)
 {
-    ARITY_CHECK(3, 3);
-    Lisp s = lisp_car(args);
-    args = lisp_cdr(args);
-    Lisp start = lisp_car(args);
+    Lisp to_check  = lisp_car(args);
+    if (lisp_is_null(to_check)) return lisp_true();
     args = lisp_cdr(args);
-    Lisp end = lisp_car(args);
-    return lisp_substring(s, lisp_int(start), lisp_int(end), ctx);
+
+    while (lisp_is_pair(args))
+    {
+        if (lisp_bool(lisp_car(args)) != lisp_bool(to_check)) return lisp_false();
+        args = lisp_cdr(args);
+    }
+    return lisp_true();
 }
 
-static Lisp sch_string_length(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_list(Lisp args, LispError* e, LispContext ctx) { return args; }
+
+static Lisp sch_is_list(Lisp args, LispError* e, LispContext ctx)
 {
     ARITY_CHECK(1, 1);
-    int n = lisp_string_length(lisp_car(args));
-    return lisp_make_int(n);
+    return lisp_make_bool(lisp_is_list(lisp_car(args)));
 }
 
-static Lisp sch_string_ref(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_make_list(Lisp args, LispError* e, LispContext ctx)
 {
-    ARITY_CHECK(2, 2);
-    Lisp str = lisp_car(args);
-    Lisp index = lisp_car(lisp_cdr(args));
-    if (lisp_type(str) != LISP_STRING || lisp_type(index) != LISP_INT)
+    Lisp length = lisp_car(args);
+    if (lisp_type(length) != LISP_INT)
+    {
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
+    }
+
+    Lisp next = lisp_cdr(args);
+    Lisp x;
+    if (lisp_is_null(next))
+    {
+        x = lisp_null();
+    }
+    else
+    {
+        x = lisp_car(lisp_cdr(args));
+    }
+    return lisp_make_list(x, lisp_int(length), ctx);
+}
+
+static Lisp sch_list_copy(Lisp args, LispError* e, LispContext ctx) {
+    return lisp_list_copy(lisp_car(args), ctx);
+}
+
+static Lisp sch_append(Lisp args, LispError* e, LispContext ctx)
+{
+    if (lisp_is_null(args)) return args;
+
+    // copy all but the last list in reverse, then attach to the last.
+    Lisp reversed = lisp_null();
+    while (lisp_is_pair(lisp_cdr(args)))
+    {
+        Lisp it = lisp_car(args);
+        while (lisp_is_pair(it))
+        {
+            reversed = lisp_cons(lisp_car(it), reversed, ctx);
+            it = lisp_cdr(it);
+        }
+        args = lisp_cdr(args);
+    }
+    return lisp_list_reverse2(reversed, lisp_car(args));
+}
+
+// Procedures which call back into lisp may trigger garbage collection.
+// Values they hold across calls are kept on the lisp stack so they are updated if moved.
+#define STACK_SLOT(i) (lisp_stack_peek(frame_size_ - (i), ctx))
+#define STACK_FRAME(n) \
+    size_t stack_save_ = ctx.p->stack_ptr; \
+    const size_t frame_size_ = (n); \
+    for (size_t i_ = 0; i_ < frame_size_; ++i_) lisp_stack_push(lisp_null(), ctx);
+#define STACK_RETURN(x) do { Lisp result_ = (x); ctx.p->stack_ptr = stack_save_; return result_; } while (0)
+
+// A lambda with fixed parameters doesn't keep its argument list,
+// so the same list can be reused for every call.
+static int args_reusable_(Lisp proc)
+{
+    if (lisp_type(proc) != LISP_LAMBDA) return 0;
+    Lisp params = lambda_args_(proc);
+    while (lisp_is_pair(params)) params = lisp_cdr(params);
+    return lisp_is_null(params);
+}
+
+// Returns an argument list for proc of length n.
+// If reuse is set, args is recycled and overwritten by the caller.
+static Lisp call_args_(Lisp* args, int reuse, int n, LispContext ctx)
+{
+    if (reuse && !lisp_is_null(*args)) return *args;
+    Lisp l = lisp_make_list(lisp_null(), n, ctx);
+    if (reuse) *args = l;
+    return l;
+}
+
+static Lisp list_to_vector_(Lisp l, LispContext ctx)
+{
+    int n = lisp_list_length(l);
+    Lisp v = lisp_make_vector(n, ctx);
+    for (int i = 0; i < n; ++i)
+    {
+        lisp_vector_set(v, i, lisp_car(l));
+        l = lisp_cdr(l);
+    }
+    return v;
+}
+
+static Lisp sch_map(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 1024);
+    Lisp proc = lisp_car(args);
+    Lisp lists = lisp_cdr(args);
+
+    if (lisp_is_null(lisp_cdr(lists)))
+    {
+        // 0: proc, 1: list, 2: result, 3: args
+        STACK_FRAME(4);
+        *STACK_SLOT(0) = proc;
+        *STACK_SLOT(1) = lisp_car(lists);
+        int reuse = args_reusable_(proc);
+
+        while (lisp_is_pair(*STACK_SLOT(1)))
+        {
+            Lisp call = call_args_(STACK_SLOT(3), reuse, 1, ctx);
+            lisp_set_car(call, lisp_car(*STACK_SLOT(1)));
+
+            Lisp x = lisp_apply(*STACK_SLOT(0), call, e, ctx);
+            if (*e != LISP_ERROR_NONE) STACK_RETURN(lisp_null());
+
+            *STACK_SLOT(2) = lisp_cons(x, *STACK_SLOT(2), ctx);
+            *STACK_SLOT(1) = lisp_cdr(*STACK_SLOT(1));
+        }
+        STACK_RETURN(lisp_list_reverse(*STACK_SLOT(2)));
+    }
+    else
+    {
+        // 0: proc, 1: vector of lists, 2: result
+        STACK_FRAME(3);
+        *STACK_SLOT(0) = proc;
+        *STACK_SLOT(1) = list_to_vector_(lists, ctx);
+
+        while (1)
+        {
+            Lisp v = *STACK_SLOT(1);
+            int n = lisp_vector_length(v);
+
+            Lisp call = lisp_null();
+            for (int i = n - 1; i >= 0; --i)
+            {
+                Lisp l = lisp_vector_ref(v, i);
+                if (lisp_is_null(l)) STACK_RETURN(lisp_list_reverse(*STACK_SLOT(2)));
+                call = lisp_cons(lisp_car(l), call, ctx);
+                lisp_vector_set(v, i, lisp_cdr(l));
+            }
+
+            Lisp x = lisp_apply(*STACK_SLOT(0), call, e, ctx);
+            if (*e != LISP_ERROR_NONE) STACK_RETURN(lisp_null());
+            *STACK_SLOT(2) = lisp_cons(x, *STACK_SLOT(2), ctx);
+        }
+    }
+}
+
+static Lisp sch_for_each(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 1024);
+    Lisp proc = lisp_car(args);
+    Lisp lists = lisp_cdr(args);
+
+    if (lisp_is_null(lisp_cdr(lists)))
+    {
+        // 0: proc, 1: list, 2: args
+        STACK_FRAME(3);
+        *STACK_SLOT(0) = proc;
+        *STACK_SLOT(1) = lisp_car(lists);
+        int reuse = args_reusable_(proc);
+
+        while (lisp_is_pair(*STACK_SLOT(1)))
+        {
+            Lisp call = call_args_(STACK_SLOT(2), reuse, 1, ctx);
+            lisp_set_car(call, lisp_car(*STACK_SLOT(1)));
+
+            lisp_apply(*STACK_SLOT(0), call, e, ctx);
+            if (*e != LISP_ERROR_NONE) STACK_RETURN(lisp_null());
+
+            *STACK_SLOT(1) = lisp_cdr(*STACK_SLOT(1));
+        }
+        STACK_RETURN(lisp_null());
+    }
+    else
+    {
+        // 0: proc, 1: vector of lists
+        STACK_FRAME(2);
+        *STACK_SLOT(0) = proc;
+        *STACK_SLOT(1) = list_to_vector_(lists, ctx);
+
+        while (1)
+        {
+            Lisp v = *STACK_SLOT(1);
+            int n = lisp_vector_length(v);
+
+            Lisp call = lisp_null();
+            for (int i = n - 1; i >= 0; --i)
+            {
+                Lisp l = lisp_vector_ref(v, i);
+                if (lisp_is_null(l)) STACK_RETURN(lisp_null());
+                call = lisp_cons(lisp_car(l), call, ctx);
+                lisp_vector_set(v, i, lisp_cdr(l));
+            }
+
+            lisp_apply(*STACK_SLOT(0), call, e, ctx);
+            if (*e != LISP_ERROR_NONE) STACK_RETURN(lisp_null());
+        }
+    }
+}
+
+static Lisp sch_filter(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 2);
+
+    // 0: pred, 1: list, 2: result, 3: args
+    STACK_FRAME(4);
+    *STACK_SLOT(0) = lisp_car(args);
+    *STACK_SLOT(1) = lisp_car(lisp_cdr(args));
+    int reuse = args_reusable_(*STACK_SLOT(0));
+
+    while (lisp_is_pair(*STACK_SLOT(1)))
+    {
+        Lisp x = lisp_car(*STACK_SLOT(1));
+        Lisp call = call_args_(STACK_SLOT(3), reuse, 1, ctx);
+        lisp_set_car(call, x);
+
+        Lisp keep = lisp_apply(*STACK_SLOT(0), call, e, ctx);
+        if (*e != LISP_ERROR_NONE) STACK_RETURN(lisp_null());
+
+        if (lisp_is_true(keep))
+            *STACK_SLOT(2) = lisp_cons(lisp_car(*STACK_SLOT(1)), *STACK_SLOT(2), ctx);
+
+        *STACK_SLOT(1) = lisp_cdr(*STACK_SLOT(1));
+    }
+    STACK_RETURN(lisp_list_reverse(*STACK_SLOT(2)));
+}
+
+static Lisp fold_left_(Lisp op, Lisp acc, Lisp l, LispError* e, LispContext ctx)
+{
+    // 0: op, 1: acc, 2: list, 3: args
+    STACK_FRAME(4);
+    *STACK_SLOT(0) = op;
+    *STACK_SLOT(1) = acc;
+    *STACK_SLOT(2) = l;
+    int reuse = args_reusable_(op);
+
+    while (lisp_is_pair(*STACK_SLOT(2)))
+    {
+        // (op acc x)
+        Lisp call = call_args_(STACK_SLOT(3), reuse, 2, ctx);
+        lisp_set_car(call, *STACK_SLOT(1));
+        lisp_set_car(lisp_cdr(call), lisp_car(*STACK_SLOT(2)));
+
+        Lisp x = lisp_apply(*STACK_SLOT(0), call, e, ctx);
+        if (*e != LISP_ERROR_NONE) STACK_RETURN(lisp_null());
+
+        *STACK_SLOT(1) = x;
+        *STACK_SLOT(2) = lisp_cdr(*STACK_SLOT(2));
+    }
+    STACK_RETURN(*STACK_SLOT(1));
+}
+
+static Lisp sch_fold_left(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(3, 3);
+    Lisp op = lisp_car(args);
+    args = lisp_cdr(args);
+    Lisp acc = lisp_car(args);
+    args = lisp_cdr(args);
+    return fold_left_(op, acc, lisp_car(args), e, ctx);
+}
+
+static Lisp sch_reduce(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(3, 3);
+    Lisp op = lisp_car(args);
+    args = lisp_cdr(args);
+    Lisp initial = lisp_car(args);
+    args = lisp_cdr(args);
+    Lisp l = lisp_car(args);
+
+    if (lisp_is_null(l)) return initial;
+    return fold_left_(op, lisp_car(l), lisp_cdr(l), e, ctx);
+}
+
+// Sorting
+// A stable merge sort on a permutation of indices.
+// When the comparator is a builtin ordering and the keys all have a matching type
+// they are unpacked into a C array and compared directly.
+// Otherwise each comparison calls back into lisp.
+static Lisp sch_less(Lisp args, LispError* e, LispContext ctx);
+static Lisp sch_string_less(Lisp args, LispError* e, LispContext ctx);
+static Lisp sch_char_less(Lisp args, LispError* e, LispContext ctx);
+static Lisp sch_symbol_less(Lisp args, LispError* e, LispContext ctx);
+
+enum
+{
+    SORT_APPLY,
+    SORT_INT,
+    SORT_REAL,
+    SORT_STRING,
+};
+
+typedef struct
+{
+    int kind;
+    union
+    {
+        LispInt* ints;
+        LispReal* reals;
+        const char** strings;
+    } keys;
+
+    // SORT_APPLY. Absolute stack positions of the comparator, keys vector and argument list.
+    size_t slot;
+    int reuse;
+    LispError* e;
+    LispContext ctx;
+} SortState;
+
+static int sort_less_(int i, int j, const SortState* s)
+{
+    switch (s->kind)
+    {
+        case SORT_INT: return s->keys.ints[i] < s->keys.ints[j];
+        case SORT_REAL: return s->keys.reals[i] < s->keys.reals[j];
+        case SORT_STRING: return strcmp(s->keys.strings[i], s->keys.strings[j]) < 0;
+        default:
+        {
+            if (*s->e != LISP_ERROR_NONE) return 0;
+            LispContext ctx = s->ctx;
+            Lisp* frame = ctx.p->stack + s->slot;
+            Lisp call = call_args_(frame + 2, s->reuse, 2, ctx);
+            lisp_set_car(call, lisp_vector_ref(frame[1], i));
+            lisp_set_car(lisp_cdr(call), lisp_vector_ref(frame[1], j));
+            return lisp_is_true(lisp_apply(frame[0], call, s->e, ctx));
+        }
+    }
+}
+
+static void sort_indices_(int* a, int* tmp, int n, const SortState* s)
+{
+    const int RUN = 24;
+
+    // insertion sort short runs
+    for (int lo = 0; lo < n; lo += RUN)
+    {
+        int hi = lo + RUN < n ? lo + RUN : n;
+        for (int i = lo + 1; i < hi; ++i)
+        {
+            int x = a[i];
+            int j = i;
+            while (j > lo && sort_less_(x, a[j - 1], s))
+            {
+                a[j] = a[j - 1];
+                --j;
+            }
+            a[j] = x;
+        }
+    }
+
+    // merge runs, alternating between buffers
+    int* src = a;
+    int* dst = tmp;
+    for (int width = RUN; width < n; width *= 2)
+    {
+        for (int lo = 0; lo < n; lo += 2 * width)
+        {
+            int mid = lo + width < n ? lo + width : n;
+            int hi = lo + 2 * width < n ? lo + 2 * width : n;
+
+            if (mid == hi || !sort_less_(src[mid], src[mid - 1], s))
+            {
+                // already in order
+                memcpy(dst + lo, src + lo, sizeof(int) * (hi - lo));
+                continue;
+            }
+
+            int i = lo, j = mid, k = lo;
+            while (i < mid && j < hi)
+                dst[k++] = sort_less_(src[j], src[i], s) ? src[j++] : src[i++];
+            while (i < mid) dst[k++] = src[i++];
+            while (j < hi) dst[k++] = src[j++];
+        }
+        int* t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != a) memcpy(a, src, sizeof(int) * n);
+}
+
+// Pick a direct comparison for op if every key supports it.
+static int sort_kind_(Lisp op, Lisp keys)
+{
+    if (lisp_type(op) != LISP_FUNC) return SORT_APPLY;
+
+    LispCFunc f = lisp_func(op);
+    int n = lisp_vector_length(keys);
+    LispType want;
+
+    if (f == sch_less)
+    {
+        int kind = SORT_INT;
+        for (int i = 0; i < n; ++i)
+        {
+            LispType t = lisp_type(lisp_vector_ref(keys, i));
+            if (t == LISP_REAL)
+                kind = SORT_REAL;
+            else if (t != LISP_INT)
+                return SORT_APPLY;
+        }
+        return kind;
+    }
+    else if (f == sch_char_less)
+    {
+        want = LISP_CHAR;
+    }
+    else if (f == sch_string_less)
+    {
+        want = LISP_STRING;
+    }
+    else if (f == sch_symbol_less)
+    {
+        want = LISP_SYMBOL;
+    }
+    else
+    {
+        return SORT_APPLY;
+    }
+
+    for (int i = 0; i < n; ++i)
+    {
+        if (lisp_type(lisp_vector_ref(keys, i)) != want) return SORT_APPLY;
+    }
+    return want == LISP_CHAR ? SORT_INT : SORT_STRING;
+}
+
+// Returns a malloced permutation which orders keys by op.
+static int* sort_permutation_(Lisp op, Lisp keys, LispError* e, LispContext ctx)
+{
+    int n = lisp_vector_length(keys);
+    int* perm = malloc(sizeof(int) * (2 * n + 1));
+    for (int i = 0; i < n; ++i) perm[i] = i;
+
+    SortState s;
+    s.kind = sort_kind_(op, keys);
+    s.e = e;
+    s.ctx = ctx;
+
+    void* unpacked = NULL;
+    if (s.kind == SORT_APPLY)
+    {
+        // 0: op, 1: keys, 2: args
+        STACK_FRAME(3);
+        s.slot = STACK_SLOT(0) - ctx.p->stack;
+        *STACK_SLOT(0) = op;
+        *STACK_SLOT(1) = keys;
+        s.reuse = args_reusable_(op);
+        sort_indices_(perm, perm + n, n, &s);
+        ctx.p->stack_ptr = stack_save_;
+    }
+    else
+    {
+        unpacked = malloc(sizeof(LispInt) * (n + 1));
+        s.keys.ints = unpacked;
+        for (int i = 0; i < n; ++i)
+        {
+            Lisp x = lisp_vector_ref(keys, i);
+            switch (lisp_type(x))
+            {
+                case LISP_INT: s.keys.ints[i] = lisp_int(x); break;
+                case LISP_CHAR: s.keys.ints[i] = lisp_char(x); break;
+                case LISP_STRING: s.keys.strings[i] = lisp_string(x); break;
+                case LISP_SYMBOL: s.keys.strings[i] = lisp_symbol_string(x); break;
+                default: break;
+            }
+            if (s.kind == SORT_REAL) s.keys.reals[i] = lisp_number_to_real(x);
+        }
+        sort_indices_(perm, perm + n, n, &s);
+        free(unpacked);
+    }
+
+    if (*e != LISP_ERROR_NONE)
+    {
+        free(perm);
+        return NULL;
+    }
+    return perm;
+}
+
+// Rearrange the vector in place so that v'[i] = v[perm[i]].
+static void sort_apply_permutation_(Lisp v, const int* perm)
+{
+    int n = lisp_vector_length(v);
+    Lisp* copy = malloc(sizeof(Lisp) * (n + 1));
+    for (int i = 0; i < n; ++i) copy[i] = lisp_vector_ref(v, i);
+    for (int i = 0; i < n; ++i) lisp_vector_set(v, i, copy[perm[i]]);
+    free(copy);
+}
+
+// Sorts seq in place (and returns it), or a copy if copy is set.
+// key_proc, if not null, is called once per element to compute the sort key.
+static Lisp sort_(Lisp seq, Lisp op, Lisp key_proc, int copy, LispError* e, LispContext ctx)
+{
+    // 0: seq, 1: op, 2: key_proc, 3: values, 4: keys, 5: args
+    STACK_FRAME(6);
+    *STACK_SLOT(0) = seq;
+    *STACK_SLOT(1) = op;
+    *STACK_SLOT(2) = key_proc;
+
+    switch (lisp_type(seq))
+    {
+        case LISP_VECTOR:
+            *STACK_SLOT(3) = copy ? lisp_subvector(seq, 0, lisp_vector_length(seq), ctx) : seq;
+            break;
+        case LISP_NULL:
+        case LISP_PAIR:
+            *STACK_SLOT(3) = list_to_vector_(seq, ctx);
+            break;
+        default:
+            *e = LISP_ERROR_ARG_TYPE;
+            STACK_RETURN(lisp_null());
+    }
+
+    int n = lisp_vector_length(*STACK_SLOT(3));
+    if (lisp_is_null(key_proc))
+    {
+        *STACK_SLOT(4) = *STACK_SLOT(3);
+    }
+    else
+    {
+        // decorate
+        *STACK_SLOT(4) = lisp_make_vector(n, ctx);
+        int reuse = args_reusable_(key_proc);
+        for (int i = 0; i < n; ++i)
+        {
+            Lisp call = call_args_(STACK_SLOT(5), reuse, 1, ctx);
+            lisp_set_car(call, lisp_vector_ref(*STACK_SLOT(3), i));
+            Lisp k = lisp_apply(*STACK_SLOT(2), call, e, ctx);
+            if (*e != LISP_ERROR_NONE) STACK_RETURN(lisp_null());
+            lisp_vector_set(*STACK_SLOT(4), i, k);
+        }
+    }
+
+    int* perm = sort_permutation_(*STACK_SLOT(1), *STACK_SLOT(4), e, ctx);
+    if (!perm) STACK_RETURN(lisp_null());
+
+    // undecorate
+    Lisp values = *STACK_SLOT(3);
+    sort_apply_permutation_(values, perm);
+    free(perm);
+
+    if (lisp_type(seq) == LISP_VECTOR) STACK_RETURN(values);
+
+    if (copy)
+    {
+        Lisp tail = lisp_null();
+        for (int i = n - 1; i >= 0; --i)
+            tail = lisp_cons(lisp_vector_ref(values, i), tail, ctx);
+        STACK_RETURN(tail);
+    }
+    else
+    {
+        Lisp it = *STACK_SLOT(0);
+        for (int i = 0; i < n; ++i, it = lisp_cdr(it))
+            lisp_set_car(it, lisp_vector_ref(values, i));
+        STACK_RETURN(*STACK_SLOT(0));
+    }
+}
+
+static Lisp sch_sort(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 2);
+    return sort_(lisp_car(args), lisp_car(lisp_cdr(args)), lisp_null(), 1, e, ctx);
+}
+
+static Lisp sch_sort_in_place(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 2);
+    return sort_(lisp_car(args), lisp_car(lisp_cdr(args)), lisp_null(), 0, e, ctx);
+}
+
+static Lisp sch_sort_by_key(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(3, 3);
+    Lisp seq = lisp_car(args);
+    args = lisp_cdr(args);
+    Lisp key_proc = lisp_car(args);
+    args = lisp_cdr(args);
+    return sort_(seq, lisp_car(args), key_proc, 1, e, ctx);
+}
+
+static Lisp sch_assq(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 2);
+    Lisp key = lisp_car(args);
+    Lisp l = lisp_car(lisp_cdr(args));
+
+    while (lisp_is_pair(l))
+    {
+        Lisp entry = lisp_car(l);
+        if (lisp_is_pair(entry) && lisp_eq(key, lisp_car(entry))) return entry;
+        l = lisp_cdr(l);
+    }
+    return lisp_false();
+}
+
+static Lisp sch_assv(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 2);
+    Lisp key = lisp_car(args);
+    Lisp l = lisp_car(lisp_cdr(args));
+
+    while (lisp_is_pair(l))
+    {
+        Lisp entry = lisp_car(l);
+        if (lisp_is_pair(entry) && lisp_equal(key, lisp_car(entry))) return entry;
+        l = lisp_cdr(l);
+    }
+    return lisp_false();
+}
+
+static Lisp sch_assoc(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 2);
+    Lisp key = lisp_car(args);
+    Lisp l = lisp_car(lisp_cdr(args));
+
+    while (lisp_is_pair(l))
+    {
+        Lisp entry = lisp_car(l);
+        if (lisp_is_pair(entry) && lisp_equal_r(key, lisp_car(entry))) return entry;
+        l = lisp_cdr(l);
+    }
+    return lisp_false();
+}
+
+static Lisp sch_memq(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 2);
+    Lisp x = lisp_car(args);
+    Lisp l = lisp_car(lisp_cdr(args));
+
+    while (lisp_is_pair(l))
+    {
+        if (lisp_eq(lisp_car(l), x)) return l;
+        l = lisp_cdr(l);
+    }
+    return lisp_false();
+}
+
+static Lisp sch_memv(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 2);
+    Lisp x = lisp_car(args);
+    Lisp l = lisp_car(lisp_cdr(args));
+
+    while (lisp_is_pair(l))
+    {
+        if (lisp_equal(lisp_car(l), x)) return l;
+        l = lisp_cdr(l);
+    }
+    return lisp_false();
+}
+
+static Lisp sch_member(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 2);
+    Lisp x = lisp_car(args);
+    Lisp l = lisp_car(lisp_cdr(args));
+
+    while (lisp_is_pair(l))
+    {
+        if (lisp_equal_r(lisp_car(l), x)) return l;
+        l = lisp_cdr(l);
+    }
+    return lisp_false();
+}
+
+static Lisp sch_append_reverse(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 2);
+
+    Lisp l = lisp_car(args);
+    args = lisp_cdr(args);
+    Lisp tail = lisp_car(args);
+
+    return lisp_list_reverse2(l, tail);
+}
+
+static Lisp sch_list_ref(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 2);
+    Lisp list = lisp_car(args);
+    args = lisp_cdr(args);
+    Lisp index = lisp_car(args);
+    return lisp_list_ref(list, lisp_int(index));
+}
+
+static Lisp sch_length(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    return lisp_make_int(lisp_list_length(lisp_car(args)));
+}
+
+static Lisp sch_list_advance(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 2);
+    Lisp x = lisp_car(args);
+    args = lisp_cdr(args);
+    Lisp count = lisp_car(args);
+    return lisp_list_advance(x, lisp_int(count));
+}
+
+static Lisp sch_add(Lisp args, LispError* e, LispContext ctx)
+{
+    LispInt exact = 0;
+    LispReal inexact = 0;
+
+    while (lisp_is_pair(args))
+    {
+        Lisp x = lisp_car(args);
+        args = lisp_cdr(args);
+        switch (lisp_type(x))
+        {
+            case LISP_INT:
+                exact += lisp_int(x);
+                break;
+            case LISP_REAL:
+                inexact += lisp_real(x);
+                break;
+            default:
+                *e = LISP_ERROR_ARG_TYPE;
+                return lisp_null();
+        }
+    }
+
+    return inexact == 0
+        ? lisp_make_int(exact)
+        : lisp_make_real(inexact + (LispReal)exact);
+}
+
+static Lisp sch_mult(Lisp args, LispError* e, LispContext ctx)
+{
+    LispInt exact = 1;
+    LispReal inexact = 1;
+
+    while (lisp_is_pair(args))
+    {
+        Lisp x = lisp_car(args);
+        args = lisp_cdr(args);
+        switch (lisp_type(x))
+        {
+            case LISP_INT:
+                exact *= lisp_int(x);
+                break;
+            case LISP_REAL:
+                inexact *= lisp_real(x);
+                break;
+            default:
+                *e = LISP_ERROR_ARG_TYPE;
+                return lisp_null();
+        }
+    }
+
+    return inexact == 1
+        ? lisp_make_int(exact)
+        : lisp_make_real(inexact * (LispReal)exact);
+}
+
+static Lisp sch_sub(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 2);
+    Lisp x = lisp_car(args);
+    args = lisp_cdr(args);
+
+    Lisp y;
+    if (lisp_is_null(args))
+    {
+        y = x;
+        x = lisp_make_int(0);
+    }
+    else
+    {
+        y = lisp_car(args);
+    }
+    switch (lisp_type(x))
+    {
+        case LISP_REAL:
+            return lisp_make_real(lisp_real(x) - lisp_number_to_real(y));
+        case LISP_INT:
+            switch (lisp_type(y))
+            {
+                case LISP_REAL:
+                    return lisp_make_real(lisp_number_to_real(x) - lisp_real(y));
+                case LISP_INT:
+                    return lisp_make_int(lisp_int(x) - lisp_int(y));
+                default:
+                    *e = LISP_ERROR_ARG_TYPE;
+                    return lisp_null();
+            }
+            break;
+        default:
+            *e = LISP_ERROR_ARG_TYPE;
+            return lisp_null();
+    }
+}
+
+static Lisp sch_divide(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 2);
+    Lisp x = lisp_car(args);
+    args = lisp_cdr(args);
+    Lisp y = lisp_car(args);
+
+    switch (lisp_type(x))
+    {
+        case LISP_REAL:
+            return lisp_make_real(lisp_real(x) / lisp_number_to_real(y));
+        case LISP_INT:
+            switch (lisp_type(y))
+            {
+                case LISP_REAL:
+                    return lisp_make_real(lisp_number_to_real(x) / lisp_real(y));
+                case LISP_INT:
+                    // TODO: divide by zero check?
+                    return lisp_make_int(lisp_int(x) / lisp_int(y));
+                default:
+                    *e = LISP_ERROR_ARG_TYPE;
+                    return lisp_null();
+            }
+            break;
+        default:
+            *e = LISP_ERROR_ARG_TYPE;
+            return lisp_null();
+    }
+}
+
+static Lisp sch_less(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 2);
+    Lisp x = lisp_car(args);
+    args = lisp_cdr(args);
+    Lisp y = lisp_car(args);
+
+    switch (lisp_type(x))
+    {
+        case LISP_REAL:
+            return lisp_make_bool(lisp_real(x) < lisp_number_to_real(y));
+        case LISP_INT:
+            switch (lisp_type(y))
+            {
+                case LISP_REAL:
+                    return lisp_make_bool(lisp_number_to_real(x) < lisp_real(y));
+                case LISP_INT:
+                    return lisp_make_bool(lisp_int(x) < lisp_int(y));
+                default:
+                    *e = LISP_ERROR_ARG_TYPE;
+                    return lisp_null();
+            }
+            break;
+        default:
+            *e = LISP_ERROR_ARG_TYPE;
+            return lisp_null();
+    }
+}
+
+static Lisp sch_to_exact(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    return lisp_make_int(lisp_number_to_int(lisp_car(args)));
+}
+
+static Lisp sch_to_inexact(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    return lisp_make_real(lisp_number_to_real(lisp_car(args)));
+}
+
+static Lisp sch_symbol_to_string(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    Lisp val = lisp_car(args);
+    if (lisp_type(val) != LISP_SYMBOL)
+    {
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
+    }
+    else
+    {
+        return lisp_make_string2(lisp_symbol_string(val), ctx);
+    }
+}
+
+static Lisp sch_is_symbol(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    return lisp_make_bool(lisp_type(lisp_car(args)) == LISP_SYMBOL);
+}
+
+static Lisp sch_symbol_less(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 2);
+    Lisp a = lisp_car(args);
+    args = lisp_cdr(args);
+    Lisp b = lisp_car(args);
+    int result = strncmp(lisp_symbol_string(a), lisp_symbol_string(b), LISP_IDENTIFIER_MAX) < 0;
+    return lisp_make_bool(result);
+}
+
+static Lisp sch_string_to_symbol(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    Lisp val = lisp_car(args);
+    if (lisp_type(val) != LISP_STRING)
+    {
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
+    }
+    else
+    {
+        return lisp_make_symbol(lisp_string(val), ctx);
+    }
+}
+
+static Lisp sch_gensym(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(0, 0);
+    return lisp_gen_symbol(ctx);
+}
+
+static Lisp sch_is_string(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    return lisp_make_bool(lisp_type(lisp_car(args)) == LISP_STRING);
+}
+
+static Lisp sch_string_is_null(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    Lisp a = lisp_car(args);
+    return lisp_make_bool(lisp_string(a)[0] == '\0');
+}
+
+static Lisp sch_make_string(Lisp args, LispError* e, LispContext ctx)
+{
+    Lisp length = lisp_car(args);
+
+    if (lisp_type(length) != LISP_INT)
+    {
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
+    }
+
+    Lisp s = lisp_make_string(lisp_int(length), ctx);
+    args = lisp_cdr(args);
+
+    if (!lisp_is_null(args))
+        lisp_buffer_fill(s, 0, lisp_int(length), lisp_char(lisp_car(args)));
+    return s;
+}
+
+static Lisp sch_string_less(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 2);
+    Lisp a = lisp_car(args);
+    args = lisp_cdr(args);
+    Lisp b = lisp_car(args);
+    int result = strcmp(lisp_string(a), lisp_string(b)) < 0;
+    return lisp_make_bool(result);
+}
+
+static Lisp sch_substring(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(3, 3);
+    Lisp s = lisp_car(args);
+    args = lisp_cdr(args);
+    Lisp start = lisp_car(args);
+    args = lisp_cdr(args);
+    Lisp end = lisp_car(args);
+    return lisp_substring(s, lisp_int(start), lisp_int(end), ctx);
+}
+
+// (string-search-forward pattern string start)
+// The index where pattern is found, or #f. Searches in place.
+static Lisp sch_string_search_forward(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(3, 3);
+    Lisp pattern = lisp_car(args);
+    args = lisp_cdr(args);
+    Lisp s = lisp_car(args);
+    Lisp start = lisp_car(lisp_cdr(args));
+    if (lisp_type(pattern) != LISP_STRING || lisp_type(s) != LISP_STRING || lisp_type(start) != LISP_INT)
+    {
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
+    }
+
+    const char* text = lisp_string(s);
+    LispInt i = lisp_int(start);
+    if (i < 0 || i >= lisp_buffer_capacity(s))
+    {
+        *e = LISP_ERROR_OUT_OF_BOUNDS;
+        return lisp_null();
+    }
+
+    const char* found = strstr(text + i, lisp_string(pattern));
+    return found ? lisp_make_int((LispInt)(found - text)) : lisp_false();
+}
+
+static Lisp sch_string_length(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    int n = lisp_string_length(lisp_car(args));
+    return lisp_make_int(n);
+}
+
+static Lisp sch_string_ref(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 2);
+    Lisp str = lisp_car(args);
+    Lisp index = lisp_car(lisp_cdr(args));
+    if (lisp_type(str) != LISP_STRING || lisp_type(index) != LISP_INT)
+    {
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
+    }
+
+    return lisp_make_char((int)lisp_string_ref(str, lisp_int(index)));
+}
+
+static Lisp sch_string_set(Lisp args, LispError* e, LispContext ctx)
+{
+    Lisp str = lisp_car(args);
+    args = lisp_cdr(args);
+    Lisp index = lisp_car(args);
+    args = lisp_cdr(args);
+    Lisp val = lisp_car(args);
+    if (lisp_type(str) != LISP_STRING || lisp_type(index) != LISP_INT || lisp_is_read_only(str))
+    {
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
+    }
+
+    lisp_string_set(str, lisp_int(index), (char)lisp_int(val));
+    return lisp_null();
+}
+
+static Lisp sch_string_upcase(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    Lisp r = lisp_buffer_copy(lisp_car(args), ctx);
+
+    char* c = lisp_buffer(r);
+    while (*c) { *c = toupper(*c); ++c; }
+    return r;
+}
+
+static Lisp sch_string_downcase(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    Lisp r = lisp_buffer_copy(lisp_car(args), ctx);
+
+    char* c = lisp_buffer(r);
+    while (*c) { *c = tolower(*c); ++c; }
+    return r;
+}
+
+static Lisp sch_string_append(Lisp args, LispError* e, LispContext ctx)
+{
+    int count = 0;
+    Lisp it = args;
+    while (lisp_is_pair(it))
+    {
+        Lisp x = lisp_car(it);
+        count += strlen(lisp_string(x));
+        it = lisp_cdr(it);
+    }
+
+    Lisp result = lisp_make_string(count, ctx);
+    char* c = lisp_buffer(result);
+
+    it = args;
+    while (lisp_is_pair(it))
+    {
+        Lisp x = lisp_car(it);
+        int n = (LispInt)strlen(lisp_string(x));
+        memcpy(c, lisp_string(x), n);
+        c += n;
+        it = lisp_cdr(it);
+    }
+    return result;
+}
+
+static Lisp sch_string_to_list(Lisp args, LispError* e, LispContext ctx)
+{
+    const char* c = lisp_string(lisp_car(args));
+    Lisp tail = lisp_null();
+    while (*c)
+    {
+        tail = lisp_cons(lisp_make_char(*c), tail, ctx);
+        ++c;
+    }
+    return lisp_list_reverse(tail);
+}
+
+static Lisp sch_list_to_string(Lisp args, LispError* e, LispContext ctx)
+{
+    Lisp l = lisp_car(args);
+    Lisp result = lisp_make_string(lisp_list_length(l), ctx);
+    char* s = lisp_buffer(result);
+
+    while (lisp_is_pair(l))
+    {
+        *s = (char)lisp_char(lisp_car(l));
+        ++s;
+        l = lisp_cdr(l);
+    }
+    return result;
+}
+
+static Lisp sch_string_to_number(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    const char* string = lisp_string(lisp_car(args));
+    if (strchr(string, '.'))
+    {
+        return lisp_parse_real(string);
+    }
+    else
+    {
+        return lisp_parse_int(string);
+    }
+}
+
+static Lisp sch_number_to_string(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    char scratch[64];
+    Lisp val = lisp_car(args);
+    switch (lisp_type(val))
+    {
+        case LISP_REAL:
+            snprintf(scratch, 64, "%f", lisp_real(val));
+            break;
+        case LISP_INT:
+            snprintf(scratch, 64, "%lli", lisp_int(val));
+            break;
+        default:
+        {
+            *e = LISP_ERROR_ARG_TYPE;
+            return lisp_null();
+        }
+    }
+    return lisp_make_string2(scratch, ctx);
+}
+
+static Lisp sch_char_less(Lisp args, LispError* e, LispContext ctx)
+{
+    Lisp a = lisp_car(args);
+    args = lisp_cdr(args);
+    Lisp b = lisp_car(args);
+    return lisp_make_bool(lisp_char(a) < lisp_char(b));
+}
+
+static Lisp sch_is_char(Lisp args, LispError* e, LispContext ctx)
+{
+    return lisp_make_bool(lisp_type(lisp_car(args)) == LISP_CHAR);
+}
+
+static Lisp sch_char_upcase(Lisp args, LispError* e, LispContext ctx)
+{
+    int c = lisp_char(lisp_car(args));
+    return lisp_make_char(toupper(c));
+}
+
+static Lisp sch_char_downcase(Lisp args, LispError* e, LispContext ctx)
+{
+    int c = lisp_char(lisp_car(args));
+    return lisp_make_char(tolower(c));
+}
+
+static Lisp sch_char_is_alphanum(Lisp args, LispError* e, LispContext ctx)
+{
+    int c = lisp_char(lisp_car(args));
+    return lisp_make_bool(isalnum(c));
+}
+
+static Lisp sch_char_is_alpha(Lisp args, LispError* e, LispContext ctx)
+{
+    int c = lisp_char(lisp_car(args));
+    return lisp_make_bool(isalpha(c));
+}
+
+static Lisp sch_char_is_number(Lisp args, LispError* e, LispContext ctx)
+{
+    int c = lisp_char(lisp_car(args));
+    return lisp_make_bool(isdigit(c));
+}
+
+static Lisp sch_char_is_white(Lisp args, LispError* e, LispContext ctx)
+{
+    int c = lisp_char(lisp_car(args));
+    return lisp_make_bool(isblank(c));
+}
+
+static Lisp sch_char_to_int(Lisp args, LispError* e, LispContext ctx)
+{
+    return lisp_make_int(lisp_char(lisp_car(args)));
+}
+
+static Lisp sch_is_int(Lisp args, LispError* e, LispContext ctx)
+{
+    return lisp_make_bool(lisp_type(lisp_car(args)) == LISP_INT);
+}
+
+static Lisp sch_is_real(Lisp args, LispError* e, LispContext ctx)
+{
+    LispType t = lisp_type(lisp_car(args));
+    return lisp_make_bool(t == LISP_INT || t == LISP_REAL);
+}
+
+static Lisp sch_is_boolean(Lisp args, LispError* e, LispContext ctx)
+{
+    return lisp_make_bool(lisp_type(lisp_car(args)) == LISP_BOOL);
+}
+
+static Lisp sch_not(Lisp args, LispError* e, LispContext ctx)
+{
+    return lisp_make_bool(!lisp_is_true(lisp_car(args)));
+}
+
+static Lisp sch_is_even(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    return lisp_make_bool( (lisp_int(lisp_car(args)) & 1) == 0);
+}
+
+static Lisp sch_exp(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    return lisp_make_real( exp(lisp_number_to_real(lisp_car(args))) );
+}
+
+static int ipow(int base, int exp)
+{
+    int result = 1;
+    for (;;)
+    {
+        if (exp & 1)
+            result *= base;
+        exp >>= 1;
+        if (!exp)
+            break;
+        base *= base;
+    }
+
+    return result;
+}
+
+static Lisp sch_power(Lisp args, LispError* e, LispContext ctx)
+{
+    Lisp base = lisp_car(args);
+    args = lisp_cdr(args);
+    Lisp power = lisp_car(args);
+
+    if (lisp_type(base) == LISP_INT && lisp_type(power) == LISP_INT)
+    {
+        return lisp_make_int( ipow(lisp_int(base), lisp_int(power)) );
+    }
+    else
+    {
+        return lisp_make_real( pow(lisp_number_to_real(base), lisp_number_to_real(power)) );
+    }
+}
+
+static Lisp sch_log(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    return lisp_make_real( log(lisp_number_to_real(lisp_car(args))) );
+}
+
+static Lisp sch_sin(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    return lisp_make_real( sin(lisp_number_to_real(lisp_car(args))) );
+}
+
+static Lisp sch_cos(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    return lisp_make_real( cos(lisp_number_to_real(lisp_car(args))) );
+}
+
+static Lisp sch_tan(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    return lisp_make_real( tan(lisp_number_to_real(lisp_car(args))) );
+}
+
+static Lisp sch_sqrt(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    return lisp_make_real( sqrt(lisp_number_to_real(lisp_car(args))) );
+}
+
+static Lisp sch_atan(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 2);
+    LispReal y = lisp_number_to_real(lisp_car(args));
+    args = lisp_cdr(args);
+
+    if (lisp_is_null(args))
+    {
+        return lisp_make_real( atan(y) );
+    }
+    else
+    {
+        LispReal x = lisp_number_to_real(lisp_car(args));
+        return lisp_make_real( atan2(y, x) );
+    }
+}
+
+static Lisp sch_round(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    Lisp x = lisp_car(args);
+    switch (lisp_type(x))
+    {
+        case LISP_INT:
+            return lisp_make_int((LispInt)round(lisp_int(x)));
+        case LISP_REAL:
+            return lisp_make_real(round(lisp_real(x)));
+        default:
+            *e = LISP_ERROR_ARG_TYPE;
+            return lisp_null();
+    }
+
+}
+
+static Lisp sch_floor(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    Lisp x = lisp_car(args);
+    switch (lisp_type(x))
+    {
+        case LISP_INT:
+            return lisp_make_int((LispInt)floor(lisp_int(x)));
+        case LISP_REAL:
+            return lisp_make_real(floor(lisp_real(x)));
+        default:
+            *e = LISP_ERROR_ARG_TYPE;
+            return lisp_null();
+    }
+
+}
+
+static Lisp sch_ceiling(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    Lisp x = lisp_car(args);
+    switch (lisp_type(x))
+    {
+        case LISP_INT:
+            return lisp_make_int((LispInt)ceil(lisp_int(x)));
+        case LISP_REAL:
+            return lisp_make_real(ceil(lisp_real(x)));
+        default:
+            *e = LISP_ERROR_ARG_TYPE;
+            return lisp_null();
+    }
+}
+
+static Lisp sch_quotient(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 2);
+    LispInt a = lisp_int(lisp_car(args));
+    args = lisp_cdr(args);
+    LispInt b = lisp_int(lisp_car(args));
+    return lisp_make_int(a / b);
+}
+
+static Lisp sch_remainder(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 2);
+    int a = lisp_int(lisp_car(args));
+    args = lisp_cdr(args);
+    int b = lisp_int(lisp_car(args));
+    return lisp_make_int(a % b);
+}
+
+static Lisp sch_modulo(Lisp args, LispError* e, LispContext ctx)
+{
+    int m = lisp_int(sch_remainder(args, e, ctx));
+    if (m < 0) {
+        int b = lisp_int(lisp_car(lisp_cdr(args)));
+        m = (b < 0) ? m - b : m + b;
+    }
+    return lisp_make_int(m);
+}
+
+static Lisp sch_abs(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    Lisp x = lisp_car(args);
+    switch (lisp_type(x))
+    {
+        case LISP_INT:
+            return lisp_make_int(llabs(lisp_int(x)));
+        case LISP_REAL:
+            return lisp_make_real(fabs(lisp_real(x)));
+        default:
+            *e = LISP_ERROR_ARG_TYPE;
+            return lisp_null();
+    }
+}
+
+static Lisp sch_is_vector(Lisp args, LispError* e, LispContext ctx)
+{
+    return lisp_make_bool( lisp_type(lisp_car(args)) == LISP_VECTOR );
+}
+
+static Lisp sch_make_vector(Lisp args, LispError* e, LispContext ctx)
+{
+    Lisp length = lisp_car(args);
+
+    if (lisp_type(length) != LISP_INT)
+    {
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
+    }
+
+    Lisp v = lisp_make_vector(lisp_int(length), ctx);
+    args = lisp_cdr(args);
+
+    if (!lisp_is_null(args))
+        lisp_vector_fill(v, lisp_car(args));
+    return v;
+}
+
+static Lisp sch_vector_grow(Lisp args, LispError* e, LispContext ctx)
+{
+    Lisp v = lisp_car(args);
+    Lisp length = lisp_car(lisp_cdr(args));
+
+    if (lisp_type(length) != LISP_INT || lisp_type(v) != LISP_VECTOR)
+    {
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
+    }
+
+    if (lisp_int(length) < lisp_vector_length(v))
     {
-        *e = LISP_ERROR_ARG_TYPE;
+        *e = LISP_ERROR_OUT_OF_BOUNDS;
         return lisp_null();
     }
 
-    return lisp_make_char((int)lisp_string_ref(str, lisp_int(index)));
+    return lisp_vector_grow(v, lisp_int(length), ctx);
 }
 
-static Lisp sch_string_set(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_vector_length(Lisp args, LispError* e, LispContext ctx)
 {
-    Lisp str = lisp_car(args);
-    args = lisp_cdr(args);
-    Lisp index = lisp_car(args);
-    args = lisp_cdr(args);
-    Lisp val = lisp_car(args);
-    if (lisp_type(str) != LISP_STRING || lisp_type(index) != LISP_INT)
+    Lisp v = lisp_car(args);
+    if (lisp_type(v) != LISP_VECTOR)
     {
         *e = LISP_ERROR_ARG_TYPE;
         return lisp_null();
     }
 
-    lisp_string_set(str, lisp_int(index), (char)lisp_int(val));
-    return lisp_null();
-}
-
-static Lisp sch_string_upcase(Lisp args, LispError* e, LispContext ctx)
-{
-    ARITY_CHECK(1, 1);
-    Lisp r = lisp_buffer_copy(lisp_car(args), ctx);
-
-    char* c = lisp_buffer(r);
-    while (*c) { *c = toupper(*c); ++c; }
-    return r;
+    return lisp_make_int(lisp_vector_length(v));
 }
 
-static Lisp sch_string_downcase(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_vector_ref(Lisp args, LispError* e, LispContext ctx)
 {
-    ARITY_CHECK(1, 1);
-    Lisp r = lisp_buffer_copy(lisp_car(args), ctx);
-
-    char* c = lisp_buffer(r);
-    while (*c) { *c = tolower(*c); ++c; }
-    return r;
-}
+    Lisp v = lisp_car(args);
+    Lisp i = lisp_car(lisp_cdr(args));
 
-static Lisp sch_string_append(Lisp args, LispError* e, LispContext ctx)
-{
-    int count = 0;
-    Lisp it = args;
-    while (lisp_is_pair(it))
+    if (lisp_type(v) != LISP_VECTOR || lisp_type(i) != LISP_INT)
     {
-        Lisp x = lisp_car(it);
-        count += strlen(lisp_string(x));
-        it = lisp_cdr(it);
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
     }
 
-    Lisp result = lisp_make_string(count, ctx);
-    char* c = lisp_buffer(result);
-
-    it = args;
-    while (lisp_is_pair(it))
+    if (lisp_int(i) >= lisp_vector_length(v))
     {
-        Lisp x = lisp_car(it);
-        int n = (LispInt)strlen(lisp_string(x));
-        memcpy(c, lisp_string(x), n);
-        c += n;
-        it = lisp_cdr(it);
+        *e = LISP_ERROR_OUT_OF_BOUNDS;
+        return lisp_null();
     }
-    return result;
+
+    return lisp_vector_ref(v, lisp_int(i));
 }
 
-static Lisp sch_string_to_list(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_vector_set(Lisp args, LispError* e, LispContext ctx)
 {
-    const char* c = lisp_string(lisp_car(args));
-    Lisp tail = lisp_null();
-    while (*c)
+    Lisp v = lisp_list_ref(args, 0);
+    Lisp i = lisp_list_ref(args, 1);
+    Lisp x = lisp_list_ref(args, 2);
+
+    if (lisp_type(v) != LISP_VECTOR || lisp_type(i) != LISP_INT)
     {
-        tail = lisp_cons(lisp_make_char(*c), tail, ctx);
-        ++c;
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
     }
-    return lisp_list_reverse(tail);
-}
-
-static Lisp sch_list_to_string(Lisp args, LispError* e, LispContext ctx)
-{
-    Lisp l = lisp_car(args);
-    Lisp result = lisp_make_string(lisp_list_length(l), ctx);
-    char* s = lisp_buffer(result);
 
-    while (lisp_is_pair(l))
+    if (lisp_int(i) >= lisp_vector_length(v))
     {
-        *s = (char)lisp_char(lisp_car(l));
-        ++s;
-        l = lisp_cdr(l);
+        *e = LISP_ERROR_OUT_OF_BOUNDS;
+        return lisp_null();
     }
-    return result;
+
+    lisp_vector_set(v, lisp_int(i), x);
+    return lisp_null();
 }
 
-static Lisp sch_string_to_number(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_vector_swap(Lisp args, LispError* e, LispContext ctx)
 {
-    ARITY_CHECK(1, 1);
-    const char* string = lisp_string(lisp_car(args));
-    if (strchr(string, '.'))
+    Lisp v = lisp_car(args);
+    args = lisp_cdr(args);
+    Lisp i = lisp_car(args);
+    args = lisp_cdr(args);
+    Lisp j = lisp_car(args);
+
+    if (lisp_type(v) != LISP_VECTOR || lisp_type(i) != LISP_INT || lisp_type(j) != LISP_INT)
     {
-        return lisp_parse_real(string);
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
     }
-    else
+    if (lisp_int(i) >= lisp_vector_length(v) || lisp_int(j) >= lisp_vector_length(v))
     {
-        return lisp_parse_int(string);
+        *e = LISP_ERROR_OUT_OF_BOUNDS;
+        return lisp_null();
     }
+    return lisp_vector_swap(v, lisp_int(i), lisp_int(j));
 }
 
-static Lisp sch_number_to_string(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_vector_fill(Lisp args, LispError* e, LispContext ctx)
 {
-    ARITY_CHECK(1, 1);
-    char scratch[64];
-    Lisp val = lisp_car(args);
-    switch (lisp_type(val))
-    {
-        case LISP_REAL:
-            snprintf(scratch, 64, "%f", lisp_real(val));
-            break;
-        case LISP_INT:
-            snprintf(scratch, 64, "%lli", lisp_int(val));
-            break;
-        default:
-        {
-            *e = LISP_ERROR_ARG_TYPE;
-            return lisp_null();
-        }
-    }
-    return lisp_make_string2(scratch, ctx);
+    Lisp v = lisp_car(args);
+    args = lisp_cdr(args);
+    lisp_vector_fill(v, lisp_car(args));
+    return lisp_null();
 }
 
-static Lisp sch_char_less(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_vector_assq(Lisp args, LispError* e, LispContext ctx)
 {
-    Lisp a = lisp_car(args);
+    Lisp k = lisp_car(args);
     args = lisp_cdr(args);
-    Lisp b = lisp_car(args);
-    return lisp_make_bool(lisp_char(a) < lisp_char(b));
+    Lisp v = lisp_car(args);
+    return lisp_avector_ref(v, k);
 }
 
-static Lisp sch_is_char(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_subvector(Lisp args, LispError* e, LispContext ctx)
 {
-    return lisp_make_bool(lisp_type(lisp_car(args)) == LISP_CHAR);
+    ARITY_CHECK(3, 3);
+    Lisp v = lisp_car(args);
+    args = lisp_cdr(args);
+    Lisp start = lisp_car(args);
+    args = lisp_cdr(args);
+    Lisp end = lisp_car(args);
+    return lisp_subvector(v, lisp_int(start), lisp_int(end), ctx);
 }
 
-static Lisp sch_char_upcase(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_list_to_vector(Lisp args, LispError* e, LispContext ctx)
 {
-    int c = lisp_char(lisp_car(args));
-    return lisp_make_char(toupper(c));
-}
+    Lisp l = lisp_car(args);
+    int n = lisp_list_length(l);
+    Lisp v = lisp_make_vector(n, ctx);
 
-static Lisp sch_char_downcase(Lisp args, LispError* e, LispContext ctx)
-{
-    int c = lisp_char(lisp_car(args));
-    return lisp_make_char(tolower(c));
+    for (int i = 0; i < n; ++i)
+    {
+        lisp_vector_set(v, i, lisp_car(l));
+        l = lisp_cdr(l);
+    }
+    return v;
 }
 
-static Lisp sch_char_is_alphanum(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_vector_to_list(Lisp args, LispError* e, LispContext ctx)
 {
-    int c = lisp_char(lisp_car(args));
-    return lisp_make_bool(isalnum(c));
-}
+    Lisp v = lisp_car(args);
+    int n = lisp_vector_length(v);
 
-static Lisp sch_char_is_alpha(Lisp args, LispError* e, LispContext ctx)
-{
-    int c = lisp_char(lisp_car(args));
-    return lisp_make_bool(isalpha(c));
+    Lisp tail = lisp_null();
+    for (int i = 0; i < n; ++i)
+        tail = lisp_cons(lisp_vector_ref(v, i), tail, ctx);
+    return lisp_list_reverse(tail);
 }
 
-static Lisp sch_char_is_number(Lisp args, LispError* e, LispContext ctx)
-{
-    int c = lisp_char(lisp_car(args));
-    return lisp_make_bool(isdigit(c));
-}
+// Typed vectors
+// The f64vector, s64vector and bytevector procedures share implementations,
+// which accept any typed vector.
 
-static Lisp sch_char_is_white(Lisp args, LispError* e, LispContext ctx)
+static Lisp make_typed_vector_of_(LispType type, int n, LispContext ctx)
 {
-    int c = lisp_char(lisp_car(args));
-    return lisp_make_bool(isblank(c));
+    switch (type)
+    {
+        case LISP_F64VECTOR: return lisp_make_f64vector(n, ctx);
+        case LISP_S64VECTOR: return lisp_make_s64vector(n, ctx);
+        default: return lisp_make_bytevector(n, ctx);
+    }
 }
 
-static Lisp sch_char_to_int(Lisp args, LispError* e, LispContext ctx)
+static Lisp typed_vector_ref_(Lisp v, int i)
 {
-    return lisp_make_int(lisp_char(lisp_car(args)));
+    switch (lisp_type(v))
+    {
+        case LISP_F64VECTOR: return lisp_make_real(lisp_f64vector(v)[i]);
+        case LISP_S64VECTOR: return lisp_make_int(lisp_s64vector(v)[i]);
+        default: return lisp_make_int(lisp_bytevector(v)[i]);
+    }
 }
 
-static Lisp sch_is_int(Lisp args, LispError* e, LispContext ctx)
+static LispError typed_vector_set_(Lisp v, int i, Lisp x)
 {
-    return lisp_make_bool(lisp_type(lisp_car(args)) == LISP_INT);
+    if (lisp_is_read_only(v)) return LISP_ERROR_ARG_TYPE;
+    switch (lisp_type(v))
+    {
+        case LISP_F64VECTOR:
+            if (lisp_type(x) != LISP_REAL && lisp_type(x) != LISP_INT) return LISP_ERROR_ARG_TYPE;
+            lisp_f64vector(v)[i] = lisp_number_to_real(x);
+            return LISP_ERROR_NONE;
+        case LISP_S64VECTOR:
+            if (lisp_type(x) != LISP_INT) return LISP_ERROR_ARG_TYPE;
+            lisp_s64vector(v)[i] = lisp_int(x);
+            return LISP_ERROR_NONE;
+        default:
+            if (lisp_type(x) != LISP_INT || lisp_int(x) < 0 || lisp_int(x) > 255) return LISP_ERROR_ARG_TYPE;
+            lisp_bytevector(v)[i] = (uint8_t)lisp_int(x);
+            return LISP_ERROR_NONE;
+    }
 }
 
-static Lisp sch_is_real(Lisp args, LispError* e, LispContext ctx)
+static size_t typed_vector_element_size_(Lisp v)
 {
-    LispType t = lisp_type(lisp_car(args));
-    return lisp_make_bool(t == LISP_INT || t == LISP_REAL);
+    return lisp_type(v) == LISP_BYTEVECTOR ? 1 : 8;
 }
 
-static Lisp sch_is_boolean(Lisp args, LispError* e, LispContext ctx)
+static Lisp make_typed_vector_filled_(LispType type, Lisp args, LispError* e, LispContext ctx)
 {
-    return lisp_make_bool(lisp_type(lisp_car(args)) == LISP_BOOL);
+    ARITY_CHECK(1, 2);
+    Lisp length = lisp_car(args);
+    if (lisp_type(length) != LISP_INT || lisp_int(length) < 0)
+    {
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
+    }
+
+    int n = (int)lisp_int(length);
+    Lisp v = make_typed_vector_of_(type, n, ctx);
+    Lisp fill = lisp_is_null(lisp_cdr(args)) ? lisp_make_int(0) : lisp_car(lisp_cdr(args));
+    for (int i = 0; i < n; ++i)
+    {
+        *e = typed_vector_set_(v, i, fill);
+        if (*e != LISP_ERROR_NONE) return lisp_null();
+    }
+    return v;
 }
 
-static Lisp sch_not(Lisp args, LispError* e, LispContext ctx)
+static Lisp typed_vector_from_list_(LispType type, Lisp l, LispError* e, LispContext ctx)
 {
-    return lisp_make_bool(!lisp_is_true(lisp_car(args)));
+    int n = lisp_list_length(l);
+    Lisp v = make_typed_vector_of_(type, n, ctx);
+    for (int i = 0; i < n; ++i)
+    {
+        *e = typed_vector_set_(v, i, lisp_car(l));
+        if (*e != LISP_ERROR_NONE) return lisp_null();
+        l = lisp_cdr(l);
+    }
+    return v;
 }
 
-static Lisp sch_is_even(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_make_f64vector(Lisp args, LispError* e, LispContext ctx)
 {
-    ARITY_CHECK(1, 1);
-    return lisp_make_bool( (lisp_int(lisp_car(args)) & 1) == 0);
+    return make_typed_vector_filled_(LISP_F64VECTOR, args, e, ctx);
 }
 
-static Lisp sch_exp(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_make_s64vector(Lisp args, LispError* e, LispContext ctx)
 {
-    ARITY_CHECK(1, 1);
-    return lisp_make_real( exp(lisp_number_to_real(lisp_car(args))) );
+    return make_typed_vector_filled_(LISP_S64VECTOR, args, e, ctx);
 }
 
-static int ipow(int base, int exp)
+static Lisp sch_make_bytevector(Lisp args, LispError* e, LispContext ctx)
 {
-    int result = 1;
-    for (;;)
-    {
-        if (exp & 1)
-            result *= base;
-        exp >>= 1;
-        if (!exp)
-            break;
-        base *= base;
-    }
+    return make_typed_vector_filled_(LISP_BYTEVECTOR, args, e, ctx);
+}
 
-    return result;
+static Lisp sch_f64vector(Lisp args, LispError* e, LispContext ctx)
+{
+    return typed_vector_from_list_(LISP_F64VECTOR, args, e, ctx);
 }
 
-static Lisp sch_power(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_s64vector(Lisp args, LispError* e, LispContext ctx)
 {
-    Lisp base = lisp_car(args);
-    args = lisp_cdr(args);
-    Lisp power = lisp_car(args);
+    return typed_vector_from_list_(LISP_S64VECTOR, args, e, ctx);
+}
 
-    if (lisp_type(base) == LISP_INT && lisp_type(power) == LISP_INT)
-    {
-        return lisp_make_int( ipow(lisp_int(base), lisp_int(power)) );
-    }
-    else
-    {
-        return lisp_make_real( pow(lisp_number_to_real(base), lisp_number_to_real(power)) );
-    }
+static Lisp sch_bytevector(Lisp args, LispError* e, LispContext ctx)
+{
+    return typed_vector_from_list_(LISP_BYTEVECTOR, args, e, ctx);
 }
 
-static Lisp sch_log(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_list_to_f64vector(Lisp args, LispError* e, LispContext ctx)
 {
     ARITY_CHECK(1, 1);
-    return lisp_make_real( log(lisp_number_to_real(lisp_car(args))) );
+    return typed_vector_from_list_(LISP_F64VECTOR, lisp_car(args), e, ctx);
 }
 
-static Lisp sch_sin(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_list_to_s64vector(Lisp args, LispError* e, LispContext ctx)
 {
     ARITY_CHECK(1, 1);
-    return lisp_make_real( sin(lisp_number_to_real(lisp_car(args))) );
+    return typed_vector_from_list_(LISP_S64VECTOR, lisp_car(args), e, ctx);
 }
 
-static Lisp sch_cos(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_is_f64vector(Lisp args, LispError* e, LispContext ctx)
 {
-    ARITY_CHECK(1, 1);
-    return lisp_make_real( cos(lisp_number_to_real(lisp_car(args))) );
+    return lisp_make_bool(lisp_type(lisp_car(args)) == LISP_F64VECTOR);
 }
 
-static Lisp sch_tan(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_is_s64vector(Lisp args, LispError* e, LispContext ctx)
 {
-    ARITY_CHECK(1, 1);
-    return lisp_make_real( tan(lisp_number_to_real(lisp_car(args))) );
+    return lisp_make_bool(lisp_type(lisp_car(args)) == LISP_S64VECTOR);
 }
 
-static Lisp sch_sqrt(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_is_bytevector(Lisp args, LispError* e, LispContext ctx)
+{
+    return lisp_make_bool(lisp_type(lisp_car(args)) == LISP_BYTEVECTOR);
+}
+
+static Lisp sch_typed_vector_length(Lisp args, LispError* e, LispContext ctx)
 {
     ARITY_CHECK(1, 1);
-    return lisp_make_real( sqrt(lisp_number_to_real(lisp_car(args))) );
+    Lisp v = lisp_car(args);
+    if (!lisp_is_typed_vector(v))
+    {
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
+    }
+    return lisp_make_int(lisp_typed_vector_length(v));
 }
 
-static Lisp sch_atan(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_typed_vector_ref(Lisp args, LispError* e, LispContext ctx)
 {
-    ARITY_CHECK(1, 2);
-    LispReal y = lisp_number_to_real(lisp_car(args));
-    args = lisp_cdr(args);
+    ARITY_CHECK(2, 2);
+    Lisp v = lisp_car(args);
+    Lisp i = lisp_car(lisp_cdr(args));
 
-    if (lisp_is_null(args))
+    if (!lisp_is_typed_vector(v) || lisp_type(i) != LISP_INT)
     {
-        return lisp_make_real( atan(y) );
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
     }
-    else
+
+    if (lisp_int(i) < 0 || lisp_int(i) >= lisp_typed_vector_length(v))
     {
-        LispReal x = lisp_number_to_real(lisp_car(args));
-        return lisp_make_real( atan2(y, x) );
+        *e = LISP_ERROR_OUT_OF_BOUNDS;
+        return lisp_null();
     }
+    return typed_vector_ref_(v, (int)lisp_int(i));
 }
 
-static Lisp sch_round(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_typed_vector_set(Lisp args, LispError* e, LispContext ctx)
 {
-    ARITY_CHECK(1, 1);
-    Lisp x = lisp_car(args);
-    switch (lisp_type(x))
+    ARITY_CHECK(3, 3);
+    Lisp v = lisp_list_ref(args, 0);
+    Lisp i = lisp_list_ref(args, 1);
+    Lisp x = lisp_list_ref(args, 2);
+
+    if (!lisp_is_typed_vector(v) || lisp_type(i) != LISP_INT)
     {
-        case LISP_INT:
-            return lisp_make_int((LispInt)round(lisp_int(x)));
-        case LISP_REAL:
-            return lisp_make_real(round(lisp_real(x)));
-        default:
-            *e = LISP_ERROR_ARG_TYPE;
-            return lisp_null();
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
     }
 
+    if (lisp_int(i) < 0 || lisp_int(i) >= lisp_typed_vector_length(v))
+    {
+        *e = LISP_ERROR_OUT_OF_BOUNDS;
+        return lisp_null();
+    }
+    *e = typed_vector_set_(v, (int)lisp_int(i), x);
+    return lisp_null();
 }
 
-static Lisp sch_floor(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_typed_vector_to_list(Lisp args, LispError* e, LispContext ctx)
 {
     ARITY_CHECK(1, 1);
-    Lisp x = lisp_car(args);
-    switch (lisp_type(x))
+    Lisp v = lisp_car(args);
+    if (!lisp_is_typed_vector(v))
     {
-        case LISP_INT:
-            return lisp_make_int((LispInt)floor(lisp_int(x)));
-        case LISP_REAL:
-            return lisp_make_real(floor(lisp_real(x)));
-        default:
-            *e = LISP_ERROR_ARG_TYPE;
-            return lisp_null();
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
     }
 
+    Lisp tail = lisp_null();
+    for (int i = lisp_typed_vector_length(v) - 1; i >= 0; --i)
+        tail = lisp_cons(typed_vector_ref_(v, i), tail, ctx);
+    return tail;
 }
 
-static Lisp sch_ceiling(Lisp args, LispError* e, LispContext ctx)
+// Reads optional [start end] arguments, defaulting to the whole vector.
+static int typed_vector_range_(Lisp v, Lisp args, int* start, int* end)
 {
-    ARITY_CHECK(1, 1);
-    Lisp x = lisp_car(args);
-    switch (lisp_type(x))
+    int n = lisp_typed_vector_length(v);
+    *start = 0;
+    *end = n;
+    if (lisp_is_pair(args))
     {
-        case LISP_INT:
-            return lisp_make_int((LispInt)ceil(lisp_int(x)));
-        case LISP_REAL:
-            return lisp_make_real(ceil(lisp_real(x)));
-        default:
-            *e = LISP_ERROR_ARG_TYPE;
-            return lisp_null();
+        if (lisp_type(lisp_car(args)) != LISP_INT) return 0;
+        *start = (int)lisp_int(lisp_car(args));
+        args = lisp_cdr(args);
     }
+    if (lisp_is_pair(args))
+    {
+        if (lisp_type(lisp_car(args)) != LISP_INT) return 0;
+        *end = (int)lisp_int(lisp_car(args));
+    }
+    return 0 <= *start && *start <= *end && *end <= n;
 }
 
-static Lisp sch_quotient(Lisp args, LispError* e, LispContext ctx)
-{
-    ARITY_CHECK(2, 2);
-    LispInt a = lisp_int(lisp_car(args));
-    args = lisp_cdr(args);
-    LispInt b = lisp_int(lisp_car(args));
-    return lisp_make_int(a / b);
-}
-
-static Lisp sch_remainder(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_typed_vector_fill(Lisp args, LispError* e, LispContext ctx)
 {
-    ARITY_CHECK(2, 2);
-    int a = lisp_int(lisp_car(args));
+    ARITY_CHECK(2, 4);
+    Lisp v = lisp_car(args);
     args = lisp_cdr(args);
-    int b = lisp_int(lisp_car(args));
-    return lisp_make_int(a % b);
-}
+    Lisp x = lisp_car(args);
 
-static Lisp sch_modulo(Lisp args, LispError* e, LispContext ctx)
-{
-    int m = lisp_int(sch_remainder(args, e, ctx));
-    if (m < 0) {
-        int b = lisp_int(lisp_car(lisp_cdr(args)));
-        m = (b < 0) ? m - b : m + b;
+    int start, end;
+    if (!lisp_is_typed_vector(v) || !typed_vector_range_(v, lisp_cdr(args), &start, &end))
+    {
+        *e = LISP_ERROR_OUT_OF_BOUNDS;
+        return lisp_null();
     }
-    return lisp_make_int(m);
-}
+    if (start == end) return lisp_null();
 
-static Lisp sch_abs(Lisp args, LispError* e, LispContext ctx)
-{
-    ARITY_CHECK(1, 1);
-    Lisp x = lisp_car(args);
-    switch (lisp_type(x))
+    // set the first and copy its bytes
+    *e = typed_vector_set_(v, start, x);
+    if (*e != LISP_ERROR_NONE) return lisp_null();
+
+    switch (lisp_type(v))
     {
-        case LISP_INT:
-            return lisp_make_int(llabs(lisp_int(x)));
-        case LISP_REAL:
-            return lisp_make_real(fabs(lisp_real(x)));
+        case LISP_F64VECTOR:
+        {
+            LispReal* data = lisp_f64vector(v);
+            for (int i = start + 1; i < end; ++i) data[i] = data[start];
+            break;
+        }
+        case LISP_S64VECTOR:
+        {
+            LispInt* data = lisp_s64vector(v);
+            for (int i = start + 1; i < end; ++i) data[i] = data[start];
+            break;
+        }
         default:
-            *e = LISP_ERROR_ARG_TYPE;
-            return lisp_null();
+        {
+            uint8_t* data = lisp_bytevector(v);
+            memset(data + start, data[start], end - start);
+            break;
+        }
     }
+    return lisp_null();
 }
 
-static Lisp sch_is_vector(Lisp args, LispError* e, LispContext ctx)
+static char* typed_vector_bytes_(Lisp v)
 {
-    return lisp_make_bool( lisp_type(lisp_car(args)) == LISP_VECTOR );
+    switch (lisp_type(v))
+    {
+        case LISP_F64VECTOR: return (char*)lisp_f64vector(v);
+        case LISP_S64VECTOR: return (char*)lisp_s64vector(v);
+        default: return (char*)lisp_bytevector(v);
+    }
 }
 
-static Lisp sch_make_vector(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_typed_vector_copy(Lisp args, LispError* e, LispContext ctx)
 {
-    Lisp length = lisp_car(args);
+    ARITY_CHECK(1, 3);
+    Lisp v = lisp_car(args);
 
-    if (lisp_type(length) != LISP_INT)
+    int start, end;
+    if (!lisp_is_typed_vector(v) || !typed_vector_range_(v, lisp_cdr(args), &start, &end))
     {
-        *e = LISP_ERROR_ARG_TYPE;
+        *e = LISP_ERROR_OUT_OF_BOUNDS;
         return lisp_null();
     }
 
-    Lisp v = lisp_make_vector(lisp_int(length), ctx);
-    args = lisp_cdr(args);
-
-    if (!lisp_is_null(args))
-        lisp_vector_fill(v, lisp_car(args));
-    return v;
+    size_t size = typed_vector_element_size_(v);
+    Lisp copy = make_typed_vector_of_(lisp_type(v), end - start, ctx);
+    memcpy(typed_vector_bytes_(copy), typed_vector_bytes_(v) + size * start, size * (end - start));
+    return copy;
 }
 
-static Lisp sch_vector_grow(Lisp args, LispError* e, LispContext ctx)
+// (bytevector-copy! to at from [start end])
+static Lisp sch_typed_vector_copy_in_place(Lisp args, LispError* e, LispContext ctx)
 {
-    Lisp v = lisp_car(args);
-    Lisp length = lisp_car(lisp_cdr(args));
+    ARITY_CHECK(3, 5);
+    Lisp to = lisp_car(args);
+    args = lisp_cdr(args);
+    Lisp at = lisp_car(args);
+    args = lisp_cdr(args);
+    Lisp from = lisp_car(args);
 
-    if (lisp_type(length) != LISP_INT || lisp_type(v) != LISP_VECTOR)
+    int start, end;
+    if (!lisp_is_typed_vector(to) || lisp_type(to) != lisp_type(from) || lisp_type(at) != LISP_INT || lisp_is_read_only(to))
     {
         *e = LISP_ERROR_ARG_TYPE;
         return lisp_null();
     }
-
-    if (lisp_int(length) < lisp_vector_length(v))
+    if (!typed_vector_range_(from, lisp_cdr(args), &start, &end) ||
+        lisp_int(at) < 0 || lisp_int(at) + (end - start) > lisp_typed_vector_length(to))
     {
         *e = LISP_ERROR_OUT_OF_BOUNDS;
         return lisp_null();
     }
 
-    return lisp_vector_grow(v, lisp_int(length), ctx);
+    size_t size = typed_vector_element_size_(to);
+    memmove(typed_vector_bytes_(to) + size * lisp_int(at), typed_vector_bytes_(from) + size * start, size * (end - start));
+    return lisp_null();
 }
 
-static Lisp sch_vector_length(Lisp args, LispError* e, LispContext ctx)
+// Bulk numeric operations on f64vector and s64vector.
+// Loops are kept simple so the compiler can vectorize them.
+// Reductions use several accumulators, since floating point addition
+// can't be reordered by the compiler.
+
+static LispReal f64_sum_(const LispReal* x, int n)
+{
+    LispReal s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        s0 += x[i];
+        s1 += x[i + 1];
+        s2 += x[i + 2];
+        s3 += x[i + 3];
+    }
+    for (; i < n; ++i) s0 += x[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+static LispReal f64_dot_(const LispReal* x, const LispReal* y, int n)
+{
+    LispReal s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        s0 += x[i] * y[i];
+        s1 += x[i + 1] * y[i + 1];
+        s2 += x[i + 2] * y[i + 2];
+        s3 += x[i + 3] * y[i + 3];
+    }
+    for (; i < n; ++i) s0 += x[i] * y[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+static int typed_vector_numeric_(Lisp v)
+{
+    return lisp_type(v) == LISP_F64VECTOR || lisp_type(v) == LISP_S64VECTOR;
+}
+
+static Lisp sch_typed_vector_sum(Lisp args, LispError* e, LispContext ctx)
 {
+    ARITY_CHECK(1, 1);
     Lisp v = lisp_car(args);
-    if (lisp_type(v) != LISP_VECTOR)
+    if (!typed_vector_numeric_(v))
     {
         *e = LISP_ERROR_ARG_TYPE;
         return lisp_null();
     }
 
-    return lisp_make_int(lisp_vector_length(v));
+    int n = lisp_typed_vector_length(v);
+    if (lisp_type(v) == LISP_F64VECTOR) return lisp_make_real(f64_sum_(lisp_f64vector(v), n));
+
+    const LispInt* x = lisp_s64vector(v);
+    LispInt s = 0;
+    for (int i = 0; i < n; ++i) s += x[i];
+    return lisp_make_int(s);
 }
 
-static Lisp sch_vector_ref(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_typed_vector_dot(Lisp args, LispError* e, LispContext ctx)
 {
-    Lisp v = lisp_car(args);
-    Lisp i = lisp_car(lisp_cdr(args));
-
-    if (lisp_type(v) != LISP_VECTOR || lisp_type(i) != LISP_INT)
+    ARITY_CHECK(2, 2);
+    Lisp a = lisp_car(args);
+    Lisp b = lisp_car(lisp_cdr(args));
+    if (!typed_vector_numeric_(a) || lisp_type(a) != lisp_type(b))
     {
         *e = LISP_ERROR_ARG_TYPE;
         return lisp_null();
     }
 
-    if (lisp_int(i) >= lisp_vector_length(v))
+    int n = lisp_typed_vector_length(a);
+    if (n != lisp_typed_vector_length(b))
     {
         *e = LISP_ERROR_OUT_OF_BOUNDS;
         return lisp_null();
     }
 
-    return lisp_vector_ref(v, lisp_int(i));
+    if (lisp_type(a) == LISP_F64VECTOR) return lisp_make_real(f64_dot_(lisp_f64vector(a), lisp_f64vector(b), n));
+
+    const LispInt* x = lisp_s64vector(a);
+    const LispInt* y = lisp_s64vector(b);
+    LispInt s = 0;
+    for (int i = 0; i < n; ++i) s += x[i] * y[i];
+    return lisp_make_int(s);
 }
 
-static Lisp sch_vector_set(Lisp args, LispError* e, LispContext ctx)
+static Lisp typed_vector_extreme_(Lisp args, int want_max, LispError* e)
 {
-    Lisp v = lisp_list_ref(args, 0);
-    Lisp i = lisp_list_ref(args, 1);
-    Lisp x = lisp_list_ref(args, 2);
-
-    if (lisp_type(v) != LISP_VECTOR || lisp_type(i) != LISP_INT)
+    ARITY_CHECK(1, 1);
+    Lisp v = lisp_car(args);
+    if (!typed_vector_numeric_(v))
     {
         *e = LISP_ERROR_ARG_TYPE;
         return lisp_null();
     }
 
-    if (lisp_int(i) >= lisp_vector_length(v))
+    int n = lisp_typed_vector_length(v);
+    if (n == 0)
     {
         *e = LISP_ERROR_OUT_OF_BOUNDS;
         return lisp_null();
     }
 
-    lisp_vector_set(v, lisp_int(i), x);
-    return lisp_null();
+    if (lisp_type(v) == LISP_F64VECTOR)
+    {
+        const LispReal* x = lisp_f64vector(v);
+        LispReal m = x[0];
+        if (want_max)
+            for (int i = 1; i < n; ++i) m = x[i] > m ? x[i] : m;
+        else
+            for (int i = 1; i < n; ++i) m = x[i] < m ? x[i] : m;
+        return lisp_make_real(m);
+    }
+    else
+    {
+        const LispInt* x = lisp_s64vector(v);
+        LispInt m = x[0];
+        if (want_max)
+            for (int i = 1; i < n; ++i) m = x[i] > m ? x[i] : m;
+        else
+            for (int i = 1; i < n; ++i) m = x[i] < m ? x[i] : m;
+        return lisp_make_int(m);
+    }
 }
 
-static Lisp sch_vector_swap(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_typed_vector_min(Lisp args, LispError* e, LispContext ctx)
+{
+    return typed_vector_extreme_(args, 0, e);
+}
+
+static Lisp sch_typed_vector_max(Lisp args, LispError* e, LispContext ctx)
 {
+    return typed_vector_extreme_(args, 1, e);
+}
+
+// (f64vector-scale! v a): v = a * v
+static Lisp sch_typed_vector_scale(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 2);
     Lisp v = lisp_car(args);
+    Lisp a = lisp_car(lisp_cdr(args));
+    if (!typed_vector_numeric_(v) ||
+        (lisp_type(a) != LISP_INT && (lisp_type(a) != LISP_REAL || lisp_type(v) != LISP_F64VECTOR)))
+    {
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
+    }
+
+    int n = lisp_typed_vector_length(v);
+    if (lisp_type(v) == LISP_F64VECTOR)
+    {
+        LispReal* x = lisp_f64vector(v);
+        LispReal k = lisp_number_to_real(a);
+        for (int i = 0; i < n; ++i) x[i] *= k;
+    }
+    else
+    {
+        LispInt* x = lisp_s64vector(v);
+        LispInt k = lisp_int(a);
+        for (int i = 0; i < n; ++i) x[i] *= k;
+    }
+    return v;
+}
+
+// (f64vector-axpy! a x y): y = a * x + y
+static Lisp sch_typed_vector_axpy(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(3, 3);
+    Lisp a = lisp_car(args);
     args = lisp_cdr(args);
-    Lisp i = lisp_car(args);
+    Lisp x = lisp_car(args);
     args = lisp_cdr(args);
-    Lisp j = lisp_car(args);
+    Lisp y = lisp_car(args);
 
-    if (lisp_type(v) != LISP_VECTOR || lisp_type(i) != LISP_INT || lisp_type(j) != LISP_INT)
+    if (!typed_vector_numeric_(x) || lisp_type(x) != lisp_type(y) ||
+        (lisp_type(a) != LISP_INT && (lisp_type(a) != LISP_REAL || lisp_type(x) != LISP_F64VECTOR)))
     {
         *e = LISP_ERROR_ARG_TYPE;
         return lisp_null();
     }
-    if (lisp_int(i) >= lisp_vector_length(v) || lisp_int(j) >= lisp_vector_length(v))
+
+    int n = lisp_typed_vector_length(x);
+    if (n != lisp_typed_vector_length(y))
     {
         *e = LISP_ERROR_OUT_OF_BOUNDS;
         return lisp_null();
     }
-    return lisp_vector_swap(v, lisp_int(i), lisp_int(j));
-}
-
-static Lisp sch_vector_fill(Lisp args, LispError* e, LispContext ctx)
-{
-    Lisp v = lisp_car(args);
-    args = lisp_cdr(args);
-    lisp_vector_fill(v, lisp_car(args));
-    return lisp_null();
-}
 
-static Lisp sch_vector_assq(Lisp args, LispError* e, LispContext ctx)
-{
-    Lisp k = lisp_car(args);
-    args = lisp_cdr(args);
-    Lisp v = lisp_car(args);
-    return lisp_avector_ref(v, k);
+    if (lisp_type(x) == LISP_F64VECTOR)
+    {
+        const LispReal* xs = lisp_f64vector(x);
+        LispReal* ys = lisp_f64vector(y);
+        LispReal k = lisp_number_to_real(a);
+        for (int i = 0; i < n; ++i) ys[i] += k * xs[i];
+    }
+    else
+    {
+        const LispInt* xs = lisp_s64vector(x);
+        LispInt* ys = lisp_s64vector(y);
+        LispInt k = lisp_int(a);
+        for (int i = 0; i < n; ++i) ys[i] += k * xs[i];
+    }
+    return y;
 }
 
-static Lisp sch_subvector(Lisp args, LispError* e, LispContext ctx)
+// Element-wise operation into a new vector.
+static Lisp typed_vector_zip_(Lisp args, int multiply, LispError* e, LispContext ctx)
 {
-    ARITY_CHECK(3, 3);
-    Lisp v = lisp_car(args);
-    args = lisp_cdr(args);
-    Lisp start = lisp_car(args);
-    args = lisp_cdr(args);
-    Lisp end = lisp_car(args);
-    return lisp_subvector(v, lisp_int(start), lisp_int(end), ctx);
-}
+    ARITY_CHECK(2, 2);
+    Lisp a = lisp_car(args);
+    Lisp b = lisp_car(lisp_cdr(args));
+    if (!typed_vector_numeric_(a) || lisp_type(a) != lisp_type(b))
+    {
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
+    }
 
-static Lisp sch_list_to_vector(Lisp args, LispError* e, LispContext ctx)
-{
-    Lisp l = lisp_car(args);
-    int n = lisp_list_length(l);
-    Lisp v = lisp_make_vector(n, ctx);
+    int n = lisp_typed_vector_length(a);
+    if (n != lisp_typed_vector_length(b))
+    {
+        *e = LISP_ERROR_OUT_OF_BOUNDS;
+        return lisp_null();
+    }
 
-    for (int i = 0; i < n; ++i)
+    Lisp result = make_typed_vector_of_(lisp_type(a), n, ctx);
+    if (lisp_type(a) == LISP_F64VECTOR)
     {
-        lisp_vector_set(v, i, lisp_car(l));
-        l = lisp_cdr(l);
+        const LispReal* x = lisp_f64vector(a);
+        const LispReal* y = lisp_f64vector(b);
+        LispReal* z = lisp_f64vector(result);
+        if (multiply)
+            for (int i = 0; i < n; ++i) z[i] = x[i] * y[i];
+        else
+            for (int i = 0; i < n; ++i) z[i] = x[i] + y[i];
     }
-    return v;
+    else
+    {
+        const LispInt* x = lisp_s64vector(a);
+        const LispInt* y = lisp_s64vector(b);
+        LispInt* z = lisp_s64vector(result);
+        if (multiply)
+            for (int i = 0; i < n; ++i) z[i] = x[i] * y[i];
+        else
+            for (int i = 0; i < n; ++i) z[i] = x[i] + y[i];
+    }
+    return result;
 }
 
-static Lisp sch_vector_to_list(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_typed_vector_add(Lisp args, LispError* e, LispContext ctx)
 {
-    Lisp v = lisp_car(args);
-    int n = lisp_vector_length(v);
+    return typed_vector_zip_(args, 0, e, ctx);
+}
 
-    Lisp tail = lisp_null();
-    for (int i = 0; i < n; ++i)
-        tail = lisp_cons(lisp_vector_ref(v, i), tail, ctx);
-    return lisp_list_reverse(tail);
+static Lisp sch_typed_vector_mul(Lisp args, LispError* e, LispContext ctx)
+{
+    return typed_vector_zip_(args, 1, e, ctx);
 }
 
 static Lisp sch_pseudo_seed(Lisp args, LispError* e, LispContext ctx)
@@ -1172,6 +3159,11 @@ static Lisp sch_univeral_time(Lisp args, LispError* e, LispContext ctx)
     return lisp_make_int((LispInt)time(NULL));
 }
 
+static Lisp sch_runtime(Lisp args, LispError* e, LispContext ctx)
+{
+    return lisp_make_real((LispReal)clock() / CLOCKS_PER_SEC);
+}
+
 static Lisp sch_is_table(Lisp args, LispError* e, LispContext ctx)
 {
     ARITY_CHECK(1, 1);
@@ -1230,29 +3222,167 @@ static Lisp sch_table_to_alist(Lisp args, LispError* e, LispContext ctx)
     return lisp_table_to_alist(table, ctx);
 }
 
+// Records
+// A constructor, predicate, accessor or modifier: (kind type arg)
+// The constructor's arg is a vector of the fields its arguments go to,
+// and the accessor or modifier's is the index of its field.
+static Lisp make_record_procedure_(int kind, Lisp type, Lisp arg, LispContext ctx)
+{
+    Lisp p = make_record_(3, ctx);
+    Vector* procedure = record_get_(p);
+    record_set_entry_(procedure, 0, lisp_make_int(kind));
+    record_set_entry_(procedure, 1, type);
+    record_set_entry_(procedure, 2, arg);
+    return p;
+}
+
+static int is_record_type_(Lisp x)
+{
+    return lisp_type(x) == LISP_RECORD && record_kind_(x) == RECORD_TYPE;
+}
+
+static int record_field_index_(Lisp type, Lisp name, LispError* e, LispContext ctx)
+{
+    int i = 0;
+    for (Lisp it = record_entry_(record_get_(type), 2); lisp_is_pair(it); it = lisp_cdr(it))
+    {
+        if (lisp_eq(lisp_car(it), name)) return i;
+        ++i;
+    }
+
+    lisp_printf(ctx.p->err_port, name);
+    fprintf(ctx.p->err_port, " is not a field of the record type.\n");
+    *e = LISP_ERROR_OUT_OF_BOUNDS;
+    return -1;
+}
+
+static Lisp sch_make_record_type(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 2);
+    Lisp fields = lisp_car(lisp_cdr(args));
+    for (Lisp it = fields; !lisp_is_null(it); it = lisp_cdr(it))
+    {
+        if (!lisp_is_pair(it) || lisp_type(lisp_car(it)) != LISP_SYMBOL)
+        {
+            *e = LISP_ERROR_ARG_TYPE;
+            return lisp_null();
+        }
+    }
+    return lisp_make_record_type(lisp_car(args), fields, ctx);
+}
+
+static Lisp sch_record_constructor(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 2);
+    Lisp type = lisp_car(args);
+    if (!is_record_type_(type))
+    {
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
+    }
+
+    // all fields in order, unless given.
+    Lisp names = lisp_is_pair(lisp_cdr(args)) ? lisp_car(lisp_cdr(args)) : record_entry_(record_get_(type), 2);
+    int n = lisp_list_length(names);
+    Lisp indices = lisp_make_vector(n, ctx);
+    for (int i = 0; i < n; ++i)
+    {
+        int index = record_field_index_(type, lisp_car(names), e, ctx);
+        if (index < 0) return lisp_null();
+        lisp_vector_set(indices, i, lisp_make_int(index));
+        names = lisp_cdr(names);
+    }
+    return make_record_procedure_(RECORD_CONSTRUCTOR, type, indices, ctx);
+}
+
+static Lisp sch_record_predicate(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    Lisp type = lisp_car(args);
+    if (!is_record_type_(type))
+    {
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
+    }
+    return make_record_procedure_(RECORD_PREDICATE, type, lisp_null(), ctx);
+}
+
+static Lisp record_field_procedure_(int kind, Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 2);
+    Lisp type = lisp_car(args);
+    if (!is_record_type_(type))
+    {
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
+    }
+
+    int index = record_field_index_(type, lisp_car(lisp_cdr(args)), e, ctx);
+    if (index < 0) return lisp_null();
+    return make_record_procedure_(kind, type, lisp_make_int(index), ctx);
+}
+
+static Lisp sch_record_accessor(Lisp args, LispError* e, LispContext ctx)
+{
+    return record_field_procedure_(RECORD_ACCESSOR, args, e, ctx);
+}
+
+static Lisp sch_record_modifier(Lisp args, LispError* e, LispContext ctx)
+{
+    return record_field_procedure_(RECORD_MODIFIER, args, e, ctx);
+}
+
+static Lisp sch_is_record(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    return lisp_make_bool(lisp_is_record(lisp_car(args)));
+}
+
+static Lisp sch_record_type_descriptor(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    Lisp r = lisp_car(args);
+    if (!lisp_is_record(r))
+    {
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
+    }
+    return lisp_record_type(r);
+}
+
+static Lisp sch_record_type_name(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    Lisp type = lisp_car(args);
+    if (!is_record_type_(type))
+    {
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
+    }
+    return record_entry_(record_get_(type), 1);
+}
+
 static Lisp sch_is_promise(Lisp args, LispError* e, LispContext ctx)
 {
   return lisp_make_bool(lisp_type(lisp_car(args)) == LISP_PROMISE);
 }
 
+// A promise which is already forced to x.
 static Lisp sch_make_promise(Lisp args, LispError* e, LispContext ctx)
 {
-    Lisp proc = lisp_car(args);
-    return lisp_make_promise(proc, ctx);
-}
+    ARITY_CHECK(1, 1);
+    Lisp x = lisp_car(args);
+    if (lisp_type(x) == LISP_PROMISE) return x;
 
-static Lisp sch_promise_store(Lisp args, LispError* e, LispContext ctx)
-{
-    Lisp promise = lisp_car(args);
-    args = lisp_cdr(args);
-    Lisp val = lisp_car(args);
-    lisp_promise_store(promise, val);
-    return lisp_null();
+    Lisp promise = promise_alloc_(x, ctx);
+    lisp_promise_store(promise, x);
+    return promise;
 }
 
-static Lisp sch_promise_proc(Lisp args, LispError* e, LispContext ctx)
+static Lisp sch_force(Lisp args, LispError* e, LispContext ctx)
 {
-    return lisp_promise_proc(lisp_car(args));
+    ARITY_CHECK(1, 1);
+    return lisp_force(lisp_car(args), e, ctx);
 }
 
 static Lisp sch_promise_val(Lisp args, LispError* e, LispContext ctx)
@@ -1265,6 +3395,66 @@ static Lisp sch_promise_forced(Lisp args, LispError* e, LispContext ctx)
     return lisp_make_bool(lisp_promise_forced(lisp_car(args)));
 }
 
+// Streams
+// Walks k cells of a stream, forcing each tail, and returns the rest.
+// The heads are collected if result is given.
+// Unless the stream may end sooner, that is an error.
+static Lisp stream_walk_(Lisp stream, LispInt k, int may_end, Lisp* result, LispError* e, LispContext ctx)
+{
+    // 0: stream, 1: result
+    STACK_FRAME(2);
+    *STACK_SLOT(0) = stream;
+
+    for (LispInt i = 0; i < k; ++i)
+    {
+        Lisp cell = *STACK_SLOT(0);
+        if (lisp_is_null(cell) && may_end) break;
+        if (!lisp_is_pair(cell))
+        {
+            *e = lisp_is_null(cell) ? LISP_ERROR_OUT_OF_BOUNDS : LISP_ERROR_ARG_TYPE;
+            STACK_RETURN(lisp_null());
+        }
+        if (result) *STACK_SLOT(1) = lisp_cons(lisp_car(cell), *STACK_SLOT(1), ctx);
+
+        // the head doesn't need the last tail.
+        if (result && i + 1 == k) break;
+
+        Lisp next = lisp_force(lisp_cdr(*STACK_SLOT(0)), e, ctx);
+        if (*e != LISP_ERROR_NONE) STACK_RETURN(lisp_null());
+        *STACK_SLOT(0) = next;
+    }
+
+    if (result) *result = lisp_list_reverse(*STACK_SLOT(1));
+    STACK_RETURN(*STACK_SLOT(0));
+}
+
+static Lisp sch_stream_head(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 2);
+    Lisp result = lisp_null();
+    stream_walk_(lisp_car(args), lisp_int(lisp_car(lisp_cdr(args))), 0, &result, e, ctx);
+    return result;
+}
+
+static Lisp sch_stream_tail(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 2);
+    return stream_walk_(lisp_car(args), lisp_int(lisp_car(lisp_cdr(args))), 0, NULL, e, ctx);
+}
+
+static Lisp sch_stream_to_list(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 2);
+    LispInt k = lisp_is_pair(lisp_cdr(args)) ? lisp_int(lisp_car(lisp_cdr(args))) : INT64_MAX;
+    Lisp result = lisp_null();
+    stream_walk_(lisp_car(args), k, 1, &result, e, ctx);
+    return result;
+}
+
+#undef STACK_SLOT
+#undef STACK_FRAME
+#undef STACK_RETURN
+
 static Lisp sch_apply(Lisp args, LispError* e, LispContext ctx)
 {
     Lisp operator = lisp_car(args);
@@ -1287,8 +3477,9 @@ static Lisp sch_lambda_env(Lisp args, LispError* e, LispContext ctx)
 static Lisp sch_is_func(Lisp args, LispError* e, LispContext ctx)
 {
     ARITY_CHECK(1, 1);
-    int type = lisp_type(lisp_car(args));
-    return lisp_make_bool(type == LISP_FUNC);
+    Lisp x = lisp_car(args);
+    // record procedures are builtin too.
+    return lisp_make_bool(lisp_type(x) == LISP_FUNC || (lisp_type(x) == LISP_RECORD && record_kind_(x) > RECORD_TYPE));
 }
 
 static Lisp sch_lambda_body(Lisp args, LispError* e, LispContext ctx)
@@ -1343,16 +3534,156 @@ static Lisp sch_print_gc_stats(Lisp args, LispError* e, LispContext ctx)
     return lisp_false();
 }
 
+static const struct { LispType type; const char* name; } heap_types[] = {
+    { LISP_PAIR, "PAIR" },
+    { LISP_STRING, "STRING" },
+    { LISP_SYMBOL, "SYMBOL" },
+    { LISP_LAMBDA, "LAMBDA" },
+    { LISP_VECTOR, "VECTOR" },
+    { LISP_TABLE, "TABLE" },
+    { LISP_PROMISE, "PROMISE" },
+    { LISP_JUMP, "CONTINUATION" },
+    { LISP_RECORD, "RECORD" },
+    { LISP_F64VECTOR, "F64VECTOR" },
+    { LISP_S64VECTOR, "S64VECTOR" },
+    { LISP_BYTEVECTOR, "BYTEVECTOR" },
+};
+
+// ((type count . bytes) ...), or ((type . bytes) ...) without counts.
+static Lisp heap_type_counts(const size_t* counts, const size_t* bytes, LispContext ctx)
+{
+    Lisp result = lisp_null();
+    int n = sizeof(heap_types) / sizeof(heap_types[0]);
+    for (int i = n - 1; i >= 0; --i)
+    {
+        LispType type = heap_types[i].type;
+        Lisp entry = lisp_make_int((LispInt)bytes[type]);
+        if (counts) entry = lisp_cons(lisp_make_int((LispInt)counts[type]), entry, ctx);
+        entry = lisp_cons(lisp_make_symbol(heap_types[i].name, ctx), entry, ctx);
+        result = lisp_cons(entry, result, ctx);
+    }
+    return result;
+}
+
+static Lisp sch_gc_statistics(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(0, 0);
+    LispHeapStats stats;
+    lisp_heap_stats(&stats, ctx);
+
+    Lisp terms[] = {
+        lisp_cons(lisp_make_symbol("COLLECTIONS", ctx), lisp_make_int((LispInt)stats.collections), ctx),
+        lisp_cons(lisp_make_symbol("HEAP-SIZE", ctx), lisp_make_int((LispInt)stats.heap_size), ctx),
+        lisp_cons(lisp_make_symbol("FREED", ctx), lisp_make_int((LispInt)stats.freed), ctx),
+        lisp_cons(lisp_make_symbol("TIME", ctx), lisp_make_int((LispInt)stats.time), ctx),
+        lisp_cons(lisp_make_symbol("ALLOCATED", ctx), heap_type_counts(stats.allocated_count, stats.allocated_bytes, ctx), ctx),
+        lisp_cons(lisp_make_symbol("LIVE", ctx), heap_type_counts(NULL, stats.live_bytes, ctx), ctx),
+    };
+    return lisp_make_list2(terms, 6, ctx);
+}
+
+// (profile thunk [path]) prints where the time in thunk went,
+// and writes the samples in folded form to path, if given.
+static Lisp sch_profile(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 2);
+    Lisp thunk = lisp_car(args);
+
+    lisp_profile_start(1000, ctx);
+    Lisp result = lisp_apply(thunk, lisp_null(), e, ctx);
+    lisp_profile_stop(ctx);
+    lisp_profile_print(lisp_stderr(ctx), ctx);
+
+    if (lisp_is_pair(lisp_cdr(args)))
+    {
+        FILE* f = fopen(lisp_string(lisp_car(lisp_cdr(args))), "w");
+        if (!f)
+        {
+            *e = LISP_ERROR_FILE_OPEN;
+            return lisp_null();
+        }
+        lisp_profile_write_folded(f, ctx);
+        fclose(f);
+    }
+    return result;
+}
+
+static int is_procedure_(Lisp x)
+{
+    return lisp_type(x) == LISP_LAMBDA || lisp_type(x) == LISP_FUNC ||
+        (lisp_type(x) == LISP_RECORD && record_kind_(x) > RECORD_TYPE);
+}
+
+static Lisp sch_future(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    Lisp thunk = lisp_car(args);
+    if (!is_procedure_(thunk))
+    {
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
+    }
+    return lisp_future(thunk, e, ctx);
+}
+
+static Lisp sch_parallel_map(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 2);
+    Lisp proc = lisp_car(args);
+    Lisp l = lisp_car(lisp_cdr(args));
+    if (!is_procedure_(proc) || !lisp_is_list(l))
+    {
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
+    }
+
+    int n = lisp_list_length(l);
+    Lisp v = lisp_make_vector(n, ctx);
+    for (int i = 0; i < n; ++i)
+    {
+        lisp_vector_set(v, i, lisp_car(l));
+        l = lisp_cdr(l);
+    }
+
+    Lisp results = lisp_parallel_map(proc, v, e, ctx);
+    if (*e != LISP_ERROR_NONE) return lisp_null();
+
+    Lisp tail = lisp_null();
+    for (int i = n - 1; i >= 0; --i)
+        tail = lisp_cons(lisp_vector_ref(results, i), tail, ctx);
+    return tail;
+}
+
+static Lisp sch_parallel_vector_map(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(2, 2);
+    Lisp proc = lisp_car(args);
+    Lisp v = lisp_car(lisp_cdr(args));
+    if (!is_procedure_(proc) || lisp_type(v) != LISP_VECTOR)
+    {
+        *e = LISP_ERROR_ARG_TYPE;
+        return lisp_null();
+    }
+    return lisp_parallel_map(proc, v, e, ctx);
+}
+
 static Lisp sch_call_cc(Lisp args, LispError* e, LispContext ctx)
 {
     ARITY_CHECK(1, 1);
     return lisp_call_cc(lisp_car(args), e, ctx);
 }
 
+static Lisp sch_call_ec(Lisp args, LispError* e, LispContext ctx)
+{
+    ARITY_CHECK(1, 1);
+    return lisp_call_ec(lisp_car(args), e, ctx);
+}
+
 static Lisp sch_is_cont(Lisp args, LispError* e, LispContext ctx)
 {
     ARITY_CHECK(1, 1);
-    return lisp_make_bool(lisp_type(lisp_car(args)) == LISP_JUMP);
+    LispType type = lisp_type(lisp_car(args));
+    return lisp_make_bool(type == LISP_JUMP || type == LISP_ESCAPE);
 }
 
 #undef ARITY_CHECK
@@ -1368,16 +3699,27 @@ static const LispFuncDef lib_cfunc_defs[] = {
     { "_WRITE-CHAR", sch_write_char },
     { "_FLUSH-OUTPUT-PORT", sch_flush },
     { "_READ", sch_read },
+    { "_INDEX-TEXT", sch_index_text },
+    { "_READ-TEXT", sch_read_text },
+    { "_WRITE-BINARY", sch_write_binary },
+    { "_READ-BINARY", sch_read_binary },
+    { "_JSON-READ", sch_json_read },
+    { "_JSON-WRITE", sch_json_write },
     { "INPUT-PORT?", sch_is_port_in },
     { "OUTPUT-PORT?", sch_is_port_out },
     { "OPEN-INPUT-FILE", sch_open_input },
     { "OPEN-OUTPUT-FILE", sch_open_output },
+    { "FILE->STRING", sch_file_to_string },
+    { "FILE->BYTEVECTOR", sch_file_to_bytevector },
+    { "READ-PARALLEL", sch_read_parallel },
     { "CLOSE-INPUT-PORT", sch_port_close },
     { "CLOSE-OUTPUT-PORT", sch_port_close },
     { "EOF-OBJECT?", sch_is_eof },
 
     // Universal Time https://www.gnu.org/software/mit-scheme/documentation/mit-scheme-ref/Universal-Time.html
     { "GET-UNIVERSAL-TIME", sch_univeral_time },
+    // Machine Time https://www.gnu.org/software/mit-scheme/documentation/mit-scheme-ref/Machine-Time.html
+    { "RUNTIME", sch_runtime },
     { "PRINT-GC-STATISTICS", sch_print_gc_stats },
 
     { "MACROEXPAND", sch_macroexpand },
@@ -1408,8 +3750,21 @@ static const LispFuncDef lib_cfunc_defs[] = {
     { "LENGTH", sch_length },
     { "APPEND", sch_append },
     { "APPEND-REVERSE!", sch_append_reverse },
+    { "MAP", sch_map },
+    { "MAP1", sch_map },
+    { "FOR-EACH", sch_for_each },
+    { "FOR-EACH1", sch_for_each },
+    { "FILTER", sch_filter },
+    { "FOLD-LEFT", sch_fold_left },
+    { "REDUCE", sch_reduce },
+    { "MEMQ", sch_memq },
+    { "MEMV", sch_memv },
+    { "MEMBER", sch_member },
     { "LIST-REF", sch_list_ref },
     { "NTHCDR", sch_list_advance },
+    { "SORT", sch_sort },
+    { "SORT!", sch_sort_in_place },
+    { "SORT-BY-KEY", sch_sort_by_key },
 
     // Vectors https://groups.csail.mit.edu/mac/ftpdir/scheme-7.4/doc-html/scheme_9.html#SEC82
     { "VECTOR?", sch_is_vector },
@@ -1425,12 +3780,66 @@ static const LispFuncDef lib_cfunc_defs[] = {
     { "LIST->VECTOR", sch_list_to_vector },
     { "VECTOR->LIST", sch_vector_to_list },
 
+    // Homogeneous vectors https://srfi.schemers.org/srfi-4/srfi-4.html
+    { "MAKE-F64VECTOR", sch_make_f64vector },
+    { "F64VECTOR", sch_f64vector },
+    { "F64VECTOR?", sch_is_f64vector },
+    { "F64VECTOR-LENGTH", sch_typed_vector_length },
+    { "F64VECTOR-REF", sch_typed_vector_ref },
+    { "F64VECTOR-SET!", sch_typed_vector_set },
+    { "F64VECTOR->LIST", sch_typed_vector_to_list },
+    { "LIST->F64VECTOR", sch_list_to_f64vector },
+    { "F64VECTOR-FILL!", sch_typed_vector_fill },
+    { "F64VECTOR-COPY", sch_typed_vector_copy },
+    { "F64VECTOR-COPY!", sch_typed_vector_copy_in_place },
+    { "F64VECTOR-SUM", sch_typed_vector_sum },
+    { "F64VECTOR-DOT", sch_typed_vector_dot },
+    { "F64VECTOR-MIN", sch_typed_vector_min },
+    { "F64VECTOR-MAX", sch_typed_vector_max },
+    { "F64VECTOR-SCALE!", sch_typed_vector_scale },
+    { "F64VECTOR-AXPY!", sch_typed_vector_axpy },
+    { "F64VECTOR-ADD", sch_typed_vector_add },
+    { "F64VECTOR-MUL", sch_typed_vector_mul },
+
+    { "MAKE-S64VECTOR", sch_make_s64vector },
+    { "S64VECTOR", sch_s64vector },
+    { "S64VECTOR?", sch_is_s64vector },
+    { "S64VECTOR-LENGTH", sch_typed_vector_length },
+    { "S64VECTOR-REF", sch_typed_vector_ref },
+    { "S64VECTOR-SET!", sch_typed_vector_set },
+    { "S64VECTOR->LIST", sch_typed_vector_to_list },
+    { "LIST->S64VECTOR", sch_list_to_s64vector },
+    { "S64VECTOR-FILL!", sch_typed_vector_fill },
+    { "S64VECTOR-COPY", sch_typed_vector_copy },
+    { "S64VECTOR-COPY!", sch_typed_vector_copy_in_place },
+    { "S64VECTOR-SUM", sch_typed_vector_sum },
+    { "S64VECTOR-DOT", sch_typed_vector_dot },
+    { "S64VECTOR-MIN", sch_typed_vector_min },
+    { "S64VECTOR-MAX", sch_typed_vector_max },
+    { "S64VECTOR-SCALE!", sch_typed_vector_scale },
+    { "S64VECTOR-AXPY!", sch_typed_vector_axpy },
+    { "S64VECTOR-ADD", sch_typed_vector_add },
+    { "S64VECTOR-MUL", sch_typed_vector_mul },
+
+    // Bytevectors https://small.r7rs.org/attachment/r7rs.pdf#section.6.9
+    { "MAKE-BYTEVECTOR", sch_make_bytevector },
+    { "BYTEVECTOR", sch_bytevector },
+    { "BYTEVECTOR?", sch_is_bytevector },
+    { "BYTEVECTOR-LENGTH", sch_typed_vector_length },
+    { "BYTEVECTOR-U8-REF", sch_typed_vector_ref },
+    { "BYTEVECTOR-U8-SET!", sch_typed_vector_set },
+    { "BYTEVECTOR->LIST", sch_typed_vector_to_list },
+    { "BYTEVECTOR-FILL!", sch_typed_vector_fill },
+    { "BYTEVECTOR-COPY", sch_typed_vector_copy },
+    { "BYTEVECTOR-COPY!", sch_typed_vector_copy_in_place },
+
     // Strings https://groups.csail.mit.edu/mac/ftpdir/scheme-7.4/doc-html/scheme_7.html#SEC61
     { "STRING?", sch_is_string },
     { "MAKE-STRING", sch_make_string },
     { "STRING=?", sch_equal_r },
     { "STRING<?", sch_string_less },
     { "SUBSTRING", sch_substring },
+    { "STRING-SEARCH-FORWARD", sch_string_search_forward },
     { "STRING-NULL?", sch_string_is_null },
     { "STRING-LENGTH", sch_string_length },
     { "STRING-REF", sch_string_ref },
@@ -1457,6 +3866,10 @@ static const LispFuncDef lib_cfunc_defs[] = {
     { "CHAR->INTEGER", sch_char_to_int },
 
     // Association Lists https://www.gnu.org/software/mit-scheme/documentation/mit-scheme-ref/Association-Lists.html
+    { "ASSQ", sch_assq },
+    { "ASSV", sch_assv },
+    { "ASSOC", sch_assoc },
+
     // Numerical operations https://www.gnu.org/software/mit-scheme/documentation/mit-scheme-ref/Numerical-operations.html
     { "=", sch_equals },
     { "+", sch_add },
@@ -1509,13 +3922,27 @@ static const LispFuncDef lib_cfunc_defs[] = {
     { "HASH-TABLE-SIZE", sch_table_size },
     { "HASH-TABLE->ALIST", sch_table_to_alist },
 
+    // Records https://www.gnu.org/software/mit-scheme/documentation/mit-scheme-ref/Records.html
+    { "MAKE-RECORD-TYPE", sch_make_record_type },
+    { "RECORD-CONSTRUCTOR", sch_record_constructor },
+    { "RECORD-PREDICATE", sch_record_predicate },
+    { "RECORD-ACCESSOR", sch_record_accessor },
+    { "RECORD-MODIFIER", sch_record_modifier },
+    { "RECORD?", sch_is_record },
+    { "RECORD-TYPE-DESCRIPTOR", sch_record_type_descriptor },
+    { "RECORD-TYPE-NAME", sch_record_type_name },
+
     { "PROMISE?", sch_is_promise },
     { "MAKE-PROMISE", sch_make_promise },
-    { "_PROMISE-PROCEDURE", sch_promise_proc },
-    { "_PROMISE-STORE!", sch_promise_store },
+    { "FORCE", sch_force },
     { "PROMISE-VALUE", sch_promise_val },
     { "PROMISE-FORCED?", sch_promise_forced },
 
+    // Streams https://www.gnu.org/software/mit-scheme/documentation/mit-scheme-ref/Streams.html
+    { "STREAM-HEAD", sch_stream_head },
+    { "STREAM-TAIL", sch_stream_tail },
+    { "STREAM->LIST", sch_stream_to_list },
+
     // Procedures https://www.gnu.org/software/mit-scheme/documentation/mit-scheme-ref/Procedure-Operations.html#Procedure-Operations
     { "APPLY", sch_apply },
     { "COMPILED-PROCEDURE?", sch_is_func },
@@ -1524,6 +3951,7 @@ static const LispFuncDef lib_cfunc_defs[] = {
     // TOOD: Almost standard
     { "PROCEDURE-BODY", sch_lambda_body },
     { "CALL/CC", sch_call_cc },
+    { "CALL/EC", sch_call_ec },
     { "CONTINUATION?", sch_is_cont },
 
     // Random Numbers https://www.gnu.org/software/mit-scheme/documentation/mit-scheme-ref/Random-Numbers.html
@@ -1532,6 +3960,13 @@ static const LispFuncDef lib_cfunc_defs[] = {
 
     // Garbage Collection https://www.gnu.org/software/mit-scheme/documentation/mit-scheme-user/Garbage-Collection.html
     { "GC-FLIP", sch_gc_flip },
+    { "GC-STATISTICS", sch_gc_statistics },
+    { "PROFILE", sch_profile },
+
+    // Futures (MultiLisp) and parallel maps, run by worker threads.
+    { "FUTURE", sch_future },
+    { "PARALLEL-MAP", sch_parallel_map },
+    { "PARALLEL-VECTOR-MAP", sch_parallel_vector_map },
 
     { NULL, NULL }
 
@@ -1539,6 +3974,9 @@ static const LispFuncDef lib_cfunc_defs[] = {
 
 void lisp_lib_load(LispContext ctx)
 {
+    // workers load the library too.
+    lisp_set_worker_init(lisp_lib_load, ctx);
+
     Lisp table = lisp_make_table(ctx);
     lisp_table_define_funcs(table, lib_cfunc_defs, ctx);
 
@@ -1564,7 +4002,7 @@ void lisp_lib_load(LispContext ctx)
         lib_0_sequences_src_, lib_1_forms_src_,
         lib_2_forms_src_, lib_3_math_src_,
         lib_4_sequences_src_, lib_5_streams_src_,
-        lib_6_other_src_,
+        lib_6_other_src_, lib_7_indexed_src_,
     };
 
     int n = sizeof(to_load) / sizeof(const char*);
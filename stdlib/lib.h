@@ -22,6 +22,20 @@ void lisp_lib_load(LispContext ctx);
 // convenience for init and load
 LispContext lisp_init_with_lib(void);
 
+// JSON
+// Objects are read as association vectors #((key . value) ...) for use with lisp_avector_ref,
+// arrays as vectors, true and false as booleans, and null as ().
+// Keys are upper case symbols, like the reader, unless LISP_JSON_STRING_KEYS is given.
+// Keys which differ only in case are then the same symbol, and are written back upper case,
+// so use string keys to write out what was read. Keys longer than LISP_IDENTIFIER_MAX are strings.
+// Integers too big for LispInt are read as reals.
+enum { LISP_JSON_STRING_KEYS = 1 };
+Lisp lisp_json_read_range(const char* start, const char* end, int flags, LispError* out_error, LispContext ctx);
+Lisp lisp_json_read_file(FILE* file, int flags, LispError* out_error, LispContext ctx);
+// Vectors whose entries are all pairs with symbol or string keys are written as objects.
+// Vectors and lists are written as arrays.
+LispError lisp_json_write(FILE* file, Lisp x);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,153 @@
+// Arenas: what is stored from inside one into older objects
+// must survive lisp_arena_end, the reuse of its pages and the next collection.
+// Built twice, the second time with LISP_GC_INCREMENTAL, where a collection
+// is left in progress while the arenas are open.
+#include <stdlib.h>
+#include <string.h>
+
+#define LISP_IMPLEMENTATION
+#include "lisp.h"
+#include "lisp_lib.h"
+
+static int failed = 0;
+
+static Lisp eval(const char* text, LispContext ctx)
+{
+    LispError e;
+    Lisp x = lisp_read(text, &e, ctx);
+    if (e == LISP_ERROR_NONE) x = lisp_eval(x, &e, ctx);
+
+    if (e != LISP_ERROR_NONE)
+    {
+        fprintf(stderr, "error: %s in %s\n", lisp_error_string(e), text);
+        failed = 1;
+        return lisp_null();
+    }
+    return x;
+}
+
+static void check(const char* text, LispContext ctx)
+{
+    if (!lisp_is_true(eval(text, ctx)))
+    {
+        fprintf(stderr, "failed: %s\n", text);
+        failed = 1;
+    }
+}
+
+// Fill the pages the arenas gave back with something else.
+static void overwrite(LispContext ctx)
+{
+    for (int i = 0; i < 2000; ++i)
+    {
+        Lisp v = lisp_make_vector(64, ctx);
+        for (int j = 0; j < 64; ++j) lisp_vector_set(v, j, lisp_make_int(0xDEAD));
+        lisp_make_string2("overwritten overwritten overwritten", ctx);
+    }
+}
+
+static const char* checks[] = {
+    "(equal? (counter) '(counted 1 2))",
+    "(equal? (eval 'defined frame) '(defined \"in frame\"))",
+    "(equal? (force promise) (list 'promised (make-vector 3 'v)))",
+    "(equal? (hash-table-ref table 'k #f) '(table 4 5))",
+    "(equal? (hash-table-ref table 999 #f) '(999))",
+    "(= (hash-table-size table) 1001)",
+    "(eq? symbol (string->symbol \"made-in-arena\"))",
+    "(equal? (symbol->string symbol) \"made-in-arena\")",
+    "(equal? (eval (string->symbol \"G999\")) '(999))",
+    "(equal? outer '(outer))",
+    "(equal? inner '(inner))",
+    "(equal? after-inner '(after-inner))",
+    "(equal? (vector-ref pair-target 0) '(left))",
+    "(equal? (vector-ref pair-target 1) '(right))",
+    NULL
+};
+
+static void check_all(LispContext ctx)
+{
+    for (int i = 0; checks[i]; ++i) check(checks[i], ctx);
+}
+
+static void run(LispContext ctx)
+{
+    // older objects, made before any arena.
+    Lisp env = lisp_env(ctx);
+    lisp_env_define(env, lisp_make_symbol("FRAME", ctx), lisp_env_extend(env, lisp_make_table(ctx), ctx), ctx);
+    eval("(define counter (let ((n #f)) (lambda args (if (pair? args) (set! n (car args))) n)))", ctx);
+    eval("(define promise (delay (list 'promised (make-vector 3 'v))))", ctx);
+    eval("(define table (make-hash-table))", ctx);
+    eval("(define pair-target (make-vector 2 #f))", ctx);
+    eval("(define other-target (make-vector 2 #f))", ctx);
+    eval("(define symbol #f)", ctx);
+    eval("(define outer #f)", ctx);
+    eval("(define inner #f)", ctx);
+    eval("(define after-inner #f)", ctx);
+
+#ifdef LISP_GC_INCREMENTAL
+    lisp_set_gc_pause(1, ctx);
+    lisp_collect(lisp_null(), ctx);
+#endif
+
+    lisp_arena_begin(ctx);
+    eval("(counter (list 'counted 1 2))", ctx);
+    eval("(eval '(define defined (list 'defined \"in frame\")) frame)", ctx);
+    eval("(force promise)", ctx);
+    eval("(hash-table-set! table 'k (list 'table 4 5))", ctx);
+    eval("(do ((i 0 (+ i 1))) ((= i 1000)) (hash-table-set! table i (list i)))", ctx);
+    eval("(set! symbol (string->symbol \"made-in-arena\"))", ctx);
+    eval("(do ((i 0 (+ i 1))) ((= i 1000)) "
+         "(eval (list 'define (string->symbol (string-append \"G\" (number->string i))) (list 'quote (list i)))))", ctx);
+    eval("(set! outer (list 'outer))", ctx);
+
+    // stores alternating between two old objects are remembered once each.
+    Lisp targets[2] = { eval("pair-target", ctx), eval("other-target", ctx) };
+    size_t remembered = ctx.p->remembered_count;
+    for (int i = 0; i < 10000; ++i)
+    {
+        lisp_vector_set(targets[i % 2], i % 2, lisp_cons(lisp_make_int(i), lisp_null(), ctx));
+    }
+    eval("(vector-set! pair-target 0 (list 'left))", ctx);
+    eval("(vector-set! pair-target 1 (list 'right))", ctx);
+    if (ctx.p->remembered_count > remembered + 2)
+    {
+        fprintf(stderr, "remembered set grew by %d\n", (int)(ctx.p->remembered_count - remembered));
+        failed = 1;
+    }
+
+    lisp_arena_begin(ctx);
+    eval("(set! inner (list 'inner))", ctx);
+    eval("(hash-table-set! table 999 (list 999))", ctx);
+    overwrite(ctx);
+    lisp_arena_end(lisp_null(), ctx);
+
+    overwrite(ctx);
+    eval("(set! after-inner (list 'after-inner))", ctx);
+    check_all(ctx);
+
+    Lisp returned = lisp_arena_end(eval("(list 'returned (list 1 2))", ctx), ctx);
+    lisp_env_define(lisp_env(ctx), lisp_make_symbol("RETURNED", ctx), returned, ctx);
+
+    overwrite(ctx);
+    check_all(ctx);
+    check("(equal? returned '(returned (1 2)))", ctx);
+    lisp_collect(lisp_null(), ctx);
+    overwrite(ctx);
+    check_all(ctx);
+    check("(equal? returned '(returned (1 2)))", ctx);
+    lisp_collect(lisp_null(), ctx);
+    check_all(ctx);
+    check("(equal? returned '(returned (1 2)))", ctx);
+}
+
+int main(int argc, const char* argv[])
+{
+    LispContext ctx = lisp_init();
+    lisp_lib_load(ctx);
+    run(ctx);
+    lisp_shutdown(ctx);
+
+    if (failed) return 1;
+    printf("arenas passed\n");
+    return 0;
+}
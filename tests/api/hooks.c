@@ -0,0 +1,196 @@
+// LispHooks: every callback is registered and counted while small programs run.
+// Built twice, the second time with LISP_GC_INCREMENTAL, where each slice
+// of a collection is reported as one.
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define LISP_IMPLEMENTATION
+#include "lisp.h"
+#include "lisp_lib.h"
+
+typedef struct
+{
+    int enter;
+    int exit;
+    int enter_loop; // entered through the symbol LOOP
+    int depth;
+    int max_depth;
+    int unbalanced; // exit without enter
+
+    int gc_start;
+    int gc_end;
+    int in_gc;
+    int gc_nested; // start within start, or end without start
+
+    int pages;
+    size_t page_bytes;
+    int pages_off_thread;
+    pthread_t thread;
+
+    int errors;
+    LispError last_error;
+} Counts;
+
+static void count_enter(void* user, Lisp procedure, Lisp name)
+{
+    Counts* c = user;
+    ++c->enter;
+    if (lisp_type(name) == LISP_SYMBOL && strcmp(lisp_symbol_string(name), "LOOP") == 0) ++c->enter_loop;
+    if (++c->depth > c->max_depth) c->max_depth = c->depth;
+}
+
+static void count_exit(void* user)
+{
+    Counts* c = user;
+    ++c->exit;
+    if (--c->depth < 0) c->unbalanced = 1;
+}
+
+static void count_gc_start(void* user)
+{
+    Counts* c = user;
+    if (c->in_gc) c->gc_nested = 1;
+    c->in_gc = 1;
+    ++c->gc_start;
+}
+
+static void count_gc_end(void* user, size_t microseconds)
+{
+    Counts* c = user;
+    if (!c->in_gc) c->gc_nested = 1;
+    c->in_gc = 0;
+    ++c->gc_end;
+}
+
+static void count_page(void* user, size_t bytes)
+{
+    Counts* c = user;
+    ++c->pages;
+    c->page_bytes += bytes;
+    if (!pthread_equal(pthread_self(), c->thread)) ++c->pages_off_thread;
+}
+
+static void count_error(void* user, LispError error)
+{
+    Counts* c = user;
+    ++c->errors;
+    c->last_error = error;
+}
+
+static int failed = 0;
+
+#define CHECK(x) \
+    do { if (!(x)) { fprintf(stderr, "failed: %s (line %d)\n", #x, __LINE__); failed = 1; } } while (0)
+
+static Lisp eval(const char* text, LispError* e, LispContext ctx)
+{
+    Lisp x = lisp_read(text, e, ctx);
+    if (*e != LISP_ERROR_NONE) return x;
+    return lisp_eval(x, e, ctx);
+}
+
+static void reset(Counts* c)
+{
+    memset(c, 0, sizeof(Counts));
+    c->thread = pthread_self();
+}
+
+static void run(Counts* c, LispContext ctx)
+{
+    LispError e;
+    eval("(define (loop n) (if (= n 0) 'done (loop (- n 1))))", &e, ctx);
+    eval("(define (count n) (if (= n 0) 0 (+ 1 (count (- n 1)))))", &e, ctx);
+
+    // each tail call exits before the next enters.
+    reset(c);
+    Lisp x = eval("(loop 10000)", &e, ctx);
+    CHECK(e == LISP_ERROR_NONE && strcmp(lisp_symbol_string(x), "DONE") == 0);
+    CHECK(c->enter_loop == 10001);
+    CHECK(c->enter == c->exit && c->depth == 0 && !c->unbalanced);
+    CHECK(c->max_depth <= 3);
+
+    reset(c);
+    x = eval("(count 100)", &e, ctx);
+    CHECK(e == LISP_ERROR_NONE && lisp_int(x) == 100);
+    CHECK(c->enter == c->exit && c->depth == 0 && !c->unbalanced);
+    CHECK(c->max_depth > 100);
+
+    // reported once, when it reaches the host.
+    FILE* quiet = fopen("/dev/null", "w");
+    if (quiet) lisp_set_stderr(quiet, ctx);
+    reset(c);
+    eval("(count 'a)", &e, ctx);
+    CHECK(e != LISP_ERROR_NONE);
+    CHECK(c->errors == 1 && c->last_error == e);
+    reset(c);
+    eval("(loop", &e, ctx);
+    CHECK(e != LISP_ERROR_NONE);
+    CHECK(c->errors == 1 && c->last_error == e);
+    lisp_set_stderr(stderr, ctx);
+    if (quiet) fclose(quiet);
+
+    reset(c);
+    lisp_collect(lisp_null(), ctx);
+    CHECK(c->gc_start == 1 && c->gc_end == 1 && !c->in_gc && !c->gc_nested);
+
+#ifdef LISP_GC_INCREMENTAL
+    // the collection is left to slices, taken as the program allocates.
+    lisp_set_gc_pause(1, ctx);
+    reset(c);
+    lisp_collect(lisp_null(), ctx);
+    eval("(do ((i 0 (+ i 1))) ((= i 200000)) (make-vector 8 i))", &e, ctx);
+    CHECK(e == LISP_ERROR_NONE);
+    CHECK(c->gc_start > 1);
+    CHECK(c->gc_start == c->gc_end && !c->in_gc && !c->gc_nested);
+    lisp_set_gc_pause(0, ctx);
+#endif
+
+    reset(c);
+    eval("(do ((i 0 (+ i 1))) ((= i 100000)) (make-vector 8 i))", &e, ctx);
+    CHECK(c->pages > 0 && c->page_bytes > 0);
+
+    // reader threads take pages without hooks. The main thread reports them when they join.
+    // The list is only split after elements which are lists themselves.
+    size_t n = 4 * 1024 * 1024;
+    char* text = malloc(n + 64);
+    size_t len = 0;
+    text[len++] = '(';
+    for (int i = 0; len < n; ++i) len += sprintf(text + len, "(%d \"s%d\") ", i, i);
+    text[len++] = ')';
+
+    reset(c);
+    x = lisp_read_range_parallel(text, text + len, 4, &e, ctx);
+    CHECK(e == LISP_ERROR_NONE && lisp_is_pair(x));
+    CHECK(c->pages > 0);
+    CHECK(c->pages_off_thread == 0);
+    free(text);
+}
+
+int main(int argc, const char* argv[])
+{
+    LispContext ctx = lisp_init();
+    lisp_lib_load(ctx);
+
+    Counts counts;
+    reset(&counts);
+
+    LispHooks hooks;
+    hooks.user = &counts;
+    hooks.enter = count_enter;
+    hooks.exit = count_exit;
+    hooks.gc_start = count_gc_start;
+    hooks.gc_end = count_gc_end;
+    hooks.page = count_page;
+    hooks.error = count_error;
+    lisp_set_hooks(&hooks, ctx);
+
+    run(&counts, ctx);
+
+    lisp_set_hooks(NULL, ctx);
+    lisp_shutdown(ctx);
+
+    if (failed) return 1;
+    printf("hooks passed\n");
+    return 0;
+}
@@ -0,0 +1,7 @@
+#!/bin/sh
+
+# C API tests, in the serial and incremental builds of each.
+../../arena-test || exit 1
+../../arena-test-incremental || exit 1
+../../hooks-test || exit 1
+../../hooks-test-incremental || exit 1
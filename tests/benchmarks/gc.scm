@@ -0,0 +1,22 @@
+; collection time with a large live heap.
+; Compare with --gc-threads N.
+
+(define n 200000)
+
+(define (build n)
+  (let ((v (make-vector n '())))
+    (do ((i 0 (+ i 1)))
+      ((= i n) v)
+      (if (= (remainder i 20000) 0) (gc-flip))
+      (vector-set! v i (list i (number->string i) (vector i (* i 2.0)))))))
+
+(define live (build n))
+(gc-flip)
+
+(define start (runtime))
+(do ((i 0 (+ i 1)))
+  ((= i 10))
+  (gc-flip))
+(display "gc-flip x10: ")
+(display (- (runtime) start))
+(newline)
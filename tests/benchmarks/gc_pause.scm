@@ -0,0 +1,26 @@
+; pause times with a large live heap while the program keeps running.
+; Compare the histograms with --gc-pause 100.
+
+(define n 200000)
+
+(define (build n)
+  (let ((v (make-vector n '())))
+    (do ((i 0 (+ i 1)))
+      ((= i n) v)
+      (if (= (remainder i 20000) 0) (gc-flip))
+      (vector-set! v i (list i (number->string i) (vector i (* i 2.0)))))))
+
+(define live (build n))
+
+(define start (runtime))
+(define (work i)
+  (if (= (remainder i 20000) 0) (gc-flip))
+  (vector-set! live (remainder (* i 7) n) (list i (number->string i))))
+
+(do ((i 0 (+ i 1)))
+  ((= i 200000))
+  (work i))
+(display "time: ")
+(display (- (runtime) start))
+(newline)
+(print-gc-statistics)
@@ -0,0 +1,26 @@
+; list processing throughput: map, filter, fold and association lookups.
+
+(define (iota-list n)
+  (do ((i (- n 1) (- i 1))
+       (l '() (cons i l)))
+    ((< i 0) l)))
+
+(define data (iota-list 20000))
+(define table (map (lambda (i) (cons i (* i i))) (iota-list 200)))
+
+(define (run)
+  (let* ((squares (map (lambda (x) (* x x)) data))
+         (evens (filter even? squares))
+         (total (fold-left + 0 evens))
+         (sums (map + data data)))
+    (for-each (lambda (x) (assv (remainder x 200) table)) data)
+    (reduce + 0 sums)
+    total))
+
+(do ((i 0 (+ i 1)))
+  ((= i 10) 'done)
+  (run)
+  (gc-flip))
+
+(display (run))
+(newline)
@@ -0,0 +1,24 @@
+; CPU bound work on each record of a dataset, spread over the workers.
+; Run from tests/data, with --workers N.
+
+(define records
+  (let* ((file (open-input-file "big_data_gen.sexpr"))
+         (data (read file)))
+    (close-input-port file)
+    data))
+
+(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))
+
+(define (score record)
+  (let ((age (cdr (vector-assq 'age record)))
+        (name (cdr (vector-assq 'name record))))
+    (cons name (+ (fib 18) (* age (string-length name))))))
+
+(define (run) (parallel-map score records))
+
+(do ((i 0 (+ i 1)))
+  ((= i 3) 'done)
+  (run))
+
+(display (length (run)))
+(newline)
@@ -0,0 +1,34 @@
+; sorting a million records with a builtin comparator and by key.
+; A lisp comparator is timed on a smaller sample, since each call
+; leaves garbage behind until the next collection.
+
+(define n 1000000)
+
+(define (make-records n)
+  (let ((v (make-vector n '())))
+    (do ((i 0 (+ i 1)))
+      ((= i n) v)
+      ; the interpreter produces garbage faster than the heap grows.
+      (if (= (remainder i 50000) 0) (gc-flip))
+      (vector-set! v i (cons (random 1000000) i)))))
+
+(define records (make-records n))
+(define keys (make-vector n 0))
+(do ((i 0 (+ i 1)))
+  ((= i n))
+  (vector-set! keys i (car (vector-ref records i))))
+(gc-flip)
+
+(define (time label thunk)
+  (let ((start (runtime)))
+    (thunk)
+    (display label)
+    (display ": ")
+    (display (- (runtime) start))
+    (newline)
+    (gc-flip)))
+
+(time "builtin <" (lambda () (sort keys <)))
+(time "by key" (lambda () (sort-by-key records car <)))
+(time "lambda (100000)"
+      (lambda () (sort (subvector records 0 100000) (lambda (a b) (< (car a) (car b))))))
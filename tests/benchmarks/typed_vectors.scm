@@ -0,0 +1,32 @@
+; numeric kernels on a boxed vector versus an f64vector.
+
+(define n 200000)
+
+(define boxed (make-vector n 0.5))
+(define unboxed (make-f64vector n 0.5))
+
+(define (boxed-dot a b)
+  (do ((i 0 (+ i 1))
+       (s 0.0 (+ s (* (vector-ref a i) (vector-ref b i)))))
+    ((= i n) s)))
+
+(define (time label thunk)
+  (let ((start (runtime)))
+    (thunk)
+    (display label)
+    (display ": ")
+    (display (- (runtime) start))
+    (newline)
+    (gc-flip)))
+
+(time "vector dot" (lambda () (boxed-dot boxed boxed)))
+(time "f64vector dot x100"
+      (lambda ()
+        (do ((i 0 (+ i 1)))
+          ((= i 100))
+          (f64vector-dot unboxed unboxed))))
+(time "f64vector axpy x100"
+      (lambda ()
+        (do ((i 0 (+ i 1)))
+          ((= i 100))
+          (f64vector-axpy! 0.5 unboxed unboxed))))
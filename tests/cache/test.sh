@@ -0,0 +1,33 @@
+#!/bin/sh
+
+# a cached expansion is used only while the macros it came from,
+# and the procedures they call, are the same.
+
+CACHE=$(mktemp -d)
+PASS=1
+
+echo '(display (m hello there))' > use.tmp
+
+# expect OUTPUT DEFINITIONS
+expect()
+{
+    printf '%s\n(load "use.tmp")\n' "$2" > main.tmp
+    OUTPUT=$(../../lisp --cache-dir "$CACHE" --script main.tmp)
+    if [ "$OUTPUT" != "$1" ]
+    then
+        echo "expected $1, got $OUTPUT: $2"
+        PASS=0
+    fi
+}
+
+expect ONE "(define (helper x) ''one) (define-macro m (lambda (a b) (helper a)))"
+expect ONE "(define (helper x) ''one) (define-macro m (lambda (a b) (helper a)))"
+# the procedure the macro calls
+expect TWO "(define (helper x) ''two) (define-macro m (lambda (a b) (helper a)))"
+expect HELLO "(define (helper x) (list 'quote x)) (define-macro m (lambda (a b) (helper a)))"
+# the parameters
+expect THERE "(define (helper x) (list 'quote x)) (define-macro m (lambda (b a) (helper a)))"
+expect THERE "(define (helper x) (list 'quote x)) (define-macro m (lambda (b a) (helper a)))"
+
+rm -rf "$CACHE" use.tmp main.tmp
+[ $PASS = "1" ]
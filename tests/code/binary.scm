@@ -0,0 +1,49 @@
+(define (round-trip x)
+  (let ((port (open-output-file "binary.bin")))
+    (write-binary x port)
+    (close-output-port port))
+  (let* ((port (open-input-file "binary.bin"))
+         (y (read-binary port)))
+    (assert (eof-object? (read-binary port)))
+    (close-input-port port)
+    y))
+
+(define data '(1 -2 300000000000 2.5 #\a "hello" sym #t #f () (a . b) #(1 (2 3) "x")))
+(assert (equal? (round-trip data) data))
+(assert (null? (round-trip '())))
+(assert (= (round-trip 42) 42))
+
+; shared structure
+(define shared (list 1 2 3))
+(define copy (round-trip (list shared shared (cdr shared))))
+(assert (eq? (list-ref copy 0) (list-ref copy 1)))
+(assert (eq? (cdr (list-ref copy 0)) (list-ref copy 2)))
+
+; cycles
+(define cycle (list 'a 'b))
+(set-cdr! (cdr cycle) cycle)
+(define cycle-copy (round-trip cycle))
+(assert (eq? (cdr (cdr cycle-copy)) cycle-copy))
+(assert (eq? (car (cdr cycle-copy)) 'b))
+
+(define v (make-vector 2 0))
+(vector-set! v 1 v)
+(define v-copy (round-trip v))
+(assert (eq? (vector-ref v-copy 1) v-copy))
+
+; typed vectors
+(define typed (list #f64(1.5 -2.25) #s64(-3 400000000000) #u8(0 7 255)))
+(assert (equal? (round-trip typed) typed))
+
+; records, with the type and procedures written alongside
+(define-record-type point (make-point x y) point? (x point-x set-point-x!) (y point-y))
+(define point-copy (round-trip (list (make-point 1 "a") point point? point-x set-point-x!)))
+(define copied (car point-copy))
+(assert (record? copied))
+(assert (not (point? copied)))
+(assert ((list-ref point-copy 2) copied))
+(==> ((list-ref point-copy 3) copied) 1)
+((list-ref point-copy 4) copied 5)
+(==> ((list-ref point-copy 3) copied) 5)
+(assert (eq? (record-type-descriptor copied) (list-ref point-copy 1)))
+(==> (record-type-name (list-ref point-copy 1)) point)
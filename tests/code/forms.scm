@@ -91,3 +91,46 @@
   (==> x B)
   (==> y A))
 
+
+; profiling
+(define (count-down n) (if (= n 0) 'done (count-down (- n 1))))
+(==> (profile (lambda () (count-down 1000))) done)
+(==> (call/cc (lambda (k) (profile (lambda () (k 'escaped))))) escaped)
+(==> (profile (lambda () (gc-flip) (map count-down '(1 2 3)))) (done done done))
+
+; escape-only continuations
+(==> (call/ec (lambda (k) (+ 1 (k 2)))) 2)
+(==> (call/ec (lambda (k) 3)) 3)
+(==> (let/ec return (for-each (lambda (x) (if (> x 2) (return x))) '(1 2 3 4)) #f) 3)
+(==> (let/ec outer (+ 1 (let/ec inner (outer 5)))) 5)
+(==> (let/ec k (map (lambda (x) (gc-flip) (if (= x 2) (k (list x)) x)) '(1 2 3))) (2))
+(assert (continuation? (call/ec (lambda (k) k))))
+(define saved (call/ec (lambda (k) k)))
+(==> (call/cc (lambda (k) (call/ec (lambda (e) (k 'jumped))))) jumped)
+(==> (let/ec k (k 1)) 1)
+
+; closures keep only the frames they use
+(define (make-counter)
+  (let ((n 0) (unused (make-vector 10 0)))
+    (lambda () (set! n (+ n 1)) n)))
+(define counter (make-counter))
+(counter)
+(==> (counter) 2)
+(define (mutual)
+  (define (f x) (if (= x 0) 'even (g (- x 1))))
+  (define (g x) (if (= x 0) 'odd (f (- x 1))))
+  (f 4))
+(==> (mutual) even)
+(==> ((((lambda (a) (lambda (b) (lambda (c) (list a b c)))) 1) 2) 3) (1 2 3))
+(==> (let ((x 1)) (let ((y 2)) (let ((z 3)) ((lambda () (set! x (+ x z)) x))))) 4)
+(define (late-define)
+  (define get (lambda () later))
+  (define later 'found)
+  (get))
+(==> (late-define) found)
+; so procedure-environment only has the frames the body refers to
+(define env-arg 'global)
+(define (refers env-arg) (lambda () env-arg))
+(define (ignores env-arg) (lambda () 1))
+(==> (eval 'env-arg (procedure-environment (refers 42))) 42)
+(==> (eval 'env-arg (procedure-environment (ignores 42))) global)
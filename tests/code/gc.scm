@@ -32,6 +32,69 @@
 
 (==> (call/cc (lambda (throw) (define x '(1 2 3)) (gc-flip) (throw x))) (1 2 3))
 
+;; large objects are kept in place, but what they refer to still moves.
+(define large (make-vector 100000 '()))
+(vector-set! large 0 (list 'a "b" 3))
+(vector-set! large 99999 (make-vector 100000 'inner))
+(define large-string (make-string 600000 #\x))
+(gc-flip)
+(gc-flip)
+(==> (vector-ref large 0) (a "b" 3))
+(assert (eq? (vector-ref (vector-ref large 99999) 5) 'inner))
+(assert (= (string-length large-string) 600000))
+(set! large '())
+(gc-flip)
+
+; allocation counts and a census of what survived
+(define big (make-string 600000 #\x))
+(gc-flip)
+(gc-flip)
+(define stats (gc-statistics))
+(define (stat section type) (cdr (assq type (cdr (assq section stats)))))
+(assert (> (cdr (assq 'collections stats)) 0))
+(assert (> (car (stat 'allocated 'pair)) 0))
+(assert (>= (cdr (stat 'allocated 'string)) 600000))
+(assert (>= (stat 'live 'string) 600000))
+(set! big '())
+
 (print-gc-statistics)
 
 
+
+; a closure doesn't retain frames it doesn't refer to
+(define (make-callback)
+  (let ((dead (make-vector 100000 0)))
+    (vector-fill! dead 1)
+    (lambda (x) (+ x 1))))
+(define callbacks (map (lambda (i) (make-callback)) '(1 2 3 4 5)))
+(gc-flip)
+(gc-flip)
+(assert (< (cdr (assq 'heap-size (gc-statistics))) 1000000))
+(==> ((car callbacks) 1) 2)
+
+; a large vector scanned across slices (--gc-pause), while the vectors it refers to are scanned too.
+(define (fill-vector n)
+  (let ((v (make-vector n 0)))
+    (do ((i 0 (+ i 1))) ((= i n))
+      (vector-set! v i (if (= 0 (remainder i 2000)) (make-vector 3000 i) (list i))))
+    (gc-flip)
+    (do ((i 0 (+ i 1))) ((= i 100000)) (list i))
+    v))
+(define (check-filled v)
+  (do ((i 0 (+ i 1))) ((= i (vector-length v)))
+    (let ((x (vector-ref v i)))
+      (assert (= (if (vector? x) (vector-ref x 0) (car x)) i)))))
+; it depends on where slices end, so try a few times
+(check-filled (fill-vector 200000))
+(check-filled (fill-vector 200000))
+(check-filled (fill-vector 200000))
+
+; live data over the soft max (--heap-max) must not ask for a collection every time
+(define kept (make-vector 600000 0))
+(vector-fill! kept 1)
+(define (collections) (cdr (assq 'collections (gc-statistics))))
+(gc-flip)
+(define before (collections))
+(do ((i 0 (+ i 1))) ((= i 20000)) (list i))
+(assert (< (- (collections) before) 20))
+(set! kept '())
@@ -0,0 +1,41 @@
+(let ((port (open-output-file "indexed.tmp")))
+  (display "; header\n(1 \"a (b\" #\\( (x . y) 'q #(1 2) ; comment )\n #u8(3) -2.5 sym)" port)
+  (close-output-port port))
+
+(define data (read-indexed "indexed.tmp"))
+(assert (indexed? data))
+(==> (indexed-length data) 9)
+(==> (indexed-ref data 1) "a (b")
+(==> (indexed-ref data 2) #\()
+(==> (indexed-ref data 3) (x . y))
+(==> (indexed-ref data 4) 'q)
+(==> (indexed-ref data 8) sym)
+(define pair (indexed-ref data 3))
+(gc-flip)
+(assert (eq? (indexed-ref data 3) pair))
+
+(define seen '())
+(indexed-for-each (lambda (x) (set! seen (cons x seen))) data)
+(==> (length seen) 9)
+(==> (car seen) sym)
+(==> (list-ref seen 2) #u8(3))
+
+(let ((port (open-output-file "indexed.tmp")))
+  (display "#((a . 1) (b . 2))" port)
+  (close-output-port port))
+(==> (indexed-ref (read-indexed "indexed.tmp") 1) (b . 2))
+
+; enough for several chunks
+(let ((port (open-output-file "indexed.tmp")))
+  (display "(" port)
+  (do ((i 0 (+ i 1))) ((= i 4000))
+    (display "(item \"a ) (b\" #\\( (x . y) 'q #(1 2 sym) ; comment )\n #u8(3) -2.5) " port)
+    (write i port))
+  (display ")" port)
+  (close-output-port port))
+(define serial (read (open-input-file "indexed.tmp")))
+(define parallel (read-parallel "indexed.tmp" 4))
+(gc-flip)
+(assert (equal? serial parallel))
+(==> (length parallel) 8000)
+(assert (eq? (car (car parallel)) 'item))
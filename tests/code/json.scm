@@ -0,0 +1,61 @@
+(define (write-text text)
+  (let ((port (open-output-file "json.tmp")))
+    (display text port)
+    (close-output-port port)))
+
+(define (read-json . args)
+  (let* ((port (open-input-file "json.tmp"))
+         (x (json-read port (pair? args))))
+    (close-input-port port)
+    x))
+
+(write-text "{\"name\": \"Bob\", \"age\": 54, \"tags\": [\"a\", true, false, null, 1.5, -2e2], \"nested\": {}}")
+(define x (read-json))
+(assert (vector? x))
+(assert (equal? (cdr (vector-assq 'name x)) "Bob"))
+(assert (= (cdr (vector-assq 'age x)) 54))
+(assert (equal? (cdr (vector-assq 'tags x)) (vector "a" #t #f '() 1.5 -200.0)))
+(assert (equal? (cdr (vector-assq 'nested x)) (vector)))
+
+(define y (read-json 'string-keys))
+(assert (equal? (car (vector-ref y 0)) "name"))
+
+(write-text "\"quote\\\" \\u0041\\u00e9\"")
+(define s (read-json))
+(assert (equal? (substring s 0 8) "quote\" A"))
+(assert (= (string-length s) 10))
+
+; write and read back
+(let ((port (open-output-file "json.tmp")))
+  (json-write x port)
+  (close-output-port port))
+(assert (equal? (read-json) x))
+
+(write-text "  ")
+(assert (eof-object? (read-json)))
+
+; integers too big for 64 bits are reals
+(write-text "[12345678901234567890, -12345678901234567890, 9223372036854775807]")
+(define big (read-json))
+(assert (real? (vector-ref big 0)))
+(assert (= (vector-ref big 0) 12345678901234567890.0))
+(assert (= (vector-ref big 1) -12345678901234567890.0))
+(assert (= (vector-ref big 2) 9223372036854775807))
+
+; numbers of any length
+(write-text (string-append "1" (make-string 599 #\0) "e-590"))
+(assert (= (read-json) 1000000000.0))
+
+; keys too long for symbols are strings
+(define long-key (make-string 2000 #\k))
+(write-text (string-append "{\"" long-key "\": 1}"))
+(assert (equal? (car (vector-ref (read-json) 0)) long-key))
+
+; keys which differ only in case are kept apart as strings
+(write-text "{\"name\": 1, \"Name\": 2}")
+(define cased (read-json 'string-keys))
+(let ((port (open-output-file "json.tmp")))
+  (json-write cased port)
+  (close-output-port port))
+(assert (equal? (read-json 'string-keys) cased))
+(assert (equal? (car (vector-ref cased 1)) "Name"))
@@ -30,6 +30,12 @@
 
 (==> (append '(a) '(b c d))  (a b c d))   
 (==> (sort '(1 4 2 6 3) <) (1 2 3 4 6))
+(==> (sort '() <) ())
+(==> (sort '("b" "a" "c") string>?) ("c" "b" "a"))
+(==> (sort-by-key '((b . 2) (a . 1) (c . 2) (d . 0)) cdr <) ((d . 0) (a . 1) (b . 2) (c . 2)))
+(define sort-in-place (list 3 2 1))
+(sort! sort-in-place <)
+(==> sort-in-place (1 2 3))
 (==> (make-list 4 1) (1 1 1 1))
 
 (==> (memq 'a '(a b c)) (a b c))
@@ -67,3 +73,21 @@
 (==> (fold-left + 0 '(1 2 3 4)) 10)
 (==> (fold-left list '() '(1 2 3 4)) ((((() 1) 2) 3) 4))
 
+
+(==> (map (lambda (x) (* x x)) '(1 2 3)) (1 4 9))
+(==> (map + '(1 2 3) '(10 20 30 40)) (11 22 33))
+(==> (map list '(1 2)) ((1) (2)))
+(==> (map (lambda args args) '(1 2)) ((1) (2)))
+(==> (filter odd? '(1 2 3 4 5)) (1 3 5))
+(==> (append) ())
+(==> (append '(a) '() '(b c) 'd) (a b c . d))
+(==> (assv 2 '((1 . a) (2 . b))) (2 . b))
+(==> (memv 3 '(1 2 3 4)) (3 4))
+
+(define visited '())
+(for-each (lambda (x y) (set! visited (cons (+ x y) visited))) '(1 2) '(10 20))
+(==> visited (22 11))
+
+; collection during a callback
+(==> (map (lambda (x) (gc-flip) (list x)) '(1 2 3)) ((1) (2) (3)))
+(==> (fold-left (lambda (acc x) (gc-flip) (cons x acc)) '() '(1 2 3)) (3 2 1))
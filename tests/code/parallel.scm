@@ -0,0 +1,35 @@
+; futures and parallel maps run on worker contexts,
+; with copies of the procedures and the globals they use.
+
+(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))
+(define offset 100)
+(define (work x) (+ offset (fib x)))
+
+(==> (parallel-map work '(1 5 10 15)) (101 105 155 710))
+(==> (parallel-map work '()) ())
+(==> (parallel-vector-map (lambda (x) (* x x)) #(1 2 3)) #(1 4 9))
+(==> (parallel-map car '((a 1) (b 2))) (a b))
+
+(define f (future (lambda () (work 20))))
+(assert (promise? f))
+(==> (touch f) 6865)
+(==> (touch f) 6865)
+(==> (touch 5) 5)
+(==> (map touch (map (lambda (x) (future (lambda () (* x 2)))) '(1 2 3))) (2 4 6))
+
+; closures, and structure in the arguments and results
+(define (make-adder n) (lambda (x) (+ x n)))
+(==> (parallel-map (make-adder 5) '(1 2 3)) (6 7 8))
+(==> (parallel-map (lambda (x) (list x (vector x "s") 'y)) '(1 2)) ((1 #(1 "s") y) (2 #(2 "s") y)))
+(define shared (list 1 2))
+(define pair (car (parallel-map (lambda (x) (cons x x)) (list shared))))
+(assert (eq? (car pair) (cdr pair)))
+(==> ((touch (future (lambda () (make-adder 3)))) 4) 7)
+
+(define table (make-hash-table))
+(hash-table-set! table 'a 1)
+(==> (parallel-map (lambda (k) (hash-table-ref table k)) '(a a)) (1 1))
+
+; globals are copied when the work is sent.
+(set! offset 0)
+(==> (parallel-map work '(10)) (55))
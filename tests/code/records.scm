@@ -0,0 +1,48 @@
+(define-record-type point (make-point x y) point? (x point-x set-point-x!) (y point-y))
+
+(define p (make-point 1 2))
+(assert (point? p))
+(assert (not (point? #(1 2))))
+(assert (record? p))
+(assert (not (record? point)))
+(==> (point-x p) 1)
+(==> (point-y p) 2)
+(set-point-x! p 3)
+(==> (point-x p) 3)
+(assert (eq? (record-type-descriptor p) point))
+(==> (record-type-name point) point)
+
+; a constructor may take some fields in another order
+(define-record-type node (make-node value) node? (next node-next set-node-next!) (value node-value))
+(define n (make-node 5))
+(==> (node-value n) 5)
+(==> (node-next n) #f)
+(assert (not (point? n)))
+
+; accessors are procedures
+(assert (procedure? point-x))
+(==> (map point-y (list (make-point 1 2) (make-point 3 4))) (2 4))
+
+; fields and types are kept by collection
+(set-node-next! n (make-node 6))
+(gc-flip)
+(assert (node? n))
+(==> (node-value (node-next n)) 6)
+(==> (point-x p) 3)
+(assert (point? (make-point 0 0)))
+
+; records of the same type as values in tables
+(define table (make-hash-table))
+(hash-table-set! table 'p p)
+(gc-flip)
+(assert (eq? (hash-table-ref table 'p (lambda () #f)) p))
+
+; records, their types and procedures are copied to workers and back
+(==> (parallel-map point-y (list (make-point 1 2) (make-point 3 4))) (2 4))
+(==> (touch (future (lambda () (point-x p)))) 3)
+(define made (parallel-map (lambda (x) (make-point x (* x x))) '(1 2 3)))
+(assert (point? (car made)))
+(==> (map point-y made) (1 4 9))
+(assert (eq? (record-type-descriptor (touch (future (lambda () p)))) point))
+(define moved (touch (future (lambda () (set-point-x! p 10) p))))
+(==> (point-x moved) 10)
@@ -30,3 +30,25 @@
   (cons-stream n (integers-starting-from (+ n 1))))
 
 (assert (equal? (stream-head (integers-starting-from 0) 5) '(0 1 2 3 4)))
+
+(==> (stream-car (stream-tail (integers-starting-from 0) 3)) 3)
+(==> (stream->list (stream 1 2 3)) (1 2 3))
+(==> (stream->list (integers-starting-from 0) 4) (0 1 2 3))
+(==> (stream-head (stream-filter odd? (integers-starting-from 0)) 3) (1 3 5))
+
+; the tail is only computed when forced
+(define forced '())
+(define s (cons-stream 1 (begin (set! forced (cons 2 forced)) '())))
+(==> forced ())
+(==> (stream-head s 1) (1))
+(==> forced ())
+(==> (stream->list s) (1))
+(==> forced (2))
+
+(==> (force (make-promise 5)) 5)
+(==> (force 5) 5)
+(assert (promise-forced? (make-promise 5)))
+
+; collection while forcing
+(==> (force (delay (begin (gc-flip) (list 1 2)))) (1 2))
+(==> (stream-head (stream-filter (lambda (x) (gc-flip) (even? x)) (integers-starting-from 0)) 3) (0 2 4))
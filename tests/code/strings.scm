@@ -58,3 +58,14 @@
 
 (assert (char-ci=? #\a #\A))
 (assert (char-ci<? #\A #\b))
+
+; files are mapped, not copied
+(define this-file (file->string "strings.scm"))
+(define found (string-search-forward "files are mapped" this-file 0))
+(==> (substring this-file found (+ found 16)) "files are mapped")
+(assert (> (string-search-forward "files are mapped" this-file (+ found 1)) found))
+(==> (string-search-forward "lo" "hello hello" 4) 9)
+(==> (string-search-forward "" "abc" 3) 3)
+(gc-flip)
+(==> (string-ref this-file found) #\f)
+(assert (= (string-length (file->string "include/prolog.scm")) (bytevector-length (file->bytevector "include/prolog.scm"))))
@@ -0,0 +1,60 @@
+; Homogeneous vectors https://srfi.schemers.org/srfi-4/srfi-4.html
+
+(define v (make-f64vector 4 1))
+(assert (f64vector? v))
+(assert (not (vector? v)))
+(assert (not (f64vector? #(1.0 2.0))))
+(==> (f64vector-length v) 4)
+(f64vector-set! v 2 2.5)
+(==> (f64vector-ref v 2) 2.5)
+(==> (f64vector->list v) (1.0 1.0 2.5 1.0))
+(==> (list->f64vector '(1 2 3)) #f64(1.0 2.0 3.0))
+(==> (f64vector 1 2.5) #f64(1 2.5))
+(assert (not (equal? #f64(1 2) #s64(1 2))))
+
+(==> (f64vector-sum #f64(1 2 3 4 5)) 15.0)
+(==> (f64vector-dot #f64(1 2 3) #f64(4 5 6)) 32.0)
+(==> (f64vector-min #f64(3 -1 2)) -1.0)
+(==> (f64vector-max #f64(3 -1 2)) 3.0)
+(==> (f64vector-add #f64(1 2) #f64(10 20)) #f64(11 22))
+(==> (f64vector-mul #f64(1 2) #f64(10 20)) #f64(10 40))
+(==> (f64vector-scale! (f64vector 1 2 3) 2) #f64(2 4 6))
+(==> (f64vector-axpy! 2 #f64(1 2 3) (f64vector 1 1 1)) #f64(3 5 7))
+
+(define w (make-f64vector 5 0))
+(f64vector-fill! w 7 1 3)
+(==> w #f64(0 7 7 0 0))
+(==> (f64vector-copy w 1 4) #f64(7 7 0))
+(f64vector-copy! w 3 #f64(8 9))
+(==> w #f64(0 7 7 8 9))
+
+; sums larger than an unrolled block
+(define big (make-f64vector 1003 0.5))
+(==> (f64vector-sum big) 501.5)
+(==> (f64vector-dot big big) 250.75)
+
+(==> (s64vector-sum (s64vector 1 2 3)) 6)
+(==> (s64vector-dot #s64(1 2 3) #s64(4 5 6)) 32)
+(==> (s64vector-max #s64(4 -9 12)) 12)
+(==> (s64vector-add #s64(1 2) #s64(3 4)) #s64(4 6))
+
+; Bytevectors
+(define b (make-bytevector 3 255))
+(assert (bytevector? b))
+(bytevector-u8-set! b 0 1)
+(==> (bytevector-u8-ref b 0) 1)
+(==> b #u8(1 255 255))
+(==> (bytevector-copy #u8(1 2 3 4) 2) #u8(3 4))
+(==> (bytevector->list (bytevector 5 6)) (5 6))
+
+; Contents survive collection
+(define kept (list->f64vector '(1.5 2.5)))
+(gc-flip)
+(==> kept #f64(1.5 2.5))
+
+; a mapped file is read-only
+(define mapped (file->bytevector "typed_vectors.scm"))
+(==> (bytevector-u8-ref mapped 0) 59)
+(==> (bytevector-copy mapped 0 2) #u8(59 32))
+(gc-flip)
+(==> (bytevector-u8-ref mapped 1) 32)
@@ -35,6 +35,20 @@
 
 ; Try other data types
 (assert (vec-sorted? (sort! #(#\C #\B #\A #\D) char<?) char<?))
+(==> (sort! (vector "pear" "apple" "fig") string<?) #("apple" "fig" "pear"))
+(==> (sort! (vector 'c 'a 'b) symbol<?) #(a b c))
+(==> (sort! (vector 3 1.5 2 0.5) <) #(0.5 1.5 2 3))
+(==> (sort! (vector) <) #())
+
+; sort copies, sort! does not
+(define unsorted (vector 3 1 2))
+(==> (sort unsorted <) #(1 2 3))
+(==> unsorted #(3 1 2))
+
+; Stable: equal keys keep their order
+(==> (sort (vector '(1 . a) '(0 . b) '(1 . c) '(0 . d)) (lambda (x y) (< (car x) (car y))))
+     #((0 . b) (0 . d) (1 . a) (1 . c)))
+(==> (sort-by-key (vector "ccc" "a" "bb" "d") string-length <) #("a" "d" "bb" "ccc"))
 
 ; Converting between lists and vectors
 ;https://www.gnu.org/software/mit-scheme/documentation/stable/mit-scheme-ref/Construction-of-Vectors.html
@@ -71,5 +85,6 @@
 (assert (not (vector-assq 'bad-key avector)))
 
 
-(sort! (make-initialized-vector 10000 (lambda (x) (random 1000000))) <)
+(assert (vec-sorted? (sort! (make-initialized-vector 10000 (lambda (x) (random 1000000))) <) <))
+(assert (vec-sorted? (sort! (make-initialized-vector 1000 (lambda (x) (random 100))) (lambda (a b) (gc-flip) (> a b))) >))
 
@@ -0,0 +1,35 @@
+; canada, text vs binary
+(define (time-it thunk)
+  (let ((start (runtime)))
+    (thunk)
+    (- (runtime) start)))
+
+(define (report label seconds)
+  (display label)
+  (display seconds)
+  (newline))
+
+(define data (read))
+
+(report "text write: " (time-it (lambda ()
+  (let ((port (open-output-file "big_data_canada.txt")))
+    (write data port)
+    (close-output-port port)))))
+
+(report "binary write: " (time-it (lambda ()
+  (let ((port (open-output-file "big_data_canada.bin")))
+    (write-binary data port)
+    (close-output-port port)))))
+
+(report "text read: " (time-it (lambda ()
+  (let ((port (open-input-file "big_data_canada.txt")))
+    (read port)
+    (close-input-port port)))))
+
+(define copy '())
+(report "binary read: " (time-it (lambda ()
+  (let ((port (open-input-file "big_data_canada.bin")))
+    (set! copy (read-binary port))
+    (close-input-port port)))))
+
+(assert (equal? copy data))
@@ -0,0 +1,16 @@
+; read JSON directly
+(let* ((file (open-input-file "big_data_gen.json"))
+       (data (json-read file)))
+    (display "records: ")
+    (display (vector-length data))
+    (newline)
+    (let ((record (vector-ref data 0)))
+        (assert (= (cdr (vector-assq 'index record)) 0))
+        (assert (eq? (cdr (vector-assq 'isActive record)) #f))
+        (assert (= (cdr (vector-assq 'age record)) 21)))
+    (close-input-port file))
+
+(let* ((file (open-input-file "big_data_canada.json"))
+       (data (json-read file)))
+    (assert (equal? (cdr (vector-assq 'type data)) "FeatureCollection"))
+    (close-input-port file))
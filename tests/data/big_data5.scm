@@ -0,0 +1,19 @@
+; lazy, indexed reading. Only the records used are read.
+(let ((data (read-indexed "big_data_gen.sexpr")))
+    (display "records: ")
+    (display (indexed-length data))
+    (newline)
+    (let ((record (indexed-ref data 0)))
+        (assert (= (cdr (vector-assq 'index record)) 0))
+        (assert (eq? (cdr (vector-assq 'isActive record)) 'False))
+        (assert (= (cdr (vector-assq 'age record)) 21)))
+    (assert (eq? (indexed-ref data 1) (indexed-ref data 1)))
+
+    (let ((count 0))
+        (indexed-for-each (lambda (record) (set! count (+ count 1))) data)
+        (assert (= count (indexed-length data)))))
+
+(gc-flip)
+(print-gc-statistics)
+(display "done")
+(newline)
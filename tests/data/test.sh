@@ -2,3 +2,6 @@
 
 ../../lisp --script big_data1.scm
 cat big_data_canada.sexpr |  ../../lisp --script big_data2.scm
+cat big_data_canada.sexpr |  ../../lisp --script big_data3.scm
+../../lisp --script big_data4.scm
+../../lisp --script big_data5.scm